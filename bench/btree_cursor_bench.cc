@@ -0,0 +1,138 @@
+/*
+ * btree_cursor_bench.cc
+ *
+ * Measures descents per second of Btree::BtreeMoveTo, and steps per second of
+ * a full scan with Btree::BtreeNext and Btree::BtreeKeySize, through a
+ * std::weak_ptr<BtCursor>, which is validated on every call, and through a
+ * BtCursorRef, which is validated once. The keys are 16 bytes long, so that
+ * every probe of the binary search compares against a cell.
+ *
+ * Usage: btree_cursor_bench [num_rows] [rounds]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr u32 kKeySize = 16;
+
+// Big-endian, so that the byte order of the keys is their numeric order
+void MakeKey(u32 value, std::vector<std::byte> &key) {
+  key.assign(kKeySize, std::byte{0x6b});
+  for (u32 i = 0; i < 4; i++) {
+    key[kKeySize - 1 - i] = std::byte(value >> (8 * i));
+  }
+}
+
+void PrintResult(const char *name, const char *unit, u64 count,
+                 Clock::time_point start) {
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  std::printf("%-28s: %12.0f %s/sec\n", name, count / elapsed.count(), unit);
+}
+
+// Descends to a mix of hits and misses, in an order that jumps across the
+// leaves
+template <typename CursorHandle>
+u64 Descend(Btree &btree, CursorHandle &cursor, u32 num_rows, u32 rounds) {
+  std::vector<std::byte> key;
+  u64 num_hits = 0;
+  for (u32 round = 0; round < rounds; round++) {
+    for (u32 i = 0; i < 2 * num_rows; i++) {
+      MakeKey((i * 7919u) % (2 * num_rows), key);
+      int result = 0;
+      btree.BtreeMoveTo(cursor, key, result);
+      num_hits += result == 0;
+    }
+  }
+  return num_hits;
+}
+
+template <typename CursorHandle>
+u64 Scan(Btree &btree, CursorHandle &cursor, u32 rounds) {
+  u64 total_key_size = 0;
+  for (u32 round = 0; round < rounds; round++) {
+    std::vector<std::byte> first_key;
+    MakeKey(0, first_key);
+    int result = 0;
+    btree.BtreeMoveTo(cursor, first_key, result);
+    bool already_at_last_entry = false;
+    while (!already_at_last_entry) {
+      u32 key_size = 0;
+      btree.BtreeKeySize(cursor, key_size);
+      total_key_size += key_size;
+      btree.BtreeNext(cursor, already_at_last_entry);
+    }
+  }
+  return total_key_size;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  u32 num_rows = argc > 1 ? std::atoi(argv[1]) : 20000;
+  u32 rounds = argc > 2 ? std::atoi(argv[2]) : 10;
+  std::printf("rows=%u rounds=%u page_size=%u\n", num_rows, rounds,
+              kDefaultPageSize);
+
+  std::string filename = "bench_btree_cursor.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  Btree btree(filename, 4096);
+  PageNumber root_page_number = 0;
+  btree.BtreeBeginTrans();
+  btree.BtreeCreateTable(root_page_number);
+  u32 next_value = 0;
+  ResultCode rc = btree.BtreeBulkLoad(
+      root_page_number,
+      [&](std::vector<std::byte> &key, std::vector<std::byte> &data) {
+        if (next_value == num_rows) {
+          return false;
+        }
+        MakeKey(2 * next_value, key);
+        data.assign(16, std::byte(next_value));
+        next_value++;
+        return true;
+      },
+      1.0);
+  btree.BtreeCommit();
+  if (rc != ResultCode::kOk) {
+    std::fprintf(stderr, "cannot load %s\n", filename.c_str());
+    return 1;
+  }
+
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  btree.BtCursorCreate(root_page_number, false, p_cursor_weak);
+  BtCursorRef cursor_ref;
+  btree.BtCursorGetRef(p_cursor_weak, cursor_ref);
+  u64 num_descents = 2ull * num_rows * rounds;
+  u64 num_steps = static_cast<u64>(num_rows) * rounds;
+
+  auto start = Clock::now();
+  u64 checksum = Descend(btree, p_cursor_weak, num_rows, rounds);
+  PrintResult("  BtreeMoveTo (weak_ptr)", "descents", num_descents, start);
+  start = Clock::now();
+  checksum -= Descend(btree, cursor_ref, num_rows, rounds);
+  PrintResult("  BtreeMoveTo (BtCursorRef)", "descents", num_descents, start);
+
+  start = Clock::now();
+  checksum += Scan(btree, p_cursor_weak, rounds);
+  PrintResult("  BtreeNext (weak_ptr)", "steps", num_steps, start);
+  start = Clock::now();
+  checksum -= Scan(btree, cursor_ref, rounds);
+  PrintResult("  BtreeNext (BtCursorRef)", "steps", num_steps, start);
+
+  btree.BtCursorClose(p_cursor_weak);
+  if (checksum != 0) {
+    std::fprintf(stderr, "the cursors visited different rows\n");
+  }
+  std::remove(filename.c_str());
+  return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * btree_lookup_bench.cc
+ *
+ * Measures point lookups per second and heap allocations per lookup, for
+ * Btree::BtreeSearch, which returns a copy of the data, and for
+ * Btree::BtreeLookup, which returns a view of it on the pinned leaf. Tables
+ * with 4-byte keys are searched through the key array of their pages; tables
+ * with 16-byte keys are searched through their cells.
+ *
+ * Allocations are counted by replacing the global operator new of this
+ * program.
+ *
+ * Usage: btree_lookup_bench [num_rows] [rounds]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+namespace {
+
+u64 num_allocations = 0;
+
+}  // namespace
+
+void *operator new(std::size_t size) {
+  num_allocations++;
+  void *p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Big-endian, so that the byte order of the keys is their numeric order. Keys
+// longer than 4 bytes are padded at the front.
+void MakeKey(u32 value, u32 key_size, std::vector<std::byte> &key) {
+  key.assign(key_size, std::byte{0x6b});
+  for (u32 i = 0; i < 4; i++) {
+    key[key_size - 1 - i] = std::byte(value >> (8 * i));
+  }
+}
+
+void PrintResult(const char *name, u32 num_lookups, u64 allocations,
+                 Clock::time_point start) {
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  std::printf("%-24s: %12.0f lookups/sec %8.2f allocations/lookup\n", name,
+              num_lookups / elapsed.count(),
+              static_cast<double>(allocations) / num_lookups);
+}
+
+void Run(const std::string &filename, u32 key_size, u32 num_rows,
+         u32 rounds) {
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  Btree btree(filename, 4096);
+  PageNumber root_page_number = 0;
+  btree.BtreeBeginTrans();
+  btree.BtreeCreateTable(root_page_number);
+  u32 next_value = 0;
+  ResultCode rc = btree.BtreeBulkLoad(
+      root_page_number,
+      [&](std::vector<std::byte> &key, std::vector<std::byte> &data) {
+        if (next_value == num_rows) {
+          return false;
+        }
+        MakeKey(2 * next_value, key_size, key);
+        data.assign(16, std::byte(next_value));
+        next_value++;
+        return true;
+      },
+      1.0);
+  btree.BtreeCommit();
+  if (rc != ResultCode::kOk) {
+    std::fprintf(stderr, "cannot load %s\n", filename.c_str());
+    return;
+  }
+
+  // Hits and misses alternate, in an order that jumps across the leaves
+  std::vector<std::byte> key;
+  key.reserve(key_size);
+  u32 num_lookups = 2 * num_rows * rounds;
+  u64 checksum = 0;
+  std::printf("key_size=%u\n", key_size);
+
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  btree.BtCursorCreate(root_page_number, false, p_cursor_weak);
+  u64 allocations_before = num_allocations;
+  auto start = Clock::now();
+  for (u32 round = 0; round < rounds; round++) {
+    for (u32 i = 0; i < 2 * num_rows; i++) {
+      MakeKey((i * 7919u) % (2 * num_rows), key_size, key);
+      int result = 0;
+      std::vector<std::byte> data =
+          btree.BtreeSearch(p_cursor_weak, key, result);
+      checksum += data.empty() ? 0 : std::to_integer<u32>(data[0]);
+    }
+  }
+  PrintResult("  BtreeSearch", num_lookups,
+              num_allocations - allocations_before, start);
+  btree.BtCursorClose(p_cursor_weak);
+
+  BtLookup lookup;
+  btree.BtreeLookupBegin(root_page_number, lookup);
+  allocations_before = num_allocations;
+  start = Clock::now();
+  for (u32 round = 0; round < rounds; round++) {
+    for (u32 i = 0; i < 2 * num_rows; i++) {
+      MakeKey((i * 7919u) % (2 * num_rows), key_size, key);
+      PayloadView data;
+      bool found = false;
+      btree.BtreeLookup(lookup, key, data, found);
+      checksum -= found ? std::to_integer<u32>(data.data[0]) : 0;
+    }
+  }
+  PrintResult("  BtreeLookup", num_lookups,
+              num_allocations - allocations_before, start);
+  btree.BtreeLookupEnd(lookup);
+
+  if (checksum != 0) {
+    std::fprintf(stderr, "the lookups found different data\n");
+  }
+  std::remove(filename.c_str());
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  u32 num_rows = argc > 1 ? std::atoi(argv[1]) : 20000;
+  u32 rounds = argc > 2 ? std::atoi(argv[2]) : 10;
+  std::printf("rows=%u rounds=%u page_size=%u\n", num_rows, rounds,
+              kDefaultPageSize);
+  Run("bench_btree_lookup_4.db", 4, num_rows, rounds);
+  Run("bench_btree_lookup_16.db", 16, num_rows, rounds);
+  return 0;
+}
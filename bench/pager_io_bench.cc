@@ -0,0 +1,132 @@
+/*
+ * pager_io_bench.cc
+ *
+ * Measures how many pages per second can be moved between the database file
+ * and a page image, comparing the staged path the pager used to take (copy
+ * the image into a temporary vector, do the I/O on the vector, copy back)
+ * with the in-place OsReadAt/OsWriteAt overloads on the page image itself.
+ *
+ * Usage: pager_io_bench [num_pages] [rounds]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "os.h"
+#include "pager.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double PagesPerSecond(u32 num_pages, Clock::time_point start) {
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  return num_pages / elapsed.count();
+}
+
+double StagedRead(OsFile &file, std::vector<std::byte> &image,
+                  u32 num_pages, u32 rounds) {
+  auto start = Clock::now();
+  for (u32 round = 0; round < rounds; round++) {
+    for (u32 i = 0; i < num_pages; i++) {
+      std::vector<std::byte> img_vec(image.begin(), image.end());
+      file.OsReadAt(img_vec, kDefaultPageSize, i * kDefaultPageSize);
+      std::copy(img_vec.begin(), img_vec.end(), image.begin());
+    }
+  }
+  return PagesPerSecond(num_pages * rounds, start);
+}
+
+double InPlaceRead(OsFile &file, std::vector<std::byte> &image,
+                   u32 num_pages, u32 rounds) {
+  auto start = Clock::now();
+  for (u32 round = 0; round < rounds; round++) {
+    for (u32 i = 0; i < num_pages; i++) {
+      file.OsReadAt(image.data(), kDefaultPageSize, i * kDefaultPageSize);
+    }
+  }
+  return PagesPerSecond(num_pages * rounds, start);
+}
+
+double StagedWrite(OsFile &file, std::vector<std::byte> &image,
+                   u32 num_pages, u32 rounds) {
+  auto start = Clock::now();
+  for (u32 round = 0; round < rounds; round++) {
+    for (u32 i = 0; i < num_pages; i++) {
+      std::vector<std::byte> img_vec(image.begin(), image.end());
+      file.OsWriteAt(img_vec, kDefaultPageSize, i * kDefaultPageSize);
+    }
+  }
+  return PagesPerSecond(num_pages * rounds, start);
+}
+
+double InPlaceWrite(OsFile &file, std::vector<std::byte> &image,
+                    u32 num_pages, u32 rounds) {
+  auto start = Clock::now();
+  for (u32 round = 0; round < rounds; round++) {
+    for (u32 i = 0; i < num_pages; i++) {
+      file.OsWriteAt(image.data(), kDefaultPageSize, i * kDefaultPageSize);
+    }
+  }
+  return PagesPerSecond(num_pages * rounds, start);
+}
+
+// Cold SqlitePagerGet calls, which now read straight into p_image_
+double PagerGet(std::string &filename, u32 num_pages, u32 rounds) {
+  u32 total = 0;
+  auto start = Clock::now();
+  for (u32 round = 0; round < rounds; round++) {
+    Pager pager(filename, 16);
+    BasePage *p_page = nullptr;
+    for (PageNumber page_number = 1; page_number <= num_pages; page_number++) {
+      if (pager.SqlitePagerGet(page_number, &p_page, SampleMemPage::create) !=
+          ResultCode::kOk) {
+        break;
+      }
+      pager.SqlitePagerUnref(p_page);
+      total++;
+    }
+  }
+  return PagesPerSecond(total, start);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  u32 num_pages = argc > 1 ? std::atoi(argv[1]) : 4096;
+  u32 rounds = argc > 2 ? std::atoi(argv[2]) : 20;
+
+  std::string filename = "bench_pager_io.db";
+  std::remove(filename.c_str());
+  OsFile file;
+  bool read_only = false;
+  if (file.OsOpenReadWrite(filename, read_only) != ResultCode::kOk) {
+    std::fprintf(stderr, "cannot open %s\n", filename.c_str());
+    return 1;
+  }
+
+  std::vector<std::byte> image(kDefaultPageSize, std::byte{0x5a});
+  InPlaceWrite(file, image, num_pages, 1);  // populate the file
+
+  std::printf("pages=%u rounds=%u page_size=%u\n", num_pages, rounds,
+              kDefaultPageSize);
+  std::printf("read   staged  : %12.0f pages/sec\n",
+              StagedRead(file, image, num_pages, rounds));
+  std::printf("read   in-place: %12.0f pages/sec\n",
+              InPlaceRead(file, image, num_pages, rounds));
+  std::printf("write  staged  : %12.0f pages/sec\n",
+              StagedWrite(file, image, num_pages, rounds));
+  std::printf("write  in-place: %12.0f pages/sec\n",
+              InPlaceWrite(file, image, num_pages, rounds));
+  file.OsClose();
+
+  std::printf("pager  get     : %12.0f pages/sec\n",
+              PagerGet(filename, num_pages, rounds));
+
+  std::remove(filename.c_str());
+  return 0;
+}
@@ -1,13 +1,17 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
 #include <iomanip>
 #include <memory>
 #include <numeric>
+#include <optional>
 #include <queue>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 #include <functional>
 #include <sstream>
@@ -20,6 +24,34 @@
 #include "sql_limit.h"
 #include "sql_rc.h"
 
+// Number of leaves a leaf scan asks the Pager to read ahead of the cursor
+static constexpr u32 kLeafPrefetchDepth = 4;
+
+// Number of pages a table reserves past the end of the file once it has no
+// contiguous room left. See Btree::AllocateTablePages.
+static constexpr u32 kPagesPerExtent = 8;
+
+// A run of page numbers reserved for one table, from next_page up to but not
+// including end_page. The pages are handed out in order and are not written
+// until then.
+struct PageExtent {
+  PageNumber next_page;
+  PageNumber end_page;
+};
+
+// Page number of the first free map page of a database that tracks its free
+// pages in a bitmap. Another one follows every FreeMapNumBits(page size) pages
+// after it, see btree_free_map.cc.
+static constexpr PageNumber kFirstFreeMapPage = 3;
+
+// A key and its data, as taken by Btree::BtreeInsertBatch
+using KeyDataPair = std::pair<std::vector<std::byte>, std::vector<std::byte>>;
+
+// Fills in the next key-data pair of a bulk load, in ascending key order, and
+// returns false once there are no more pairs. See Btree::BtreeBulkLoad.
+using BulkLoadSource =
+    std::function<bool(std::vector<std::byte> &key, std::vector<std::byte> &data)>;
+
 /**
  * @class BtCursor
  *
@@ -51,6 +83,7 @@
  */
 class BtCursor {
   friend class Btree;
+  friend class BtCursorRef;
 
  private:
   PageNumber root_page_number;
@@ -59,11 +92,43 @@ class BtCursor {
   bool writable;
   bool skip_next;
   int compare_result;
+  bool is_open;  // false once the cursor is closed
 
  public:
   BtCursor();
 };
 
+/**
+ * @class BtCursorRef
+ *
+ * @brief A handle to an open BtCursor for hot loops.
+ *
+ * Every Btree function that takes a std::weak_ptr<BtCursor> locks it and looks
+ * the cursor up in the Btree's set of cursors before doing any work. A
+ * BtCursorRef is validated once, by Btree::BtCursorGetRef, and the overloads
+ * that take it only check that the cursor has not been closed since. The
+ * handle keeps the BtCursor object alive, so that check is safe even after
+ * the cursor is closed, but it does not keep the cursor open.
+ *
+ * It is move-only, so that the reference count of the cursor is not touched
+ * on the way into the hot loop.
+ */
+class BtCursorRef {
+  friend class Btree;
+
+ private:
+  std::shared_ptr<BtCursor> p_cursor_;
+
+ public:
+  BtCursorRef() = default;
+  BtCursorRef(BtCursorRef &&) = default;
+  BtCursorRef &operator=(BtCursorRef &&) = default;
+  BtCursorRef(const BtCursorRef &) = delete;
+  BtCursorRef &operator=(const BtCursorRef &) = delete;
+
+  [[nodiscard]] bool IsOpen() const { return p_cursor_ && p_cursor_->is_open; }
+};
+
 struct SharedBtCursorPtrHash {
   std::size_t operator()(const std::shared_ptr<BtCursor> &ptr) const {
     return std::hash<std::shared_ptr<BtCursor>>()(ptr);
@@ -77,12 +142,124 @@ struct SharedBtCursorPtrEqual {
   }
 };
 
+/**
+ * The keys a range scan visits. A missing bound leaves that end of the table
+ * open. low_key is always the smaller key, whichever way the scan goes; a
+ * reverse scan starts from high_key. A limit of 0 means no limit.
+ */
+struct BtRange {
+  std::optional<std::vector<std::byte>> low_key;
+  std::optional<std::vector<std::byte>> high_key;
+  bool low_inclusive = true;
+  bool high_inclusive = true;
+  bool reverse = false;
+  u32 limit = 0;
+};
+
+/**
+ * A key or data of the current row of a range scan. It points into the pinned
+ * leaf page, or into a buffer of the iterator when the payload is on overflow
+ * pages, and is only valid until the iterator moves.
+ */
+struct PayloadView {
+  const std::byte *data = nullptr;
+  u32 size = 0;
+};
+
+/**
+ * @class BtRangeIterator
+ *
+ * @brief A pull-based iterator over the rows of a table whose keys fall in a
+ * BtRange.
+ *
+ * It is opened with Btree::BtreeRangeBegin and owns a read-only BtCursor,
+ * which keeps the leaf of the current row pinned. Each call to
+ * Btree::BtreeRangeNext moves to the next row; nothing is copied until the
+ * caller asks for the key or data of a row, and not even then unless the row
+ * spills onto overflow pages. Btree::BtreeRangeEnd closes the cursor.
+ */
+class BtRangeIterator {
+  friend class Btree;
+
+ private:
+  std::weak_ptr<BtCursor> p_cursor_weak_;
+  BtRange range_;
+  bool is_started_ = false;
+  bool is_done_ = false;
+  u32 num_rows_ = 0;
+  std::vector<std::byte> key_buffer_;
+  std::vector<std::byte> data_buffer_;
+};
+
+/**
+ * @class BtLookup
+ *
+ * @brief A handle for point lookups in one table that allocate no memory.
+ *
+ * It is opened with Btree::BtreeLookupBegin and owns a read-only BtCursor.
+ * Btree::BtreeLookup leaves the cursor on the row it finds, which keeps the
+ * leaf pinned, so the data can be viewed in the page image instead of being
+ * copied. Data on overflow pages is copied into a buffer of the handle that
+ * keeps its capacity from one lookup to the next. Btree::BtreeLookupEnd
+ * closes the cursor.
+ */
+class BtLookup {
+  friend class Btree;
+
+ private:
+  std::weak_ptr<BtCursor> p_cursor_weak_;
+  std::vector<std::byte> data_buffer_;
+};
+
+/**
+ * What one call of Btree::BtreeIncrementalVacuum did, and what is left for the
+ * next one.
+ */
+struct BtVacuumStats {
+  u32 num_pages_moved = 0;      // live pages copied into free pages
+  u32 num_pages_truncated = 0;  // pages cut off the end of the file
+  u64 num_bytes_reclaimed = 0;  // num_pages_truncated in bytes
+  u32 num_free_pages_left = 0;  // pages still on the free list
+  u32 num_pages_scanned = 0;    // table pages read to find where pages are
+                                // referenced from, 0 if the map was reused
+};
+
+/**
+ * How the free pages of the database lie in the file, as reported by
+ * Btree::BtreeFreeSpaceStats.
+ */
+struct BtFreeSpaceStats {
+  u32 num_pages = 0;         // pages in the file
+  u32 num_free_pages = 0;    // pages that are free
+  u32 num_free_runs = 0;     // runs of consecutive free pages
+  u32 longest_free_run = 0;  // pages in the longest of them
+};
+
 /**
  * Forward declaration of the BalanceContext struct.
  * The full definition will be in the implementation file.
  */
 struct BalanceContext;
 
+/**
+ * Forward declaration of the BulkLoadLevel struct, defined in
+ * btree_bulk_load.cc.
+ */
+struct BulkLoadLevel;
+
+/**
+ * Where the page number of a page of a table is kept, so it can be pointed at
+ * the page's new place when Btree::BtreeIncrementalVacuum moves the page. A
+ * tree page is referenced from its parent, the first overflow page of a cell
+ * from the cell, and any other overflow page from the overflow page before it.
+ */
+struct VacuumReference {
+  enum class Kind { kLeftChild, kRightChild, kOverflow, kNextOverflow };
+  Kind kind;
+  PageNumber page_number;  // page that holds the reference
+  u16 cell_idx;            // cell that holds it, for kLeftChild and kOverflow
+};
+
 /**
  * @class Btree
  *
@@ -124,6 +301,33 @@ class Btree {
   // Pointer to first page.
   FirstPage *p_first_page_;
 
+  // Whether Balance writes prefix-compressed pages
+  bool key_prefix_compression_;
+
+  // Free space format of the databases that NewDatabase creates
+  FreeSpaceFormat free_space_format_;
+
+  // Page size of the databases that LockBtree finds empty
+  u32 page_size_;
+
+  // Extents by the root page of their table, and the first page number that
+  // no extent has reserved. Both are dropped at the end of a transaction.
+  std::unordered_map<PageNumber, PageExtent> extents_;
+  PageNumber next_unreserved_page_;
+  // Copies of the two above, taken when a checkpoint begins
+  std::unordered_map<PageNumber, PageExtent> ckpt_extents_;
+  PageNumber ckpt_next_unreserved_page_;
+
+  // The free pages and the references to the pages of the tables that
+  // BtreeIncrementalVacuum found, kept up to date by its moves. The next call
+  // reuses them if it vacuums the same tables and the pager's data version is
+  // still vacuum_data_version_, i.e. nothing else changed a page meanwhile.
+  bool has_vacuum_state_;
+  u64 vacuum_data_version_;
+  std::vector<PageNumber> vacuum_root_page_numbers_;
+  std::set<PageNumber> vacuum_free_pages_;
+  std::unordered_map<PageNumber, VacuumReference> vacuum_references_;
+
   // These are functions that don't involve BtCursor and are privately used by
   // the Btree class
 
@@ -141,24 +345,98 @@ class Btree {
   ResultCode FreePage(BasePage *&p_input_base_page, PageNumber &page_number,
                       bool is_overflow_page);
 
+  // Allocating pages that belong together, see btree_extent.cc
+  ResultCode AllocateTablePages(
+      PageNumber root_page_number, PageNumber near_page_number, u32 num_pages,
+      std::vector<std::pair<PageNumber, NodePage *>> &pages);
+  ResultCode AllocateTablePage(PageNumber root_page_number,
+                               PageNumber near_page_number,
+                               NodePage *&p_node_page, PageNumber &page_number);
+  ResultCode AllocateFreePageAfter(PageNumber near_page_number,
+                                   NodePage *&p_node_page,
+                                   PageNumber &page_number, bool &found);
+  ResultCode FreeListRemove(PageNumber page_number, u32 max_info_pages,
+                            bool &found);
+  ResultCode AllocateFromExtent(PageExtent &extent, u32 num_pages,
+                                std::vector<std::pair<PageNumber, NodePage *>> &pages);
+  ResultCode ReleaseExtents();
+  PageNumber FindRootPageNumber(NodePage *p_page);
+
+  // Tracking free pages in free map pages, see btree_free_map.cc
+  [[nodiscard]] bool UsesFreeMap() const;
+  [[nodiscard]] bool IsFreeMapPage(PageNumber page_number) const;
+  ResultCode FreeMapAllocate(PageNumber near_page_number,
+                             NodePage *&p_node_page, PageNumber &page_number);
+  ResultCode FreeMapFree(const std::vector<PageNumber> &page_numbers);
+  ResultCode FreeMapRemove(PageNumber page_number, bool &found);
+  ResultCode FreeMapCollect(std::set<PageNumber> &free_pages);
+
   ResultCode ClearCell(NodePage &node_page, u16 cell_idx);
   ResultCode FillInCell(Cell &cell_in);
   void ReParentPage(PageNumber page_number, NodePage *p_new_parent);
   void ReParentChildPages(NodePage &node_page);
-  ResultCode ClearDatabasePage(PageNumber page_number, bool free_page);
+
+  // Freeing the pages of a table without writing them, see btree_drop.cc
+  ResultCode DropCollectNode(PageNumber page_number,
+                             std::vector<PageNumber> &child_page_numbers,
+                             std::vector<PageNumber> &page_numbers);
+  ResultCode DropCollectPages(PageNumber page_number,
+                              std::vector<PageNumber> &page_numbers);
+  ResultCode DropFreePages(std::vector<PageNumber> &page_numbers);
 
   // ######################  BtCursor Public Functions   ######################
   // These are functions that involve BtCursor and are publicly used by the
   // Btree class
 
   void GetTempCursor(BtCursor &cursor, BtCursor &temp_cursor);
+
+  // The work of the public cursor functions, once the cursor is validated
+  ResultCode CursorKeySize(const BtCursor &cursor, u32 &key_size);
+  u32 CursorKey(const BtCursor &cursor, u32 offset, u32 amount,
+                std::vector<std::byte> &result);
+  ResultCode CursorDataSize(const BtCursor &cursor, u32 &data_size);
+  u32 CursorData(const BtCursor &cursor, u32 offset, u32 amount,
+                 std::vector<std::byte> &result);
+  ResultCode CursorKeyCompare(const BtCursor &cursor,
+                              std::vector<std::byte> &key, u32 num_ignore,
+                              int &result);
+  ResultCode CursorMoveTo(BtCursor &cursor, std::vector<std::byte> &key,
+                          int &result);
+  ResultCode CursorNext(BtCursor &cursor, bool &already_at_last_entry);
+
   void ReleaseTempCursor(BtCursor &temp_cursor);
   ResultCode GetPayload(const BtCursor &cursor, u32 offset, u32 amount,
                         std::vector<std::byte> &result);
+  ResultCode ReadOverflowPayload(PageNumber next_page_number, u32 offset,
+                                 u32 amount, std::vector<std::byte> &result);
+  ResultCode GetCellKey(const Cell &cell, std::vector<std::byte> &key);
   ResultCode MoveToChild(BtCursor &cursor, PageNumber child_page_number);
   ResultCode MoveToParent(BtCursor &cursor);
   ResultCode MoveToRoot(BtCursor &cursor);
   ResultCode MoveToLeftmost(BtCursor &cursor);
+  ResultCode MoveToCellInPage(const std::weak_ptr<BtCursor> &p_cursor_weak,
+                              std::vector<std::byte> &key, int &result);
+  bool SearchFixedKeys(BtCursor &cursor, const std::vector<std::byte> &key,
+                       int &lower_bound, int &c);
+
+  // Helper functions for stepping a BtRangeIterator
+  ResultCode RangeStep(BtRangeIterator &iterator);
+  ResultCode RangeMoveToNextLeaf(BtCursor &cursor, bool &has_next_leaf);
+  ResultCode RangeMoveToPrevLeaf(BtCursor &cursor, bool &has_prev_leaf);
+  ResultCode RangeGetPayload(BtRangeIterator &iterator, bool is_key,
+                             PayloadView &view);
+  ResultCode GetPayloadView(const BtCursor &cursor, bool is_key,
+                            std::vector<std::byte> &buffer, PayloadView &view);
+
+  // Helper functions for BtreeMultiGet
+  ResultCode MultiGetDescend(const std::weak_ptr<BtCursor> &p_cursor_weak,
+                             std::vector<std::byte> &key,
+                             std::vector<std::pair<NodePage *, u16>> &bounds,
+                             int &result);
+  ResultCode MultiGetIsInPage(const std::weak_ptr<BtCursor> &p_cursor_weak,
+                              std::vector<std::byte> &key,
+                              const std::pair<NodePage *, u16> &bound,
+                              bool &is_in_page);
 
   // Btree Private Functions: Balance and related helper methods
   ResultCode Balance(NodePage *p_page, const std::weak_ptr<BtCursor> &p_cursor);
@@ -191,6 +469,11 @@ class Btree {
   // Helper functions for calculating and managing page distribution
   void CalculateNewPageDistribution(BalanceContext &context);
   void BalancePageDistribution(BalanceContext &context);
+  void CalculateCompressedPageDistribution(BalanceContext &context);
+  u32 BalanceHelperKeyPrefixSize(const BalanceContext &context, u32 begin,
+                                 u32 end, u32 &first_local_cell_idx);
+  u32 BalanceHelperCompressedSize(const BalanceContext &context, u32 begin,
+                                  u32 end);
 
   // Helper functions for allocating and setting up new pages
   ResultCode AllocateNewPages(BalanceContext &context, bool isInternal);
@@ -227,6 +510,34 @@ class Btree {
                                      NodePage *&p_extra_unref,
                                      bool &return_ok_early);
   int BalanceHelperFindChildIdx(NodePage *p_page, NodePage *p_parent);
+  ResultCode BalanceHelperRelinkLeaves(BalanceContext &context);
+  ResultCode BalanceHelperRelinkLeaf(PageNumber page_number, bool is_next,
+                                     PageNumber old_page_number,
+                                     PageNumber new_page_number);
+
+  // Helper functions for BtreeIncrementalVacuum
+  ResultCode VacuumCollectFreePages(std::set<PageNumber> &free_pages);
+  ResultCode VacuumCollectReferences(
+      PageNumber page_number,
+      std::unordered_map<PageNumber, VacuumReference> &references);
+  ResultCode VacuumCollectOverflowReferences(
+      PageNumber page_number, u16 cell_idx, PageNumber overflow_page_number,
+      std::unordered_map<PageNumber, VacuumReference> &references);
+  ResultCode VacuumMovePage(
+      PageNumber page_number, PageNumber new_page_number,
+      std::unordered_map<PageNumber, VacuumReference> &references);
+
+  // Helper functions for building a table bottom-up in BtreeBulkLoad
+  ResultCode BulkLoadStartNode(PageNumber root_page_number,
+                               BulkLoadLevel &level, bool is_internal);
+  ResultCode BulkLoadAddChild(PageNumber root_page_number,
+                              std::vector<BulkLoadLevel> &levels, u32 level_idx,
+                              PageNumber child, std::vector<std::byte> &max_key,
+                              u32 limit);
+  ResultCode BulkLoadAddFullNode(PageNumber root_page_number,
+                                 std::vector<BulkLoadLevel> &levels,
+                                 u32 level_idx, u32 limit);
+  ResultCode BulkLoadSplitLast(BulkLoadLevel &level);
 
   Btree(const std::string &filename);
   static Btree *instance_;
@@ -239,10 +550,17 @@ class Btree {
   static Btree &RebuildInstance(const std::string &filename);
 
   // ############################ Btree Public Functions ####################
-  Btree(std::string filename, int cache_size);
+  Btree(std::string filename, int cache_size,
+        PageIoMode io_mode = PageIoMode::POSITIONAL_IO);
   ResultCode BtreeSetCacheSize(int cache_size);
+  ResultCode BtreeSetKeyPrefixCompression(bool enable);
+  ResultCode BtreeSetFreeSpaceFormat(FreeSpaceFormat format);
+  ResultCode BtreeSetPageSize(u32 page_size);
+  ResultCode BtreeSetJournalMode(JournalMode mode);
+  ResultCode BtreeSetGroupCommit(std::chrono::microseconds window);
   ResultCode BtreeBeginTrans();
   ResultCode BtreeCommit();
+  ResultCode BtreeCommit(const CommitCallback &on_durable);
   ResultCode BtreeRollback();
 
   ResultCode BtreeBeginCkpt();
@@ -259,11 +577,34 @@ class Btree {
   ResultCode BtreeClearTable(PageNumber root_page_number);
   ResultCode BtreeDropTable(PageNumber root_page_number);
 
+  // Dropping a table now and freeing its pages later, a few at a time
+  ResultCode BtreeDropTableDeferred(PageNumber root_page_number);
+  ResultCode BtreeReclaimPages(u32 max_pages, u32 &num_pages_freed);
+
   // Helper function for testing, not part of the original sqlite3, meant to
   // help students find the page count by calling the pagers' PagerPageCount
   // function.
   u32 BtreePageCount();
 
+  // Returns the number of bytes in a page of the database
+  u32 BtreePageSize() const;
+
+  // Helper function for testing and benchmarks, returns the cache counters of
+  // the pager
+  PagerCacheStats BtreeCacheStats();
+
+  // Helper function for testing and benchmarks, returns the write-ahead log
+  // counters of the pager
+  PagerWalStats BtreeWalStats();
+
+  // Helper function for testing and benchmarks, counts the leaves of a table
+  // and the runs of consecutive page numbers they form along the leaf chain
+  ResultCode BtreeLeafRuns(PageNumber root_page_number, u32 &num_leaves,
+                           u32 &num_runs);
+
+  // Counts the free pages of the database and the runs they form
+  ResultCode BtreeFreeSpaceStats(BtFreeSpaceStats &stats);
+
   // BtCursor Public Functions
   ResultCode BtCursorCreate(PageNumber root_page_number, bool writable,
                             std::weak_ptr<BtCursor> &p_cursor_weak);
@@ -291,16 +632,55 @@ class Btree {
                        bool &already_at_last_entry);
   ResultCode BtreeLinkedListNext(const std::weak_ptr<BtCursor> &p_cursor_weak,
                                  bool &already_at_last_entry);
+  ResultCode BtreeLinkedListPrev(const std::weak_ptr<BtCursor> &p_cursor_weak,
+                                 bool &already_at_first_entry);
   ResultCode BTreePrev(const std::weak_ptr<BtCursor> &p_cursor_weak);
+
+  // The same cursor functions on a BtCursorRef, which skip validating the
+  // cursor on every call
+  ResultCode BtCursorGetRef(const std::weak_ptr<BtCursor> &p_cursor_weak,
+                            BtCursorRef &cursor_ref);
+  ResultCode BtreeKeySize(BtCursorRef &cursor_ref, u32 &key_size);
+  u32 BtreeKey(BtCursorRef &cursor_ref, u32 offset, u32 amount,
+               std::vector<std::byte> &result);
+  ResultCode BtreeDataSize(BtCursorRef &cursor_ref, u32 &data_size);
+  u32 BtreeData(BtCursorRef &cursor_ref, u32 offset, u32 amount,
+                std::vector<std::byte> &result);
+  ResultCode BtreeKeyCompare(BtCursorRef &cursor_ref,
+                             std::vector<std::byte> &key, u32 num_ignore,
+                             int &result);
+  ResultCode BtreeMoveTo(BtCursorRef &cursor_ref, std::vector<std::byte> &key,
+                         int &result);
+  ResultCode BtreeNext(BtCursorRef &cursor_ref, bool &already_at_last_entry);
   ResultCode BtreeInsert(const std::weak_ptr<BtCursor> &p_cursor_weak,
                          std::vector<std::byte> &key,
                          std::vector<std::byte> &data);
+  ResultCode BtreeInsertBatch(const std::weak_ptr<BtCursor> &p_cursor_weak,
+                              std::vector<KeyDataPair> &pairs);
+  ResultCode BtreeBulkLoad(PageNumber root_page_number,
+                           const BulkLoadSource &next_pair, double fill_factor);
 
   ResultCode BtreeGetNodeDepth(const std::weak_ptr<BtCursor> &p_cursor_weak,
                                u32 &depth);
   std::vector<std::byte> BtreeSearch(
       const std::weak_ptr<BtCursor> &p_cursor_weak, std::vector<std::byte> &key,
       int &result);
+  ResultCode BtreeRangeBegin(PageNumber root_page_number, const BtRange &range,
+                             BtRangeIterator &iterator);
+  ResultCode BtreeRangeNext(BtRangeIterator &iterator, bool &has_row);
+  ResultCode BtreeRangeKey(BtRangeIterator &iterator, PayloadView &key);
+  ResultCode BtreeRangeData(BtRangeIterator &iterator, PayloadView &data);
+  ResultCode BtreeRangeEnd(BtRangeIterator &iterator);
+  ResultCode BtreeLookupBegin(PageNumber root_page_number, BtLookup &lookup);
+  ResultCode BtreeLookup(BtLookup &lookup, std::vector<std::byte> &key,
+                         PayloadView &data, bool &found);
+  ResultCode BtreeLookupEnd(BtLookup &lookup);
+  ResultCode BtreeMultiGet(
+      PageNumber root_page_number, std::vector<std::vector<std::byte>> &keys,
+      std::vector<std::optional<std::vector<std::byte>>> &results);
+  ResultCode BtreeIncrementalVacuum(
+      const std::vector<PageNumber> &root_page_numbers, u32 max_pages,
+      BtVacuumStats &stats);
   std::vector<std::vector<std::byte>> BtreeRangeSearch(
       const std::weak_ptr<BtCursor> &p_cursor_weak,
       std::vector<std::byte> &key_start, std::vector<std::byte> &key_end,
@@ -25,7 +25,14 @@ Btree::Btree(const std::string &filename)
       read_only_(pager_->SqlitePagerIsReadOnly()),
       in_trans_(false),
       in_ckpt_(false),
-      p_first_page_(nullptr) {}
+      p_first_page_(nullptr),
+      key_prefix_compression_(false),
+      free_space_format_(FreeSpaceFormat::kFreeList),
+      page_size_(kDefaultPageSize),
+      next_unreserved_page_(0),
+      ckpt_next_unreserved_page_(0),
+      has_vacuum_state_(false),
+      vacuum_data_version_(0) {}
 
 Btree &Btree::RebuildInstance(const std::string &filename) {
   if (instance_ != nullptr) {
@@ -35,15 +42,24 @@ Btree &Btree::RebuildInstance(const std::string &filename) {
   return *instance_;
 }
 
-Btree::Btree(std::string filename, int cache_size)
+Btree::Btree(std::string filename, int cache_size, PageIoMode io_mode)
     : filename_(filename),
       has_writable_bt_cursor_(false),
       pager_(std::make_unique<Pager>(filename_,
-                                     cache_size < 10 ? 10 : cache_size)),
+                                     cache_size < 10 ? 10 : cache_size,
+                                     EvictionPolicy::FIRST_NON_DIRTY,
+                                     io_mode)),
       read_only_(pager_->SqlitePagerIsReadOnly()),
       in_trans_(false),
       in_ckpt_(false),
-      p_first_page_(nullptr) {}
+      p_first_page_(nullptr),
+      key_prefix_compression_(false),
+      free_space_format_(FreeSpaceFormat::kFreeList),
+      page_size_(kDefaultPageSize),
+      next_unreserved_page_(0),
+      ckpt_next_unreserved_page_(0),
+      has_vacuum_state_(false),
+      vacuum_data_version_(0) {}
 
 // --------------------- Btree Private Functions ---------------------
 
@@ -82,6 +98,8 @@ ResultCode Btree::NewDatabase() {
 
   // Step 4: Initialize FirstPage and RootPage, and then unref RootPage
   p_first_page_->SetDefaultByteView();
+  p_first_page_->SetFreeSpaceFormat(free_space_format_);
+  p_first_page_->SetPageSize(pager_->SqlitePagerPageSize());
   p_root_page->ZeroPage();
   rc = pager_->SqlitePagerUnref(p_root_page);
   return rc;
@@ -91,7 +109,27 @@ ResultCode Btree::LockBtree() {
   if (p_first_page_ != nullptr) {
     return ResultCode::kOk;
   }
-  ResultCode rc;
+  // Step 1: Read the page size of the file before any page goes through the
+  // cache. A new database gets the page size chosen by BtreeSetPageSize.
+  std::vector<std::byte> header(kMinPageSize);
+  ResultCode rc = pager_->SqlitePagerReadFileHeader(header);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  u32 page_size =
+      FirstPage::GetPageSizeOfImage(PageImage(header.data(), header.size()));
+  if (page_size == 0) {
+    page_size = page_size_;
+  }
+  if (!IsValidPageSize(page_size)) {
+    return ResultCode::kCorrupt;
+  }
+  rc = pager_->SqlitePagerSetPageSize(page_size);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+
+  // Step 2: Get page 1
   BasePage *p_base_page = nullptr;
   rc = pager_->SqlitePagerGet(1, &p_base_page, FirstPage::CreateDerivedPage);
   if (rc != ResultCode::kOk || p_base_page == nullptr) {
@@ -99,8 +137,10 @@ ResultCode Btree::LockBtree() {
   }
   p_first_page_ = dynamic_cast<FirstPage *>(p_base_page);
 
+  // Step 3: Page 1 has to agree with the page size it was read with
   if (pager_->SqlitePagerPageCount() > 0 &&
-      !p_first_page_->HasCorrectMagicInt()) {
+      (!p_first_page_->HasCorrectMagicInt() ||
+       p_first_page_->GetPageSize() != pager_->SqlitePagerPageSize())) {
     rc = ResultCode::kCorrupt;
     pager_->SqlitePagerUnref(p_base_page);
     p_first_page_ = nullptr;
@@ -134,35 +174,37 @@ ResultCode Btree::InitPage(NodePage &node_page, NodePage *p_parent) {
     return ResultCode::kOk;
   }
   node_page.is_init_ = true;
-  node_page.cell_trackers_.clear();
+
+  // The cells are found through the cell directory when they are needed, so
+  // only the header and the free blocks are checked here
   NodePageHeaderByteView node_page_header =
       node_page.GetNodePageHeaderByteView();
-  ImageIndex iterator_idx = node_page_header.first_cell_idx;
-  CellHeaderByteView cell_header{};
-  u16 free_space = kUsableSpace;
-  while (iterator_idx != 0) {
-    if (iterator_idx > kPageSize - kMinCellSize ||
-        iterator_idx < sizeof(NodePageHeaderByteView)) {
-      return ResultCode::kCorrupt;
-    }
-    cell_header = node_page.GetCellHeaderByteViewByImageIndex(iterator_idx);
-    u16 cell_size = cell_header.GetCellSize();
-    if (iterator_idx + cell_size > kPageSize) {
-      return ResultCode::kCorrupt;
-    }
-    free_space -= cell_size;
-    node_page.SetCellHeaderByteViewByImageIndex(iterator_idx, cell_header);
-    CellTracker tracker;
-    tracker.image_idx = iterator_idx;
-    node_page.cell_trackers_.push_back(tracker);
-    iterator_idx = cell_header.next_cell_start_idx;
-  }
-  node_page.num_free_bytes_ = 0;
-  iterator_idx = node_page_header.first_free_block_idx;
+  if (node_page_header.cell_content_idx == 0 &&
+      node_page_header.num_cells == 0) {
+    node_page.num_free_bytes_ = 0;  // the page was never written
+    return ResultCode::kOk;
+  }
+  if (node_page_header.fixed_key_size != 0 &&
+      node_page_header.fixed_key_size != sizeof(u32) &&
+      node_page_header.fixed_key_size != sizeof(u64)) {
+    return ResultCode::kCorrupt;
+  }
+  u32 page_end = NodePageEnd(node_page.p_image_.size());
+  u32 directory_end_idx = sizeof(NodePageHeaderByteView) +
+                          node_page_header.num_cells *
+                              node_page.GetCellDirectoryEntrySize();
+  if (node_page_header.cell_content_idx < directory_end_idx ||
+      node_page_header.cell_content_idx > page_end) {
+    return ResultCode::kCorrupt;
+  }
+  node_page.num_free_bytes_ = node_page_header.cell_content_idx -
+                              directory_end_idx +
+                              node_page_header.num_fragmented_bytes;
+  ImageIndex iterator_idx = node_page_header.first_free_block_idx;
   FreeBlockByteView free_block{};
   while (iterator_idx != 0) {
-    if (iterator_idx > kPageSize - sizeof(FreeBlockByteView) ||
-        iterator_idx < sizeof(NodePageHeaderByteView)) {
+    if (iterator_idx > page_end - sizeof(FreeBlockByteView) ||
+        iterator_idx < node_page_header.cell_content_idx) {
       return ResultCode::kCorrupt;
     }
     free_block = node_page.GetFreeBlockByteView(iterator_idx);
@@ -173,10 +215,7 @@ ResultCode Btree::InitPage(NodePage &node_page, NodePage *p_parent) {
     }
     iterator_idx = next_block_idx;
   }
-  if (node_page.cell_trackers_.empty() && node_page.num_free_bytes_ == 0) {
-    return ResultCode::kOk;
-  }
-  if (node_page.num_free_bytes_ != free_space) {
+  if (node_page.num_free_bytes_ > UsableSpace(node_page.p_image_.size())) {
     return ResultCode::kCorrupt;
   }
   return ResultCode::kOk;
@@ -189,6 +228,10 @@ ResultCode Btree::AllocatePage(NodePage *&p_node_page,
   }
   ResultCode rc = ResultCode::kOk;
   BasePage *p_base_page = nullptr;
+  if (UsesFreeMap() &&
+      p_first_page_->GetFirstPageByteView().first_free_page != 0) {
+    return FreeMapAllocate(0, p_node_page, page_number);
+  }
   if (p_first_page_->GetFirstPageByteView().first_free_page != 0) {
     NodePage *p_overflow_page = nullptr;
     rc = pager_->SqlitePagerWrite(p_first_page_);
@@ -232,7 +275,14 @@ ResultCode Btree::AllocatePage(NodePage *&p_node_page,
       p_node_page = dynamic_cast<NodePage *>(p_base_page);
     }
   } else {
-    page_number = pager_->SqlitePagerPageCount() + 1;
+    // pages reserved by extents are past the end of the file too
+    page_number = std::max(pager_->SqlitePagerPageCount() + 1,
+                           next_unreserved_page_);
+    // a free map page is never handed out, it reads as an empty map until
+    // it is written
+    if (IsFreeMapPage(page_number)) {
+      page_number++;
+    }
     rc = pager_->SqlitePagerGet(page_number, &p_base_page,
                                 NodePage::CreateDerivedPage);
     if (rc != ResultCode::kOk) {
@@ -269,9 +319,12 @@ ResultCode Btree::FreePage(BasePage *&p_input_base_page,
     p_overflow_page = dynamic_cast<NodePage *>(p_base_page);
     page_number = pager_->SqlitePagerPageNumber(p_base_page);
   }
-  if (page_number <= 2) {
+  if (page_number <= 2 || IsFreeMapPage(page_number)) {
     return ResultCode::kError;
   }
+  if (UsesFreeMap()) {
+    return FreeMapFree({page_number});
+  }
   rc = pager_->SqlitePagerWrite(p_first_page_);
   if (rc != ResultCode::kOk) {
     return rc;
@@ -290,7 +343,11 @@ ResultCode Btree::FreePage(BasePage *&p_input_base_page,
         if (rc == ResultCode::kOk) {
           p_overflow_page->InsertPageNumber(page_number);
           pager_->SqlitePagerUnref(p_base_page);
-          pager_->SqlitePagerDontWrite(page_number);
+          // the last page keeps the file long enough to hold every page on
+          // the free list
+          if (page_number < pager_->SqlitePagerPageCount()) {
+            pager_->SqlitePagerDontWrite(page_number);
+          }
           return rc;
         }
       } else {
@@ -326,8 +383,8 @@ ResultCode Btree::FreePage(BasePage *&p_input_base_page,
   first_page.first_free_page = page_number;
   p_first_page_->SetFirstPageByteView(first_page);
   std::memset(
-      p_overflow_page->p_image_->data() + sizeof(OverflowPageHeaderByteView), 0,
-      kOverflowSize);
+      p_overflow_page->p_image_.data() + sizeof(OverflowPageHeaderByteView), 0,
+      OverflowSize(p_overflow_page->p_image_.size()));
   if (p_parent) {
     pager_->SqlitePagerUnref(p_parent);
   }
@@ -345,7 +402,7 @@ ResultCode Btree::ClearCell(NodePage &node_page, u16 cell_idx) {
   // If not, return because we don't need to clear anything
   CellHeaderByteView cell_header = node_page.GetCellHeaderByteView(cell_idx);
   if (cell_header.overflow_page == 0 &&
-      cell_header.key_size + cell_header.data_size <= kMaxLocalPayload) {
+      node_page.IsPayloadLocal(cell_header)) {
     return ResultCode::kOk;
   }
 
@@ -387,7 +444,7 @@ ResultCode Btree::ClearCell(NodePage &node_page, u16 cell_idx) {
 ResultCode Btree::FillInCell(Cell &cell_in) {
   // Step 1: Check if the payload is small enough to fit in a single page
   // If true, return because we don't need to allocate space in overflow pages
-  if (!cell_in.NeedOverflowPage()) {
+  if (!cell_in.NeedOverflowPage(BtreePageSize())) {
     return ResultCode::kOk;
   }
   ResultCode rc;
@@ -412,13 +469,14 @@ ResultCode Btree::FillInCell(Cell &cell_in) {
     p_prior_page = p_overflow_page;
 
     u32 size_to_copy;
-    if (payload_copy_start_offset + kOverflowSize > cell_in.GetPayloadSize()) {
+    u32 overflow_size = OverflowSize(p_overflow_page->p_image_.size());
+    if (payload_copy_start_offset + overflow_size > cell_in.GetPayloadSize()) {
       size_to_copy = cell_in.GetPayloadSize() - payload_copy_start_offset;
     } else {
-      size_to_copy = kOverflowSize;
+      size_to_copy = overflow_size;
     }
     std::memcpy(
-        p_overflow_page->p_image_->data() + sizeof(OverflowPageHeaderByteView),
+        p_overflow_page->p_image_.data() + sizeof(OverflowPageHeaderByteView),
         cell_in.payload_.data() + payload_copy_start_offset, size_to_copy);
     payload_copy_start_offset += size_to_copy;
   }
@@ -460,7 +518,7 @@ void Btree::ReParentPage(PageNumber page_number, NodePage *p_new_parent) {
 void Btree::ReParentChildPages(NodePage &node_page) {
   // Only internal nodes have child pages that need to be re-parented
   if (node_page.IsInternalNode()) {
-    for (u16 cell_idx = 0; cell_idx < node_page.cell_trackers_.size();
+    for (u16 cell_idx = 0; cell_idx < node_page.GetNumCells();
          ++cell_idx) {
       CellHeaderByteView cell_header = node_page.GetCellHeaderByteView(cell_idx);
       ReParentPage(cell_header.left_child, &node_page);
@@ -470,83 +528,64 @@ void Btree::ReParentChildPages(NodePage &node_page) {
   // For leaf nodes, no need to re-parent as they don't have child nodes
 }
 
-// CHAOS: modify to handle leaf node don't have right_child
-ResultCode Btree::ClearDatabasePage(PageNumber page_number, bool free_page) {
-  BasePage *p_base_page = nullptr;
-  NodePage *p_node_page = nullptr;
-  ResultCode rc;
-
-  rc = pager_->SqlitePagerGet(page_number, &p_base_page,
-                             NodePage::CreateDerivedPage);
-  if (rc != ResultCode::kOk) {
-    return rc;
-  }
-
-  rc = pager_->SqlitePagerWrite(p_base_page);
-  if (rc != ResultCode::kOk) {
-    return rc;
-  }
-
-  p_node_page = dynamic_cast<NodePage *>(p_base_page);
-  NodePageHeaderByteView node_page_header =
-      p_node_page->GetNodePageHeaderByteView();
-
-  // For B+ tree, only internal nodes need to traverse child pointers
-  if (p_node_page->IsInternalNode()) {
-    for (u16 cell_idx = 0; cell_idx < p_node_page->cell_trackers_.size();
-         ++cell_idx) {
-      CellHeaderByteView cell_header =
-          p_node_page->GetCellHeaderByteView(cell_idx);
+// --------------------- Btree Public Functions ---------------------
 
-      if (cell_header.left_child != 0) {
-        rc = ClearDatabasePage(cell_header.left_child, true);
-        if (rc != ResultCode::kOk) {
-          return rc;
-        }
-      }
+ResultCode Btree::BtreeSetCacheSize(int cache_size) {
+  pager_->SqlitePagerSetCachesize(cache_size);
+  return ResultCode::kOk;
+}
 
-      // For internal nodes, we don't need to clear cell data,
-      // only child pointers
-      if (!p_node_page->IsInternalNode()) {
-        rc = ClearCell(*p_node_page, cell_idx);
-        if (rc != ResultCode::kOk) {
-          return rc;
-        }
-      }
-    }
+/*
+ * Turns prefix compression on or off for the pages that Balance writes from
+ * now on. A compressed page stores the key prefix shared by its cells once, so
+ * tables whose keys share long prefixes need fewer pages. Pages already on
+ * disk keep their format; both kinds can be read at any time.
+ */
+ResultCode Btree::BtreeSetKeyPrefixCompression(bool enable) {
+  key_prefix_compression_ = enable;
+  return ResultCode::kOk;
+}
 
-    if (node_page_header.right_child != 0) {
-      rc = ClearDatabasePage(node_page_header.right_child, true);
-      if (rc != ResultCode::kOk) {
-        return rc;
-      }
-    }
-  } else {
-    // For leaf nodes, we need to clear all cells but not traverse child pointers
-    for (u16 cell_idx = 0; cell_idx < p_node_page->cell_trackers_.size();
-         ++cell_idx) {
-      rc = ClearCell(*p_node_page, cell_idx);
-      if (rc != ResultCode::kOk) {
-        return rc;
-      }
-    }
-  }
+/*
+ * Chooses how the free pages of a database that is created from now on are
+ * tracked, see FreeSpaceFormat. A database that already exists keeps the
+ * format it was created with.
+ */
+ResultCode Btree::BtreeSetFreeSpaceFormat(FreeSpaceFormat format) {
+  free_space_format_ = format;
+  return ResultCode::kOk;
+}
 
-  if (free_page) {
-    rc = FreePage(p_base_page, page_number, false);
-  } else {
-    p_node_page->ZeroPage();
+/*
+ * Chooses the page size of a database that is created from now on, a power of
+ * two from kMinPageSize to kMaxPageSize, otherwise kMisuse is returned. A
+ * database that already exists keeps the page size recorded on its page 1.
+ */
+ResultCode Btree::BtreeSetPageSize(u32 page_size) {
+  if (!IsValidPageSize(page_size)) {
+    return ResultCode::kMisuse;
   }
-
-  rc = pager_->SqlitePagerUnref(p_base_page);
-  return rc;
+  page_size_ = page_size;
+  return ResultCode::kOk;
 }
 
-// --------------------- Btree Public Functions ---------------------
+/*
+ * Chooses how transactions are made durable, see
+ * Pager::SqlitePagerSetJournalMode. Must be called before the first
+ * transaction, otherwise kMisuse is returned.
+ */
+ResultCode Btree::BtreeSetJournalMode(JournalMode mode) {
+  return pager_->SqlitePagerSetJournalMode(mode);
+}
 
-ResultCode Btree::BtreeSetCacheSize(int cache_size) {
-  pager_->SqlitePagerSetCachesize(cache_size);
-  return ResultCode::kOk;
+/*
+ * Lets commits in JournalMode::WAL share syncs of the log, see
+ * Pager::SqlitePagerSetGroupCommit. Commits made through
+ * BtreeCommit(const CommitCallback &) then return before they are durable, so
+ * the next transaction can join the same group.
+ */
+ResultCode Btree::BtreeSetGroupCommit(std::chrono::microseconds window) {
+  return pager_->SqlitePagerSetGroupCommit(window);
 }
 
 /*
@@ -591,13 +630,39 @@ ResultCode Btree::BtreeBeginTrans() {
 }
 
 ResultCode Btree::BtreeCommit() {
-  ResultCode rc;
+  std::promise<ResultCode> durable;
+  std::future<ResultCode> result = durable.get_future();
+  ResultCode rc = BtreeCommit(
+      [&durable](ResultCode sync_rc) { durable.set_value(sync_rc); });
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  return result.get();
+}
+
+/*
+ * Commits like BtreeCommit(), but with group commit on (see
+ * BtreeSetGroupCommit) it returns as soon as the commit is in the log.
+ * on_durable is called exactly once with the outcome, possibly later from the
+ * group commit thread, see Pager::SqlitePagerCommit(const CommitCallback &).
+ */
+ResultCode Btree::BtreeCommit(const CommitCallback &on_durable) {
+  ResultCode rc = ResultCode::kOk;
+  bool is_told = false;  // the pager tells on_durable itself
   if (!in_trans_) {
-    return ResultCode::kError;
+    rc = ResultCode::kError;
+  } else if (!read_only_) {
+    rc = ReleaseExtents();
+    if (rc == ResultCode::kOk) {
+      rc = pager_->SqlitePagerCommit(on_durable);
+      is_told = true;
+    }
   }
-  rc = read_only_ ? ResultCode::kOk : pager_->SqlitePagerCommit();
   in_trans_ = false;
   in_ckpt_ = false;
+  if (!is_told && on_durable) {
+    on_durable(rc);
+  }
   return rc;
 }
 
@@ -608,6 +673,8 @@ ResultCode Btree::BtreeRollback() {
   }
   in_trans_ = false;
   in_ckpt_ = false;
+  extents_.clear();
+  next_unreserved_page_ = 0;
   for (auto &bt_cursor : bt_cursor_set_) {
     if (bt_cursor->p_page) {
       pager_->SqlitePagerUnref(bt_cursor->p_page);
@@ -629,6 +696,8 @@ ResultCode Btree::BtreeBeginCkpt() {
   } else {
     rc = pager_->SqlitePagerCkptBegin();
   }
+  ckpt_extents_ = extents_;
+  ckpt_next_unreserved_page_ = next_unreserved_page_;
   in_ckpt_ = true;
   return rc;
 }
@@ -656,6 +725,8 @@ ResultCode Btree::BtreeRollbackCkpt() {
     }
   }
   rc = pager_->SqlitePagerCkptRollback();
+  extents_ = ckpt_extents_;
+  next_unreserved_page_ = ckpt_next_unreserved_page_;
   in_ckpt_ = false;
   return rc;
 }
@@ -702,8 +773,34 @@ ResultCode Btree::BtreeClearTable(PageNumber root_page_number) {
   if (num_locks != 0) {
     return ResultCode::kLocked;
   }
-  ResultCode rc;
-  rc = ClearDatabasePage(root_page_number, false);
+  // Step 1: Find the pages below the root. They are read, but not written.
+  std::vector<PageNumber> child_page_numbers;
+  std::vector<PageNumber> page_numbers;
+  ResultCode rc =
+      DropCollectNode(root_page_number, child_page_numbers, page_numbers);
+  for (PageNumber child_page_number : child_page_numbers) {
+    if (rc != ResultCode::kOk) {
+      break;
+    }
+    rc = DropCollectPages(child_page_number, page_numbers);
+  }
+
+  // Step 2: Empty the root and free the rest, see btree_drop.cc
+  BasePage *p_base_page = nullptr;
+  if (rc == ResultCode::kOk) {
+    rc = pager_->SqlitePagerGet(root_page_number, &p_base_page,
+                                NodePage::CreateDerivedPage);
+  }
+  if (rc == ResultCode::kOk) {
+    rc = pager_->SqlitePagerWrite(p_base_page);
+    if (rc == ResultCode::kOk) {
+      dynamic_cast<NodePage *>(p_base_page)->ZeroPage();
+    }
+    pager_->SqlitePagerUnref(p_base_page);
+  }
+  if (rc == ResultCode::kOk) {
+    rc = DropFreePages(page_numbers);
+  }
   if (rc != ResultCode::kOk) {
     BtreeRollback();
   }
@@ -740,6 +837,14 @@ ResultCode Btree::BtreeDropTable(PageNumber root_page_number) {
 
 u32 Btree::BtreePageCount() { return pager_->SqlitePagerPageCount(); }
 
+u32 Btree::BtreePageSize() const { return pager_->SqlitePagerPageSize(); }
+
+PagerCacheStats Btree::BtreeCacheStats() {
+  return pager_->SqlitePagerCacheStats();
+}
+
+PagerWalStats Btree::BtreeWalStats() { return pager_->SqlitePagerWalStats(); }
+
 ResultCode Btree::BtreeGetMeta(
     std::array<int, kMetaIntArraySize> &meta_int_arr) {
   BasePage *p_base_page = nullptr;
@@ -28,6 +28,7 @@ struct BalanceContext {
   std::vector<u32> new_combined_cell_sizes;
   std::vector<std::pair<PageNumber, NodePage *>> new_page_number_to_page;
   PageNumber final_right_child;
+  PageNumber first_prev_leaf;
   int divider_start_cell_idx;
 };
 
@@ -71,6 +72,12 @@ ResultCode Btree::BalanceLeafNode(NodePage *p_page, const std::weak_ptr<BtCursor
     goto balance_cleanup;
   }
 
+  // Step 12b: Link the leaves around the old pages to the new pages
+  rc = BalanceHelperRelinkLeaves(context);
+  if (rc != ResultCode::kOk) {
+    goto balance_cleanup;
+  }
+
   // Step 13: Re-parent the child pages
   ReParentAllPages(context);
 
@@ -81,10 +88,6 @@ ResultCode Btree::BalanceLeafNode(NodePage *p_page, const std::weak_ptr<BtCursor
 balance_cleanup:
   CleanupBalanceOperation(context, p_extra_unref, p_parent, p_cursor);
   return rc;
-
-
-
-
 }
 
 ResultCode Btree::BalanceInternalNode(NodePage *p_page,
@@ -157,7 +160,6 @@ ResultCode Btree::Balance(NodePage *p_page,
 
   // Step 2: Check if the page needs any balancing at all
   if (IsBalancing(p_page)) {
-    p_page->RelinkCellList(); // Make sure the cells are linked properly
     return ResultCode::kOk;
   }
 
@@ -200,7 +202,7 @@ ResultCode Btree::Balance(NodePage *p_page,
  */
 bool Btree::IsBalancing(NodePage *p_page) {
   return !p_page->IsOverfull() &&
-         p_page->num_free_bytes_ < kPageSize / 2 &&
+         p_page->num_free_bytes_ < p_page->p_image_.size() / 2 &&
          p_page->GetNumCells() >= 2;
 }
 
@@ -357,15 +359,22 @@ ResultCode Btree::CollectCellsForRedistribution(BalanceContext &context,
                                               bool isInternal) {
   ResultCode rc;
   BasePage *p_base_page = nullptr;
+  u32 page_size = BtreePageSize();
 
   for (size_t i = 0; i < context.divider_page_numbers.size(); ++i) {
     context.num_cells_in_divider_pages.push_back(context.divider_pages[i]->GetNumCells());
+    if (i == 0) {
+      context.first_prev_leaf = divider_page_headers[i].prev_leaf;
+    }
 
     // Collect all cells from the page
     for (size_t j = 0; j < context.divider_pages[i]->GetNumCells(); ++j) {
       context.redistributed_cells.push_back(context.divider_pages[i]->GetCell(j));
       context.redistributed_cell_sizes.push_back(
-          context.redistributed_cells.back().GetCellSize());
+          context.redistributed_cells.back().GetCellSize(page_size) +
+          kCellDirectoryEntrySize +
+          NodePage::GetFixedKeySize(context.redistributed_cells.back(),
+                                    page_size));
     }
 
     // Handle divider cells between pages
@@ -378,7 +387,10 @@ ResultCode Btree::CollectCellsForRedistribution(BalanceContext &context,
             divider_page_headers[i].right_child;
         // add the parent cell size to redistributed cell size array
         context.redistributed_cell_sizes.push_back(
-            context.redistributed_cells.back().GetCellSize());
+            context.redistributed_cells.back().GetCellSize(page_size) +
+            kCellDirectoryEntrySize +
+            NodePage::GetFixedKeySize(context.redistributed_cells.back(),
+                                      page_size));
       }
       // 存疑
       p_parent->DropCell(context.divider_start_cell_idx);
@@ -386,8 +398,13 @@ ResultCode Btree::CollectCellsForRedistribution(BalanceContext &context,
       context.final_right_child = divider_page_headers[i].right_child;
     }
 
-    // Free the page after extracting its cells
+    // Free the page after extracting its cells. It is journaled before it is
+    // zeroed, so a rollback brings its cells back
     p_base_page = context.divider_pages[i];
+    rc = pager_->SqlitePagerWrite(p_base_page);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
     auto *p_node_page = dynamic_cast<NodePage *>(p_base_page);
     p_node_page->ZeroPage();
 
@@ -407,27 +424,131 @@ ResultCode Btree::CollectCellsForRedistribution(BalanceContext &context,
  * @param context: the balance context
  */
 void Btree::CalculateNewPageDistribution(BalanceContext &context) {
+  if (key_prefix_compression_) {
+    CalculateCompressedPageDistribution(context);
+    return;
+  }
+
   // Calculate initial distribution
+  u32 usable_space = UsableSpace(BtreePageSize());
   u32 subtotal = 0;
   for (u32 i = 0; i < context.redistributed_cell_sizes.size(); ++i) {
     u32 cell_size = context.redistributed_cell_sizes[i];
-    if (subtotal + cell_size > kUsableSpace) {
+    if (subtotal + cell_size > usable_space) {
       context.new_combined_cell_sizes.push_back(subtotal);
       context.new_divider_cell_indexes.push_back(i);
-      assert(context.new_combined_cell_sizes.back() <= kUsableSpace);
+      assert(context.new_combined_cell_sizes.back() <= usable_space);
       subtotal = cell_size;
     } else {
       subtotal += cell_size;
     }
   }
   context.new_combined_cell_sizes.push_back(subtotal);
-  assert(context.new_combined_cell_sizes.back() <= kUsableSpace);
+  assert(context.new_combined_cell_sizes.back() <= usable_space);
   context.new_divider_cell_indexes.push_back(context.redistributed_cell_sizes.size());
 
   // Evenly distribute cells across pages
   BalancePageDistribution(context);
 }
 
+/**
+ * Finds the size of the key prefix that the cells from begin to end would
+ * share on a prefix-compressed page. Cells on overflow pages keep their whole
+ * key, so only the other cells count. With fewer than 2 of them, no prefix is
+ * worth storing.
+ *
+ * @param first_local_cell_idx: set to the index of the first counted cell
+ * @return: the size of the prefix, at most 255 bytes
+ */
+u32 Btree::BalanceHelperKeyPrefixSize(const BalanceContext &context, u32 begin,
+                                      u32 end, u32 &first_local_cell_idx) {
+  u32 page_size = BtreePageSize();
+  u32 prefix_size = UINT8_MAX;
+  u32 num_local_cells = 0;
+  for (u32 i = begin; i < end; ++i) {
+    const Cell &cell = context.redistributed_cells[i];
+    if (cell.NeedOverflowPage(page_size)) {
+      continue;
+    }
+    if (num_local_cells++ == 0) {
+      first_local_cell_idx = i;
+    }
+    const Cell &first_cell = context.redistributed_cells[first_local_cell_idx];
+    u32 n = std::min(prefix_size, cell.cell_header_.key_size);
+    u32 j = 0;
+    while (j < n && cell.payload_[j] == first_cell.payload_[j]) {
+      ++j;
+    }
+    prefix_size = j;
+  }
+  return num_local_cells < 2 ? 0 : prefix_size;
+}
+
+/**
+ * The number of bytes the cells from begin to end take on a prefix-compressed
+ * page, including the prefix itself.
+ */
+u32 Btree::BalanceHelperCompressedSize(const BalanceContext &context,
+                                       u32 begin, u32 end) {
+  u32 first_local_cell_idx = 0;
+  u32 prefix_size =
+      BalanceHelperKeyPrefixSize(context, begin, end, first_local_cell_idx);
+  u32 page_size = BtreePageSize();
+  u32 size = prefix_size;
+  for (u32 i = begin; i < end; ++i) {
+    size += context.redistributed_cell_sizes[i];
+    if (!context.redistributed_cells[i].NeedOverflowPage(page_size)) {
+      size -= prefix_size;
+    }
+  }
+  return size;
+}
+
+/**
+ * Same as CalculateNewPageDistribution followed by BalancePageDistribution,
+ * but for prefix-compressed pages: the size of a page depends on the prefix
+ * its cells share, so it is recomputed whenever a cell moves.
+ *
+ * @param context: the balance context
+ */
+void Btree::CalculateCompressedPageDistribution(BalanceContext &context) {
+  // Fill each page as much as possible
+  u32 usable_space = UsableSpace(BtreePageSize());
+  u32 num_cells = context.redistributed_cells.size();
+  u32 begin = 0;
+  for (u32 i = 0; i < num_cells; ++i) {
+    if (i > begin &&
+        BalanceHelperCompressedSize(context, begin, i + 1) > usable_space) {
+      context.new_combined_cell_sizes.push_back(
+          BalanceHelperCompressedSize(context, begin, i));
+      context.new_divider_cell_indexes.push_back(i);
+      begin = i;
+    }
+  }
+  context.new_combined_cell_sizes.push_back(
+      BalanceHelperCompressedSize(context, begin, num_cells));
+  context.new_divider_cell_indexes.push_back(num_cells);
+
+  // Move cells from front pages to back pages while the back page is less
+  // than half full and the cell still fits
+  for (u32 i = context.new_combined_cell_sizes.size() - 1; i > 0; --i) {
+    u32 prev_begin = i > 1 ? context.new_divider_cell_indexes[i - 2] : 0;
+    while (context.new_combined_cell_sizes[i] < usable_space / 2 &&
+           context.new_divider_cell_indexes[i - 1] > prev_begin + 1) {
+      u32 divider = context.new_divider_cell_indexes[i - 1] - 1;
+      u32 size = BalanceHelperCompressedSize(
+          context, divider, context.new_divider_cell_indexes[i]);
+      if (size > usable_space) {
+        break;
+      }
+      context.new_divider_cell_indexes[i - 1] = divider;
+      context.new_combined_cell_sizes[i] = size;
+      context.new_combined_cell_sizes[i - 1] =
+          BalanceHelperCompressedSize(context, prev_begin, divider);
+    }
+  }
+}
+
 /**
  * Balance the distribution of cells across pages.
  *
@@ -435,8 +556,9 @@ void Btree::CalculateNewPageDistribution(BalanceContext &context) {
  */
 void Btree::BalancePageDistribution(BalanceContext &context) {
   // Redistribute cells from front pages to back pages for better balance
+  u32 usable_space = UsableSpace(BtreePageSize());
   for (u32 i = context.new_combined_cell_sizes.size() - 1; i > 0; --i) {
-    while (context.new_combined_cell_sizes[i] < kUsableSpace / 2) {
+    while (context.new_combined_cell_sizes[i] < usable_space / 2) {
       context.new_divider_cell_indexes[i - 1] -= 1;
       context.new_combined_cell_sizes[i] +=
           context.redistributed_cell_sizes[context.new_divider_cell_indexes[i - 1]];
@@ -455,24 +577,21 @@ void Btree::BalancePageDistribution(BalanceContext &context) {
  * @return: appropriate result code
  */
 ResultCode Btree::AllocateNewPages(BalanceContext &context, bool isInternal) {
-  ResultCode rc;
-
-  for (u32 i = 0; i < context.new_combined_cell_sizes.size(); ++i) {
-    NodePage *p_new_page = nullptr;
-    PageNumber new_page_number{};
-
-    rc = AllocatePage(p_new_page, new_page_number);
-    if (rc != ResultCode::kOk) {
-      return rc;
-    }
-
+  // The old pages are on the free list by now, so the first new page starts
+  // where the first old one was, and the others follow it
+  PageNumber root_page_number = FindRootPageNumber(context.p_parent);
+  ResultCode rc = AllocateTablePages(
+      root_page_number, context.divider_page_numbers.front() - 1,
+      static_cast<u32>(context.new_combined_cell_sizes.size()),
+      context.new_page_number_to_page);
+
+  for (auto &[new_page_number, p_new_page] : context.new_page_number_to_page) {
     p_new_page->ZeroPage();
     p_new_page->is_init_ = true;
     p_new_page->SetNodeType(isInternal);
-    context.new_page_number_to_page.emplace_back(new_page_number, p_new_page);
   }
 
-  return ResultCode::kOk;
+  return rc;
 }
 
 /**
@@ -527,6 +646,13 @@ ResultCode Btree::RedistributeCells(BalanceContext &context,
         p_new_page->SetNodePageHeaderByteView(page_header);
       }
     }
+
+    // Link the leaf back to the one before it
+    if (!isInternal) {
+      p_new_page->SetPrevLeaf(
+          i == 0 ? context.first_prev_leaf
+                 : context.new_page_number_to_page[i - 1].first);
+    }
   }
 
   // Update the right child references
@@ -562,6 +688,18 @@ ResultCode Btree::InsertCellsIntoNewPage(BalanceContext &context,
                                         NodePage *p_new_page,
                                         const std::weak_ptr<BtCursor> &p_cursor,
                                         u32 page_index) {
+  if (key_prefix_compression_) {
+    u32 first_local_cell_idx = 0;
+    u32 prefix_size = BalanceHelperKeyPrefixSize(
+        context, context.num_cells_inserted,
+        context.new_divider_cell_indexes[page_index], first_local_cell_idx);
+    if (prefix_size > 0) {
+      const Cell &first_cell = context.redistributed_cells[first_local_cell_idx];
+      p_new_page->SetKeyPrefix(std::vector<std::byte>(
+          first_cell.payload_.begin(),
+          first_cell.payload_.begin() + prefix_size));
+    }
+  }
   while (context.num_cells_inserted < context.new_divider_cell_indexes[page_index]) {
     Cell cell_to_insert = context.redistributed_cells[context.num_cells_inserted];
 
@@ -606,8 +744,11 @@ ResultCode Btree::InsertCellsIntoParent(BalanceContext &context,
     // CHAOS: handle linked list part at here
     // Add an empty key cell to the parent
     const Cell cell_push_to_parent = context.redistributed_cells[context.num_cells_inserted - 1];
-    std::vector<std::byte> key_value(cell_push_to_parent.cell_header_.key_size);
-    std::memcpy(key_value.data(), cell_push_to_parent.payload_.data(), cell_push_to_parent.cell_header_.key_size);
+    std::vector<std::byte> key_value;
+    ResultCode rc = GetCellKey(cell_push_to_parent, key_value);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
     cell_to_insert = Cell(key_value);
 
     // Handle linked list
@@ -735,7 +876,7 @@ Btree::BalanceHelperHandleRoot(NodePage *&p_page, NodePage *&p_parent,
   NodePage *p_child = nullptr;
 
   // Step 1: Handle the case where the root page has no cells
-  if (p_page->cell_trackers_.empty()) {
+  if (p_page->GetNumCells() == 0) {
 
     /*
      * 1-1: Handle the case where the root page has a right child
@@ -788,8 +929,6 @@ Btree::BalanceHelperHandleRoot(NodePage *&p_page, NodePage *&p_parent,
       }
       FreePage(p_base_page, child_page_number, false);
       pager_->SqlitePagerUnref(p_child);
-    } else {
-      p_page->RelinkCellList();
     }
     return_ok_early = true;
     return ResultCode::kOk;
@@ -815,7 +954,6 @@ Btree::BalanceHelperHandleRoot(NodePage *&p_page, NodePage *&p_parent,
   // -------------------------
 
   if (!root_page_is_overfull) {
-    p_page->RelinkCellList();
     return_ok_early = true;
     return ResultCode::kOk;
   }
@@ -829,7 +967,9 @@ Btree::BalanceHelperHandleRoot(NodePage *&p_page, NodePage *&p_parent,
   if (rc != ResultCode::kOk) {
     return rc;
   }
-  rc = AllocatePage(p_child, child_page_number);
+  rc = AllocateTablePage(pager_->SqlitePagerPageNumber(p_page),
+                         pager_->SqlitePagerPageNumber(p_page), p_child,
+                         child_page_number);
   if (rc != ResultCode::kOk) {
     return rc;
   }
@@ -922,4 +1062,72 @@ int Btree::BalanceHelperFindChildIdx(NodePage *p_page, NodePage *p_parent) {
   // In cases where the idx is neither found in the left child of each cell nor
   // the right child of the page, the value of -1 will be returned.
   return idx;
-}
\ No newline at end of file
+}
+
+/**
+ * This is a helper function for BalanceLeafNode(). The leaves are chained in
+ * both directions, and the leaves just before and after the redistributed
+ * pages still point at old pages, which have been freed. This function points
+ * them at the first and the last new page.
+ *
+ * @param context: the balance context, after the cells were redistributed
+ * @return: appropriate result code
+ */
+ResultCode Btree::BalanceHelperRelinkLeaves(BalanceContext &context) {
+  PageNumber old_first_page_number = context.divider_page_numbers.front();
+  PageNumber new_first_page_number = context.new_page_number_to_page.front().first;
+  PageNumber old_last_page_number = context.divider_page_numbers.back();
+  PageNumber new_last_page_number = context.new_page_number_to_page.back().first;
+  ResultCode rc = ResultCode::kOk;
+
+  // Step 1: Point the leaf before the old pages at the first new page
+  if (context.first_prev_leaf != 0 &&
+      old_first_page_number != new_first_page_number) {
+    rc = BalanceHelperRelinkLeaf(context.first_prev_leaf, true,
+                                 old_first_page_number, new_first_page_number);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+  }
+
+  // Step 2: Point the leaf after the old pages back at the last new page
+  if (context.final_right_child != 0 &&
+      old_last_page_number != new_last_page_number) {
+    rc = BalanceHelperRelinkLeaf(context.final_right_child, false,
+                                 old_last_page_number, new_last_page_number);
+  }
+  return rc;
+}
+
+/**
+ * This is a helper function for BalanceHelperRelinkLeaves(). It replaces the
+ * next (is_next is true) or previous leaf link of the leaf page_number, if
+ * that link points at old_page_number.
+ */
+ResultCode Btree::BalanceHelperRelinkLeaf(PageNumber page_number, bool is_next,
+                                          PageNumber old_page_number,
+                                          PageNumber new_page_number) {
+  BasePage *p_base_page = nullptr;
+  ResultCode rc = pager_->SqlitePagerGet(page_number, &p_base_page,
+                                         NodePage::CreateDerivedPage);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  auto *p_page = dynamic_cast<NodePage *>(p_base_page);
+  PageNumber linked_page_number =
+      is_next ? p_page->GetNextLeaf() : p_page->GetPrevLeaf();
+  if (p_page->IsInternalNode() || linked_page_number != old_page_number) {
+    rc = ResultCode::kCorrupt;
+  } else {
+    rc = pager_->SqlitePagerWrite(p_page);
+  }
+  if (rc == ResultCode::kOk) {
+    if (is_next) {
+      p_page->SetNextLeaf(new_page_number);
+    } else {
+      p_page->SetPrevLeaf(new_page_number);
+    }
+  }
+  pager_->SqlitePagerUnref(p_page);
+  return rc;
+}
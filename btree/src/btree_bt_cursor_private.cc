@@ -26,22 +26,29 @@ ResultCode Btree::GetPayload(const BtCursor &cursor, u32 offset, u32 amount, std
   if (!cursor.p_page || cursor.cell_index >= cursor.p_page->GetNumCells()) {
     return ResultCode::kError;
   }
-  ResultCode rc;
   PageNumber next_page_number = cursor.p_page->GetCellHeaderByteView(cursor.cell_index).overflow_page;
-  ImageIndex cell_start_idx = cursor.p_page->cell_trackers_[cursor.cell_index].image_idx;
 
   if (next_page_number == 0) {
     u32 a = amount;
     result.resize(a);
-    u32 total_offset = cell_start_idx + sizeof(CellHeaderByteView) + offset;
-    memcpy(result.data(),
-           cursor.p_page->p_image_->data() + total_offset, a);
+    cursor.p_page->ReadLocalPayload(cursor.cell_index, offset, a, result.data());
     if (a == amount) {
       return ResultCode::kOk;
     } else {
       return ResultCode::kError;
     }
   }
+  return ReadOverflowPayload(next_page_number, offset, amount, result);
+}
+
+/*
+ * Appends amount bytes of a payload stored on overflow pages, from offset on,
+ * to result. next_page_number is the first page of the chain.
+ */
+ResultCode Btree::ReadOverflowPayload(PageNumber next_page_number, u32 offset,
+                                      u32 amount,
+                                      std::vector<std::byte> &result) {
+  ResultCode rc;
   while (amount > 0 && next_page_number != 0) {
     BasePage *p_base_page = nullptr;
     rc = pager_->SqlitePagerGet(next_page_number, &p_base_page,
@@ -49,18 +56,19 @@ ResultCode Btree::GetPayload(const BtCursor &cursor, u32 offset, u32 amount, std
     if (rc != ResultCode::kOk) { return rc; }
     auto *p_overflow_page = dynamic_cast<OverFreePage *>(p_base_page);
     next_page_number = p_overflow_page->GetOverflowPageHeaderByteView().next_page;
-    if (offset < kOverflowSize) {
+    u32 overflow_size = OverflowSize(p_overflow_page->p_image_.size());
+    if (offset < overflow_size) {
       u32 a = amount;
-      if (a + offset > kOverflowSize) {
-        a = kOverflowSize - offset;
+      if (a + offset > overflow_size) {
+        a = overflow_size - offset;
       }
       result.resize(result.size() + a);
       memcpy(result.data() + result.size() - a,
-             p_overflow_page->p_image_->data() + sizeof(OverflowPageHeaderByteView) + offset, a);
+             p_overflow_page->p_image_.data() + sizeof(OverflowPageHeaderByteView) + offset, a);
       offset = 0;
       amount -= a;
     } else {
-      offset -= kOverflowSize;
+      offset -= overflow_size;
     }
     pager_->SqlitePagerUnref(p_base_page);
   }
@@ -70,6 +78,54 @@ ResultCode Btree::GetPayload(const BtCursor &cursor, u32 offset, u32 amount, std
   return ResultCode::kOk;
 }
 
+/*
+ * Copies the key of a cell taken off a page into key. The key of a cell whose
+ * payload is on overflow pages is read from the first of them.
+ */
+ResultCode Btree::GetCellKey(const Cell &cell, std::vector<std::byte> &key) {
+  key.clear();
+  if (cell.cell_header_.overflow_page != 0) {
+    return ReadOverflowPayload(cell.cell_header_.overflow_page, 0,
+                               cell.cell_header_.key_size, key);
+  }
+  key.assign(cell.payload_.begin(),
+             cell.payload_.begin() + cell.cell_header_.key_size);
+  return ResultCode::kOk;
+}
+
+/*
+ * Views the key or data of the cell under the cursor. A local payload is
+ * viewed in the page image, except for the key on a prefix-compressed page;
+ * that key and payloads on overflow pages are copied into buffer first.
+ */
+ResultCode Btree::GetPayloadView(const BtCursor &cursor, bool is_key,
+                                 std::vector<std::byte> &buffer,
+                                 PayloadView &view) {
+  CellHeaderByteView cell_header =
+      cursor.p_page->GetCellHeaderByteView(cursor.cell_index);
+  u32 offset = is_key ? 0 : cell_header.key_size;
+  view.size = is_key ? cell_header.key_size : cell_header.data_size;
+  u32 prefix_size = cursor.p_page->GetKeyPrefixSize();
+  if (cell_header.overflow_page == 0 && is_key && prefix_size > 0) {
+    buffer.resize(view.size);
+    cursor.p_page->ReadLocalPayload(cursor.cell_index, 0, view.size,
+                                    buffer.data());
+    view.data = buffer.data();
+    return ResultCode::kOk;
+  }
+  if (cell_header.overflow_page == 0) {
+    ImageIndex cell_start_idx =
+        cursor.p_page->GetCellImageIndex(cursor.cell_index);
+    view.data = cursor.p_page->p_image_.data() + cell_start_idx +
+                sizeof(CellHeaderByteView) + offset - (is_key ? 0 : prefix_size);
+    return ResultCode::kOk;
+  }
+  buffer.clear();
+  ResultCode rc = GetPayload(cursor, offset, view.size, buffer);
+  view.data = buffer.data();
+  return rc;
+}
+
 /*
  * Moves the cursor to point to its child page, as indicated by the child_page_number.
  */
@@ -117,8 +173,15 @@ ResultCode Btree::MoveToRoot(BtCursor &cursor) {
   if (rc != ResultCode::kOk) { return rc; }
   auto p_node_page = dynamic_cast<NodePage *>(p_base_page);
   rc = InitPage(*p_node_page, nullptr);
-  if (rc != ResultCode::kOk) { return rc; }
-  pager_->SqlitePagerUnref(p_base_page);
+  if (rc != ResultCode::kOk) {
+    pager_->SqlitePagerUnref(p_base_page);
+    return rc;
+  }
+  // the cursor keeps the reference to the root and gives up the one to the
+  // page it leaves, as MoveToChild and MoveToParent do
+  if (cursor.p_page) {
+    pager_->SqlitePagerUnref(cursor.p_page);
+  }
   cursor.p_page = p_node_page;
   cursor.cell_index = 0;
   return ResultCode::kOk;
@@ -139,3 +202,65 @@ ResultCode Btree::MoveToLeftmost(BtCursor &cursor) {
 }
 
 
+
+/*
+ * Binary-searches the page the cursor is on for key, without descending.
+ * Leaves the cursor and result the way BtreeMoveTo does on a leaf: result is 0
+ * on a match, and otherwise compares the cell under the cursor against key.
+ */
+ResultCode Btree::MoveToCellInPage(const std::weak_ptr<BtCursor> &p_cursor_weak,
+                                   std::vector<std::byte> &key, int &result) {
+  auto &cursor = *p_cursor_weak.lock();
+  int lower_bound = 0;
+  int upper_bound = static_cast<int>(cursor.p_page->GetNumCells()) - 1;
+  int c = -1;
+  if (SearchFixedKeys(cursor, key, lower_bound, c)) {
+    upper_bound = -1;
+  }
+  while (lower_bound <= upper_bound) {
+    cursor.cell_index = (lower_bound + upper_bound) / 2;
+    ResultCode rc = CursorKeyCompare(cursor, key, 0, c);
+    if (rc != ResultCode::kOk) { return rc; }
+    if (c == 0) { break; }
+    if (c < 0) {
+      lower_bound = cursor.cell_index + 1;
+    } else {
+      upper_bound = cursor.cell_index - 1;
+    }
+  }
+  result = c;
+  cursor.compare_result = c;
+  return ResultCode::kOk;
+}
+
+/*
+ * Searches the page the cursor is on through its key array, when it has one
+ * for keys as long as key. The cursor and c are left the way the binary search
+ * of BtreeMoveTo leaves them: on a match the cursor points to the matching
+ * cell and c is 0, otherwise c compares the cell under the cursor against key.
+ * lower_bound is set to the number of cells with a smaller key.
+ *
+ * Returns false, without touching anything, if the page has to be searched
+ * through its cells.
+ */
+bool Btree::SearchFixedKeys(BtCursor &cursor, const std::vector<std::byte> &key,
+                            int &lower_bound, int &c) {
+  u16 index = 0;
+  bool found = false;
+  if (!cursor.p_page->FindFixedKey(key.data(), key.size(), index, found)) {
+    return false;
+  }
+  u32 num_cells = cursor.p_page->GetNumCells();
+  lower_bound = index;
+  if (found) {
+    cursor.cell_index = index;
+    c = 0;
+  } else if (index < num_cells) {
+    cursor.cell_index = index;
+    c = 1;
+  } else {
+    cursor.cell_index = num_cells == 0 ? 0 : num_cells - 1;
+    c = -1;
+  }
+  return true;
+}
@@ -17,6 +17,7 @@ BtCursor::BtCursor() {
   writable = false;
   skip_next = false;
   compare_result = 0;
+  is_open = false;
 }
 
 // --------------------- BtCursor Public Functions ---------------------
@@ -75,6 +76,7 @@ ResultCode Btree::BtCursorCreate(PageNumber root_page_number, bool writable,
 
   // Step 7: Insert the BtCursor into the map
   bt_cursor->p_page = dynamic_cast<NodePage *>(p_base_page);
+  bt_cursor->is_open = true;
   bt_cursor_set_.insert(bt_cursor);
   p_cursor_weak = bt_cursor;
   if (writable) {
@@ -116,11 +118,33 @@ ResultCode Btree::BtCursorClose(const std::weak_ptr<BtCursor> &p_cursor_weak) {
     pager_->SqlitePagerUnref(p_cursor->p_page);
   }
 
+  p_cursor->is_open = false;
   bt_cursor_set_.erase(p_cursor);
 
   return ResultCode::kOk;
 }
 
+/**
+ * BtCursorGetRef validates an open cursor once and hands out a BtCursorRef to
+ * it. The overloads that take the BtCursorRef skip the validation that the
+ * weak pointer overloads repeat on every call.
+ * @param p_cursor_weak: weak cursor pointer
+ * @param cursor_ref: set to a handle to the cursor
+ * @return result code
+ */
+ResultCode Btree::BtCursorGetRef(const std::weak_ptr<BtCursor> &p_cursor_weak,
+                                 BtCursorRef &cursor_ref) {
+  if (p_cursor_weak.expired()) {
+    return ResultCode::kError;
+  }
+  auto p_cursor = p_cursor_weak.lock();
+  if (bt_cursor_set_.find(p_cursor) == bt_cursor_set_.end()) {
+    return ResultCode::kError;
+  }
+  cursor_ref.p_cursor_ = std::move(p_cursor);
+  return ResultCode::kOk;
+}
+
 ResultCode Btree::BtreeKeySize(const std::weak_ptr<BtCursor> &p_cursor_weak,
                                u32 &key_size) {
   // Step 1: Check if the cursor exists, and return error if not
@@ -133,7 +157,17 @@ ResultCode Btree::BtreeKeySize(const std::weak_ptr<BtCursor> &p_cursor_weak,
   }
 
   // Step 2: Using information from the BtCursor to get the key size
-  auto cursor = *p_cursor;
+  return CursorKeySize(*p_cursor, key_size);
+}
+
+ResultCode Btree::BtreeKeySize(BtCursorRef &cursor_ref, u32 &key_size) {
+  if (!cursor_ref.IsOpen()) {
+    return ResultCode::kError;
+  }
+  return CursorKeySize(*cursor_ref.p_cursor_, key_size);
+}
+
+ResultCode Btree::CursorKeySize(const BtCursor &cursor, u32 &key_size) {
   NodePage *p_node_page = cursor.p_page;
   if (!p_node_page || cursor.cell_index >= p_node_page->GetNumCells()) {
     key_size = 0;
@@ -157,8 +191,20 @@ u32 Btree::BtreeKey(const std::weak_ptr<BtCursor> &p_cursor_weak, u32 offset,
     return 0;
   }
 
+  return CursorKey(*p_cursor, offset, amount, result);
+}
+
+u32 Btree::BtreeKey(BtCursorRef &cursor_ref, u32 offset, u32 amount,
+                    std::vector<std::byte> &result) {
+  if (!cursor_ref.IsOpen()) {
+    return 0;
+  }
+  return CursorKey(*cursor_ref.p_cursor_, offset, amount, result);
+}
+
+u32 Btree::CursorKey(const BtCursor &cursor, u32 offset, u32 amount,
+                     std::vector<std::byte> &result) {
   // Step 2: Find the key size and return 0 if the key size is 0
-  auto cursor = *p_cursor;
   CellHeaderByteView cell_header{};
   result.clear();
   if (amount == 0 || !cursor.p_page ||
@@ -188,7 +234,17 @@ ResultCode Btree::BtreeDataSize(const std::weak_ptr<BtCursor> &p_cursor_weak,
     return ResultCode::kError;
   }
 
-  auto cursor = *p_cursor;
+  return CursorDataSize(*p_cursor, data_size);
+}
+
+ResultCode Btree::BtreeDataSize(BtCursorRef &cursor_ref, u32 &data_size) {
+  if (!cursor_ref.IsOpen()) {
+    return ResultCode::kError;
+  }
+  return CursorDataSize(*cursor_ref.p_cursor_, data_size);
+}
+
+ResultCode Btree::CursorDataSize(const BtCursor &cursor, u32 &data_size) {
   if (!cursor.p_page || cursor.cell_index >= cursor.p_page->GetNumCells()) {
     data_size = 0;
   } else {
@@ -210,7 +266,19 @@ u32 Btree::BtreeData(const std::weak_ptr<BtCursor> &p_cursor_weak, u32 offset,
     return 0;
   }
 
-  auto cursor = *p_cursor;
+  return CursorData(*p_cursor, offset, amount, result);
+}
+
+u32 Btree::BtreeData(BtCursorRef &cursor_ref, u32 offset, u32 amount,
+                     std::vector<std::byte> &result) {
+  if (!cursor_ref.IsOpen()) {
+    return 0;
+  }
+  return CursorData(*cursor_ref.p_cursor_, offset, amount, result);
+}
+
+u32 Btree::CursorData(const BtCursor &cursor, u32 offset, u32 amount,
+                      std::vector<std::byte> &result) {
   result.clear();
   if (amount == 0 || !cursor.p_page ||
       cursor.cell_index >= cursor.p_page->GetNumCells()) {
@@ -238,8 +306,21 @@ ResultCode Btree::BtreeKeyCompare(const std::weak_ptr<BtCursor> &p_cursor_weak,
   if (bt_cursor_set_.find(p_cursor) == bt_cursor_set_.end()) {
     return ResultCode::kError;
   }
+  return CursorKeyCompare(*p_cursor, key, num_ignore, result);
+}
+
+ResultCode Btree::BtreeKeyCompare(BtCursorRef &cursor_ref,
+                                  std::vector<std::byte> &key, u32 num_ignore,
+                                  int &result) {
+  if (!cursor_ref.IsOpen()) {
+    return ResultCode::kError;
+  }
+  return CursorKeyCompare(*cursor_ref.p_cursor_, key, num_ignore, result);
+}
 
-  auto cursor = *p_cursor;
+ResultCode Btree::CursorKeyCompare(const BtCursor &cursor,
+                                   std::vector<std::byte> &key,
+                                   u32 num_ignore, int &result) {
   if (!cursor.p_page || cursor.cell_index >= cursor.p_page->GetNumCells()) {
     return ResultCode::kError;
   }
@@ -249,23 +330,23 @@ ResultCode Btree::BtreeKeyCompare(const std::weak_ptr<BtCursor> &p_cursor_weak,
       num_ignore > cell_header.key_size ? 0 : cell_header.key_size - num_ignore;
   u32 key_size = key.size();
   u32 n = key_size < num_local ? key_size : num_local;
-  if (n > kMaxLocalPayload) {
-    n = kMaxLocalPayload;
+  if (n > MaxLocalPayload(BtreePageSize())) {
+    n = MaxLocalPayload(BtreePageSize());
   }
   int c;
-  CellTracker tracker = cursor.p_page->cell_trackers_[cursor.cell_index];
-  if (!tracker.IsCellWrittenIntoImage()) {
-    c = std::memcmp(tracker.cell.payload_.data(), key.data(), n);
-    if (c == 0 && key.size() != tracker.cell.cell_header_.key_size) {
-      c = tracker.cell.cell_header_.key_size < key.size() ? -1 : 1;
+  // A cell waiting for Balance keeps its payload in its tracker, unless the
+  // payload has already been moved to overflow pages
+  if (cursor.p_page->GetCellImageIndex(cursor.cell_index) == 0 &&
+      cell_header.overflow_page == 0) {
+    c = cursor.p_page->CompareLocalPayload(cursor.cell_index, key.data(), n);
+    if (c == 0 && key.size() != cell_header.key_size) {
+      c = cell_header.key_size < key.size() ? -1 : 1;
     }
     result = c;
     return ResultCode::kOk;
   }
-  ImageIndex payload_start_idx = tracker.image_idx + sizeof(CellHeaderByteView);
   if (cell_header.overflow_page == 0) {
-    c = std::memcmp(cursor.p_page->p_image_->data() + payload_start_idx,
-                    key.data(), n);
+    c = cursor.p_page->CompareLocalPayload(cursor.cell_index, key.data(), n);
     result = c;
     return ResultCode::kOk;
   }
@@ -286,10 +367,10 @@ ResultCode Btree::BtreeKeyCompare(const std::weak_ptr<BtCursor> &p_cursor_weak,
         p_overflow_page->GetOverflowPageHeaderByteView();
     next_page_number = overflow_page_header.next_page;
     n = key_size < num_local ? key_size : num_local;
-    if (n > kOverflowSize) {
-      n = kOverflowSize;
+    if (n > OverflowSize(p_overflow_page->p_image_.size())) {
+      n = OverflowSize(p_overflow_page->p_image_.size());
     }
-    c = std::memcmp(p_overflow_page->p_image_->data() +
+    c = std::memcmp(p_overflow_page->p_image_.data() +
                         sizeof(OverflowPageHeaderByteView),
                     key.data() + key_compare_start_idx, n);
     pager_->SqlitePagerUnref(p_base_page);
@@ -399,7 +480,19 @@ ResultCode Btree::BtreeMoveTo(const std::weak_ptr<BtCursor> &p_cursor_weak,
   if (bt_cursor_set_.find(p_cursor) == bt_cursor_set_.end()) {
     return ResultCode::kError;
   }
-  auto &cursor = *p_cursor;
+  return CursorMoveTo(*p_cursor, key, result);
+}
+
+ResultCode Btree::BtreeMoveTo(BtCursorRef &cursor_ref,
+                              std::vector<std::byte> &key, int &result) {
+  if (!cursor_ref.IsOpen()) {
+    return ResultCode::kError;
+  }
+  return CursorMoveTo(*cursor_ref.p_cursor_, key, result);
+}
+
+ResultCode Btree::CursorMoveTo(BtCursor &cursor, std::vector<std::byte> &key,
+                               int &result) {
   if (!cursor.p_page) {
     return ResultCode::kAbort;
   }
@@ -419,13 +512,23 @@ ResultCode Btree::BtreeMoveTo(const std::weak_ptr<BtCursor> &p_cursor_weak,
     // This is because upper_bound must be able to become -1
     // to successfully skip the loop when the page is empty.
     int lower_bound = 0;
-    int upper_bound = cursor.p_page->cell_trackers_.size() - 1;
+    int upper_bound = cursor.p_page->GetNumCells() - 1;
     int c = -1;
 
+    // A page with a key array is searched without reading its cells
+    if (SearchFixedKeys(cursor, key, lower_bound, c)) {
+      if (c == 0 && !cursor.p_page->IsInternalNode()) {
+        result = c;
+        cursor.compare_result = c;
+        return ResultCode::kOk;
+      }
+      upper_bound = -1;
+    }
+
     // This is a binary search on the cells in the current node
     while (lower_bound <= upper_bound) {
       cursor.cell_index = (lower_bound + upper_bound) / 2;
-      rc = BtreeKeyCompare(p_cursor_weak, key, 0, c);
+      rc = CursorKeyCompare(cursor, key, 0, c);
       if (rc != ResultCode::kOk) {
         return rc;
       }
@@ -453,7 +556,7 @@ ResultCode Btree::BtreeMoveTo(const std::weak_ptr<BtCursor> &p_cursor_weak,
     }
     PageNumber child_page_number;
     // This is an edge case
-    if (lower_bound >= cursor.p_page->cell_trackers_.size()) {
+    if (lower_bound >= cursor.p_page->GetNumCells()) {
       child_page_number =
           cursor.p_page->GetNodePageHeaderByteView().right_child;
     } else {
@@ -502,13 +605,23 @@ ResultCode Btree::BtreeMoveToWithStop(const std::weak_ptr<BtCursor> &p_cursor_we
     // This is because upper_bound must be able to become -1
     // to successfully skip the loop when the page is empty.
     int lower_bound = 0;
-    int upper_bound = cursor.p_page->cell_trackers_.size() - 1;
+    int upper_bound = cursor.p_page->GetNumCells() - 1;
     int c = -1;
 
+    // A page with a key array is searched without reading its cells
+    if (SearchFixedKeys(cursor, key, lower_bound, c)) {
+      if (c == 0) {
+        result = c;
+        cursor.compare_result = c;
+        return ResultCode::kOk;
+      }
+      upper_bound = -1;
+    }
+
     // This is a binary search on the cells in the current node
     while (lower_bound <= upper_bound) {
       cursor.cell_index = (lower_bound + upper_bound) / 2;
-      rc = BtreeKeyCompare(p_cursor_weak, key, 0, c);
+      rc = CursorKeyCompare(cursor, key, 0, c);
       if (rc != ResultCode::kOk) {
         return rc;
       }
@@ -528,7 +641,7 @@ ResultCode Btree::BtreeMoveToWithStop(const std::weak_ptr<BtCursor> &p_cursor_we
     }
     PageNumber child_page_number;
     // This is an edge case
-    if (lower_bound >= cursor.p_page->cell_trackers_.size()) {
+    if (lower_bound >= cursor.p_page->GetNumCells()) {
       child_page_number =
           cursor.p_page->GetNodePageHeaderByteView().right_child;
     } else {
@@ -556,7 +669,18 @@ ResultCode Btree::BtreeNext(const std::weak_ptr<BtCursor> &p_cursor_weak,
   if (bt_cursor_set_.find(p_cursor) == bt_cursor_set_.end()) {
     return ResultCode::kError;
   }
-  auto &cursor = *p_cursor;
+  return CursorNext(*p_cursor, already_at_last_entry);
+}
+
+ResultCode Btree::BtreeNext(BtCursorRef &cursor_ref,
+                            bool &already_at_last_entry) {
+  if (!cursor_ref.IsOpen()) {
+    return ResultCode::kError;
+  }
+  return CursorNext(*cursor_ref.p_cursor_, already_at_last_entry);
+}
+
+ResultCode Btree::CursorNext(BtCursor &cursor, bool &already_at_last_entry) {
   if (!cursor.p_page) {
     return ResultCode::kAbort;
   }
@@ -613,28 +737,71 @@ ResultCode Btree::BtreeLinkedListNext(const std::weak_ptr<BtCursor> &p_cursor_we
     return ResultCode::kAbort;
   }
 
-  if (cursor.cell_index < cursor.p_page->GetNumCells()) {
+  already_at_last_entry = false;
+  if (cursor.cell_index + 1 < cursor.p_page->GetNumCells()) {
     cursor.cell_index++;
-    already_at_last_entry = false;
     return ResultCode::kOk;
-  } else {
-    PageNumber next_page_number = p_cursor->p_page->GetNodePageHeaderByteView().right_child;
-    if (next_page_number == 0) {
-      already_at_last_entry = true;
-      return ResultCode::kOk;
-    } else {
-      BasePage *p_base_page = nullptr;
-      ResultCode rc = pager_->SqlitePagerGet(next_page_number, &p_base_page, NodePage::CreateDerivedPage);
-      if (rc != ResultCode::kOk) {
-        return rc;
-      }
-      cursor.p_page = dynamic_cast<NodePage *>(p_base_page);
-      cursor.cell_index = 0;
+  }
+  // step straight from the last cell of this leaf to the first cell of the
+  // next one, so the cursor never rests past the end of a leaf
+  bool has_next_leaf = false;
+  ResultCode rc = RangeMoveToNextLeaf(cursor, has_next_leaf);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  if (!has_next_leaf) {
+    already_at_last_entry = true;
+    return ResultCode::kOk;
+  }
+  if (cursor.p_page->GetNumCells() == 0) {
+    return ResultCode::kCorrupt;  // only the root may be an empty leaf
+  }
+  return ResultCode::kOk;
+}
 
-      already_at_last_entry = false;
-      return ResultCode::kOk;
-    }
+/**
+ * BtreeLinkedListPrev is the mirror of BtreeLinkedListNext for descending
+ * scans. It moves the cursor to the previous entry on its leaf, or to the last
+ * entry of the previous leaf through the backward leaf links, so it never
+ * climbs through the parents.
+ * @param p_cursor_weak: weak cursor pointer, on a leaf
+ * @param already_at_first_entry: set to true if the cursor was on the first
+ * entry of the table and did not move
+ * @return result code
+ */
+ResultCode Btree::BtreeLinkedListPrev(const std::weak_ptr<BtCursor> &p_cursor_weak,
+                                      bool &already_at_first_entry) {
+  if (p_cursor_weak.expired()) {
+    return ResultCode::kError;
+  }
+  auto p_cursor = p_cursor_weak.lock();
+  if (bt_cursor_set_.find(p_cursor) == bt_cursor_set_.end()) {
+    return ResultCode::kError;
+  }
+  auto &cursor = *p_cursor;
+  if (!cursor.p_page) {
+    return ResultCode::kAbort;
   }
+
+  already_at_first_entry = false;
+  if (cursor.cell_index > 0) {
+    cursor.cell_index--;
+    return ResultCode::kOk;
+  }
+  bool has_prev_leaf = false;
+  ResultCode rc = RangeMoveToPrevLeaf(cursor, has_prev_leaf);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  if (!has_prev_leaf) {
+    already_at_first_entry = true;
+    return ResultCode::kOk;
+  }
+  if (cursor.p_page->GetNumCells() == 0) {
+    return ResultCode::kCorrupt;  // only the root may be an empty leaf
+  }
+  cursor.cell_index = cursor.p_page->GetNumCells() - 1;
+  return ResultCode::kOk;
 }
 
 ResultCode Btree::BTreePrev(const std::weak_ptr<BtCursor> &p_cursor_weak) {
@@ -769,7 +936,7 @@ ResultCode Btree::BtreeInsert(const std::weak_ptr<BtCursor> &p_cursor_weak,
     // We will increase cursor.cell_index so that our cursor will point to the
     // cell we are about to insert
     cursor.cell_index++;
-  } else if (p_cursor->p_page->GetNodePageHeaderByteView().right_child != 0) {
+  } else if (cursor.p_page->IsInternalNode()) {
     return ResultCode::kError;
   }
   if (!pager_->SqlitePagerIsWritable(p_cursor->p_page)) {
@@ -798,6 +965,126 @@ ResultCode Btree::BtreeInsert(const std::weak_ptr<BtCursor> &p_cursor_weak,
   return rc;
 }
 
+/**
+ * @brief Inserts a batch of key-data pairs, replacing the data of keys that
+ * are already in the table.
+ *
+ * The batch is sorted by key in place, and of equal keys only the last one is
+ * inserted. The cursor then walks the sorted run: a key only costs a
+ * BtreeMoveTo when it lies beyond the last key of the cursor's leaf, and
+ * otherwise is found with a binary search of that leaf. A leaf is balanced
+ * once, when the run leaves it, instead of after every insert.
+ *
+ * @param p_cursor_weak: weak pointer to a writable cursor on the table
+ * @param pairs: key-data pairs to insert, sorted in place
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeInsertBatch(const std::weak_ptr<BtCursor> &p_cursor_weak,
+                                   std::vector<KeyDataPair> &pairs) {
+  // Step 1: Check if p_cursor is valid for insertion, and return error if not
+  if (p_cursor_weak.expired()) {
+    return ResultCode::kError;
+  }
+  auto p_cursor = p_cursor_weak.lock();
+  if (bt_cursor_set_.find(p_cursor) == bt_cursor_set_.end()) {
+    return ResultCode::kError;
+  }
+  auto &cursor = *p_cursor;
+  if (!cursor.p_page) {
+    return ResultCode::kAbort;
+  }
+  if (!in_trans_) {
+    return ResultCode::kAbort;
+  }
+  for (const auto &pair : pairs) {
+    if (pair.first.size() + pair.second.size() == 0) {
+      return ResultCode::kAbort;
+    }
+  }
+  if (!cursor.writable) {
+    return ResultCode::kPerm;
+  }
+
+  // Step 2: Sort the batch, keeping equal keys in the order they were given
+  std::stable_sort(pairs.begin(), pairs.end(),
+                   [](const KeyDataPair &a, const KeyDataPair &b) {
+                     return a.first < b.first;
+                   });
+
+  ResultCode rc = ResultCode::kOk;
+  bool cursor_on_leaf = false;
+  bool leaf_needs_balance = false;
+  for (size_t i = 0; i < pairs.size(); ++i) {
+    if (i + 1 < pairs.size() && !(pairs[i].first < pairs[i + 1].first)) {
+      continue;  // a later pair replaces this one
+    }
+    std::vector<std::byte> &key = pairs[i].first;
+    int local_compare_result;
+
+    // Step 3: Stay on the cursor's leaf if the key is not beyond its last key
+    if (cursor_on_leaf && cursor.p_page->GetNumCells() > 0 &&
+        cursor.p_page->GetNextLeaf() != 0) {
+      cursor.cell_index = cursor.p_page->GetNumCells() - 1;
+      rc = CursorKeyCompare(cursor, key, 0, local_compare_result);
+      if (rc != ResultCode::kOk) {
+        break;
+      }
+      cursor_on_leaf = local_compare_result >= 0;
+    }
+    if (cursor_on_leaf) {
+      rc = MoveToCellInPage(p_cursor_weak, key, local_compare_result);
+    } else {
+      // Step 4: Balance the leaf the run is leaving, then descend from the root
+      if (leaf_needs_balance) {
+        rc = Balance(cursor.p_page, p_cursor_weak);
+        leaf_needs_balance = false;
+        if (rc != ResultCode::kOk) {
+          break;
+        }
+      }
+      rc = CursorMoveTo(cursor, key, local_compare_result);
+      cursor_on_leaf = true;
+    }
+    if (rc != ResultCode::kOk) {
+      break;
+    }
+
+    // Step 5: Insert the cell the same way BtreeInsert does
+    rc = pager_->SqlitePagerWrite(cursor.p_page);
+    if (rc != ResultCode::kOk) {
+      break;
+    }
+    Cell new_cell(key, pairs[i].second);
+    rc = FillInCell(new_cell);
+    if (rc != ResultCode::kOk) {
+      break;
+    }
+    if (local_compare_result == 0) {
+      rc = ClearCell(*cursor.p_page, cursor.cell_index);
+      if (rc != ResultCode::kOk) {
+        break;
+      }
+      cursor.p_page->DropCell(cursor.cell_index);
+    } else if (local_compare_result < 0 && cursor.p_page->GetNumCells() > 0) {
+      cursor.cell_index++;
+    } else if (cursor.p_page->IsInternalNode()) {
+      rc = ResultCode::kError;
+      break;
+    }
+    cursor.p_page->InsertCell(new_cell, cursor.cell_index);
+    leaf_needs_balance = true;
+  }
+
+  // Step 6: Balance the last leaf
+  if (leaf_needs_balance) {
+    ResultCode balance_rc = Balance(cursor.p_page, p_cursor_weak);
+    if (rc == ResultCode::kOk) {
+      rc = balance_rc;
+    }
+  }
+  return rc;
+}
+
 /*
  *  Deletes an entry that p_cursor is pointing to.
  *
@@ -846,8 +1133,11 @@ ResultCode Btree::BtreeDelete(const std::weak_ptr<BtCursor> &p_cursor_weak) {
   // ----------------------------------------
   // Save the key value for finding internal cursor in B+ tree
   Cell current_cell_delete = cursor.p_page->GetCell(cursor.cell_index);
-  std::vector<std::byte> target_key_value(current_cell_delete.cell_header_.key_size);
-  std::memcpy(target_key_value.data(), current_cell_delete.payload_.data(), current_cell_delete.cell_header_.key_size);
+  std::vector<std::byte> target_key_value;
+  rc = GetCellKey(current_cell_delete, target_key_value);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
 
   // Step 2: Find the child page number
   // CHAOS: Maybe not necessary for b+ treee
@@ -946,8 +1236,12 @@ ResultCode Btree::BtreeDelete(const std::weak_ptr<BtCursor> &p_cursor_weak) {
       cursor.p_page->DropCell(cursor.cell_index);
       Cell cell_push_to_parent = p_leaf_cursor->p_page->GetCell(p_leaf_cursor->cell_index);
 
-      std::vector<std::byte> key_value(cell_push_to_parent.cell_header_.key_size);
-      std::memcpy(key_value.data(), cell_push_to_parent.payload_.data(), cell_push_to_parent.cell_header_.key_size);
+      std::vector<std::byte> key_value;
+      rc = GetCellKey(cell_push_to_parent, key_value);
+      if (rc != ResultCode::kOk) {
+        bt_cursor_set_.erase(p_leaf_cursor);
+        return rc;
+      }
       Cell next_cell = Cell(key_value);
 
       next_cell.cell_header_.left_child = child_page_number;
@@ -1069,9 +1363,17 @@ std::vector<std::byte> Btree::BtreeSearch(const std::weak_ptr<BtCursor> &p_curso
       return {};
     }
 
-    Cell target_cell = cursor.p_page->GetCell(cursor.cell_index);
-    std::vector<std::byte> target_data(target_cell.cell_header_.data_size);
-    std::memcpy(target_data.data(), target_cell.payload_.data() + target_cell.cell_header_.key_size, target_cell.cell_header_.data_size);
+    // Read the data only, straight into the vector that is returned
+    CellHeaderByteView cell_header =
+        cursor.p_page->GetCellHeaderByteView(cursor.cell_index);
+    std::vector<std::byte> target_data;
+    target_data.reserve(cell_header.data_size);
+    rc = GetPayload(cursor, cell_header.key_size, cell_header.data_size,
+                    target_data);
+    if (rc != ResultCode::kOk) {
+      result = -1;
+      return {};
+    }
 
     result = 0;
     return target_data;
@@ -0,0 +1,346 @@
+/*
+ * btree_bulk_load.cc
+ *
+ * The file is dedicated to Btree::BtreeBulkLoad(), which builds a table from
+ * key-data pairs that already come in key order.
+ */
+#include "btree.h"
+
+/**
+ * One level of the tree while it is being built. Only the rightmost node of a
+ * level is still open; the nodes left of it are finished and released.
+ *
+ * The last child added to an internal level has no divider cell yet: it gets
+ * one when the next child arrives, or becomes the right child of the node if
+ * the node is full or the load is over. pending_key is the largest key in the
+ * subtree of that child, and last_divider_key the key of the last divider cell
+ * of the open node.
+ *
+ * A full internal node is not added to the level above until the node after
+ * it has a divider cell. Should the load end first, the node after it would
+ * only have a right child, so it takes the last child of the full node instead
+ * (see BulkLoadSplitLast).
+ */
+struct BulkLoadLevel {
+  NodePage *p_page = nullptr;
+  PageNumber page_number = 0;
+  PageNumber pending_child = 0;
+  std::vector<std::byte> pending_key;
+  std::vector<std::byte> last_divider_key;
+  NodePage *p_full_page = nullptr;
+  PageNumber full_page_number = 0;
+  std::vector<std::byte> full_page_max_key;
+  std::vector<std::byte> full_page_last_divider_key;
+};
+
+// Whether a cell of cell_size bytes still fits on a page of page_size bytes
+// with num_cells cells and num_free_bytes free bytes, filled up to limit
+static bool BulkLoadFits(u32 num_cells, u32 num_free_bytes, u32 cell_size,
+                         u32 limit, u32 page_size) {
+  u32 used = UsableSpace(page_size) - num_free_bytes;
+  return num_cells == 0 ||
+         (used + cell_size <= limit && cell_size <= num_free_bytes);
+}
+
+// Internal nodes take two divider cells whatever the fill factor, so that a
+// full node still has one when BulkLoadSplitLast takes its last child
+static bool BulkLoadFitsInternal(u32 num_cells, u32 num_free_bytes,
+                                 u32 cell_size, u32 limit, u32 page_size) {
+  return BulkLoadFits(num_cells, num_free_bytes, cell_size, limit,
+                      page_size) ||
+         (num_cells < 2 && cell_size <= num_free_bytes);
+}
+
+/**
+ * Allocates the next node of a level, next to the previous node of the level
+ * if possible. It is left referenced until it is full.
+ */
+ResultCode Btree::BulkLoadStartNode(PageNumber root_page_number,
+                                    BulkLoadLevel &level, bool is_internal) {
+  level.p_page = nullptr;
+  ResultCode rc = AllocateTablePage(root_page_number, level.page_number,
+                                    level.p_page, level.page_number);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  level.p_page->ZeroPage();
+  level.p_page->is_init_ = true;
+  level.p_page->SetNodeType(is_internal);
+  return ResultCode::kOk;
+}
+
+/**
+ * Adds a finished child node, whose largest key is max_key, to the internal
+ * level level_idx, creating that level if needed. The previous child of the
+ * level gets its divider cell in the open node, after which the full node
+ * before the open node, if any, is added to the level above. If the divider
+ * does not fit, the previous child closes the node as its right child and the
+ * node is kept back as the full node of the level.
+ */
+ResultCode Btree::BulkLoadAddChild(PageNumber root_page_number,
+                                   std::vector<BulkLoadLevel> &levels,
+                                   u32 level_idx, PageNumber child,
+                                   std::vector<std::byte> &max_key, u32 limit) {
+  ResultCode rc;
+  if (level_idx == levels.size()) {
+    levels.push_back(BulkLoadLevel{});
+    rc = BulkLoadStartNode(root_page_number, levels.back(), true);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+  }
+  if (levels[level_idx].pending_child != 0) {
+    Cell divider(levels[level_idx].pending_key);
+    divider.cell_header_.left_child = levels[level_idx].pending_child;
+    NodePage *p_open_page = levels[level_idx].p_page;
+    u32 page_size = p_open_page->p_image_.size();
+    if (BulkLoadFitsInternal(
+            p_open_page->GetNumCells(), p_open_page->num_free_bytes_,
+            divider.GetCellSize(page_size) + kCellDirectoryEntrySize +
+                NodePage::GetFixedKeySize(divider, page_size),
+            limit, page_size)) {
+      rc = FillInCell(divider);
+      if (rc != ResultCode::kOk) {
+        return rc;
+      }
+      p_open_page->InsertCell(divider, p_open_page->GetNumCells());
+      levels[level_idx].last_divider_key =
+          std::move(levels[level_idx].pending_key);
+      rc = BulkLoadAddFullNode(root_page_number, levels, level_idx, limit);
+      if (rc != ResultCode::kOk) {
+        return rc;
+      }
+    } else {
+      BulkLoadLevel &level = levels[level_idx];
+      NodePageHeaderByteView page_header =
+          level.p_page->GetNodePageHeaderByteView();
+      page_header.right_child = level.pending_child;
+      level.p_page->SetNodePageHeaderByteView(page_header);
+      level.p_full_page = level.p_page;
+      level.full_page_number = level.page_number;
+      level.full_page_max_key = std::move(level.pending_key);
+      level.full_page_last_divider_key = std::move(level.last_divider_key);
+      rc = BulkLoadStartNode(root_page_number, level, true);
+      if (rc != ResultCode::kOk) {
+        return rc;
+      }
+    }
+  }
+  levels[level_idx].pending_child = child;
+  levels[level_idx].pending_key = std::move(max_key);
+  return ResultCode::kOk;
+}
+
+/**
+ * Adds the full node of level level_idx, if it has one, to the level above and
+ * releases it.
+ */
+ResultCode Btree::BulkLoadAddFullNode(PageNumber root_page_number,
+                                      std::vector<BulkLoadLevel> &levels,
+                                      u32 level_idx, u32 limit) {
+  NodePage *p_full_page = levels[level_idx].p_full_page;
+  if (p_full_page == nullptr) {
+    return ResultCode::kOk;
+  }
+  levels[level_idx].p_full_page = nullptr;
+  std::vector<std::byte> max_key =
+      std::move(levels[level_idx].full_page_max_key);
+  ResultCode rc =
+      BulkLoadAddChild(root_page_number, levels, level_idx + 1,
+                       levels[level_idx].full_page_number, max_key, limit);
+  pager_->SqlitePagerUnref(p_full_page);
+  return rc;
+}
+
+/**
+ * Gives the open node of an internal level, which has no divider cell yet, the
+ * right child of the full node before it. The full node ends with the child of
+ * its last divider cell instead, and that cell is dropped.
+ */
+ResultCode Btree::BulkLoadSplitLast(BulkLoadLevel &level) {
+  NodePage *p_full_page = level.p_full_page;
+  u16 last_cell_idx = p_full_page->GetNumCells() - 1;
+
+  // Step 1: The right child of the full node moves to the open node
+  Cell divider(level.full_page_max_key);
+  divider.cell_header_.left_child =
+      p_full_page->GetNodePageHeaderByteView().right_child;
+  ResultCode rc = FillInCell(divider);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  level.p_page->InsertCell(divider, 0);
+  level.last_divider_key = std::move(level.full_page_max_key);
+
+  // Step 2: The child of the last divider of the full node becomes its right
+  // child, and the largest key of the full node is the key of that divider
+  PageNumber last_child =
+      p_full_page->GetCellHeaderByteView(last_cell_idx).left_child;
+  rc = ClearCell(*p_full_page, last_cell_idx);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  p_full_page->DropCell(last_cell_idx);
+  NodePageHeaderByteView full_page_header =
+      p_full_page->GetNodePageHeaderByteView();
+  full_page_header.right_child = last_child;
+  p_full_page->SetNodePageHeaderByteView(full_page_header);
+  level.full_page_max_key = std::move(level.full_page_last_divider_key);
+  return ResultCode::kOk;
+}
+
+/**
+ * @brief Builds the table rooted at root_page_number from key-data pairs in
+ * ascending key order, without searching the tree or calling Balance.
+ *
+ * next_pair is called until it returns false. Leaves are filled one after the
+ * other up to fill_factor of their usable space and linked through
+ * SetNextLeaf and SetPrevLeaf. Whenever a node is full, its largest key becomes the divider
+ * of the node one level up, so the internal levels are built bottom-up along
+ * with the leaves and only the rightmost node of each level is kept in the
+ * cache. The finished top node is finally copied into the root page.
+ *
+ * The table must be empty and have no open cursors. A key that is not greater
+ * than the previous one stops the load with kMisuse; on any error the
+ * transaction is rolled back.
+ *
+ * @param root_page_number: root page of an empty table
+ * @param next_pair: fills in the next key and data, false when there is none
+ * @param fill_factor: how full to pack each page, in (0, 1]
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeBulkLoad(PageNumber root_page_number,
+                                const BulkLoadSource &next_pair,
+                                double fill_factor) {
+  if (!in_trans_) {
+    return ResultCode::kError;
+  }
+  if (read_only_) {
+    return ResultCode::kReadOnly;
+  }
+  if (!(fill_factor > 0 && fill_factor <= 1)) {
+    return ResultCode::kMisuse;
+  }
+  auto it = lock_count_map_.find(root_page_number);
+  if (it != lock_count_map_.end() && it->second != 0) {
+    return ResultCode::kLocked;
+  }
+
+  // Step 1: Make sure the table is empty
+  BasePage *p_base_page = nullptr;
+  ResultCode rc = pager_->SqlitePagerGet(root_page_number, &p_base_page,
+                                         NodePage::CreateDerivedPage);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  auto *p_root = dynamic_cast<NodePage *>(p_base_page);
+  rc = InitPage(*p_root, nullptr);
+  if (rc == ResultCode::kOk &&
+      (p_root->GetNumCells() != 0 || p_root->IsInternalNode())) {
+    rc = ResultCode::kMisuse;
+  }
+  if (rc != ResultCode::kOk) {
+    pager_->SqlitePagerUnref(p_root);
+    return rc;
+  }
+
+  // Step 2: Fill the leaves in key order
+  u32 page_size = BtreePageSize();
+  u32 limit = static_cast<u32>(fill_factor * UsableSpace(page_size));
+  std::vector<BulkLoadLevel> levels(1);
+  std::vector<std::byte> key, data, last_key;
+  bool is_first_pair = true;
+  rc = BulkLoadStartNode(root_page_number, levels[0], false);
+  while (rc == ResultCode::kOk && next_pair(key, data)) {
+    if (key.size() + data.size() == 0 || (!is_first_pair && !(last_key < key))) {
+      rc = ResultCode::kMisuse;
+      break;
+    }
+    is_first_pair = false;
+    Cell cell(key, data);
+    if (!BulkLoadFits(levels[0].p_page->GetNumCells(),
+                      levels[0].p_page->num_free_bytes_,
+                      cell.GetCellSize(page_size) + kCellDirectoryEntrySize +
+                          NodePage::GetFixedKeySize(cell, page_size),
+                      limit, page_size)) {
+      // the leaf is full: link it to a new one and hand it to the level above
+      NodePage *p_full_leaf = levels[0].p_page;
+      PageNumber full_leaf_number = levels[0].page_number;
+      rc = BulkLoadStartNode(root_page_number, levels[0], false);
+      if (rc == ResultCode::kOk) {
+        p_full_leaf->SetNextLeaf(levels[0].page_number);
+        levels[0].p_page->SetPrevLeaf(full_leaf_number);
+        rc = BulkLoadAddChild(root_page_number, levels, 1, full_leaf_number,
+                              last_key, limit);
+      }
+      pager_->SqlitePagerUnref(p_full_leaf);
+      if (rc != ResultCode::kOk) {
+        break;
+      }
+    }
+    rc = FillInCell(cell);
+    if (rc != ResultCode::kOk) {
+      break;
+    }
+    levels[0].p_page->InsertCell(cell, levels[0].p_page->GetNumCells());
+    last_key.swap(key);
+  }
+
+  // Step 3: Close the rightmost node of every level, bottom-up. Its last
+  // child becomes its right child, and the node is added to the level above.
+  // The levels vector may grow while this loop runs.
+  for (u32 level_idx = 0; level_idx < levels.size(); level_idx++) {
+    NodePage *p_page = levels[level_idx].p_page;
+    if (rc != ResultCode::kOk) {
+      if (p_page != nullptr) {
+        pager_->SqlitePagerUnref(p_page);
+      }
+      if (levels[level_idx].p_full_page != nullptr) {
+        pager_->SqlitePagerUnref(levels[level_idx].p_full_page);
+      }
+      continue;
+    }
+    if (level_idx > 0) {
+      // a node that would only have a right child takes one from its left
+      if (p_page->GetNumCells() == 0 &&
+          levels[level_idx].p_full_page != nullptr) {
+        rc = BulkLoadSplitLast(levels[level_idx]);
+      }
+      if (rc == ResultCode::kOk) {
+        rc = BulkLoadAddFullNode(root_page_number, levels, level_idx, limit);
+      }
+      if (rc != ResultCode::kOk) {
+        pager_->SqlitePagerUnref(p_page);
+        if (levels[level_idx].p_full_page != nullptr) {
+          pager_->SqlitePagerUnref(levels[level_idx].p_full_page);
+        }
+        continue;
+      }
+      NodePageHeaderByteView page_header = p_page->GetNodePageHeaderByteView();
+      page_header.right_child = levels[level_idx].pending_child;
+      p_page->SetNodePageHeaderByteView(page_header);
+      last_key = std::move(levels[level_idx].pending_key);
+    }
+    if (level_idx + 1 < levels.size()) {
+      rc = BulkLoadAddChild(root_page_number, levels, level_idx + 1,
+                            levels[level_idx].page_number, last_key, limit);
+      pager_->SqlitePagerUnref(p_page);
+      continue;
+    }
+
+    // Step 4: The top node is the only one of its level: it becomes the root
+    rc = pager_->SqlitePagerWrite(p_root);
+    if (rc == ResultCode::kOk) {
+      p_page->CopyPage(*p_root);
+      BasePage *p_top_page = p_page;
+      PageNumber top_page_number = 0;
+      rc = FreePage(p_top_page, top_page_number, false);
+    }
+    pager_->SqlitePagerUnref(p_page);
+  }
+  pager_->SqlitePagerUnref(p_root);
+  if (rc != ResultCode::kOk) {
+    BtreeRollback();
+  }
+  return rc;
+}
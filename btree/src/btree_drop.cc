@@ -0,0 +1,200 @@
+/*
+ * btree_drop.cc
+ *
+ * The file is dedicated to giving up the pages of a table when it is cleared
+ * or dropped. The pages are only read, to find the pages below them, and are
+ * then freed all at once without being written, so their images never reach
+ * the journal. A dropped table can also be left whole for
+ * Btree::BtreeReclaimPages() to free a few pages at a time later on.
+ */
+#include "btree.h"
+
+/**
+ * @brief Appends the overflow pages of the cells of page page_number to
+ * page_numbers, and its children to child_page_numbers. Overflow pages are
+ * read for their header only.
+ */
+ResultCode Btree::DropCollectNode(PageNumber page_number,
+                                  std::vector<PageNumber> &child_page_numbers,
+                                  std::vector<PageNumber> &page_numbers) {
+  BasePage *p_base_page = nullptr;
+  ResultCode rc = pager_->SqlitePagerGet(page_number, &p_base_page,
+                                         NodePage::CreateDerivedPage);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  auto *p_node_page = dynamic_cast<NodePage *>(p_base_page);
+  rc = InitPage(*p_node_page, p_node_page->p_parent_);
+  for (u16 cell_idx = 0;
+       rc == ResultCode::kOk && cell_idx < p_node_page->GetNumCells();
+       cell_idx++) {
+    CellHeaderByteView cell_header =
+        p_node_page->GetCellHeaderByteView(cell_idx);
+    if (p_node_page->IsInternalNode()) {
+      child_page_numbers.push_back(cell_header.left_child);
+    }
+    PageNumber overflow_page_number = cell_header.overflow_page;
+    while (rc == ResultCode::kOk && overflow_page_number != 0) {
+      page_numbers.push_back(overflow_page_number);
+      rc = pager_->SqlitePagerGet(overflow_page_number, &p_base_page,
+                                  NodePage::CreateDerivedPage);
+      if (rc != ResultCode::kOk) {
+        break;
+      }
+      PageNumber next_overflow_page_number =
+          dynamic_cast<NodePage *>(p_base_page)
+              ->GetOverflowPageHeaderByteView()
+              .next_page;
+      pager_->SqlitePagerUnref(p_base_page);
+      if (next_overflow_page_number == overflow_page_number) {
+        rc = ResultCode::kCorrupt;
+      }
+      overflow_page_number = next_overflow_page_number;
+    }
+  }
+  if (rc == ResultCode::kOk && p_node_page->IsInternalNode()) {
+    child_page_numbers.push_back(
+        p_node_page->GetNodePageHeaderByteView().right_child);
+  }
+  pager_->SqlitePagerUnref(p_node_page);
+  return rc;
+}
+
+/**
+ * @brief Appends page page_number and every page below it to page_numbers.
+ */
+ResultCode Btree::DropCollectPages(PageNumber page_number,
+                                   std::vector<PageNumber> &page_numbers) {
+  std::vector<PageNumber> stack = {page_number};
+  ResultCode rc = ResultCode::kOk;
+  while (rc == ResultCode::kOk && !stack.empty()) {
+    page_number = stack.back();
+    stack.pop_back();
+    page_numbers.push_back(page_number);
+    rc = DropCollectNode(page_number, stack, page_numbers);
+  }
+  return rc;
+}
+
+/**
+ * @brief Frees the pages in page_numbers, none of which is written.
+ *
+ * Free map pages take the pages in ascending order, so that each free map page
+ * is written once. The free list takes them in descending order, so that
+ * AllocatePage(), which takes the page listed last, hands them out from the
+ * lowest one up. Only the pages that become free list info pages are written.
+ *
+ * @param page_numbers: the pages, sorted on return
+ * @return: appropriate result code
+ */
+ResultCode Btree::DropFreePages(std::vector<PageNumber> &page_numbers) {
+  std::sort(page_numbers.begin(), page_numbers.end());
+  if (UsesFreeMap()) {
+    return FreeMapFree(page_numbers);
+  }
+  ResultCode rc = ResultCode::kOk;
+  for (auto it = page_numbers.rbegin();
+       rc == ResultCode::kOk && it != page_numbers.rend(); it++) {
+    BasePage *p_base_page = nullptr;
+    PageNumber page_number = *it;
+    rc = FreePage(p_base_page, page_number, false);
+  }
+  return rc;
+}
+
+/**
+ * @brief Drops the table rooted at root_page_number without freeing its pages
+ * yet.
+ *
+ * The root page is pushed onto the stack of pending drops on page 1, which is
+ * the only page written. Its pages stay in use until BtreeReclaimPages() frees
+ * them, in this transaction or a later one; the stack survives closing the
+ * database. Page 2, which is never freed, and a table dropped while the stack
+ * is full are dropped right away with BtreeDropTable().
+ *
+ * @param root_page_number: root page of the table
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeDropTableDeferred(PageNumber root_page_number) {
+  if (!in_trans_) {
+    return ResultCode::kError;
+  }
+  if (read_only_) {
+    return ResultCode::kReadOnly;
+  }
+  auto it = lock_count_map_.find(root_page_number);
+  if (it != lock_count_map_.end() && it->second != 0) {
+    return ResultCode::kLocked;
+  }
+  if (root_page_number <= 2 ||
+      p_first_page_->GetNumPendingDrops() ==
+          p_first_page_->GetMaxPendingDrops()) {
+    return BtreeDropTable(root_page_number);
+  }
+  ResultCode rc = pager_->SqlitePagerWrite(p_first_page_);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  p_first_page_->PushPendingDrop(root_page_number);
+  return ResultCode::kOk;
+}
+
+/**
+ * @brief Frees about max_pages pages of the tables that
+ * BtreeDropTableDeferred() left behind.
+ *
+ * A page is taken off the stack of pending drops and freed along with its
+ * overflow pages, and its children are pushed in its place. Only when the
+ * stack has no room for them is a whole subtree freed at once, which may go
+ * past max_pages.
+ *
+ * @param max_pages: how many pages to free, roughly
+ * @param num_pages_freed: how many pages were freed, 0 once nothing is pending
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeReclaimPages(u32 max_pages, u32 &num_pages_freed) {
+  num_pages_freed = 0;
+  if (!in_trans_) {
+    return ResultCode::kError;
+  }
+  if (read_only_) {
+    return ResultCode::kReadOnly;
+  }
+  std::vector<PageNumber> page_numbers;
+  ResultCode rc = ResultCode::kOk;
+  while (rc == ResultCode::kOk && page_numbers.size() < max_pages &&
+         p_first_page_->GetNumPendingDrops() != 0) {
+    rc = pager_->SqlitePagerWrite(p_first_page_);
+    if (rc != ResultCode::kOk) {
+      break;
+    }
+    PageNumber page_number = p_first_page_->PopPendingDrop();
+    std::vector<PageNumber> child_page_numbers;
+    page_numbers.push_back(page_number);
+    rc = DropCollectNode(page_number, child_page_numbers, page_numbers);
+    u32 num_free_slots =
+        p_first_page_->GetMaxPendingDrops() -
+        p_first_page_->GetNumPendingDrops();
+    if (child_page_numbers.size() <= num_free_slots) {
+      for (PageNumber child_page_number : child_page_numbers) {
+        p_first_page_->PushPendingDrop(child_page_number);
+      }
+      continue;
+    }
+    for (PageNumber child_page_number : child_page_numbers) {
+      if (rc != ResultCode::kOk) {
+        break;
+      }
+      rc = DropCollectPages(child_page_number, page_numbers);
+    }
+  }
+  if (rc == ResultCode::kOk) {
+    rc = DropFreePages(page_numbers);
+  }
+  if (rc != ResultCode::kOk) {
+    BtreeRollback();
+    return rc;
+  }
+  num_pages_freed = static_cast<u32>(page_numbers.size());
+  return ResultCode::kOk;
+}
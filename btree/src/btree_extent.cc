@@ -0,0 +1,391 @@
+/*
+ * btree_extent.cc
+ *
+ * The file is dedicated to the page allocator that keeps the pages of one
+ * table close together in the file. Btree::AllocatePage() takes whichever free
+ * page comes last in the free list, or appends one page, so the leaves of a
+ * table drift apart as the table grows and a scan along the leaf chain reads
+ * the file in random order. Btree::AllocateTablePages() prefers the free page
+ * right after its neighbour and otherwise hands out pages from a run of
+ * contiguous pages reserved for the table, its extent.
+ */
+#include "btree.h"
+
+/**
+ * @brief Allocates num_pages pages for the table rooted at root_page_number
+ * and appends them to pages, each page written but not initialized.
+ *
+ * Each page is taken from the first place that has one:
+ *   1. the free page that directly follows the previous page, which is
+ *      near_page_number for the first one
+ *   2. the extent of the table, which hands out the remaining pages as one run
+ *   3. the free list, through AllocatePage(), or with free map pages the
+ *      first free page after the previous page on its free map page
+ *   4. a new extent of at least kPagesPerExtent pages, reserved past every
+ *      page that is in use or reserved. If the old extent of the table ends
+ *      there, the new one simply continues it.
+ *
+ * Pages of an extent are not written until they are handed out, so reserving
+ * one costs nothing. Whatever is left of the extents when the transaction
+ * commits goes to the free list, see ReleaseExtents().
+ *
+ * @param root_page_number: root page of the table the pages are for
+ * @param near_page_number: the page the first new page should follow, 0 for
+ * none
+ * @param num_pages: number of pages to allocate
+ * @param pages: the new page numbers and pages are appended here. They are
+ * left there on an error, for the caller to unref.
+ * @return: appropriate result code
+ */
+ResultCode Btree::AllocateTablePages(
+    PageNumber root_page_number, PageNumber near_page_number, u32 num_pages,
+    std::vector<std::pair<PageNumber, NodePage *>> &pages) {
+  if (!p_first_page_) {
+    return ResultCode::kError;
+  }
+  ResultCode rc = ResultCode::kOk;
+  size_t first_idx = pages.size();
+  size_t end_idx = first_idx + num_pages;
+  while (rc == ResultCode::kOk && pages.size() < end_idx) {
+    // Step 1: The free page right after the previous one
+    PageNumber prev_page_number =
+        pages.size() == first_idx ? near_page_number : pages.back().first;
+    NodePage *p_node_page = nullptr;
+    PageNumber page_number = 0;
+    if (prev_page_number != 0) {
+      bool found = false;
+      rc = AllocateFreePageAfter(prev_page_number, p_node_page, page_number,
+                                 found);
+      if (rc != ResultCode::kOk) {
+        break;
+      }
+      if (found) {
+        pages.emplace_back(page_number, p_node_page);
+        continue;
+      }
+    }
+
+    // Step 2: The rest of the run from the table's extent
+    u32 num_left = static_cast<u32>(end_idx - pages.size());
+    PageExtent &extent = extents_[root_page_number];
+    if (extent.next_page < extent.end_page) {
+      rc = AllocateFromExtent(
+          extent, std::min(num_left, extent.end_page - extent.next_page),
+          pages);
+      continue;
+    }
+
+    // Step 3: Any free page
+    if (p_first_page_->GetFirstPageByteView().first_free_page != 0) {
+      rc = UsesFreeMap()
+               ? FreeMapAllocate(prev_page_number, p_node_page, page_number)
+               : AllocatePage(p_node_page, page_number);
+      if (rc == ResultCode::kOk) {
+        pages.emplace_back(page_number, p_node_page);
+      }
+      continue;
+    }
+
+    // Step 4: A new extent at the end of the file
+    PageNumber first_page_number =
+        std::max(pager_->SqlitePagerPageCount() + 1, next_unreserved_page_);
+    extent.next_page = first_page_number;
+    extent.end_page = first_page_number + std::max(num_left, kPagesPerExtent);
+    next_unreserved_page_ = extent.end_page;
+    rc = AllocateFromExtent(extent, num_left, pages);
+  }
+  return rc;
+}
+
+/**
+ * @brief Allocates one page for the table rooted at root_page_number, as
+ * close after near_page_number as AllocateTablePages() can find one.
+ */
+ResultCode Btree::AllocateTablePage(PageNumber root_page_number,
+                                    PageNumber near_page_number,
+                                    NodePage *&p_node_page,
+                                    PageNumber &page_number) {
+  std::vector<std::pair<PageNumber, NodePage *>> pages;
+  ResultCode rc =
+      AllocateTablePages(root_page_number, near_page_number, 1, pages);
+  if (rc != ResultCode::kOk) {
+    for (auto &[unused_page_number, p_page] : pages) {
+      pager_->SqlitePagerUnref(p_page);
+    }
+    return rc;
+  }
+  page_number = pages[0].first;
+  p_node_page = pages[0].second;
+  return ResultCode::kOk;
+}
+
+/**
+ * @brief Takes page near_page_number + 1 off the free list, if it is on the
+ * first free list info page or is that page itself.
+ *
+ * Only the first info page is searched: it holds the pages freed most
+ * recently, which is where Balance puts the pages it is about to replace. Free
+ * map pages know about every free page.
+ *
+ * @param near_page_number: the page before the one wanted
+ * @param p_node_page: the page, written, if found
+ * @param page_number: its page number, if found
+ * @param found: whether the page was free
+ * @return: appropriate result code
+ */
+ResultCode Btree::AllocateFreePageAfter(PageNumber near_page_number,
+                                        NodePage *&p_node_page,
+                                        PageNumber &page_number, bool &found) {
+  PageNumber wanted_page_number = near_page_number + 1;
+  ResultCode rc = FreeListRemove(wanted_page_number, 1, found);
+  if (rc != ResultCode::kOk || !found) {
+    return rc;
+  }
+  BasePage *p_base_page = nullptr;
+  rc = pager_->SqlitePagerGet(wanted_page_number, &p_base_page,
+                              NodePage::CreateDerivedPage);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  rc = pager_->SqlitePagerWrite(p_base_page);
+  if (rc != ResultCode::kOk) {
+    pager_->SqlitePagerUnref(p_base_page);
+    return rc;
+  }
+  p_node_page = dynamic_cast<NodePage *>(p_base_page);
+  page_number = wanted_page_number;
+  return ResultCode::kOk;
+}
+
+/**
+ * @brief Takes page_number off the free list, searching at most
+ * max_info_pages free list info pages from the first one.
+ *
+ * A listed page is replaced by the last page listed on its info page. An info
+ * page that is taken hands the pages it lists over to the last of them, which
+ * becomes an info page in its place; an info page that lists nothing is simply
+ * unlinked. With free map pages, the bit of the page is cleared.
+ *
+ * @param page_number: the page to take
+ * @param max_info_pages: how many info pages to search
+ * @param found: whether the page was on the searched part of the free list
+ * @return: appropriate result code
+ */
+ResultCode Btree::FreeListRemove(PageNumber page_number, u32 max_info_pages,
+                                 bool &found) {
+  if (UsesFreeMap()) {
+    return FreeMapRemove(page_number, found);
+  }
+  found = false;
+  PageNumber prev_info_page_number = 0;
+  PageNumber info_page_number =
+      p_first_page_->GetFirstPageByteView().first_free_page;
+  for (u32 num_searched = 0;
+       info_page_number != 0 && num_searched < max_info_pages;
+       num_searched++) {
+    BasePage *p_base_page = nullptr;
+    ResultCode rc = pager_->SqlitePagerGet(info_page_number, &p_base_page,
+                                           NodePage::CreateDerivedPage);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    auto *p_info_page = dynamic_cast<NodePage *>(p_base_page);
+    u16 num_free_list_pages = p_info_page->GetNumberOfFreeListPages();
+    PageNumber next_info_page_number =
+        p_info_page->GetOverflowPageHeaderByteView().next_page;
+
+    u16 free_list_idx = 0;
+    if (info_page_number != page_number) {
+      while (free_list_idx < num_free_list_pages &&
+             p_info_page->GetFreeListInfoPageNumber(free_list_idx) !=
+                 page_number) {
+        free_list_idx++;
+      }
+      if (free_list_idx == num_free_list_pages) {
+        pager_->SqlitePagerUnref(p_info_page);
+        prev_info_page_number = info_page_number;
+        info_page_number = next_info_page_number;
+        continue;
+      }
+    }
+
+    rc = pager_->SqlitePagerWrite(p_first_page_);
+    if (rc == ResultCode::kOk) {
+      rc = pager_->SqlitePagerWrite(p_info_page);
+    }
+    if (rc != ResultCode::kOk) {
+      pager_->SqlitePagerUnref(p_info_page);
+      return rc;
+    }
+    if (info_page_number != page_number) {
+      // Step 1: Fill the gap with the last entry, so the list stays packed
+      p_info_page->SetFreeListInfoPageNumber(
+          free_list_idx, p_info_page->GetFinalFreeListInfoPageNumber());
+      p_info_page->DecrementFreeListNumPages();
+    } else {
+      // Step 2: Put the last listed page, or the next info page, in the
+      // place of the info page
+      PageNumber replacement_page_number = next_info_page_number;
+      if (num_free_list_pages != 0) {
+        replacement_page_number = p_info_page->GetFinalFreeListInfoPageNumber();
+        p_info_page->DecrementFreeListNumPages();
+        rc = pager_->SqlitePagerGet(replacement_page_number, &p_base_page,
+                                    NodePage::CreateDerivedPage);
+        if (rc == ResultCode::kOk) {
+          rc = pager_->SqlitePagerWrite(p_base_page);
+          if (rc == ResultCode::kOk) {
+            std::memcpy(p_base_page->p_image_.data(),
+                        p_info_page->p_image_.data(),
+                        p_info_page->p_image_.size());
+          }
+          pager_->SqlitePagerUnref(p_base_page);
+        }
+      }
+      if (rc == ResultCode::kOk && prev_info_page_number != 0) {
+        rc = pager_->SqlitePagerGet(prev_info_page_number, &p_base_page,
+                                    NodePage::CreateDerivedPage);
+        if (rc == ResultCode::kOk) {
+          rc = pager_->SqlitePagerWrite(p_base_page);
+          if (rc == ResultCode::kOk) {
+            auto *p_prev_info_page = dynamic_cast<NodePage *>(p_base_page);
+            OverflowPageHeaderByteView header =
+                p_prev_info_page->GetOverflowPageHeaderByteView();
+            header.next_page = replacement_page_number;
+            p_prev_info_page->SetOverflowPageHeaderByteView(header);
+          }
+          pager_->SqlitePagerUnref(p_base_page);
+        }
+      } else if (rc == ResultCode::kOk) {
+        FirstPageByteView first_page = p_first_page_->GetFirstPageByteView();
+        first_page.first_free_page = replacement_page_number;
+        p_first_page_->SetFirstPageByteView(first_page);
+      }
+      if (rc != ResultCode::kOk) {
+        pager_->SqlitePagerUnref(p_info_page);
+        return rc;
+      }
+    }
+    p_first_page_->DecrementNumFreePages();
+    pager_->SqlitePagerUnref(p_info_page);
+    found = true;
+    return ResultCode::kOk;
+  }
+  return ResultCode::kOk;
+}
+
+/**
+ * @brief Hands out the next num_pages pages of extent, which has at least that
+ * many left, and appends them to pages. A free map page in the extent is
+ * skipped, so fewer pages may be handed out.
+ */
+ResultCode Btree::AllocateFromExtent(
+    PageExtent &extent, u32 num_pages,
+    std::vector<std::pair<PageNumber, NodePage *>> &pages) {
+  for (u32 i = 0; i < num_pages && extent.next_page < extent.end_page; i++) {
+    if (IsFreeMapPage(extent.next_page)) {
+      extent.next_page++;
+      continue;
+    }
+    BasePage *p_base_page = nullptr;
+    ResultCode rc = pager_->SqlitePagerGet(extent.next_page, &p_base_page,
+                                           NodePage::CreateDerivedPage);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    rc = pager_->SqlitePagerWrite(p_base_page);
+    if (rc != ResultCode::kOk) {
+      pager_->SqlitePagerUnref(p_base_page);
+      return rc;
+    }
+    pages.emplace_back(extent.next_page, dynamic_cast<NodePage *>(p_base_page));
+    extent.next_page++;
+  }
+  return ResultCode::kOk;
+}
+
+/**
+ * @brief Puts the pages that the extents did not hand out on the free list and
+ * forgets the extents. Called before the transaction commits.
+ *
+ * A leftover page past the last page in use was never written, and the file
+ * does not grow to hold it, so it is simply dropped. A leftover page before
+ * that is a hole in the file and has to be freed, or it would never be used.
+ *
+ * @return: appropriate result code
+ */
+ResultCode Btree::ReleaseExtents() {
+  ResultCode rc = ResultCode::kOk;
+  for (auto &[root_page_number, extent] : extents_) {
+    for (PageNumber page_number = extent.next_page;
+         rc == ResultCode::kOk && page_number < extent.end_page &&
+         page_number <= pager_->SqlitePagerPageCount();
+         page_number++) {
+      if (IsFreeMapPage(page_number)) {
+        continue;
+      }
+      BasePage *p_base_page = nullptr;
+      PageNumber page_number_to_free = page_number;
+      rc = FreePage(p_base_page, page_number_to_free, false);
+    }
+  }
+  extents_.clear();
+  next_unreserved_page_ = 0;
+  return rc;
+}
+
+/**
+ * @brief Finds the root page of the table p_page belongs to, by following the
+ * parent pointers up.
+ */
+PageNumber Btree::FindRootPageNumber(NodePage *p_page) {
+  while (p_page->p_parent_ != nullptr) {
+    p_page = p_page->p_parent_;
+  }
+  return pager_->SqlitePagerPageNumber(p_page);
+}
+
+/**
+ * @brief Walks the leaf chain of the table rooted at root_page_number and
+ * counts its leaves, and the runs of consecutive page numbers they form. A
+ * table whose leaves are laid out in key order has a single run.
+ *
+ * @param root_page_number: root page of the table
+ * @param num_leaves: number of leaves
+ * @param num_runs: number of runs, at most num_leaves
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeLeafRuns(PageNumber root_page_number, u32 &num_leaves,
+                                u32 &num_runs) {
+  num_leaves = 0;
+  num_runs = 0;
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  ResultCode rc = BtCursorCreate(root_page_number, false, p_cursor_weak);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  bool table_is_empty = false;
+  rc = BtreeFirst(p_cursor_weak, table_is_empty);
+  PageNumber page_number = 0;
+  if (rc == ResultCode::kOk) {
+    page_number = pager_->SqlitePagerPageNumber(p_cursor_weak.lock()->p_page);
+  }
+  BtCursorClose(p_cursor_weak);
+
+  PageNumber prev_page_number = 0;
+  while (rc == ResultCode::kOk && page_number != 0) {
+    num_leaves++;
+    if (page_number != prev_page_number + 1) {
+      num_runs++;
+    }
+    BasePage *p_base_page = nullptr;
+    rc = pager_->SqlitePagerGet(page_number, &p_base_page,
+                                NodePage::CreateDerivedPage);
+    if (rc != ResultCode::kOk) {
+      break;
+    }
+    prev_page_number = page_number;
+    page_number = dynamic_cast<NodePage *>(p_base_page)->GetNextLeaf();
+    pager_->SqlitePagerUnref(p_base_page);
+  }
+  return rc;
+}
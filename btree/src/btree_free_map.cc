@@ -0,0 +1,317 @@
+/*
+ * btree_free_map.cc
+ *
+ * The file is dedicated to the bitmap format of the free space map, which a
+ * database can be created with instead of the free list (see
+ * Btree::BtreeSetFreeSpaceFormat()).
+ *
+ * Page kFirstFreeMapPage is a free map page. It holds one bit for each of the
+ * FreeMapNumBits() pages after it, set if the page is free, and the page after
+ * those is the next free map page. The free map page of any page is found by
+ * arithmetic, so freeing a page or taking a given page off the map reads and
+ * writes one free map page, and the free page right after a page is found on
+ * the free map page of that page. A free map page past the end of the file is
+ * not written until one of its pages is freed; until then it reads as zeros,
+ * i.e. as a map of pages in use.
+ *
+ * Page 1 still counts the free pages. Its first_free_page is the first free map
+ * page that may have a bit set, and 0 when no page is free.
+ */
+#include "btree.h"
+
+// The free map page whose range holds page_number, or page_number if it is a
+// free map page itself, in a database of pages of page_size bytes
+static PageNumber FreeMapPageOf(PageNumber page_number, u32 page_size) {
+  return page_number -
+         (page_number - kFirstFreeMapPage) % (FreeMapNumBits(page_size) + 1);
+}
+
+/**
+ * @brief Whether the database tracks its free pages in free map pages.
+ */
+bool Btree::UsesFreeMap() const {
+  return p_first_page_ != nullptr &&
+         p_first_page_->GetFreeSpaceFormat() == FreeSpaceFormat::kBitmap;
+}
+
+/**
+ * @brief Whether page_number is a free map page. Always false for a database
+ * that uses the free list.
+ */
+bool Btree::IsFreeMapPage(PageNumber page_number) const {
+  return UsesFreeMap() && page_number >= kFirstFreeMapPage &&
+         FreeMapPageOf(page_number, BtreePageSize()) == page_number;
+}
+
+/**
+ * @brief Takes a free page off the map, written but not initialized.
+ *
+ * The first free page after near_page_number on the free map page of
+ * near_page_number is preferred. Otherwise the free page with the lowest page
+ * number is taken.
+ *
+ * @param near_page_number: the page the new page should follow, 0 for none
+ * @param p_node_page: the page
+ * @param page_number: its page number
+ * @return: appropriate result code, kCorrupt if page 1 counts free pages that
+ * the map does not have
+ */
+ResultCode Btree::FreeMapAllocate(PageNumber near_page_number,
+                                  NodePage *&p_node_page,
+                                  PageNumber &page_number) {
+  u32 page_size = BtreePageSize();
+  PageNumber num_pages = pager_->SqlitePagerPageCount();
+  PageNumber map_page_number = 0;
+  u32 start_bit_idx = 0;
+  if (near_page_number >= kFirstFreeMapPage && near_page_number < num_pages) {
+    map_page_number = FreeMapPageOf(near_page_number, page_size);
+    start_bit_idx = near_page_number - map_page_number;
+  } else {
+    map_page_number = p_first_page_->GetFirstPageByteView().first_free_page;
+  }
+  page_number = 0;
+  while (map_page_number != 0 && map_page_number <= num_pages) {
+    BasePage *p_base_page = nullptr;
+    ResultCode rc = pager_->SqlitePagerGet(map_page_number, &p_base_page,
+                                           NodePage::CreateDerivedPage);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    u32 bit_idx =
+        dynamic_cast<NodePage *>(p_base_page)->FindFreeMapBit(start_bit_idx);
+    pager_->SqlitePagerUnref(p_base_page);
+    if (bit_idx < FreeMapNumBits(page_size)) {
+      page_number = map_page_number + 1 + bit_idx;
+      break;
+    }
+    // nothing after the near page: fall back to the lowest free page
+    if (start_bit_idx != 0) {
+      map_page_number = p_first_page_->GetFirstPageByteView().first_free_page;
+      start_bit_idx = 0;
+    } else {
+      map_page_number += FreeMapNumBits(page_size) + 1;
+    }
+  }
+  if (page_number == 0) {
+    return ResultCode::kCorrupt;
+  }
+
+  bool found = false;
+  ResultCode rc = FreeMapRemove(page_number, found);
+  if (rc == ResultCode::kOk && !found) {
+    rc = ResultCode::kCorrupt;
+  }
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  BasePage *p_base_page = nullptr;
+  rc = pager_->SqlitePagerGet(page_number, &p_base_page,
+                              NodePage::CreateDerivedPage);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  rc = pager_->SqlitePagerWrite(p_base_page);
+  if (rc != ResultCode::kOk) {
+    pager_->SqlitePagerUnref(p_base_page);
+    return rc;
+  }
+  p_node_page = dynamic_cast<NodePage *>(p_base_page);
+  return ResultCode::kOk;
+}
+
+/**
+ * @brief Marks the pages free, reading and writing each free map page once.
+ * The pages themselves are not touched, and are no longer written back.
+ *
+ * @param page_numbers: pages that are not free map pages, in ascending order
+ * @return: appropriate result code, kCorrupt if a page is free already
+ */
+ResultCode Btree::FreeMapFree(const std::vector<PageNumber> &page_numbers) {
+  if (page_numbers.empty()) {
+    return ResultCode::kOk;
+  }
+  ResultCode rc = pager_->SqlitePagerWrite(p_first_page_);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  FirstPageByteView first_page = p_first_page_->GetFirstPageByteView();
+  u32 page_size = BtreePageSize();
+  PageNumber num_pages = pager_->SqlitePagerPageCount();
+  size_t page_idx = 0;
+  while (rc == ResultCode::kOk && page_idx < page_numbers.size()) {
+    PageNumber map_page_number =
+        FreeMapPageOf(page_numbers[page_idx], page_size);
+    BasePage *p_base_page = nullptr;
+    rc = pager_->SqlitePagerGet(map_page_number, &p_base_page,
+                                NodePage::CreateDerivedPage);
+    if (rc != ResultCode::kOk) {
+      break;
+    }
+    rc = pager_->SqlitePagerWrite(p_base_page);
+    auto *p_map_page = dynamic_cast<NodePage *>(p_base_page);
+    for (; rc == ResultCode::kOk && page_idx < page_numbers.size() &&
+           FreeMapPageOf(page_numbers[page_idx], page_size) ==
+               map_page_number;
+         page_idx++) {
+      PageNumber page_number = page_numbers[page_idx];
+      u32 bit_idx = page_number - map_page_number - 1;
+      if (page_number == map_page_number ||
+          p_map_page->IsFreeMapBitSet(bit_idx)) {
+        rc = ResultCode::kCorrupt;
+        break;
+      }
+      p_map_page->SetFreeMapBit(bit_idx, true);
+      first_page.num_free_pages++;
+      // the last page keeps the file long enough to hold every free page
+      if (page_number < num_pages) {
+        pager_->SqlitePagerDontWrite(page_number);
+      }
+    }
+    pager_->SqlitePagerUnref(p_map_page);
+  }
+  PageNumber first_map_page_number =
+      FreeMapPageOf(page_numbers.front(), page_size);
+  if (first_page.first_free_page == 0 ||
+      first_map_page_number < first_page.first_free_page) {
+    first_page.first_free_page = first_map_page_number;
+  }
+  p_first_page_->SetFirstPageByteView(first_page);
+  return rc;
+}
+
+/**
+ * @brief Takes page_number off the map, if it is free, and keeps the count and
+ * the first free map page on page 1 in step.
+ *
+ * @param page_number: the page to take
+ * @param found: whether the page was free
+ * @return: appropriate result code
+ */
+ResultCode Btree::FreeMapRemove(PageNumber page_number, bool &found) {
+  found = false;
+  if (page_number <= kFirstFreeMapPage || IsFreeMapPage(page_number) ||
+      page_number > pager_->SqlitePagerPageCount()) {
+    return ResultCode::kOk;
+  }
+  PageNumber map_page_number = FreeMapPageOf(page_number, BtreePageSize());
+  u32 bit_idx = page_number - map_page_number - 1;
+  BasePage *p_base_page = nullptr;
+  ResultCode rc = pager_->SqlitePagerGet(map_page_number, &p_base_page,
+                                         NodePage::CreateDerivedPage);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  auto *p_map_page = dynamic_cast<NodePage *>(p_base_page);
+  if (!p_map_page->IsFreeMapBitSet(bit_idx)) {
+    pager_->SqlitePagerUnref(p_map_page);
+    return ResultCode::kOk;
+  }
+  rc = pager_->SqlitePagerWrite(p_first_page_);
+  if (rc == ResultCode::kOk) {
+    rc = pager_->SqlitePagerWrite(p_map_page);
+  }
+  if (rc != ResultCode::kOk) {
+    pager_->SqlitePagerUnref(p_map_page);
+    return rc;
+  }
+  p_map_page->SetFreeMapBit(bit_idx, false);
+  u32 num_map_free_pages = p_map_page->GetFreeMapHeaderByteView().num_free_pages;
+  pager_->SqlitePagerUnref(p_map_page);
+  found = true;
+
+  FirstPageByteView first_page = p_first_page_->GetFirstPageByteView();
+  first_page.num_free_pages--;
+  if (first_page.num_free_pages == 0) {
+    first_page.first_free_page = 0;
+  } else if (num_map_free_pages == 0 &&
+             map_page_number == first_page.first_free_page) {
+    // move on to the next free map page that has a free page
+    PageNumber num_pages = pager_->SqlitePagerPageCount();
+    PageNumber next_map_page_number = map_page_number;
+    while (num_map_free_pages == 0) {
+      next_map_page_number += FreeMapNumBits(BtreePageSize()) + 1;
+      if (next_map_page_number > num_pages) {
+        rc = ResultCode::kCorrupt;
+        break;
+      }
+      rc = pager_->SqlitePagerGet(next_map_page_number, &p_base_page,
+                                  NodePage::CreateDerivedPage);
+      if (rc != ResultCode::kOk) {
+        break;
+      }
+      num_map_free_pages = dynamic_cast<NodePage *>(p_base_page)
+                               ->GetFreeMapHeaderByteView()
+                               .num_free_pages;
+      pager_->SqlitePagerUnref(p_base_page);
+    }
+    first_page.first_free_page = next_map_page_number;
+  }
+  p_first_page_->SetFirstPageByteView(first_page);
+  return rc;
+}
+
+/**
+ * @brief Adds every free page on the map to free_pages.
+ */
+ResultCode Btree::FreeMapCollect(std::set<PageNumber> &free_pages) {
+  u32 page_size = BtreePageSize();
+  PageNumber num_pages = pager_->SqlitePagerPageCount();
+  for (PageNumber map_page_number =
+           p_first_page_->GetFirstPageByteView().first_free_page;
+       map_page_number != 0 && map_page_number <= num_pages;
+       map_page_number += FreeMapNumBits(page_size) + 1) {
+    BasePage *p_base_page = nullptr;
+    ResultCode rc = pager_->SqlitePagerGet(map_page_number, &p_base_page,
+                                           NodePage::CreateDerivedPage);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    auto *p_map_page = dynamic_cast<NodePage *>(p_base_page);
+    if (p_map_page->GetFreeMapHeaderByteView().num_free_pages != 0) {
+      for (u32 bit_idx = p_map_page->FindFreeMapBit(0);
+           bit_idx < FreeMapNumBits(page_size);
+           bit_idx = p_map_page->FindFreeMapBit(bit_idx + 1)) {
+        free_pages.insert(map_page_number + 1 + bit_idx);
+      }
+    }
+    pager_->SqlitePagerUnref(p_map_page);
+  }
+  return ResultCode::kOk;
+}
+
+/**
+ * @brief Counts the free pages of the database and the runs of consecutive
+ * page numbers they form.
+ *
+ * With the free list every info page is read, one after the other along the
+ * chain. With free map pages only the free map pages from the first one with a
+ * free page are read, one for every FreeMapNumBits() pages of the file.
+ *
+ * @param stats: the counts
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeFreeSpaceStats(BtFreeSpaceStats &stats) {
+  stats = {};
+  if (!p_first_page_) {
+    return ResultCode::kError;
+  }
+  std::set<PageNumber> free_pages;
+  ResultCode rc = VacuumCollectFreePages(free_pages);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  stats.num_pages = pager_->SqlitePagerPageCount();
+  stats.num_free_pages = static_cast<u32>(free_pages.size());
+  PageNumber prev_page_number = 0;
+  u32 run_length = 0;
+  for (PageNumber page_number : free_pages) {
+    if (page_number != prev_page_number + 1) {
+      stats.num_free_runs++;
+      run_length = 0;
+    }
+    run_length++;
+    stats.longest_free_run = std::max(stats.longest_free_run, run_length);
+    prev_page_number = page_number;
+  }
+  return ResultCode::kOk;
+}
@@ -0,0 +1,214 @@
+/*
+ * btree_lookup.cc
+ *
+ * The file is dedicated to point lookups other than Btree::BtreeSearch():
+ * BtLookup, which returns a view of the data instead of a copy, so looking up
+ * a row allocates no memory, and Btree::BtreeMultiGet(), which looks up many
+ * keys in one pass over the tree.
+ */
+#include "btree.h"
+
+/**
+ * @brief Opens a lookup handle on the table rooted at root_page_number.
+ *
+ * @param root_page_number: root page of the table
+ * @param lookup: a handle that is not open yet
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeLookupBegin(PageNumber root_page_number,
+                                   BtLookup &lookup) {
+  if (!lookup.p_cursor_weak_.expired()) {
+    return ResultCode::kMisuse;
+  }
+  return BtCursorCreate(root_page_number, false, lookup.p_cursor_weak_);
+}
+
+/**
+ * @brief Looks up the row with the given key.
+ *
+ * The leaf of the row stays pinned by the handle's cursor, and data points
+ * into it, or into the handle's buffer for data on overflow pages. The view is
+ * valid until the next lookup or BtreeLookupEnd.
+ *
+ * @param lookup: an open handle
+ * @param key: key of the row
+ * @param data: view of the data of the row, empty if there is none
+ * @param found: set to whether the table has a row with the key
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeLookup(BtLookup &lookup, std::vector<std::byte> &key,
+                              PayloadView &data, bool &found) {
+  found = false;
+  data = PayloadView();
+  if (lookup.p_cursor_weak_.expired()) {
+    return ResultCode::kMisuse;
+  }
+  BtCursor &cursor = *lookup.p_cursor_weak_.lock();
+  int c = 0;
+  ResultCode rc = CursorMoveTo(cursor, key, c);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  if (c != 0 || cursor.cell_index >= cursor.p_page->GetNumCells()) {
+    return ResultCode::kOk;
+  }
+  found = true;
+  return GetPayloadView(cursor, false, lookup.data_buffer_, data);
+}
+
+/**
+ * @brief Closes the handle's cursor, which unpins its leaf. The handle can be
+ * opened again afterwards.
+ * @param lookup: an open handle
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeLookupEnd(BtLookup &lookup) {
+  if (lookup.p_cursor_weak_.expired()) {
+    return ResultCode::kMisuse;
+  }
+  ResultCode rc = BtCursorClose(lookup.p_cursor_weak_);
+  lookup.p_cursor_weak_.reset();
+  lookup.data_buffer_.clear();
+  return rc;
+}
+
+/**
+ * @brief Looks up many keys of the table rooted at root_page_number at once.
+ *
+ * The keys are visited in ascending order by a single cursor. Instead of
+ * starting from the root for every key, the cursor only climbs as far as the
+ * lowest page whose subtree holds the next key, and descends from there. So
+ * neighbouring keys share the internal pages above them, and every leaf is
+ * visited at most once, however many of the keys it holds.
+ *
+ * The table must not have a writable cursor open.
+ *
+ * @param root_page_number: root page of the table
+ * @param keys: the keys to look up, in any order; they are not reordered
+ * @param results: set to the data of each key, in the order of keys, or to
+ * std::nullopt for a key that is not in the table
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeMultiGet(
+    PageNumber root_page_number, std::vector<std::vector<std::byte>> &keys,
+    std::vector<std::optional<std::vector<std::byte>>> &results) {
+  results.assign(keys.size(), std::nullopt);
+  if (keys.empty()) {
+    return ResultCode::kOk;
+  }
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  ResultCode rc = BtCursorCreate(root_page_number, false, p_cursor_weak);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  BtCursor &cursor = *p_cursor_weak.lock();
+
+  // Step 1: Sort the positions of the keys, not the keys themselves
+  std::vector<u32> order(keys.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&keys](u32 a, u32 b) {
+    return keys[a] < keys[b];
+  });
+
+  // bounds[d] is the divider cell that bounds the subtree of the page at depth
+  // d from above, or nullptr for the pages along the right edge of the tree.
+  // The new cursor is on the root.
+  std::vector<std::pair<NodePage *, u16>> bounds(1, {nullptr, 0});
+  rc = InitPage(*cursor.p_page, nullptr);
+  for (size_t i = 0; i < order.size() && rc == ResultCode::kOk; ++i) {
+    std::vector<std::byte> &key = keys[order[i]];
+
+    // Step 2: Climb until the page under the cursor holds the key
+    while (rc == ResultCode::kOk && bounds.size() > 1) {
+      bool is_in_page = false;
+      rc = MultiGetIsInPage(p_cursor_weak, key, bounds.back(), is_in_page);
+      if (rc != ResultCode::kOk || is_in_page) {
+        break;
+      }
+      rc = MoveToParent(cursor);
+      bounds.pop_back();
+    }
+    if (rc != ResultCode::kOk) {
+      break;
+    }
+
+    // Step 3: Descend to the leaf and read the data of a matching cell
+    int c = 0;
+    rc = MultiGetDescend(p_cursor_weak, key, bounds, c);
+    if (rc == ResultCode::kOk && c == 0 &&
+        cursor.cell_index < cursor.p_page->GetNumCells()) {
+      CellHeaderByteView cell_header =
+          cursor.p_page->GetCellHeaderByteView(cursor.cell_index);
+      std::vector<std::byte> &data = results[order[i]].emplace();
+      data.reserve(cell_header.data_size);
+      rc = GetPayload(cursor, cell_header.key_size, cell_header.data_size,
+                      data);
+    }
+  }
+  ResultCode close_rc = BtCursorClose(p_cursor_weak);
+  return rc != ResultCode::kOk ? rc : close_rc;
+}
+
+/*
+ * Moves the cursor from the page it is on down to the leaf where key belongs,
+ * pushing the bound of every page it enters onto bounds. On the leaf, the
+ * cursor and result are left the way MoveToCellInPage leaves them.
+ */
+ResultCode Btree::MultiGetDescend(
+    const std::weak_ptr<BtCursor> &p_cursor_weak, std::vector<std::byte> &key,
+    std::vector<std::pair<NodePage *, u16>> &bounds, int &result) {
+  BtCursor &cursor = *p_cursor_weak.lock();
+  while (true) {
+    ResultCode rc = MoveToCellInPage(p_cursor_weak, key, result);
+    if (rc != ResultCode::kOk || !cursor.p_page->IsInternalNode()) {
+      return rc;
+    }
+    // A divider is the largest key of its left subtree, so an equal key goes
+    // to the left as well
+    NodePage *p_page = cursor.p_page;
+    u32 child_idx = cursor.cell_index;
+    if (result < 0 && p_page->GetNumCells() > 0) {
+      child_idx++;
+    }
+    PageNumber child_page_number;
+    if (child_idx >= p_page->GetNumCells()) {
+      child_page_number = p_page->GetNodePageHeaderByteView().right_child;
+      bounds.push_back(bounds.back());
+    } else {
+      child_page_number = p_page->GetCellHeaderByteView(child_idx).left_child;
+      bounds.emplace_back(p_page, child_idx);
+    }
+    rc = MoveToChild(cursor, child_page_number);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+  }
+}
+
+/*
+ * Sets is_in_page to whether key lies in the subtree of the page the cursor is
+ * on, whose upper bound is the divider cell bound. The key is known not to lie
+ * below the subtree, because it is not smaller than the key looked up before.
+ */
+ResultCode Btree::MultiGetIsInPage(const std::weak_ptr<BtCursor> &p_cursor_weak,
+                                   std::vector<std::byte> &key,
+                                   const std::pair<NodePage *, u16> &bound,
+                                   bool &is_in_page) {
+  if (bound.first == nullptr) {
+    is_in_page = true;
+    return ResultCode::kOk;
+  }
+  // Compare against the divider without moving the cursor off its page; the
+  // divider's page stays pinned as an ancestor of the cursor's page
+  BtCursor &cursor = *p_cursor_weak.lock();
+  NodePage *p_page = cursor.p_page;
+  u16 cell_index = cursor.cell_index;
+  cursor.p_page = bound.first;
+  cursor.cell_index = bound.second;
+  int c = 0;
+  ResultCode rc = CursorKeyCompare(cursor, key, 0, c);
+  cursor.p_page = p_page;
+  cursor.cell_index = cell_index;
+  is_in_page = c >= 0;
+  return rc;
+}
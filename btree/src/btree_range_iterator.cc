@@ -0,0 +1,294 @@
+/*
+ * btree_range_iterator.cc
+ *
+ * The file is dedicated to BtRangeIterator, the streaming alternative to
+ * Btree::BtreeRangeSearch(). Rows are visited one at a time on the leaf that
+ * the iterator's cursor pins, instead of being copied into a vector first.
+ */
+#include "btree.h"
+
+// --------------------- Range Iterator Public Functions ---------------------
+
+/**
+ * @brief Opens a range scan over the table rooted at root_page_number.
+ *
+ * A read-only cursor is created for the iterator and placed on the first row
+ * of the scan, i.e. the smallest key in the range, or the largest one for a
+ * reverse scan. The first call to BtreeRangeNext returns that row.
+ *
+ * @param root_page_number: root page of the table
+ * @param range: bounds, direction and limit of the scan
+ * @param iterator: an iterator that is not open yet
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeRangeBegin(PageNumber root_page_number,
+                                  const BtRange &range,
+                                  BtRangeIterator &iterator) {
+  if (!iterator.p_cursor_weak_.expired()) {
+    return ResultCode::kMisuse;
+  }
+  ResultCode rc =
+      BtCursorCreate(root_page_number, false, iterator.p_cursor_weak_);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  iterator.range_ = range;
+  iterator.is_started_ = false;
+  iterator.is_done_ = false;
+  iterator.num_rows_ = 0;
+  const std::weak_ptr<BtCursor> &p_cursor_weak = iterator.p_cursor_weak_;
+  BtCursor &cursor = *p_cursor_weak.lock();
+
+  // Step 1: Find the key the scan starts from, or the end of the table
+  std::optional<std::vector<std::byte>> &start_key =
+      range.reverse ? iterator.range_.high_key : iterator.range_.low_key;
+  bool start_inclusive = range.reverse ? range.high_inclusive
+                                       : range.low_inclusive;
+  int c = 0;
+  if (start_key) {
+    rc = CursorMoveTo(cursor, *start_key, c);
+  } else {
+    rc = MoveToRoot(cursor);
+    while (rc == ResultCode::kOk && cursor.p_page->IsInternalNode()) {
+      NodePage *p_page = cursor.p_page;
+      PageNumber child_page_number =
+          range.reverse || p_page->GetNumCells() == 0
+              ? p_page->GetNodePageHeaderByteView().right_child
+              : p_page->GetCellHeaderByteView(0).left_child;
+      rc = MoveToChild(cursor, child_page_number);
+    }
+    if (rc == ResultCode::kOk) {
+      u32 num_cells = cursor.p_page->GetNumCells();
+      cursor.cell_index = range.reverse && num_cells > 0 ? num_cells - 1 : 0;
+    }
+  }
+  if (rc != ResultCode::kOk) {
+    BtreeRangeEnd(iterator);
+    return rc;
+  }
+
+  // Step 2: Step off a cell that lies outside the start bound. Only an empty
+  // root is a leaf without cells.
+  if (cursor.p_page->GetNumCells() == 0) {
+    iterator.is_done_ = true;
+  } else if (start_key && (range.reverse ? c > 0 : c < 0)) {
+    rc = RangeStep(iterator);
+  } else if (start_key && c == 0 && !start_inclusive) {
+    rc = RangeStep(iterator);
+  }
+  if (rc != ResultCode::kOk) {
+    BtreeRangeEnd(iterator);
+  }
+  return rc;
+}
+
+/**
+ * @brief Moves the iterator to the next row of the scan.
+ *
+ * @param iterator: an open iterator
+ * @param has_row: set to false once the scan has passed its end bound, or has
+ * returned limit rows
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeRangeNext(BtRangeIterator &iterator, bool &has_row) {
+  has_row = false;
+  if (iterator.p_cursor_weak_.expired()) {
+    return ResultCode::kMisuse;
+  }
+  const BtRange &range = iterator.range_;
+  if (iterator.is_done_ ||
+      (range.limit != 0 && iterator.num_rows_ == range.limit)) {
+    iterator.is_done_ = true;
+    return ResultCode::kOk;
+  }
+  ResultCode rc;
+  if (iterator.is_started_) {
+    rc = RangeStep(iterator);
+    if (rc != ResultCode::kOk || iterator.is_done_) {
+      return rc;
+    }
+  }
+  iterator.is_started_ = true;
+
+  // Check the row against the bound the scan is heading to
+  std::optional<std::vector<std::byte>> &end_key =
+      range.reverse ? iterator.range_.low_key : iterator.range_.high_key;
+  if (end_key) {
+    int c;
+    rc = CursorKeyCompare(*iterator.p_cursor_weak_.lock(), *end_key, 0, c);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    bool end_inclusive = range.reverse ? range.low_inclusive
+                                       : range.high_inclusive;
+    if ((range.reverse ? c < 0 : c > 0) || (c == 0 && !end_inclusive)) {
+      iterator.is_done_ = true;
+      return ResultCode::kOk;
+    }
+  }
+  iterator.num_rows_++;
+  has_row = true;
+  return ResultCode::kOk;
+}
+
+/**
+ * @brief Gets the key of the current row.
+ * @param iterator: an iterator on a row
+ * @param key: view of the key, valid until the iterator moves
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeRangeKey(BtRangeIterator &iterator, PayloadView &key) {
+  return RangeGetPayload(iterator, true, key);
+}
+
+/**
+ * @brief Gets the data of the current row.
+ * @param iterator: an iterator on a row
+ * @param data: view of the data, valid until the iterator moves
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeRangeData(BtRangeIterator &iterator,
+                                 PayloadView &data) {
+  return RangeGetPayload(iterator, false, data);
+}
+
+/**
+ * @brief Closes the iterator's cursor, which unpins its leaf. The iterator can
+ * be opened again afterwards.
+ * @param iterator: an open iterator
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeRangeEnd(BtRangeIterator &iterator) {
+  if (iterator.p_cursor_weak_.expired()) {
+    return ResultCode::kMisuse;
+  }
+  ResultCode rc = BtCursorClose(iterator.p_cursor_weak_);
+  iterator.p_cursor_weak_.reset();
+  iterator.is_done_ = true;
+  iterator.key_buffer_.clear();
+  iterator.data_buffer_.clear();
+  return rc;
+}
+
+// --------------------- Range Iterator Private Functions ---------------------
+
+/*
+ * Moves the iterator's cursor one cell in the direction of the scan, crossing
+ * into the next or previous leaf when needed. Sets is_done_ when the cursor
+ * runs off the table.
+ */
+ResultCode Btree::RangeStep(BtRangeIterator &iterator) {
+  BtCursor &cursor = *iterator.p_cursor_weak_.lock();
+  ResultCode rc;
+  if (!iterator.range_.reverse) {
+    cursor.cell_index++;
+    while (cursor.cell_index >= cursor.p_page->GetNumCells()) {
+      bool has_next_leaf;
+      rc = RangeMoveToNextLeaf(cursor, has_next_leaf);
+      if (rc != ResultCode::kOk) {
+        return rc;
+      }
+      if (!has_next_leaf) {
+        iterator.is_done_ = true;
+        return ResultCode::kOk;
+      }
+    }
+    return ResultCode::kOk;
+  }
+
+  if (cursor.cell_index > 0) {
+    cursor.cell_index--;
+    return ResultCode::kOk;
+  }
+  bool has_prev_leaf;
+  rc = RangeMoveToPrevLeaf(cursor, has_prev_leaf);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  if (!has_prev_leaf) {
+    iterator.is_done_ = true;
+    return ResultCode::kOk;
+  }
+  if (cursor.p_page->GetNumCells() == 0) {
+    return ResultCode::kCorrupt;  // only the root may be an empty leaf
+  }
+  cursor.cell_index = cursor.p_page->GetNumCells() - 1;
+  return ResultCode::kOk;
+}
+
+/*
+ * Moves the cursor to the first cell of the leaf after its own, following the
+ * leaf chain. The old leaf is unpinned.
+ */
+ResultCode Btree::RangeMoveToNextLeaf(BtCursor &cursor, bool &has_next_leaf) {
+  PageNumber next_page_number = cursor.p_page->GetNextLeaf();
+  has_next_leaf = next_page_number != 0;
+  if (!has_next_leaf) {
+    return ResultCode::kOk;
+  }
+  BasePage *p_base_page = nullptr;
+  ResultCode rc = pager_->SqlitePagerGet(next_page_number, &p_base_page,
+                                         NodePage::CreateDerivedPage);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  auto *p_next_page = dynamic_cast<NodePage *>(p_base_page);
+  // the leaf was not reached from a parent, so keep whichever parent it has
+  rc = InitPage(*p_next_page, p_next_page->p_parent_);
+  if (rc != ResultCode::kOk) {
+    pager_->SqlitePagerUnref(p_next_page);
+    return rc;
+  }
+  pager_->SqlitePagerUnref(cursor.p_page);
+  cursor.p_page = p_next_page;
+  cursor.cell_index = 0;
+  pager_->SqlitePagerPrefetch(p_next_page->GetNextLeaf(), kLeafPrefetchDepth,
+                              NodePage::GetNextLeafOfImage);
+  return ResultCode::kOk;
+}
+
+/*
+ * Moves the cursor to the last cell of the leaf before its own, following the
+ * leaf chain backwards. The old leaf is unpinned.
+ */
+ResultCode Btree::RangeMoveToPrevLeaf(BtCursor &cursor, bool &has_prev_leaf) {
+  PageNumber prev_page_number = cursor.p_page->GetPrevLeaf();
+  has_prev_leaf = prev_page_number != 0;
+  if (!has_prev_leaf) {
+    return ResultCode::kOk;
+  }
+  BasePage *p_base_page = nullptr;
+  ResultCode rc = pager_->SqlitePagerGet(prev_page_number, &p_base_page,
+                                         NodePage::CreateDerivedPage);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  auto *p_prev_page = dynamic_cast<NodePage *>(p_base_page);
+  rc = InitPage(*p_prev_page, p_prev_page->p_parent_);
+  if (rc != ResultCode::kOk) {
+    pager_->SqlitePagerUnref(p_prev_page);
+    return rc;
+  }
+  pager_->SqlitePagerUnref(cursor.p_page);
+  cursor.p_page = p_prev_page;
+  cursor.cell_index = 0;
+  pager_->SqlitePagerPrefetch(p_prev_page->GetPrevLeaf(), kLeafPrefetchDepth,
+                              NodePage::GetPrevLeafOfImage);
+  return ResultCode::kOk;
+}
+
+/*
+ * Points view at the key or data of the row under the iterator, using the
+ * iterator's buffers when the payload cannot be viewed in the pinned leaf
+ */
+ResultCode Btree::RangeGetPayload(BtRangeIterator &iterator, bool is_key,
+                                  PayloadView &view) {
+  if (iterator.p_cursor_weak_.expired() || !iterator.is_started_ ||
+      iterator.is_done_) {
+    return ResultCode::kMisuse;
+  }
+  BtCursor &cursor = *iterator.p_cursor_weak_.lock();
+  return GetPayloadView(cursor, is_key,
+                        is_key ? iterator.key_buffer_ : iterator.data_buffer_,
+                        view);
+}
@@ -0,0 +1,364 @@
+/*
+ * btree_vacuum.cc
+ *
+ * The file is dedicated to Btree::BtreeIncrementalVacuum(), which gives free
+ * pages back to the file system a few at a time. Pages of the tables that sit
+ * at the end of the file are copied into free pages further in front, and the
+ * end of the file is cut off.
+ */
+#include "btree.h"
+
+/**
+ * @brief Shrinks the file by up to max_pages pages.
+ *
+ * Every call starts from the end of the file. A free page there is taken off
+ * the free list, and a page of one of the tables is first copied into the
+ * free page with the lowest page number: the reference to it, the parent
+ * pointers of its cached children and the links of its neighbouring leaves are
+ * pointed at the new place. Then the last page is cut off. The call stops
+ * early at a root page, at a page that belongs to none of the given tables,
+ * or when no free page is left.
+ *
+ * To know where pages are referenced from, every page of every table is read
+ * once, and the map that comes out of it is kept up to date by the moves. The
+ * next call reuses it as long as it vacuums the same tables and no page was
+ * changed by anything else in between, so it only reads the pages it moves;
+ * the number of pages written is bounded by max_pages. The file is cut when
+ * the transaction commits, so short transactions that each vacuum a few pages
+ * keep the write lock short.
+ *
+ * The transaction must have no open cursors. The tables are rolled back on an
+ * error.
+ *
+ * @param root_page_numbers: root pages of all tables and indexes
+ * @param max_pages: most pages to cut off the file
+ * @param stats: what was done, and how many free pages are left
+ * @return: appropriate result code
+ */
+ResultCode Btree::BtreeIncrementalVacuum(
+    const std::vector<PageNumber> &root_page_numbers, u32 max_pages,
+    BtVacuumStats &stats) {
+  stats = {};
+  if (!in_trans_) {
+    return ResultCode::kError;
+  }
+  if (read_only_) {
+    return ResultCode::kReadOnly;
+  }
+  if (!bt_cursor_set_.empty()) {
+    return ResultCode::kLocked;
+  }
+
+  // Step 1: Pages reserved by extents go back to the free list first
+  ResultCode rc = ReleaseExtents();
+
+  // Step 2: Find the free pages and where the pages of the tables are
+  // referenced from, unless the last call left them and they still hold
+  std::set<PageNumber> &free_pages = vacuum_free_pages_;
+  std::unordered_map<PageNumber, VacuumReference> &references =
+      vacuum_references_;
+  if (rc == ResultCode::kOk &&
+      (!has_vacuum_state_ ||
+       vacuum_data_version_ != pager_->SqlitePagerDataVersion() ||
+       vacuum_root_page_numbers_ != root_page_numbers)) {
+    has_vacuum_state_ = false;
+    free_pages.clear();
+    references.clear();
+    vacuum_root_page_numbers_ = root_page_numbers;
+    rc = VacuumCollectFreePages(free_pages);
+    for (PageNumber root_page_number : root_page_numbers) {
+      if (rc != ResultCode::kOk) {
+        break;
+      }
+      rc = VacuumCollectReferences(root_page_number, references);
+    }
+    stats.num_pages_scanned = root_page_numbers.size() + references.size();
+  }
+
+  // Step 3: Empty the last page of the file and cut it off, until enough
+  // pages are cut or the last page has to stay
+  PageNumber last_page_number = pager_->SqlitePagerPageCount();
+  while (rc == ResultCode::kOk && stats.num_pages_truncated < max_pages &&
+         last_page_number > 2) {
+    bool found = false;
+    if (IsFreeMapPage(last_page_number)) {
+      found = true;  // it only maps pages after it, and they are gone
+    } else if (free_pages.count(last_page_number) != 0) {
+      rc = FreeListRemove(last_page_number, UINT32_MAX, found);
+      free_pages.erase(last_page_number);
+    } else {
+      if (references.count(last_page_number) == 0 || free_pages.empty()) {
+        break;
+      }
+      PageNumber new_page_number = *free_pages.begin();
+      free_pages.erase(free_pages.begin());
+      rc = FreeListRemove(new_page_number, UINT32_MAX, found);
+      if (rc == ResultCode::kOk && found) {
+        rc = VacuumMovePage(last_page_number, new_page_number, references);
+        stats.num_pages_moved++;
+      }
+    }
+    if (rc == ResultCode::kOk && !found) {
+      rc = ResultCode::kCorrupt;  // the free list changed under the walk
+    }
+    if (rc == ResultCode::kOk) {
+      last_page_number--;
+      rc = pager_->SqlitePagerTruncate(last_page_number);
+      stats.num_pages_truncated++;
+    }
+  }
+  if (rc != ResultCode::kOk) {
+    has_vacuum_state_ = false;
+    BtreeRollback();
+    return rc;
+  }
+  // the moves kept the map current; only later changes can make it stale
+  has_vacuum_state_ = true;
+  vacuum_data_version_ = pager_->SqlitePagerDataVersion();
+  stats.num_bytes_reclaimed =
+      u64{stats.num_pages_truncated} * BtreePageSize();
+  stats.num_free_pages_left =
+      p_first_page_->GetFirstPageByteView().num_free_pages;
+  return ResultCode::kOk;
+}
+
+// --------------------- Vacuum Private Functions ---------------------
+
+/*
+ * Adds every page on the free list to free_pages, the info pages as well as
+ * the pages they list
+ */
+ResultCode Btree::VacuumCollectFreePages(std::set<PageNumber> &free_pages) {
+  if (UsesFreeMap()) {
+    return FreeMapCollect(free_pages);
+  }
+  PageNumber info_page_number =
+      p_first_page_->GetFirstPageByteView().first_free_page;
+  while (info_page_number != 0) {
+    if (!free_pages.insert(info_page_number).second) {
+      return ResultCode::kCorrupt;  // the info pages form a loop
+    }
+    BasePage *p_base_page = nullptr;
+    ResultCode rc = pager_->SqlitePagerGet(info_page_number, &p_base_page,
+                                           NodePage::CreateDerivedPage);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    auto *p_info_page = dynamic_cast<NodePage *>(p_base_page);
+    for (u16 free_list_idx = 0;
+         free_list_idx < p_info_page->GetNumberOfFreeListPages();
+         free_list_idx++) {
+      free_pages.insert(p_info_page->GetFreeListInfoPageNumber(free_list_idx));
+    }
+    info_page_number = p_info_page->GetOverflowPageHeaderByteView().next_page;
+    pager_->SqlitePagerUnref(p_info_page);
+  }
+  return ResultCode::kOk;
+}
+
+/*
+ * Records where each page below the tree page page_number is referenced from,
+ * including the overflow pages of its cells
+ */
+ResultCode Btree::VacuumCollectReferences(
+    PageNumber page_number,
+    std::unordered_map<PageNumber, VacuumReference> &references) {
+  BasePage *p_base_page = nullptr;
+  ResultCode rc = pager_->SqlitePagerGet(page_number, &p_base_page,
+                                         NodePage::CreateDerivedPage);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  auto *p_node_page = dynamic_cast<NodePage *>(p_base_page);
+  rc = InitPage(*p_node_page, p_node_page->p_parent_);
+  std::vector<PageNumber> child_page_numbers;
+  for (u16 cell_idx = 0;
+       rc == ResultCode::kOk && cell_idx < p_node_page->GetNumCells();
+       cell_idx++) {
+    CellHeaderByteView cell_header =
+        p_node_page->GetCellHeaderByteView(cell_idx);
+    if (cell_header.overflow_page != 0) {
+      rc = VacuumCollectOverflowReferences(page_number, cell_idx,
+                                           cell_header.overflow_page,
+                                           references);
+    }
+    if (p_node_page->IsInternalNode()) {
+      references[cell_header.left_child] = {
+          VacuumReference::Kind::kLeftChild, page_number, cell_idx};
+      child_page_numbers.push_back(cell_header.left_child);
+    }
+  }
+  if (rc == ResultCode::kOk && p_node_page->IsInternalNode()) {
+    PageNumber right_child = p_node_page->GetNodePageHeaderByteView().right_child;
+    references[right_child] = {VacuumReference::Kind::kRightChild, page_number,
+                               0};
+    child_page_numbers.push_back(right_child);
+  }
+  pager_->SqlitePagerUnref(p_node_page);
+
+  for (PageNumber child_page_number : child_page_numbers) {
+    if (rc != ResultCode::kOk) {
+      break;
+    }
+    rc = VacuumCollectReferences(child_page_number, references);
+  }
+  return rc;
+}
+
+/*
+ * Records where each page of the overflow chain that starts at
+ * overflow_page_number, for cell cell_idx of page page_number, is referenced
+ * from
+ */
+ResultCode Btree::VacuumCollectOverflowReferences(
+    PageNumber page_number, u16 cell_idx, PageNumber overflow_page_number,
+    std::unordered_map<PageNumber, VacuumReference> &references) {
+  VacuumReference reference = {VacuumReference::Kind::kOverflow, page_number,
+                               cell_idx};
+  while (overflow_page_number != 0) {
+    if (references.count(overflow_page_number) != 0) {
+      return ResultCode::kCorrupt;  // the chain loops or is shared
+    }
+    references[overflow_page_number] = reference;
+    BasePage *p_base_page = nullptr;
+    ResultCode rc = pager_->SqlitePagerGet(overflow_page_number, &p_base_page,
+                                           NodePage::CreateDerivedPage);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    reference = {VacuumReference::Kind::kNextOverflow, overflow_page_number, 0};
+    overflow_page_number = dynamic_cast<NodePage *>(p_base_page)
+                               ->GetOverflowPageHeaderByteView()
+                               .next_page;
+    pager_->SqlitePagerUnref(p_base_page);
+  }
+  return ResultCode::kOk;
+}
+
+/*
+ * Copies page page_number into the free page new_page_number, which is
+ * already off the free list, and points every reference to it at its new
+ * place
+ */
+ResultCode Btree::VacuumMovePage(
+    PageNumber page_number, PageNumber new_page_number,
+    std::unordered_map<PageNumber, VacuumReference> &references) {
+  VacuumReference reference = references[page_number];
+  bool is_tree_page = reference.kind == VacuumReference::Kind::kLeftChild ||
+                      reference.kind == VacuumReference::Kind::kRightChild;
+
+  // Step 1: Copy the image. Writing the old page journals it, so a rollback
+  // brings it back after the file is cut.
+  BasePage *p_base_page = nullptr;
+  BasePage *p_new_base_page = nullptr;
+  BasePage *p_holder_base_page = nullptr;
+  ResultCode rc = pager_->SqlitePagerGet(page_number, &p_base_page,
+                                         NodePage::CreateDerivedPage);
+  if (rc == ResultCode::kOk) {
+    rc = pager_->SqlitePagerWrite(p_base_page);
+  }
+  if (rc == ResultCode::kOk) {
+    rc = pager_->SqlitePagerGet(new_page_number, &p_new_base_page,
+                                NodePage::CreateDerivedPage);
+  }
+  if (rc == ResultCode::kOk) {
+    rc = pager_->SqlitePagerWrite(p_new_base_page);
+  }
+  if (rc == ResultCode::kOk) {
+    rc = pager_->SqlitePagerGet(reference.page_number, &p_holder_base_page,
+                                NodePage::CreateDerivedPage);
+  }
+  if (rc == ResultCode::kOk) {
+    rc = pager_->SqlitePagerWrite(p_holder_base_page);
+  }
+  if (rc != ResultCode::kOk) {
+    for (BasePage *p_page :
+         {p_base_page, p_new_base_page, p_holder_base_page}) {
+      if (p_page != nullptr) {
+        pager_->SqlitePagerUnref(p_page);
+      }
+    }
+    return rc;
+  }
+  auto *p_page = dynamic_cast<NodePage *>(p_base_page);
+  auto *p_new_page = dynamic_cast<NodePage *>(p_new_base_page);
+  auto *p_holder = dynamic_cast<NodePage *>(p_holder_base_page);
+  for (NodePage *p_stale_page : {p_page, p_new_page}) {
+    if (p_stale_page->p_parent_ != nullptr) {
+      pager_->SqlitePagerUnref(p_stale_page->p_parent_);
+    }
+    p_stale_page->DestroyExtra();
+  }
+  std::memcpy(p_new_page->p_image_.data(), p_page->p_image_.data(),
+              p_page->p_image_.size());
+
+  // Step 2: Point the reference at the new page
+  if (reference.kind != VacuumReference::Kind::kNextOverflow) {
+    rc = InitPage(*p_holder, p_holder->p_parent_);
+  }
+  if (rc == ResultCode::kOk) {
+    switch (reference.kind) {
+      case VacuumReference::Kind::kLeftChild:
+      case VacuumReference::Kind::kOverflow: {
+        CellHeaderByteView cell_header =
+            p_holder->GetCellHeaderByteView(reference.cell_idx);
+        if (reference.kind == VacuumReference::Kind::kLeftChild) {
+          cell_header.left_child = new_page_number;
+        } else {
+          cell_header.overflow_page = new_page_number;
+        }
+        p_holder->SetCellHeaderByteView(reference.cell_idx, cell_header);
+        break;
+      }
+      case VacuumReference::Kind::kRightChild: {
+        NodePageHeaderByteView page_header =
+            p_holder->GetNodePageHeaderByteView();
+        page_header.right_child = new_page_number;
+        p_holder->SetNodePageHeaderByteView(page_header);
+        break;
+      }
+      case VacuumReference::Kind::kNextOverflow: {
+        OverflowPageHeaderByteView overflow_header =
+            p_holder->GetOverflowPageHeaderByteView();
+        overflow_header.next_page = new_page_number;
+        p_holder->SetOverflowPageHeaderByteView(overflow_header);
+        break;
+      }
+    }
+  }
+
+  // Step 3: A leaf is relinked to its neighbours, and the cached children of
+  // an internal page are handed to the new page
+  if (rc == ResultCode::kOk && is_tree_page) {
+    rc = InitPage(*p_new_page, p_holder);
+  }
+  if (rc == ResultCode::kOk && is_tree_page) {
+    if (p_new_page->IsInternalNode()) {
+      ReParentChildPages(*p_new_page);
+    } else {
+      PageNumber prev_page_number = p_new_page->GetPrevLeaf();
+      PageNumber next_page_number = p_new_page->GetNextLeaf();
+      if (prev_page_number != 0) {
+        rc = BalanceHelperRelinkLeaf(prev_page_number, true, page_number,
+                                     new_page_number);
+      }
+      if (rc == ResultCode::kOk && next_page_number != 0) {
+        rc = BalanceHelperRelinkLeaf(next_page_number, false, page_number,
+                                     new_page_number);
+      }
+    }
+  }
+  pager_->SqlitePagerUnref(p_holder);
+  pager_->SqlitePagerUnref(p_new_page);
+  pager_->SqlitePagerUnref(p_page);
+
+  // Step 4: References held by the moved page now live on the new page
+  references.erase(page_number);
+  references[new_page_number] = reference;
+  for (auto &[referenced_page_number, other_reference] : references) {
+    if (other_reference.page_number == page_number) {
+      other_reference.page_number = new_page_number;
+    }
+  }
+  return rc;
+}
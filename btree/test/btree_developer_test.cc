@@ -1,3 +1,7 @@
+#include <fstream>
+#include <map>
+#include <random>
+
 #include "btree.h"
 
 #include "gtest/gtest.h"
@@ -151,3 +155,1909 @@ TEST(DestroyExtraTest, FirstPageDestroyExtra) {
   FirstPageByteView header_after_destroy = first_page.GetFirstPageByteView();
   EXPECT_EQ(header_after_destroy.magic_int, header_before_destroy.magic_int);
 }
+
+// Big-endian, so that the byte order of the keys is their numeric order
+static std::vector<std::byte> BigEndianKey(u32 value) {
+  return {std::byte(value >> 24), std::byte(value >> 16), std::byte(value >> 8),
+          std::byte(value)};
+}
+
+TEST(BulkLoadTest, BuildsSearchableTreeFromSortedPairs) {
+  std::string filename = "test_BuildsSearchableTreeFromSortedPairs.db";
+  std::string journal_filename =
+      "test_BuildsSearchableTreeFromSortedPairs.db-journal";
+  std::remove(filename.c_str());
+  std::remove(journal_filename.c_str());
+  ResultCode rc;
+  // Cursors pin every page above the leaf they stand on, so a tree of three
+  // levels needs more than the usual 10 cache pages
+  Btree btree(filename, 100);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  PageNumber root_page_number;
+  rc = btree.BtreeCreateTable(root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 1: Load 3000 pairs, enough for three levels
+  const u32 num_pairs = 3000;
+  u32 next_key = 0;
+  rc = btree.BtreeBulkLoad(
+      root_page_number,
+      [&next_key](std::vector<std::byte> &key, std::vector<std::byte> &data) {
+        if (next_key == num_pairs) return false;
+        key = BigEndianKey(next_key);
+        data = BigEndianKey(next_key * 7);
+        next_key++;
+        return true;
+      },
+      1.0);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  u32 num_loaded_pages = btree.BtreePageCount();
+
+  // Step 2: Every key is found with its data
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  for (u32 i = 0; i < num_pairs; i++) {
+    std::vector<std::byte> key = BigEndianKey(i);
+    int result;
+    std::vector<std::byte> data = btree.BtreeSearch(p_cursor_weak, key, result);
+    ASSERT_EQ(result, 0) << "key " << i;
+    EXPECT_EQ(data, BigEndianKey(i * 7));
+  }
+
+  // Step 3: The leaves are chained in key order
+  bool table_is_empty = false;
+  rc = btree.BtreeFirst(p_cursor_weak, table_is_empty);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_FALSE(table_is_empty);
+  u32 num_scanned = 0;
+  bool already_at_last_entry = false;
+  while (!already_at_last_entry) {
+    u32 key_size = 0;
+    if (btree.BtreeKeySize(p_cursor_weak, key_size) == ResultCode::kOk &&
+        key_size == 4) {
+      std::vector<std::byte> key;
+      btree.BtreeKey(p_cursor_weak, 0, 4, key);
+      EXPECT_EQ(key, BigEndianKey(num_scanned));
+      num_scanned++;
+    }
+    rc = btree.BtreeLinkedListNext(p_cursor_weak, already_at_last_entry);
+    ASSERT_EQ(rc, ResultCode::kOk);
+  }
+  EXPECT_EQ(num_scanned, num_pairs);
+
+  // Step 4: The tree takes regular inserts afterwards
+  std::vector<std::byte> key = BigEndianKey(num_pairs + 1);
+  std::vector<std::byte> data = BigEndianKey(1);
+  rc = btree.BtreeInsert(p_cursor_weak, key, data);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  int result;
+  EXPECT_EQ(btree.BtreeSearch(p_cursor_weak, key, result), data);
+  EXPECT_EQ(result, 0);
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 5: Keys out of order are refused
+  PageNumber other_root_page_number;
+  rc = btree.BtreeCreateTable(other_root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  u32 num_calls = 0;
+  rc = btree.BtreeBulkLoad(
+      other_root_page_number,
+      [&num_calls](std::vector<std::byte> &key, std::vector<std::byte> &data) {
+        key = BigEndianKey(num_calls == 1 ? 0 : 5);
+        data = BigEndianKey(0);
+        return num_calls++ < 2;
+      },
+      0.5);
+  EXPECT_EQ(rc, ResultCode::kMisuse);
+  EXPECT_GT(num_loaded_pages, 10);
+}
+
+TEST(BulkLoadTest, DeletesFromTheLastLeafAfterLoading) {
+  std::string filename = "test_DeletesFromTheLastLeafAfterLoading.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  Btree btree(filename, 100);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  // With 1024-byte pages, the last leaf of these loads is the only child
+  // added to an internal level after a node of that level filled up
+  for (u32 num_pairs : {1288u, 1291u, 2575u, 2578u}) {
+    PageNumber root_page_number;
+    rc = btree.BtreeCreateTable(root_page_number);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    u32 next_key = 0;
+    rc = btree.BtreeBulkLoad(
+        root_page_number,
+        [&next_key, num_pairs](std::vector<std::byte> &key,
+                               std::vector<std::byte> &data) {
+          if (next_key == num_pairs) return false;
+          key = BigEndianKey(next_key);
+          data = BigEndianKey(next_key * 7);
+          next_key++;
+          return true;
+        },
+        1.0);
+    ASSERT_EQ(rc, ResultCode::kOk);
+
+    // Step 1: Delete the keys of the last leaf and more, from the back
+    std::weak_ptr<BtCursor> p_cursor_weak;
+    rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    const u32 num_deleted = 40;
+    for (u32 i = num_pairs; i > num_pairs - num_deleted; i--) {
+      std::vector<std::byte> key = BigEndianKey(i - 1);
+      int result = 0;
+      rc = btree.BtreeMoveTo(p_cursor_weak, key, result);
+      ASSERT_EQ(rc, ResultCode::kOk);
+      ASSERT_EQ(result, 0) << num_pairs << " key " << i - 1;
+      rc = btree.BtreeDelete(p_cursor_weak);
+      ASSERT_EQ(rc, ResultCode::kOk) << num_pairs << " key " << i - 1;
+    }
+
+    // Step 2: The deleted keys are gone and the others are still found
+    for (u32 i = 0; i < num_pairs; i++) {
+      std::vector<std::byte> key = BigEndianKey(i);
+      int result;
+      std::vector<std::byte> data =
+          btree.BtreeSearch(p_cursor_weak, key, result);
+      if (i < num_pairs - num_deleted) {
+        ASSERT_EQ(result, 0) << num_pairs << " key " << i;
+        EXPECT_EQ(data, BigEndianKey(i * 7));
+      } else {
+        EXPECT_NE(result, 0) << num_pairs << " key " << i;
+      }
+    }
+    rc = btree.BtCursorClose(p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+  }
+  rc = btree.BtreeCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+TEST(InsertBatchTest, InsertsUnsortedBatchesWithDuplicates) {
+  std::string filename = "test_InsertsUnsortedBatchesWithDuplicates.db";
+  std::string journal_filename =
+      "test_InsertsUnsortedBatchesWithDuplicates.db-journal";
+  std::remove(filename.c_str());
+  std::remove(journal_filename.c_str());
+  ResultCode rc;
+  Btree btree(filename, 1000);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 1: Fill and drop a table first, so that the splits below reuse pages
+  // from the free list and the new leaves are not in page number order
+  PageNumber dropped_root_page_number;
+  rc = btree.BtreeCreateTable(dropped_root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  PageNumber root_page_number;
+  rc = btree.BtreeCreateTable(root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(dropped_root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::vector<KeyDataPair> batch;
+  for (u32 key = 0; key < 1000; key++) {
+    batch.emplace_back(BigEndianKey(key), BigEndianKey(key));
+  }
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtreeDropTable(dropped_root_page_number);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 2: Insert the even keys in a shuffled order
+  const u32 num_keys = 1000;
+  std::vector<u32> shuffled_keys(num_keys);
+  for (u32 i = 0; i < num_keys; i++) {
+    shuffled_keys[i] = i * 2;
+  }
+  std::shuffle(shuffled_keys.begin(), shuffled_keys.end(), std::mt19937(7));
+  batch.clear();
+  for (u32 key : shuffled_keys) {
+    batch.emplace_back(BigEndianKey(key), BigEndianKey(key));
+  }
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+
+  // Step 3: Insert half of the odd keys, and rewrite some even keys twice
+  batch.clear();
+  for (u32 i = 0; i < num_keys / 2; i++) {
+    u32 key = shuffled_keys[i] + 1;
+    batch.emplace_back(BigEndianKey(key), BigEndianKey(key));
+  }
+  for (u32 i = 0; i < 100; i++) {
+    batch.emplace_back(BigEndianKey(shuffled_keys[i]), BigEndianKey(0));
+    batch.emplace_back(BigEndianKey(shuffled_keys[i]), BigEndianKey(1));
+  }
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+
+  // Step 4: Every key is found, with the data given last
+  std::vector<u32> expected_keys;
+  for (u32 i = 0; i < num_keys; i++) {
+    u32 key = shuffled_keys[i];
+    expected_keys.push_back(key);
+    if (i < num_keys / 2) {
+      expected_keys.push_back(key + 1);
+    }
+    std::vector<std::byte> search_key = BigEndianKey(key);
+    int result;
+    std::vector<std::byte> data =
+        btree.BtreeSearch(p_cursor_weak, search_key, result);
+    ASSERT_EQ(result, 0) << "key " << key;
+    EXPECT_EQ(data, BigEndianKey(i < 100 ? 1 : key));
+  }
+  std::sort(expected_keys.begin(), expected_keys.end());
+
+  // Step 5: The leaves hold the keys in order
+  bool table_is_empty = false;
+  rc = btree.BtreeFirst(p_cursor_weak, table_is_empty);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::vector<u32> scanned_keys;
+  bool already_at_last_entry = false;
+  while (!already_at_last_entry) {
+    u32 key_size = 0;
+    if (btree.BtreeKeySize(p_cursor_weak, key_size) == ResultCode::kOk &&
+        key_size == 4) {
+      std::vector<std::byte> key;
+      btree.BtreeKey(p_cursor_weak, 0, 4, key);
+      scanned_keys.push_back(std::to_integer<u32>(key[0]) << 24 |
+                             std::to_integer<u32>(key[1]) << 16 |
+                             std::to_integer<u32>(key[2]) << 8 |
+                             std::to_integer<u32>(key[3]));
+    }
+    rc = btree.BtreeLinkedListNext(p_cursor_weak, already_at_last_entry);
+    ASSERT_EQ(rc, ResultCode::kOk);
+  }
+  EXPECT_EQ(scanned_keys, expected_keys);
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+// Runs a range scan to the end and returns the keys it visited
+static std::vector<u32> ScanRange(Btree &btree, PageNumber root_page_number,
+                                  const BtRange &range) {
+  BtRangeIterator iterator;
+  std::vector<u32> keys;
+  EXPECT_EQ(btree.BtreeRangeBegin(root_page_number, range, iterator),
+            ResultCode::kOk);
+  bool has_row = true;
+  while (true) {
+    EXPECT_EQ(btree.BtreeRangeNext(iterator, has_row), ResultCode::kOk);
+    if (!has_row) {
+      break;
+    }
+    PayloadView key;
+    EXPECT_EQ(btree.BtreeRangeKey(iterator, key), ResultCode::kOk);
+    EXPECT_EQ(key.size, 4);
+    keys.push_back(std::to_integer<u32>(key.data[0]) << 24 |
+                   std::to_integer<u32>(key.data[1]) << 16 |
+                   std::to_integer<u32>(key.data[2]) << 8 |
+                   std::to_integer<u32>(key.data[3]));
+  }
+  EXPECT_EQ(btree.BtreeRangeEnd(iterator), ResultCode::kOk);
+  return keys;
+}
+
+TEST(RangeIteratorTest, ScansBoundsBothWaysWithLimit) {
+  std::string filename = "test_ScansBoundsBothWaysWithLimit.db";
+  std::string journal_filename = "test_ScansBoundsBothWaysWithLimit.db-journal";
+  std::remove(filename.c_str());
+  std::remove(journal_filename.c_str());
+  ResultCode rc;
+  Btree btree(filename, 1000);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  PageNumber root_page_number;
+  rc = btree.BtreeCreateTable(root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 1: An empty table has no rows either way
+  BtRange range;
+  EXPECT_TRUE(ScanRange(btree, root_page_number, range).empty());
+  range.reverse = true;
+  EXPECT_TRUE(ScanRange(btree, root_page_number, range).empty());
+
+  // Step 2: Fill in the even keys 0 to 3998; key 1000 gets data that spills
+  // onto overflow pages
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::vector<KeyDataPair> batch;
+  for (u32 key = 0; key < 4000; key += 2) {
+    batch.emplace_back(BigEndianKey(key), BigEndianKey(key));
+  }
+  batch[500].second.assign(3 * MaxLocalPayload(kDefaultPageSize),
+                           std::byte{0x5a});
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 3: Whole table, forward and reverse
+  std::vector<u32> expected_keys;
+  for (u32 key = 0; key < 4000; key += 2) {
+    expected_keys.push_back(key);
+  }
+  range = BtRange();
+  EXPECT_EQ(ScanRange(btree, root_page_number, range), expected_keys);
+  range.reverse = true;
+  std::reverse(expected_keys.begin(), expected_keys.end());
+  EXPECT_EQ(ScanRange(btree, root_page_number, range), expected_keys);
+
+  // Step 4: Bounds that are keys, exclusive, and bounds between keys
+  range = BtRange();
+  range.low_key = BigEndianKey(100);
+  range.high_key = BigEndianKey(3000);
+  range.low_inclusive = false;
+  expected_keys.clear();
+  for (u32 key = 102; key <= 3000; key += 2) {
+    expected_keys.push_back(key);
+  }
+  EXPECT_EQ(ScanRange(btree, root_page_number, range), expected_keys);
+  range.reverse = true;
+  range.low_key = BigEndianKey(101);
+  range.high_key = BigEndianKey(3001);
+  range.high_inclusive = false;
+  std::reverse(expected_keys.begin(), expected_keys.end());
+  EXPECT_EQ(ScanRange(btree, root_page_number, range), expected_keys);
+
+  // Step 5: A limit stops the scan early
+  range.limit = 3;
+  EXPECT_EQ(ScanRange(btree, root_page_number, range),
+            std::vector<u32>({3000, 2998, 2996}));
+
+  // Step 6: Data on overflow pages is read when asked for
+  range = BtRange();
+  range.low_key = BigEndianKey(1000);
+  range.limit = 1;
+  BtRangeIterator iterator;
+  rc = btree.BtreeRangeBegin(root_page_number, range, iterator);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  bool has_row = false;
+  rc = btree.BtreeRangeNext(iterator, has_row);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  ASSERT_TRUE(has_row);
+  PayloadView data;
+  rc = btree.BtreeRangeData(iterator, data);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(std::vector<std::byte>(data.data, data.data + data.size),
+            std::vector<std::byte>(3 * MaxLocalPayload(kDefaultPageSize),
+                                   std::byte{0x5a}));
+  rc = btree.BtreeRangeNext(iterator, has_row);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_FALSE(has_row);
+  rc = btree.BtreeRangeEnd(iterator);
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+TEST(RangeSearchTest, ReturnsEveryRowAcrossLeafBoundaries) {
+  std::string filename = "test_ReturnsEveryRowAcrossLeafBoundaries.db";
+  std::string journal_filename =
+      "test_ReturnsEveryRowAcrossLeafBoundaries.db-journal";
+  std::remove(filename.c_str());
+  std::remove(journal_filename.c_str());
+  ResultCode rc;
+  Btree btree(filename, 1000);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  PageNumber root_page_number;
+  rc = btree.BtreeCreateTable(root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 1: Fill in the even keys 0 to 3998, which takes many leaves
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::vector<KeyDataPair> batch;
+  for (u32 key = 0; key < 4000; key += 2) {
+    batch.emplace_back(BigEndianKey(key), BigEndianKey(key * 3));
+  }
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  ASSERT_GT(btree.BtreePageCount(), 10);
+
+  // Step 2: A range that starts on a key, a range that starts between keys,
+  // and a range that runs off the end of the table return all their rows
+  struct RangeCase {
+    u32 key_start, key_end, first_key, last_key;
+    int expected_result;
+  };
+  for (const RangeCase &range_case :
+       {RangeCase{10, 3000, 10, 3000, 0}, RangeCase{11, 3001, 12, 3000, 1},
+        RangeCase{3500, 5000, 3500, 3998, 0}}) {
+    std::vector<std::byte> key_start = BigEndianKey(range_case.key_start);
+    std::vector<std::byte> key_end = BigEndianKey(range_case.key_end);
+    int result = -1;
+    std::vector<std::vector<std::byte>> rows =
+        btree.BtreeRangeSearch(p_cursor_weak, key_start, key_end, result);
+    EXPECT_EQ(result, range_case.expected_result);
+    std::vector<std::vector<std::byte>> expected_rows;
+    for (u32 key = range_case.first_key; key <= range_case.last_key;
+         key += 2) {
+      expected_rows.push_back(BigEndianKey(key * 3));
+    }
+    EXPECT_EQ(rows, expected_rows) << "range from " << range_case.key_start;
+  }
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+// A key made of a long prefix shared by every row and a big-endian suffix
+static std::vector<std::byte> PrefixedKey(u32 value) {
+  std::vector<std::byte> key =
+      Btree::StringToByteVector("warehouse/eu-west-1/orders/2024/customer/");
+  std::vector<std::byte> suffix = BigEndianKey(value);
+  key.insert(key.end(), suffix.begin(), suffix.end());
+  return key;
+}
+
+// Runs a range scan to the end and returns the whole keys it visited
+static std::vector<std::vector<std::byte>> ScanKeys(Btree &btree,
+                                                    PageNumber root_page_number,
+                                                    bool reverse) {
+  BtRange range;
+  range.reverse = reverse;
+  BtRangeIterator iterator;
+  std::vector<std::vector<std::byte>> keys;
+  EXPECT_EQ(btree.BtreeRangeBegin(root_page_number, range, iterator),
+            ResultCode::kOk);
+  bool has_row = true;
+  while (true) {
+    EXPECT_EQ(btree.BtreeRangeNext(iterator, has_row), ResultCode::kOk);
+    if (!has_row) {
+      break;
+    }
+    PayloadView key;
+    EXPECT_EQ(btree.BtreeRangeKey(iterator, key), ResultCode::kOk);
+    keys.emplace_back(key.data, key.data + key.size);
+  }
+  EXPECT_EQ(btree.BtreeRangeEnd(iterator), ResultCode::kOk);
+  return keys;
+}
+
+TEST(PrefixCompressionTest, PacksSharedPrefixKeysIntoFewerPages) {
+  std::string filenames[2] = {"test_PacksSharedPrefixKeys_plain.db",
+                              "test_PacksSharedPrefixKeys_compressed.db"};
+  u32 page_counts[2];
+  for (int compress = 0; compress < 2; ++compress) {
+    std::remove(filenames[compress].c_str());
+    std::remove((filenames[compress] + "-journal").c_str());
+  }
+  ResultCode rc;
+  Btree plain_btree(filenames[0], 1000);
+  Btree btree(filenames[1], 1000);
+  rc = btree.BtreeSetKeyPrefixCompression(true);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 1: Fill the same rows into a plain and a compressed table
+  PageNumber root_page_number = 0;
+  std::vector<std::vector<std::byte>> expected_keys;
+  for (int compress = 0; compress < 2; ++compress) {
+    Btree &b = compress ? btree : plain_btree;
+    rc = b.BtreeBeginTrans();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = b.BtreeCreateTable(root_page_number);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::weak_ptr<BtCursor> p_cursor_weak;
+    rc = b.BtCursorCreate(root_page_number, true, p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::vector<KeyDataPair> batch;
+    for (u32 value = 0; value < 2000; ++value) {
+      batch.emplace_back(PrefixedKey(value), BigEndianKey(value));
+    }
+    rc = b.BtreeInsertBatch(p_cursor_weak, batch);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    rc = b.BtCursorClose(p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    page_counts[compress] = b.BtreePageCount();
+  }
+  EXPECT_LT(2 * page_counts[1], page_counts[0]);
+
+  // Step 2: Every row of the compressed table is found and scanned in order
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  int result = 0;
+  for (u32 value = 0; value < 2000; ++value) {
+    std::vector<std::byte> key = PrefixedKey(value);
+    EXPECT_EQ(btree.BtreeSearch(p_cursor_weak, key, result),
+              BigEndianKey(value));
+    expected_keys.push_back(key);
+  }
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(ScanKeys(btree, root_page_number, false), expected_keys);
+
+  // Step 3: Keys without the prefix turn compression off for the pages they
+  // land on, and the table stays whole
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::vector<KeyDataPair> batch;
+  for (u32 value = 0; value < 100; ++value) {
+    batch.emplace_back(BigEndianKey(value), BigEndianKey(value));
+  }
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  for (u32 value = 100; value-- > 0;) {
+    expected_keys.insert(expected_keys.begin(), BigEndianKey(value));
+  }
+  for (u32 value = 0; value < 2000; value += 7) {
+    std::vector<std::byte> key = PrefixedKey(value);
+    EXPECT_EQ(btree.BtreeSearch(p_cursor_weak, key, result),
+              BigEndianKey(value));
+    key = BigEndianKey(value % 100);
+    EXPECT_EQ(btree.BtreeSearch(p_cursor_weak, key, result), key);
+  }
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(ScanKeys(btree, root_page_number, false), expected_keys);
+  std::reverse(expected_keys.begin(), expected_keys.end());
+  EXPECT_EQ(ScanKeys(btree, root_page_number, true), expected_keys);
+}
+
+TEST(SlottedPageTest, ReusesFreedSpaceAndSurvivesReopen) {
+  std::string filename = "test_ReusesFreedSpace.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  PageNumber root_page_number = 0;
+  {
+    Btree btree(filename, 1000);
+    rc = btree.BtreeBeginTrans();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeCreateTable(root_page_number);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::weak_ptr<BtCursor> p_cursor_weak;
+    rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::vector<KeyDataPair> batch;
+    for (u32 value = 0; value < 1000; ++value) {
+      batch.emplace_back(BigEndianKey(value),
+                         std::vector<std::byte>(value % 13, std::byte{1}));
+    }
+    rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+    ASSERT_EQ(rc, ResultCode::kOk);
+
+    // Step 1: Deleting cells leaves free blocks and fragments between the
+    // remaining ones
+    int result = 0;
+    for (u32 value = 0; value < 1000; value += 3) {
+      std::vector<std::byte> key = BigEndianKey(value);
+      rc = btree.BtreeMoveTo(p_cursor_weak, key, result);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      EXPECT_EQ(result, 0);
+      rc = btree.BtreeDelete(p_cursor_weak);
+      EXPECT_EQ(rc, ResultCode::kOk);
+    }
+
+    // Step 2: Reinserting with other sizes reuses that space
+    batch.clear();
+    for (u32 value = 0; value < 1000; value += 3) {
+      batch.emplace_back(BigEndianKey(value),
+                         std::vector<std::byte>(value % 7, std::byte{2}));
+    }
+    rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtCursorClose(p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeCommit();
+    EXPECT_EQ(rc, ResultCode::kOk);
+  }
+
+  // Step 3: The pages are read back from the cell directory alone
+  Btree btree(filename, 1000);
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, false, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  int result = 0;
+  std::vector<std::vector<std::byte>> expected_keys;
+  for (u32 value = 0; value < 1000; ++value) {
+    std::vector<std::byte> key = BigEndianKey(value);
+    std::vector<std::byte> data =
+        value % 3 == 0 ? std::vector<std::byte>(value % 7, std::byte{2})
+                       : std::vector<std::byte>(value % 13, std::byte{1});
+    std::vector<std::byte> found = btree.BtreeSearch(p_cursor_weak, key, result);
+    EXPECT_EQ(result, 0);
+    EXPECT_EQ(found, data);
+    expected_keys.push_back(key);
+  }
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(ScanKeys(btree, root_page_number, false), expected_keys);
+}
+
+// An 8-byte key that is big-endian too, with value in both halves
+static std::vector<std::byte> BigEndianKey64(u32 value) {
+  std::vector<std::byte> key = BigEndianKey(value * 7919);
+  std::vector<std::byte> low = BigEndianKey(value);
+  key.insert(key.end(), low.begin(), low.end());
+  return key;
+}
+
+TEST(FixedKeyTest, SearchesIntegerKeysAndFallsBackForOtherKeys) {
+  std::string filename = "test_SearchesIntegerKeys.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  Btree btree(filename, 1000);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  PageNumber root_page_number = 0;
+  rc = btree.BtreeCreateTable(root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 1: Every page of a table with 8-byte keys has a key array
+  std::vector<u32> values(3000);
+  for (u32 i = 0; i < values.size(); ++i) {
+    values[i] = 2 * i;
+  }
+  std::shuffle(values.begin(), values.end(), std::mt19937(16));
+  std::vector<KeyDataPair> batch;
+  for (u32 value : values) {
+    batch.emplace_back(BigEndianKey64(value), BigEndianKey(value));
+  }
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  int result = 0;
+  for (u32 value = 0; value < 6000; ++value) {
+    std::vector<std::byte> key = BigEndianKey64(value);
+    std::vector<std::byte> data = btree.BtreeSearch(p_cursor_weak, key, result);
+    if (value % 2 == 0) {
+      EXPECT_EQ(result, 0);
+      EXPECT_EQ(data, BigEndianKey(value));
+    } else {
+      EXPECT_TRUE(data.empty());
+    }
+  }
+
+  // Step 2: 4-byte keys turn the key array off for the pages they land on,
+  // and searches still find every row
+  batch.clear();
+  for (u32 value = 0; value < 300; ++value) {
+    batch.emplace_back(BigEndianKey(value * 13), BigEndianKey(value));
+  }
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  for (u32 value = 0; value < 300; ++value) {
+    std::vector<std::byte> key = BigEndianKey(value * 13);
+    EXPECT_EQ(btree.BtreeSearch(p_cursor_weak, key, result),
+              BigEndianKey(value));
+  }
+  for (u32 value = 0; value < 6000; value += 2) {
+    std::vector<std::byte> key = BigEndianKey64(value);
+    EXPECT_EQ(btree.BtreeSearch(p_cursor_weak, key, result),
+              BigEndianKey(value));
+  }
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 3: So does a key on overflow pages
+  rc = btree.BtreeCreateTable(root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  batch.clear();
+  for (u32 value = 0; value < 10; value += 2) {
+    batch.emplace_back(BigEndianKey64(value), BigEndianKey(value));
+  }
+  batch.emplace_back(BigEndianKey64(1),
+                     std::vector<std::byte>(MaxLocalPayload(kDefaultPageSize),
+                                            std::byte{3}));
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  for (u32 value = 0; value < 10; value += 2) {
+    std::vector<std::byte> key = BigEndianKey64(value);
+    EXPECT_EQ(btree.BtreeSearch(p_cursor_weak, key, result),
+              BigEndianKey(value));
+  }
+  std::vector<std::byte> key = BigEndianKey64(1);
+  rc = btree.BtreeMoveTo(p_cursor_weak, key, result);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(result, 0);
+  std::vector<std::byte> data;
+  btree.BtreeData(p_cursor_weak, 0, MaxLocalPayload(kDefaultPageSize), data);
+  EXPECT_EQ(data, std::vector<std::byte>(MaxLocalPayload(kDefaultPageSize),
+                                         std::byte{3}));
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtreeCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+TEST(FixedKeyTest, SurvivesRandomInsertsAndDeletes) {
+  std::string filename = "test_SurvivesRandomInsertsAndDeletes.db";
+  ResultCode rc;
+  for (u32 seed = 1; seed <= 8; seed++) {
+    std::remove(filename.c_str());
+    std::remove((filename + "-journal").c_str());
+    Btree btree(filename, 1000);
+    rc = btree.BtreeBeginTrans();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    PageNumber root_page_number = 0;
+    rc = btree.BtreeCreateTable(root_page_number);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::weak_ptr<BtCursor> p_cursor_weak;
+    rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+
+    // Step 1: Insert and delete 8-byte keys at random, with data of random
+    // size so that pages split and merge
+    std::mt19937 rng(seed);
+    std::map<u32, std::vector<std::byte>> rows;
+    for (u32 op = 0; op < 400; op++) {
+      int result = 0;
+      if (rows.empty() || rng() % 3 != 0) {
+        u32 value = rng() % 500;
+        std::vector<std::byte> key = BigEndianKey64(value);
+        std::vector<std::byte> data(8 + rng() % 120, std::byte(value));
+        rc = btree.BtreeMoveTo(p_cursor_weak, key, result);
+        ASSERT_EQ(rc, ResultCode::kOk) << "seed " << seed << " op " << op;
+        rc = btree.BtreeInsert(p_cursor_weak, key, data);
+        ASSERT_EQ(rc, ResultCode::kOk) << "seed " << seed << " op " << op;
+        rows[value] = data;
+      } else {
+        auto it = rows.begin();
+        std::advance(it, rng() % rows.size());
+        std::vector<std::byte> key = BigEndianKey64(it->first);
+        rc = btree.BtreeMoveTo(p_cursor_weak, key, result);
+        ASSERT_EQ(rc, ResultCode::kOk) << "seed " << seed << " op " << op;
+        ASSERT_EQ(result, 0) << "seed " << seed << " op " << op;
+        rc = btree.BtreeDelete(p_cursor_weak);
+        ASSERT_EQ(rc, ResultCode::kOk) << "seed " << seed << " op " << op;
+        rows.erase(it);
+      }
+    }
+
+    // Step 2: Every remaining row is found, and only those
+    for (u32 value = 0; value < 500; value++) {
+      std::vector<std::byte> key = BigEndianKey64(value);
+      int result = 0;
+      std::vector<std::byte> data =
+          btree.BtreeSearch(p_cursor_weak, key, result);
+      auto it = rows.find(value);
+      if (it != rows.end()) {
+        EXPECT_EQ(result, 0) << "seed " << seed << " value " << value;
+        EXPECT_EQ(data, it->second) << "seed " << seed << " value " << value;
+      } else {
+        EXPECT_TRUE(data.empty()) << "seed " << seed << " value " << value;
+      }
+    }
+    rc = btree.BtCursorClose(p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeCommit();
+    EXPECT_EQ(rc, ResultCode::kOk);
+  }
+}
+
+// With the pager in memory-mapped mode, clean pages are read-only views of the
+// file, so a btree that changed a page without SqlitePagerWrite would crash.
+// The cache is small, so mapped pages are also evicted and mapped again.
+TEST(MemoryMappedTest, ChangesPagesOnlyThroughThePager) {
+  std::string filename = "test_ChangesPagesOnlyThroughThePager.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  PageNumber root_page_number = 0;
+  std::map<u32, std::vector<std::byte>> rows;
+  {
+    Btree btree(filename, 10);
+    rc = btree.BtreeBeginTrans();
+    ASSERT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeCreateTable(root_page_number);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::weak_ptr<BtCursor> p_cursor_weak;
+    rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    for (u32 value = 0; value < 300; value++) {
+      std::vector<std::byte> key = BigEndianKey(value);
+      std::vector<std::byte> data(40, std::byte(value));
+      rc = btree.BtreeInsert(p_cursor_weak, key, data);
+      ASSERT_EQ(rc, ResultCode::kOk) << "value " << value;
+      rows[value] = data;
+    }
+    rc = btree.BtCursorClose(p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeCommit();
+    ASSERT_EQ(rc, ResultCode::kOk);
+  }
+
+  // Step 1: Each transaction inserts, replaces and deletes rows of the
+  // pages the previous one committed, which are now mapped
+  {
+    Btree btree(filename, 10, PageIoMode::MEMORY_MAPPED);
+    std::mt19937 rng(7);
+    for (u32 trans = 0; trans < 3; trans++) {
+      rc = btree.BtreeBeginTrans();
+      ASSERT_EQ(rc, ResultCode::kOk);
+      std::weak_ptr<BtCursor> p_cursor_weak;
+      rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      for (u32 op = 0; op < 100; op++) {
+        int result = 0;
+        if (rng() % 2 == 0) {
+          u32 value = rng() % 400;
+          std::vector<std::byte> key = BigEndianKey(value);
+          std::vector<std::byte> data(8 + rng() % 60, std::byte(op));
+          rc = btree.BtreeMoveTo(p_cursor_weak, key, result);
+          ASSERT_EQ(rc, ResultCode::kOk) << "trans " << trans << " op " << op;
+          rc = btree.BtreeInsert(p_cursor_weak, key, data);
+          ASSERT_EQ(rc, ResultCode::kOk) << "trans " << trans << " op " << op;
+          rows[value] = data;
+        } else {
+          auto it = rows.begin();
+          std::advance(it, rng() % rows.size());
+          std::vector<std::byte> key = BigEndianKey(it->first);
+          rc = btree.BtreeMoveTo(p_cursor_weak, key, result);
+          ASSERT_EQ(rc, ResultCode::kOk) << "trans " << trans << " op " << op;
+          ASSERT_EQ(result, 0) << "trans " << trans << " op " << op;
+          rc = btree.BtreeDelete(p_cursor_weak);
+          ASSERT_EQ(rc, ResultCode::kOk) << "trans " << trans << " op " << op;
+          rows.erase(it);
+        }
+      }
+      rc = btree.BtCursorClose(p_cursor_weak);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeCommit();
+      ASSERT_EQ(rc, ResultCode::kOk);
+    }
+  }
+
+  // Step 2: The file holds exactly the rows left
+  Btree btree(filename, 100);
+  rc = btree.BtreeBeginTrans();
+  ASSERT_EQ(rc, ResultCode::kOk);
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, false, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  for (u32 value = 0; value < 400; value++) {
+    std::vector<std::byte> key = BigEndianKey(value);
+    int result = 0;
+    std::vector<std::byte> data = btree.BtreeSearch(p_cursor_weak, key, result);
+    auto it = rows.find(value);
+    if (it != rows.end()) {
+      EXPECT_EQ(result, 0) << "value " << value;
+      EXPECT_EQ(data, it->second) << "value " << value;
+    } else {
+      EXPECT_TRUE(data.empty()) << "value " << value;
+    }
+  }
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtreeCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+TEST(LookupTest, ViewsDataOnThePinnedLeafOrInTheBuffer) {
+  std::string filename = "test_ViewsDataOnThePinnedLeaf.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  Btree btree(filename, 1000);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  PageNumber root_page_number = 0;
+  rc = btree.BtreeCreateTable(root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::vector<KeyDataPair> batch;
+  for (u32 value = 0; value < 1000; value += 2) {
+    batch.emplace_back(BigEndianKey(value), BigEndianKey(value * 3));
+  }
+  std::vector<std::byte> big_data(3 * MaxLocalPayload(kDefaultPageSize));
+  for (u32 i = 0; i < big_data.size(); ++i) {
+    big_data[i] = std::byte(i);
+  }
+  batch.emplace_back(BigEndianKey(1), big_data);
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 1: Every row is found, and no other
+  BtLookup lookup;
+  rc = btree.BtreeLookupBegin(root_page_number, lookup);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(btree.BtreeLookupBegin(root_page_number, lookup),
+            ResultCode::kMisuse);
+  std::vector<std::byte> key(4);
+  PayloadView data;
+  bool found = false;
+  for (u32 value = 2; value < 1000; ++value) {
+    key = BigEndianKey(value);
+    rc = btree.BtreeLookup(lookup, key, data, found);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    EXPECT_EQ(found, value % 2 == 0);
+    if (value % 2 == 0) {
+      EXPECT_EQ(std::vector<std::byte>(data.data, data.data + data.size),
+                BigEndianKey(value * 3));
+    } else {
+      EXPECT_EQ(data.size, 0);
+    }
+  }
+
+  // Step 2: Data on overflow pages is viewed in the handle's buffer
+  key = BigEndianKey(1);
+  rc = btree.BtreeLookup(lookup, key, data, found);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_TRUE(found);
+  EXPECT_EQ(std::vector<std::byte>(data.data, data.data + data.size), big_data);
+  rc = btree.BtreeLookupEnd(lookup);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(btree.BtreeLookupEnd(lookup), ResultCode::kMisuse);
+
+  // Step 3: BtreeSearch reads the same row through the overflow pages
+  rc = btree.BtCursorCreate(root_page_number, false, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  int result = 0;
+  EXPECT_EQ(btree.BtreeSearch(p_cursor_weak, key, result), big_data);
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtreeCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+TEST(MultiGetTest, SharesDescentsBetweenNeighbouringKeys) {
+  std::string filename = "test_SharesDescents.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  Btree btree(filename, 1000);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  PageNumber root_page_number = 0;
+  rc = btree.BtreeCreateTable(root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::vector<KeyDataPair> batch;
+  for (u32 value = 0; value < 6000; value += 2) {
+    batch.emplace_back(BigEndianKey(value), BigEndianKey(value * 3));
+  }
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 1: A shuffled run of keys, half of them missing and some repeated
+  std::vector<std::vector<std::byte>> keys;
+  for (u32 value = 1000; value < 3000; ++value) {
+    keys.push_back(BigEndianKey(value));
+  }
+  keys.push_back(BigEndianKey(1500));
+  keys.push_back(BigEndianKey(9999));
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(18));
+  std::vector<std::vector<std::byte>> keys_given = keys;
+  std::vector<std::optional<std::vector<std::byte>>> results;
+  PagerCacheStats stats_before = btree.BtreeCacheStats();
+  rc = btree.BtreeMultiGet(root_page_number, keys, results);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  PagerCacheStats stats_after = btree.BtreeCacheStats();
+  u32 multi_get_page_gets = stats_after.num_hits + stats_after.num_misses -
+                            stats_before.num_hits - stats_before.num_misses;
+  EXPECT_EQ(keys, keys_given);
+  ASSERT_EQ(results.size(), keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    u32 value = (std::to_integer<u32>(keys[i][0]) << 24) |
+                (std::to_integer<u32>(keys[i][1]) << 16) |
+                (std::to_integer<u32>(keys[i][2]) << 8) |
+                std::to_integer<u32>(keys[i][3]);
+    if (value % 2 == 0 && value < 6000) {
+      ASSERT_TRUE(results[i].has_value());
+      EXPECT_EQ(*results[i], BigEndianKey(value * 3));
+    } else {
+      EXPECT_FALSE(results[i].has_value());
+    }
+  }
+
+  // Step 2: The same lookups one by one get many more pages from the cache
+  rc = btree.BtCursorCreate(root_page_number, false, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  stats_before = btree.BtreeCacheStats();
+  int result = 0;
+  for (std::vector<std::byte> &key : keys) {
+    btree.BtreeSearch(p_cursor_weak, key, result);
+  }
+  stats_after = btree.BtreeCacheStats();
+  u32 search_page_gets = stats_after.num_hits + stats_after.num_misses -
+                         stats_before.num_hits - stats_before.num_misses;
+  EXPECT_LT(4 * multi_get_page_gets, search_page_gets);
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtreeCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+TEST(LeafChainTest, WalksBackwardsAfterSplitsAndMerges) {
+  std::string filename = "test_WalksBackwards.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  Btree btree(filename, 1000);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  PageNumber root_page_number = 0;
+  rc = btree.BtreeCreateTable(root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  // Step 1: Split leaves all over the tree by inserting the odd keys between
+  // the even ones, then merge some of them again with deletes
+  for (u32 parity = 0; parity < 2; ++parity) {
+    std::vector<KeyDataPair> batch;
+    for (u32 value = parity; value < 3000; value += 2) {
+      batch.emplace_back(BigEndianKey(value),
+                         std::vector<std::byte>(20, std::byte{3}));
+    }
+    rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+    ASSERT_EQ(rc, ResultCode::kOk);
+  }
+  int result = 0;
+  for (u32 value = 0; value < 3000; ++value) {
+    if (value % 4 == 1) {
+      std::vector<std::byte> key = BigEndianKey(value);
+      rc = btree.BtreeMoveTo(p_cursor_weak, key, result);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      EXPECT_EQ(result, 0);
+      rc = btree.BtreeDelete(p_cursor_weak);
+      ASSERT_EQ(rc, ResultCode::kOk);
+    }
+  }
+  std::vector<std::vector<std::byte>> expected_keys;
+  for (u32 value = 3000; value-- > 0;) {
+    if (value % 4 != 1) {
+      expected_keys.push_back(BigEndianKey(value));
+    }
+  }
+
+  // Step 2: The backward links visit every key in descending order
+  bool table_is_empty = false;
+  rc = btree.BtreeLast(p_cursor_weak, table_is_empty);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_FALSE(table_is_empty);
+  std::vector<std::vector<std::byte>> scanned_keys;
+  bool already_at_first_entry = false;
+  while (!already_at_first_entry) {
+    std::vector<std::byte> key;
+    btree.BtreeKey(p_cursor_weak, 0, 4, key);
+    scanned_keys.push_back(key);
+    rc = btree.BtreeLinkedListPrev(p_cursor_weak, already_at_first_entry);
+    ASSERT_EQ(rc, ResultCode::kOk);
+  }
+  EXPECT_EQ(scanned_keys, expected_keys);
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(ScanKeys(btree, root_page_number, true), expected_keys);
+  rc = btree.BtreeCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+TEST(CursorRefTest, ValidatesOnceAndNoticesClose) {
+  std::string filename = "test_ValidatesOnce.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  Btree btree(filename, 1000);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  PageNumber root_page_number = 0;
+  rc = btree.BtreeCreateTable(root_page_number);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::vector<KeyDataPair> batch;
+  for (u32 value = 0; value < 2000; value += 2) {
+    batch.emplace_back(BigEndianKey(value), BigEndianKey(value + 1));
+  }
+  rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+  ASSERT_EQ(rc, ResultCode::kOk);
+
+  // Step 1: The handle sees the same rows as the weak pointer
+  BtCursorRef cursor_ref;
+  EXPECT_FALSE(cursor_ref.IsOpen());
+  rc = btree.BtCursorGetRef(p_cursor_weak, cursor_ref);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  BtCursorRef moved_cursor_ref = std::move(cursor_ref);
+  EXPECT_TRUE(moved_cursor_ref.IsOpen());
+  for (u32 value = 500; value < 600; ++value) {
+    std::vector<std::byte> key = BigEndianKey(value);
+    int result = 0;
+    rc = btree.BtreeMoveTo(moved_cursor_ref, key, result);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    EXPECT_EQ(result == 0, value % 2 == 0);
+    int compare_result = 0;
+    rc = btree.BtreeKeyCompare(moved_cursor_ref, key, 0, compare_result);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    EXPECT_EQ(compare_result, result);
+    if (result == 0) {
+      u32 data_size = 0;
+      rc = btree.BtreeDataSize(moved_cursor_ref, data_size);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      std::vector<std::byte> data;
+      EXPECT_EQ(btree.BtreeData(moved_cursor_ref, 0, data_size, data), 4u);
+      EXPECT_EQ(data, BigEndianKey(value + 1));
+    }
+  }
+  std::vector<std::byte> key = BigEndianKey(598);
+  int result = 0;
+  rc = btree.BtreeMoveTo(moved_cursor_ref, key, result);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  bool already_at_last_entry = false;
+  rc = btree.BtreeNext(moved_cursor_ref, already_at_last_entry);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  btree.BtreeKey(p_cursor_weak, 0, 4, key);
+  EXPECT_EQ(key, BigEndianKey(600));
+
+  // Step 2: Closing the cursor through the weak pointer invalidates the handle
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_FALSE(moved_cursor_ref.IsOpen());
+  u32 key_size = 0;
+  EXPECT_EQ(btree.BtreeKeySize(moved_cursor_ref, key_size),
+            ResultCode::kError);
+  EXPECT_EQ(btree.BtreeMoveTo(moved_cursor_ref, key, result),
+            ResultCode::kError);
+  EXPECT_EQ(btree.BtreeKey(moved_cursor_ref, 0, 4, key), 0u);
+  EXPECT_EQ(btree.BtCursorGetRef(p_cursor_weak, cursor_ref),
+            ResultCode::kError);
+  rc = btree.BtreeCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+TEST(ExtentTest, KeepsLeavesOfInterleavedTablesTogether) {
+  std::string filename = "test_KeepsLeavesTogether.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  PageNumber root_page_numbers[2] = {0, 0};
+  const u32 num_rounds = 30;
+  const u32 num_keys_per_round = 50 * kDefaultPageSize / 1024;
+  {
+    Btree btree(filename, 1000);
+    rc = btree.BtreeBeginTrans();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    for (PageNumber &root_page_number : root_page_numbers) {
+      rc = btree.BtreeCreateTable(root_page_number);
+      EXPECT_EQ(rc, ResultCode::kOk);
+    }
+
+    // Step 1: The two tables grow in turns, so a page taken from the end of
+    // the file would alternate between them
+    for (u32 round = 0; round < num_rounds; round++) {
+      for (PageNumber root_page_number : root_page_numbers) {
+        std::weak_ptr<BtCursor> p_cursor_weak;
+        rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+        EXPECT_EQ(rc, ResultCode::kOk);
+        std::vector<KeyDataPair> batch;
+        for (u32 i = 0; i < num_keys_per_round; i++) {
+          u32 value = round * num_keys_per_round + i;
+          batch.emplace_back(BigEndianKey(value),
+                             std::vector<std::byte>(20, std::byte{7}));
+        }
+        rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+        ASSERT_EQ(rc, ResultCode::kOk);
+        rc = btree.BtCursorClose(p_cursor_weak);
+        EXPECT_EQ(rc, ResultCode::kOk);
+      }
+    }
+
+    // Step 2: Each table's leaves still come in a few long runs
+    for (PageNumber root_page_number : root_page_numbers) {
+      u32 num_leaves = 0;
+      u32 num_runs = 0;
+      rc = btree.BtreeLeafRuns(root_page_number, num_leaves, num_runs);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      EXPECT_GT(num_leaves, 40);
+      EXPECT_LE(num_runs * 4, num_leaves);
+    }
+    rc = btree.BtreeCommit();
+    EXPECT_EQ(rc, ResultCode::kOk);
+  }
+
+  // Step 3: The pages the extents did not hand out went to the free list, and
+  // both tables read back in full after reopening and take more rows
+  Btree btree(filename, 1000);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  std::vector<std::vector<std::byte>> expected_keys;
+  for (u32 value = 0; value < num_rounds * num_keys_per_round; value++) {
+    expected_keys.push_back(BigEndianKey(value));
+  }
+  for (PageNumber root_page_number : root_page_numbers) {
+    EXPECT_EQ(ScanKeys(btree, root_page_number, false), expected_keys);
+    std::weak_ptr<BtCursor> p_cursor_weak;
+    rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::vector<KeyDataPair> batch;
+    for (u32 value = num_rounds * num_keys_per_round;
+         value < (num_rounds + 4) * num_keys_per_round; value++) {
+      batch.emplace_back(BigEndianKey(value),
+                         std::vector<std::byte>(20, std::byte{8}));
+    }
+    rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtCursorClose(p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+  }
+  rc = btree.BtreeCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  for (u32 value = num_rounds * num_keys_per_round;
+       value < (num_rounds + 4) * num_keys_per_round; value++) {
+    expected_keys.push_back(BigEndianKey(value));
+  }
+  for (PageNumber root_page_number : root_page_numbers) {
+    EXPECT_EQ(ScanKeys(btree, root_page_number, false), expected_keys);
+  }
+}
+
+TEST(VacuumTest, MovesPagesForwardAndShrinksTheFile) {
+  std::string filename = "test_MovesPagesForward.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  PageNumber kept_root_page_number = 0;
+  const u32 num_keys = 2000;
+  auto data_of = [](u32 value) {
+    return std::vector<std::byte>(
+        value % 50 == 0 ? MaxLocalPayload(kDefaultPageSize) + 300 : 20,
+        std::byte(value));
+  };
+  std::vector<std::vector<std::byte>> expected_keys;
+  for (u32 value = 0; value < num_keys; value++) {
+    expected_keys.push_back(BigEndianKey(value));
+  }
+  u32 num_full_pages = 0;
+  {
+    Btree btree(filename, 1000);
+    rc = btree.BtreeBeginTrans();
+    EXPECT_EQ(rc, ResultCode::kOk);
+
+    // Step 1: Two tables grow side by side, then one of them is dropped,
+    // which leaves free pages all over the file
+    PageNumber dropped_root_page_number = 0;
+    rc = btree.BtreeCreateTable(kept_root_page_number);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeCreateTable(dropped_root_page_number);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    for (u32 round = 0; round < 10; round++) {
+      for (PageNumber root_page_number :
+           {kept_root_page_number, dropped_root_page_number}) {
+        std::weak_ptr<BtCursor> p_cursor_weak;
+        rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+        EXPECT_EQ(rc, ResultCode::kOk);
+        std::vector<KeyDataPair> batch;
+        for (u32 value = round * num_keys / 10;
+             value < (round + 1) * num_keys / 10; value++) {
+          batch.emplace_back(BigEndianKey(value), data_of(1));
+        }
+        rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+        ASSERT_EQ(rc, ResultCode::kOk);
+        // every row gets its own data, which spills onto overflow pages for
+        // every 50th row
+        for (KeyDataPair &pair : batch) {
+          int result = 0;
+          rc = btree.BtreeMoveTo(p_cursor_weak, pair.first, result);
+          EXPECT_EQ(rc, ResultCode::kOk);
+          std::vector<std::byte> data = data_of(
+              (static_cast<u32>(pair.first[2]) << 8) | static_cast<u32>(pair.first[3]));
+          rc = btree.BtreeInsert(p_cursor_weak, pair.first, data);
+          ASSERT_EQ(rc, ResultCode::kOk);
+        }
+        rc = btree.BtCursorClose(p_cursor_weak);
+        EXPECT_EQ(rc, ResultCode::kOk);
+      }
+    }
+    rc = btree.BtreeDropTable(dropped_root_page_number);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeCommit();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    num_full_pages = btree.BtreePageCount();
+
+    // Step 2: A vacuum that is rolled back changes nothing
+    BtVacuumStats stats;
+    rc = btree.BtreeBeginTrans();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeIncrementalVacuum({kept_root_page_number}, 20, stats);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    EXPECT_EQ(stats.num_pages_truncated, 20);
+    EXPECT_EQ(stats.num_bytes_reclaimed, 20 * kDefaultPageSize);
+    EXPECT_GT(stats.num_pages_moved, 0);
+    rc = btree.BtreeRollback();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    EXPECT_EQ(btree.BtreePageCount(), num_full_pages);
+    EXPECT_EQ(ScanKeys(btree, kept_root_page_number, false), expected_keys);
+
+    // Step 3: Vacuum 20 pages per transaction until the file stops shrinking.
+    // The tables are only read again after the insert of the second call.
+    u32 num_truncated = 0;
+    u32 num_calls = 0;
+    do {
+      rc = btree.BtreeBeginTrans();
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeIncrementalVacuum({kept_root_page_number}, 20, stats);
+      ASSERT_EQ(rc, ResultCode::kOk);
+      if (num_calls == 0 || num_calls == 2) {
+        EXPECT_GT(stats.num_pages_scanned, 0) << "call " << num_calls;
+      } else {
+        EXPECT_EQ(stats.num_pages_scanned, 0) << "call " << num_calls;
+      }
+      if (num_calls == 1) {
+        std::weak_ptr<BtCursor> p_cursor_weak;
+        rc = btree.BtCursorCreate(kept_root_page_number, true, p_cursor_weak);
+        EXPECT_EQ(rc, ResultCode::kOk);
+        std::vector<std::byte> key = BigEndianKey(num_keys);
+        std::vector<std::byte> data = data_of(num_keys);
+        rc = btree.BtreeInsert(p_cursor_weak, key, data);
+        EXPECT_EQ(rc, ResultCode::kOk);
+        rc = btree.BtCursorClose(p_cursor_weak);
+        EXPECT_EQ(rc, ResultCode::kOk);
+        expected_keys.push_back(key);
+      }
+      rc = btree.BtreeCommit();
+      EXPECT_EQ(rc, ResultCode::kOk);
+      num_truncated += stats.num_pages_truncated;
+      num_calls++;
+    } while (stats.num_pages_truncated != 0);
+    EXPECT_GT(num_calls, 3);
+    EXPECT_EQ(stats.num_free_pages_left, 0);
+    EXPECT_GT(num_truncated * 3, num_full_pages);
+    EXPECT_EQ(btree.BtreePageCount(), num_full_pages - num_truncated);
+  }
+
+  // Step 4: The file is cut, and the table reads back in full both ways
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  u32 file_size = static_cast<u32>(file.tellg());
+  Btree btree(filename, 1000);
+  EXPECT_EQ(file_size, btree.BtreePageCount() * kDefaultPageSize);
+  EXPECT_LT(btree.BtreePageCount(), num_full_pages);
+  EXPECT_EQ(ScanKeys(btree, kept_root_page_number, false), expected_keys);
+  std::reverse(expected_keys.begin(), expected_keys.end());
+  EXPECT_EQ(ScanKeys(btree, kept_root_page_number, true), expected_keys);
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(kept_root_page_number, false, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  for (u32 value = 0; value < num_keys; value += 25) {
+    std::vector<std::byte> key = BigEndianKey(value);
+    int result = 0;
+    EXPECT_EQ(btree.BtreeSearch(p_cursor_weak, key, result), data_of(value));
+    EXPECT_EQ(result, 0);
+  }
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+TEST(FreeMapTest, ReusesFreePagesAndReportsFreeSpace) {
+  std::string filename = "test_ReusesFreePages.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  PageNumber root_page_numbers[2] = {0, 0};
+  const u32 num_rounds = 10;
+  const u32 num_keys_per_round = 150 * kDefaultPageSize / 1024;
+  const u32 num_keys = num_rounds * num_keys_per_round;
+  std::vector<std::vector<std::byte>> expected_keys;
+  for (u32 value = 0; value < num_keys; value++) {
+    expected_keys.push_back(BigEndianKey(value));
+  }
+  auto insert_keys = [&rc](Btree &btree, PageNumber root_page_number,
+                           u32 first_value, u32 end_value) {
+    std::weak_ptr<BtCursor> p_cursor_weak;
+    rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::vector<KeyDataPair> batch;
+    for (u32 value = first_value; value < end_value; value++) {
+      batch.emplace_back(BigEndianKey(value),
+                         std::vector<std::byte>(20, std::byte{7}));
+    }
+    rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtCursorClose(p_cursor_weak);
+    EXPECT_EQ(rc, ResultCode::kOk);
+  };
+  BtFreeSpaceStats free_space_stats;
+  {
+    Btree btree(filename, 1000);
+    rc = btree.BtreeSetFreeSpaceFormat(FreeSpaceFormat::kBitmap);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeBeginTrans();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    for (PageNumber &root_page_number : root_page_numbers) {
+      rc = btree.BtreeCreateTable(root_page_number);
+      EXPECT_EQ(rc, ResultCode::kOk);
+    }
+    // the first free map page is never handed out
+    EXPECT_EQ(root_page_numbers[0], kFirstFreeMapPage + 1);
+
+    // Step 1: The two tables grow in turns and still get leaves in long runs
+    for (u32 round = 0; round < num_rounds; round++) {
+      for (PageNumber root_page_number : root_page_numbers) {
+        insert_keys(btree, root_page_number, round * num_keys_per_round,
+                    (round + 1) * num_keys_per_round);
+      }
+    }
+    for (PageNumber root_page_number : root_page_numbers) {
+      u32 num_leaves = 0;
+      u32 num_runs = 0;
+      rc = btree.BtreeLeafRuns(root_page_number, num_leaves, num_runs);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      EXPECT_LE(num_runs * 4, num_leaves);
+    }
+    rc = btree.BtreeCommit();
+    EXPECT_EQ(rc, ResultCode::kOk);
+
+    // Step 2: The pages of a dropped table are counted on page 1 and found on
+    // the map, in long runs
+    rc = btree.BtreeBeginTrans();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeDropTable(root_page_numbers[1]);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeCommit();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeFreeSpaceStats(free_space_stats);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::array<int, kMetaIntArraySize> meta_int_arr{};
+    rc = btree.BtreeGetMeta(meta_int_arr);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    EXPECT_EQ(free_space_stats.num_pages, btree.BtreePageCount());
+    EXPECT_EQ(free_space_stats.num_free_pages, meta_int_arr[0]);
+    EXPECT_GT(free_space_stats.num_free_pages * 3, btree.BtreePageCount());
+    EXPECT_LE(free_space_stats.num_free_runs * 4,
+              free_space_stats.num_free_pages);
+    EXPECT_GE(free_space_stats.longest_free_run, 4);
+  }
+
+  // Step 3: After reopening, the database still uses the map, and the table
+  // grows into the free pages before the file grows
+  Btree btree(filename, 1000);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  u32 num_pages = btree.BtreePageCount();
+  insert_keys(btree, root_page_numbers[0], num_keys, num_keys + num_keys / 2);
+  rc = btree.BtreeCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  for (u32 value = num_keys; value < num_keys + num_keys / 2; value++) {
+    expected_keys.push_back(BigEndianKey(value));
+  }
+  EXPECT_EQ(btree.BtreePageCount(), num_pages);
+  BtFreeSpaceStats new_free_space_stats;
+  rc = btree.BtreeFreeSpaceStats(new_free_space_stats);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_GT(new_free_space_stats.num_free_pages, 0);
+  EXPECT_LT(new_free_space_stats.num_free_pages,
+            free_space_stats.num_free_pages);
+  EXPECT_EQ(ScanKeys(btree, root_page_numbers[0], false), expected_keys);
+
+  // Step 4: Vacuum takes the rest of the free pages off the map
+  BtVacuumStats stats;
+  do {
+    rc = btree.BtreeBeginTrans();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeIncrementalVacuum({root_page_numbers[0]}, 20, stats);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeCommit();
+    EXPECT_EQ(rc, ResultCode::kOk);
+  } while (stats.num_pages_truncated != 0);
+  EXPECT_EQ(stats.num_free_pages_left, 0);
+  rc = btree.BtreeFreeSpaceStats(new_free_space_stats);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(new_free_space_stats.num_free_pages, 0);
+  EXPECT_EQ(new_free_space_stats.num_pages, btree.BtreePageCount());
+  EXPECT_EQ(ScanKeys(btree, root_page_numbers[0], false), expected_keys);
+}
+
+TEST(DropTest, FreesTablesWithoutJournalingTheirPages) {
+  for (FreeSpaceFormat format :
+       {FreeSpaceFormat::kFreeList, FreeSpaceFormat::kBitmap}) {
+    std::string filename =
+        format == FreeSpaceFormat::kBitmap ? "test_FreesTablesBitmap.db"
+                                           : "test_FreesTablesFreeList.db";
+    std::string journal_filename = filename + "-journal";
+    std::remove(filename.c_str());
+    std::remove(journal_filename.c_str());
+    ResultCode rc;
+    const u32 num_keys = 2000 * kDefaultPageSize / 1024;
+    auto data_of = [](u32 value) {
+      return std::vector<std::byte>(
+          value % 50 == 0 ? MaxLocalPayload(kDefaultPageSize) + 300 : 20,
+          std::byte(value));
+    };
+    auto journal_size = [&journal_filename]() {
+      std::ifstream file(journal_filename, std::ios::binary | std::ios::ate);
+      return static_cast<u32>(file.tellg());
+    };
+    // page 1, page 2 and, with the bitmap, the first free map page stay
+    u32 num_kept_pages = format == FreeSpaceFormat::kBitmap ? 3 : 2;
+    auto fill_table = [&](Btree &btree, PageNumber &root_page_number) {
+      rc = btree.BtreeBeginTrans();
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeCreateTable(root_page_number);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      std::weak_ptr<BtCursor> p_cursor_weak;
+      rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      std::vector<KeyDataPair> batch;
+      for (u32 value = 0; value < num_keys; value++) {
+        batch.emplace_back(BigEndianKey(value), data_of(1));
+      }
+      rc = btree.BtreeInsertBatch(p_cursor_weak, batch);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      // every 50th row spills onto overflow pages
+      for (u32 value = 0; value < num_keys; value += 50) {
+        std::vector<std::byte> key = BigEndianKey(value);
+        int result = 0;
+        rc = btree.BtreeMoveTo(p_cursor_weak, key, result);
+        EXPECT_EQ(rc, ResultCode::kOk);
+        std::vector<std::byte> data = data_of(value);
+        rc = btree.BtreeInsert(p_cursor_weak, key, data);
+        EXPECT_EQ(rc, ResultCode::kOk);
+      }
+      rc = btree.BtCursorClose(p_cursor_weak);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeCommit();
+      EXPECT_EQ(rc, ResultCode::kOk);
+    };
+    BtFreeSpaceStats free_space_stats;
+    {
+      Btree btree(filename, 1000);
+      rc = btree.BtreeSetFreeSpaceFormat(format);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      PageNumber root_page_number = 0;
+      fill_table(btree, root_page_number);
+      u32 num_pages = btree.BtreePageCount();
+
+      // Step 1: Dropping the table journals a handful of pages, not the table
+      rc = btree.BtreeBeginTrans();
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeDropTable(root_page_number);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      EXPECT_LT(journal_size(), 8 * (kDefaultPageSize + sizeof(PageNumber)));
+      rc = btree.BtreeCommit();
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeFreeSpaceStats(free_space_stats);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      EXPECT_EQ(btree.BtreePageCount(), num_pages);
+      EXPECT_EQ(free_space_stats.num_free_pages, num_pages - num_kept_pages);
+
+      // Step 2: The table is built again in the free pages, and dropped with
+      // only page 1 written
+      fill_table(btree, root_page_number);
+      EXPECT_EQ(btree.BtreePageCount(), num_pages);
+      rc = btree.BtreeBeginTrans();
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeDropTableDeferred(root_page_number);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      EXPECT_LT(journal_size(), 2 * (kDefaultPageSize + sizeof(PageNumber)));
+      rc = btree.BtreeCommit();
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeFreeSpaceStats(free_space_stats);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      EXPECT_LT(free_space_stats.num_free_pages * 10, num_pages);
+    }
+
+    // Step 3: After reopening, the pages of the dropped table are freed a few
+    // at a time
+    Btree btree(filename, 1000);
+    u32 num_calls = 0;
+    u32 num_pages_freed = 0;
+    u32 num_pages_freed_total = 0;
+    do {
+      rc = btree.BtreeBeginTrans();
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeReclaimPages(40, num_pages_freed);
+      ASSERT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeCommit();
+      EXPECT_EQ(rc, ResultCode::kOk);
+      num_pages_freed_total += num_pages_freed;
+      num_calls++;
+    } while (num_pages_freed != 0);
+    EXPECT_GT(num_calls, 4);
+    BtFreeSpaceStats new_free_space_stats;
+    rc = btree.BtreeFreeSpaceStats(new_free_space_stats);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    EXPECT_EQ(new_free_space_stats.num_free_pages,
+              free_space_stats.num_free_pages + num_pages_freed_total);
+    EXPECT_EQ(new_free_space_stats.num_free_pages,
+              btree.BtreePageCount() - num_kept_pages);
+  }
+}
+
+TEST(PageSizeTest, OpensFilesAtTheirOwnPageSize) {
+  const u32 num_keys = 600;
+  for (JournalMode mode : {JournalMode::ROLLBACK, JournalMode::WAL}) {
+    for (u32 page_size : {kMinPageSize, 1024u, 16384u, kMaxPageSize}) {
+      // every tenth row is on overflow pages, key included, so leaves also
+      // split right after such a row
+      auto data_of = [page_size](u32 value) {
+        return std::vector<std::byte>(
+            value % 10 == 0 ? MaxLocalPayload(page_size) + 300 : 20,
+            std::byte(value));
+      };
+      std::string filename = "test_OpensFilesAtTheirOwnPageSize.db";
+      std::remove(filename.c_str());
+      std::remove((filename + "-journal").c_str());
+      std::remove((filename + "-wal").c_str());
+      ResultCode rc;
+      PageNumber root_page_number = 0;
+
+      // Step 1: A new database is created with the chosen page size
+      {
+        Btree btree(filename, 100);
+        rc = btree.BtreeSetPageSize(page_size);
+        ASSERT_EQ(rc, ResultCode::kOk);
+        rc = btree.BtreeSetJournalMode(mode);
+        ASSERT_EQ(rc, ResultCode::kOk);
+        rc = btree.BtreeBeginTrans();
+        ASSERT_EQ(rc, ResultCode::kOk);
+        EXPECT_EQ(btree.BtreePageSize(), page_size);
+        rc = btree.BtreeCreateTable(root_page_number);
+        EXPECT_EQ(rc, ResultCode::kOk);
+        std::weak_ptr<BtCursor> p_cursor_weak;
+        rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+        EXPECT_EQ(rc, ResultCode::kOk);
+        for (u32 value = 0; value < num_keys; value++) {
+          std::vector<std::byte> key = BigEndianKey(value * 7919 % num_keys);
+          std::vector<std::byte> data = data_of(value * 7919 % num_keys);
+          rc = btree.BtreeInsert(p_cursor_weak, key, data);
+          ASSERT_EQ(rc, ResultCode::kOk);
+        }
+        rc = btree.BtCursorClose(p_cursor_weak);
+        EXPECT_EQ(rc, ResultCode::kOk);
+        rc = btree.BtreeCommit();
+        ASSERT_EQ(rc, ResultCode::kOk);
+      }
+
+      // Step 2: A handle that was told nothing about the page size reads the
+      // one recorded in the file, whatever page size it would create
+      Btree btree(filename, 100);
+      rc = btree.BtreeSetPageSize(page_size == kMaxPageSize ? kMinPageSize
+                                                             : kMaxPageSize);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeSetJournalMode(mode);
+      ASSERT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeBeginTrans();
+      ASSERT_EQ(rc, ResultCode::kOk);
+      EXPECT_EQ(btree.BtreePageSize(), page_size);
+      std::vector<std::vector<std::byte>> expected_keys;
+      for (u32 value = 0; value < num_keys; value++) {
+        expected_keys.push_back(BigEndianKey(value));
+      }
+      EXPECT_EQ(ScanKeys(btree, root_page_number, false), expected_keys);
+      std::weak_ptr<BtCursor> p_cursor_weak;
+      rc = btree.BtCursorCreate(root_page_number, false, p_cursor_weak);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      for (u32 value = 0; value < num_keys; value += 5) {
+        std::vector<std::byte> key = BigEndianKey(value);
+        int result = 0;
+        EXPECT_EQ(btree.BtreeSearch(p_cursor_weak, key, result),
+                  data_of(value));
+      }
+      rc = btree.BtCursorClose(p_cursor_weak);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeCommit();
+      EXPECT_EQ(rc, ResultCode::kOk);
+      if (mode == JournalMode::ROLLBACK) {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        EXPECT_EQ(file.tellg() % page_size, 0);
+        EXPECT_EQ(file.tellg() / page_size, btree.BtreePageCount());
+      }
+    }
+  }
+}
+
+TEST(PageSizeTest, RefusesInvalidPageSizes) {
+  std::string filename = "test_RefusesInvalidPageSizes.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  ResultCode rc;
+  // Step 1: Page sizes outside the range or not a power of two are refused
+  {
+    Btree btree(filename, 100);
+    for (u32 page_size : {0u, 256u, 3000u, 2 * kMaxPageSize}) {
+      rc = btree.BtreeSetPageSize(page_size);
+      EXPECT_EQ(rc, ResultCode::kMisuse);
+    }
+    rc = btree.BtreeBeginTrans();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    EXPECT_EQ(btree.BtreePageSize(), kDefaultPageSize);
+    rc = btree.BtreeCommit();
+    EXPECT_EQ(rc, ResultCode::kOk);
+  }
+  {
+    Pager pager(filename, 100);
+    BasePage *p_base_page = nullptr;
+    rc = pager.SqlitePagerGet(1, &p_base_page, FirstPage::CreateDerivedPage);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    auto *p_first_page = dynamic_cast<FirstPage *>(p_base_page);
+    EXPECT_EQ(p_first_page->GetPageSize(), kDefaultPageSize);
+
+    // Step 2: Pretend that page 1 records a page size no database can have
+    rc = pager.SqlitePagerBegin(p_first_page);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = pager.SqlitePagerWrite(p_first_page);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    p_first_page->SetPageSize(3000);
+    rc = pager.SqlitePagerCommit();
+    EXPECT_EQ(rc, ResultCode::kOk);
+    pager.SqlitePagerUnref(p_first_page);
+  }
+
+  // Step 3: The file is not read with a made up page size
+  Btree btree(filename, 100);
+  rc = btree.BtreeBeginTrans();
+  EXPECT_EQ(rc, ResultCode::kCorrupt);
+}
+
+TEST(GroupCommitTest, SharesLogSyncsBetweenTransactions) {
+  std::string filename = "test_SharesLogSyncsBetweenTransactions.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  std::remove((filename + "-wal").c_str());
+  ResultCode rc;
+  PageNumber root_page_number = 0;
+  const u32 num_trans = 20;
+  {
+    Btree btree(filename, 100);
+    rc = btree.BtreeSetJournalMode(JournalMode::WAL);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeSetGroupCommit(std::chrono::milliseconds(100));
+    ASSERT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeBeginTrans();
+    ASSERT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeCreateTable(root_page_number);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree.BtreeCommit();
+    ASSERT_EQ(rc, ResultCode::kOk);
+    PagerWalStats stats = btree.BtreeWalStats();
+    EXPECT_EQ(stats.num_commits, 1);
+    EXPECT_EQ(stats.num_syncs, 1);
+
+    // Step 1: Each transaction returns once it is in the log, so the next one
+    // joins the group that is still waiting for its sync
+    std::atomic<u32> num_durable{0};
+    for (u32 i = 0; i < num_trans; i++) {
+      rc = btree.BtreeBeginTrans();
+      ASSERT_EQ(rc, ResultCode::kOk);
+      std::weak_ptr<BtCursor> p_cursor_weak;
+      rc = btree.BtCursorCreate(root_page_number, true, p_cursor_weak);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      std::vector<std::byte> key = BigEndianKey(i);
+      std::vector<std::byte> data = BigEndianKey(i * 7);
+      rc = btree.BtreeInsert(p_cursor_weak, key, data);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtCursorClose(p_cursor_weak);
+      EXPECT_EQ(rc, ResultCode::kOk);
+      rc = btree.BtreeCommit([&num_durable](ResultCode sync_rc) {
+        if (sync_rc == ResultCode::kOk) num_durable++;
+      });
+      ASSERT_EQ(rc, ResultCode::kOk);
+    }
+    for (int i = 0; i < 200 && num_durable < num_trans; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(num_durable, num_trans);
+    stats = btree.BtreeWalStats();
+    EXPECT_EQ(stats.num_commits, num_trans + 1);
+    EXPECT_LT(stats.num_syncs, num_trans / 2);
+    EXPECT_GT(stats.commits_per_sync, 2.0);
+  }
+
+  // Step 2: Every transaction is in the log after reopening it
+  Btree btree(filename, 100);
+  rc = btree.BtreeSetJournalMode(JournalMode::WAL);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtreeBeginTrans();
+  ASSERT_EQ(rc, ResultCode::kOk);
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, false, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  for (u32 i = 0; i < num_trans; i++) {
+    std::vector<std::byte> key = BigEndianKey(i);
+    int result = 1;
+    std::vector<std::byte> data = btree.BtreeSearch(p_cursor_weak, key, result);
+    EXPECT_EQ(result, 0) << "key " << i;
+    EXPECT_EQ(data, BigEndianKey(i * 7));
+  }
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtreeCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+TEST(GroupCommitTest, SharesLogSyncsBetweenHandles) {
+  std::string filename = "test_SharesLogSyncsBetweenHandles.db";
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  std::remove((filename + "-wal").c_str());
+  ResultCode rc;
+  PageNumber root_page_number = 0;
+  const u32 num_trans = 20;
+  {
+    Btree btree_a(filename, 100);
+    Btree btree_b(filename, 100);
+    for (Btree *p_btree : {&btree_a, &btree_b}) {
+      rc = p_btree->BtreeSetJournalMode(JournalMode::WAL);
+      ASSERT_EQ(rc, ResultCode::kOk);
+      rc = p_btree->BtreeSetGroupCommit(std::chrono::milliseconds(100));
+      ASSERT_EQ(rc, ResultCode::kOk);
+    }
+    rc = btree_a.BtreeBeginTrans();
+    ASSERT_EQ(rc, ResultCode::kOk);
+    rc = btree_a.BtreeCreateTable(root_page_number);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    rc = btree_a.BtreeCommit();
+    ASSERT_EQ(rc, ResultCode::kOk);
+
+    // Step 1: Two handles on the file commit from their own threads. The
+    // writer lock passes back and forth between them, and a sync of the log
+    // covers the commits of both
+    std::atomic<u32> num_durable{0};
+    auto run = [&](Btree &btree, u32 first_key) {
+      for (u32 i = first_key; i < first_key + num_trans; i++) {
+        ResultCode trans_rc;
+        while ((trans_rc = btree.BtreeBeginTrans()) == ResultCode::kBusy) {
+          std::this_thread::yield();
+        }
+        ASSERT_EQ(trans_rc, ResultCode::kOk);
+        std::weak_ptr<BtCursor> p_cursor_weak;
+        EXPECT_EQ(btree.BtCursorCreate(root_page_number, true, p_cursor_weak),
+                  ResultCode::kOk);
+        std::vector<std::byte> key = BigEndianKey(i);
+        std::vector<std::byte> data = BigEndianKey(i * 7);
+        EXPECT_EQ(btree.BtreeInsert(p_cursor_weak, key, data), ResultCode::kOk);
+        EXPECT_EQ(btree.BtCursorClose(p_cursor_weak), ResultCode::kOk);
+        trans_rc = btree.BtreeCommit([&num_durable](ResultCode sync_rc) {
+          if (sync_rc == ResultCode::kOk) num_durable++;
+        });
+        ASSERT_EQ(trans_rc, ResultCode::kOk);
+      }
+    };
+    std::thread thread_a(run, std::ref(btree_a), 0);
+    std::thread thread_b(run, std::ref(btree_b), num_trans);
+    thread_a.join();
+    thread_b.join();
+    for (int i = 0; i < 200 && num_durable < 2 * num_trans; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(num_durable, 2 * num_trans);
+    EXPECT_GT(btree_a.BtreeWalStats().num_shared_syncs, 0);
+    EXPECT_GT(btree_b.BtreeWalStats().num_shared_syncs, 0);
+  }
+
+  // Step 2: The transactions of both handles are in the log after reopening it
+  Btree btree(filename, 100);
+  rc = btree.BtreeSetJournalMode(JournalMode::WAL);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtreeBeginTrans();
+  ASSERT_EQ(rc, ResultCode::kOk);
+  std::weak_ptr<BtCursor> p_cursor_weak;
+  rc = btree.BtCursorCreate(root_page_number, false, p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  for (u32 i = 0; i < 2 * num_trans; i++) {
+    std::vector<std::byte> key = BigEndianKey(i);
+    int result = 1;
+    std::vector<std::byte> data = btree.BtreeSearch(p_cursor_weak, key, result);
+    EXPECT_EQ(result, 0) << "key " << i;
+    EXPECT_EQ(data, BigEndianKey(i * 7));
+  }
+  rc = btree.BtCursorClose(p_cursor_weak);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  rc = btree.BtreeCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
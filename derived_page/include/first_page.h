@@ -33,6 +33,15 @@ struct FirstPageByteView {
 // the Btree to store meta information.
 constexpr u16 kMetaIntArraySize = 4;
 
+/**
+ * How the free pages of the database are tracked, chosen when the database is
+ * created.
+ * - kFreeList: a chain of free list info pages, each listing free pages
+ * - kBitmap: free map pages at fixed places in the file, each with one bit per
+ *   page of the range that follows it
+ */
+enum class FreeSpaceFormat : u32 { kFreeList = 0, kBitmap = 1 };
+
 /**
  * @class FirstPage
  *
@@ -43,6 +52,13 @@ constexpr u16 kMetaIntArraySize = 4;
  * - A page number that points to the first FreeListInfoPage
  * - An unsigned integer that records the number of free pages. An array of 4
  * integers, metadata used by the VDBE layer
+ * - The format of the free space map (see FreeSpaceFormat), after the meta
+ * integers so that files written before it existed read as kFreeList
+ * - The page size the database was created with, 0 for files written before it
+ * was recorded, whose pages are 1024 bytes. It lies within the first
+ * kMinPageSize bytes, so it can be read before the page size is known
+ * - A stack of pages of dropped tables whose subtrees are still to be freed,
+ * see Btree::BtreeDropTableDeferred()
  *
  * @note The first page is special page since many operations require it to be
  * in memory, such as reading database configuration and knowing where the free
@@ -51,8 +67,15 @@ constexpr u16 kMetaIntArraySize = 4;
 class FirstPage : public BasePage {
  private:
   static constexpr int kCorrectMagicInt = 12345;
+  static constexpr ImageIndex kFreeSpaceFormatIdx =
+      sizeof(FirstPageByteView) + (kMetaIntArraySize - 1) * sizeof(int);
+  static constexpr ImageIndex kPageSizeIdx =
+      kFreeSpaceFormatIdx + sizeof(FreeSpaceFormat);
+  static constexpr ImageIndex kPendingDropsIdx = kPageSizeIdx + sizeof(u32);
 
  public:
+  FirstPage() = default;
+  explicit FirstPage(WithoutImage without_image) : BasePage(without_image) {}
   static std::unique_ptr<BasePage> CreateDerivedPage();
 
   [[nodiscard]] FirstPageByteView GetFirstPageByteView() const;
@@ -64,5 +87,16 @@ class FirstPage : public BasePage {
 
   void GetMeta(std::array<int, kMetaIntArraySize> &meta_int_arr);
   void UpdateMeta(std::array<int, kMetaIntArraySize> &meta_int_arr);
+  [[nodiscard]] FreeSpaceFormat GetFreeSpaceFormat() const;
+  void SetFreeSpaceFormat(FreeSpaceFormat format);
+  [[nodiscard]] u32 GetPageSize() const;
+  void SetPageSize(u32 page_size);
+  static u32 GetPageSizeOfImage(const PageImage &image);
+
+  [[nodiscard]] u32 GetMaxPendingDrops() const;
+  [[nodiscard]] u32 GetNumPendingDrops() const;
+  [[nodiscard]] PageNumber GetPendingDrop(u32 pending_idx) const;
+  void PushPendingDrop(PageNumber page_number);
+  PageNumber PopPendingDrop();
   void DestroyExtra() override;
 };
\ No newline at end of file
@@ -2,7 +2,11 @@
 
 #include <gtest/gtest_prod.h>
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <vector>
 
 #include "over_free_page.h"
@@ -22,15 +26,40 @@ struct NodePageHeaderByteView {
   // a Btree.
   PageNumber right_child; // if node is leaf, this is next ptr
 
-  // The first cell starts at this index
-  ImageIndex first_cell_idx;
+  // The page number of the previous leaf when the page is a leaf, 0 for the
+  // first leaf and for internal nodes. Together with right_child, it chains
+  // the leaves in both directions.
+  PageNumber prev_leaf;
 
-  // The first free block starts at this index. Set to 0 if there are no free
-  // blocks.
+  // The cell content area starts at this index and runs to the end of the
+  // page. The bytes between the end of the cell directory and this index are
+  // unallocated.
+  ImageIndex cell_content_idx;
+
+  // The first free block inside the cell content area starts at this index.
+  // Set to 0 if there are no free blocks.
   ImageIndex first_free_block_idx;
 
   // CHAOS: (CHANGE) true if this is an internal node, false if it's a leaf node
   bool is_internal_;
+
+  // The size of the key prefix shared by the cells on the page, 0 if the page
+  // is not prefix-compressed. See NodePage::SetKeyPrefix.
+  u8 key_prefix_size;
+
+  // The key prefix starts at this index
+  ImageIndex key_prefix_idx;
+
+  // The number of entries in the cell directory
+  u16 num_cells;
+
+  // The number of free bytes in pieces too small to hold a free block. They
+  // are reclaimed by NodePage::DefragmentPage.
+  u8 num_fragmented_bytes;
+
+  // 4 or 8 if the cell directory starts with a key array holding the key of
+  // every cell as an integer, 0 otherwise. See NodePage::FindFixedKey.
+  u8 fixed_key_size;
 };
 
 /*
@@ -74,31 +103,58 @@ struct CellHeaderByteView {
   // The size of the data in bytes
   u32 data_size;
 
-  // The index of the next cell
-  ImageIndex next_cell_start_idx;
-
   // The page number of the overflow page that holds that cannot be fit within
   // this page. Set to 0 if there is no overflow page.
   PageNumber overflow_page;
 
   // ######### Public Functions #########
 
-  // Helper function for getting the total size of the cell header.
-  [[nodiscard]] u32 GetCellSize() const;
+  // Helper function for getting the total size of the cell on a page of
+  // page_size bytes.
+  [[nodiscard]] u32 GetCellSize(u32 page_size) const;
 };
 
 // Minimum size of a cell
 const u16 kMinCellSize = sizeof(CellHeaderByteView) + 4;
 
-// Usable space on a page in bytes. It is all the space except for the header on
-// the page.
-const u16 kUsableSpace = kPageSize - sizeof(NodePageHeaderByteView);
+// The end of the part of a page of page_size bytes that a NodePage lays out.
+// Every index into it, the end of the cell content area included, has to fit
+// an ImageIndex, so the last byte of a page of kMaxPageSize bytes is unused.
+constexpr u32 NodePageEnd(u32 page_size) {
+  return std::min<u32>(page_size, std::numeric_limits<ImageIndex>::max());
+}
+
+// Usable space on a page of page_size bytes. It is all the space except for
+// the header on the page.
+constexpr u32 UsableSpace(u32 page_size) {
+  return NodePageEnd(page_size) - sizeof(NodePageHeaderByteView);
+}
+
+// Size of one cell directory entry. Every cell on a page takes this much space
+// on top of its own size, plus the size of its key if the page has a key array.
+const u16 kCellDirectoryEntrySize = sizeof(ImageIndex);
 
 /* ------------------------------------
  *  NodePageHeaderByteView (20 bytes)
- *
- *  Remaining space: (kPageSize - 20) bytes
+ *  Cell directory: the key array, if any, then the ImageIndex of every cell,
+ *  both in key order
+ *  ------------------------------
+ *  Unallocated space
  *  ------------------------------
+ *  Cell content area: cells, free blocks and the key prefix, in any order
+ *  ------------------------------
+ *
+ * The cell directory grows towards the end of the page and the cell content
+ * area grows towards the start. Because the directory is sorted, a cell can
+ * be found by binary search on the page image, and a page needs no set-up
+ * work per cell when it is loaded.
+ *
+ * When every cell on a page has a local key of 4 or 8 bytes, the keys are
+ * also kept in the key array, as unsigned integers in the byte order of the
+ * machine. A key is read as a big-endian integer, so the integers sort the
+ * same way std::memcmp sorts the keys. The key array starts right after the
+ * header and is aligned to the key size, so it can be searched without
+ * touching the cells.
  */
 
 /*
@@ -167,20 +223,22 @@ class Cell {
   Cell(const CellHeaderByteView &cell_header_in,
        const std::vector<std::byte> &payload_in);
   u32 GetPayloadSize();
-  u32 GetCellSize() const;
-  bool NeedOverflowPage() const;
+  u32 GetCellSize(u32 page_size) const;
+  bool NeedOverflowPage(u32 page_size) const;
 };
 
 /*
  * The maximum amount of payload (in bytes) that can be stored locally for
- * a database entry.  If the entry contains more data than this, the
- * extra goes onto overflow pages.
+ * a database entry on a page of page_size bytes.  If the entry contains more
+ * data than this, the extra goes onto overflow pages.
  *
  * This number is chosen so that at least 4 cells will fit on every page.
- * Currently, the number is 238.
+ * It is 240 for pages of 1024 bytes.
  */
-const u16 kMaxLocalPayload =
-    kUsableSpace / 4 - sizeof(CellHeaderByteView) + sizeof(PageNumber);
+constexpr u32 MaxLocalPayload(u32 page_size) {
+  return UsableSpace(page_size) / 4 - sizeof(CellHeaderByteView) +
+         sizeof(PageNumber);
+}
 
 /*
  * CellTracker
@@ -201,6 +259,9 @@ const u16 kMaxLocalPayload =
  * If a cell is written on the page, we use the image_idx to find the starting
  * index of the cell header on the page. If a cell is not written on the page,
  * the entire cell would be in the CellTracker
+ *
+ * A page only has CellTrackers while it is overfull. Otherwise the cell
+ * directory on the page image is the list of cells.
  */
 class CellTracker {
  public:
@@ -231,6 +292,13 @@ class CellTracker {
  * the insertion of cells, require the use of other pages such as overflow
  * pages. These operations are handled by the Btree class.
  *
+ * A page may be prefix-compressed. Its header then holds the size and index of
+ * a key prefix that every cell with a local payload shares, and those cells
+ * only store the rest of their key after their header. The key_size stored in
+ * such a cell header is the size of that rest. Cells with overflow pages keep
+ * their whole key. GetCellHeaderByteView, SetCellHeaderByteView and GetCell
+ * hide the difference; only the functions working with image indexes see it.
+ *
  * NodePage is currently a derived class of the OverFreePage since a NodePage
  * might be added to the free list at some point and will need to handle the
  * responsibilities of writing the content of an Overfull page or a
@@ -252,11 +320,13 @@ class NodePage : public OverFreePage {
 
   bool is_overfull_;
 
+  // The cells of an overfull page, empty otherwise
   std::vector<CellTracker> cell_trackers_;
 
  public:
   // Constructor and destructor
   NodePage();
+  explicit NodePage(WithoutImage without_image);
   void DestroyExtra() override;
 
   // -----------------------------------------------------------------------------------------------
@@ -296,16 +366,36 @@ class NodePage : public OverFreePage {
 
   [[nodiscard]] bool IsOverfull() const;
 
+  // Whether a cell with this header keeps its payload on the page
+  [[nodiscard]] bool IsPayloadLocal(
+      const CellHeaderByteView &cell_header) const;
+
+  // Rewrites the page without its key prefix
+  void ClearKeyPrefix();
+
+  // Functions for the cell directory
+  [[nodiscard]] ImageIndex GetCellImageIndex(u16 cell_idx) const;
+  [[nodiscard]] u32 GetNumUnallocatedBytes() const;
+  [[nodiscard]] u16 GetCellDirectoryEntrySize() const;
+  void InsertCellDirectoryEntry(u16 cell_idx, ImageIndex image_idx,
+                                const std::byte *key);
+  void RemoveCellDirectoryEntry(u16 cell_idx);
+  void LoadCellTrackers();
+
+  // Functions for the key array
+  [[nodiscard]] static u16 GetFixedKeySize(const Cell &cell, u32 page_size);
+  [[nodiscard]] u64 GetFixedKey(u16 cell_idx) const;
+  void ClearFixedKeys();
+
  public:
   // Public functions for manipulating the page image
-  ImageIndex AllocateSpace(u32 num_bytes_in);
+  ImageIndex AllocateSpace(u32 num_bytes_in, u32 num_bytes_to_keep = 0);
   void ZeroPage();
   void DefragmentPage();
   void CopyPage(NodePage &dest);
   void DropCell(u16 cell_idx);
   void InsertCell(Cell &cell_in, u16 cell_idx);
   void FreeSpace(ImageIndex free_start_idx, u16 num_bytes_to_free);
-  void RelinkCellList();
 
   /** CHAOS: (CHANGE)
  * Checks if this node is an internal node
@@ -337,6 +427,17 @@ class NodePage : public OverFreePage {
     return GetNodePageHeaderByteView().right_child;
   }
 
+  /**
+   * Same as GetNextLeaf, but reads a raw page image, for callers that have not
+   * loaded the page, such as the Pager's prefetch thread
+   * @return page number of the next leaf node, 0 for internal nodes
+   */
+  static PageNumber GetNextLeafOfImage(const PageImage &image) {
+    NodePageHeaderByteView header{};
+    std::memcpy(&header, image.data(), sizeof(NodePageHeaderByteView));
+    return header.is_internal_ ? 0 : header.right_child;
+  }
+
   /** CHAOS: (CHANGE)
    * Sets the next leaf node (only for leaf nodes)
    * For leaf nodes, right_child is used as next_leaf pointer
@@ -351,11 +452,58 @@ class NodePage : public OverFreePage {
     SetNodePageHeaderByteView(header);
   }
 
+  /**
+   * Gets the previous leaf node (only valid for leaf nodes)
+   * @return page number of the previous leaf node, 0 for the first leaf
+   */
+  PageNumber GetPrevLeaf() const {
+    if (IsInternalNode()) {
+      return 0; // Not valid for internal nodes
+    }
+    return GetNodePageHeaderByteView().prev_leaf;
+  }
+
+  /**
+   * Same as GetPrevLeaf, but reads a raw page image, like GetNextLeafOfImage
+   * @return page number of the previous leaf node, 0 for internal nodes
+   */
+  static PageNumber GetPrevLeafOfImage(const PageImage &image) {
+    NodePageHeaderByteView header{};
+    std::memcpy(&header, image.data(), sizeof(NodePageHeaderByteView));
+    return header.is_internal_ ? 0 : header.prev_leaf;
+  }
+
+  /**
+   * Sets the previous leaf node (only for leaf nodes)
+   * @param prev_leaf_page_number page number of the previous leaf node
+   */
+  void SetPrevLeaf(PageNumber prev_leaf_page_number) {
+    if (IsInternalNode()) {
+      return; // Not valid for internal nodes
+    }
+    NodePageHeaderByteView header = GetNodePageHeaderByteView();
+    header.prev_leaf = prev_leaf_page_number;
+    SetNodePageHeaderByteView(header);
+  }
+
   // Public functions for inspecting the NodePage and its page image
 
-  u32 GetNumCells();
+  [[nodiscard]] u32 GetNumCells() const;
   Cell GetCell(u16 cell_idx);
 
+  // Functions for prefix-compressed pages. The cell headers and payloads
+  // returned by the functions above always hold the whole key.
+  bool SetKeyPrefix(const std::vector<std::byte> &prefix);
+  [[nodiscard]] u32 GetKeyPrefixSize() const;
+  void ReadLocalPayload(u16 cell_idx, u32 offset, u32 amount,
+                        std::byte *out) const;
+  [[nodiscard]] int CompareLocalPayload(u16 cell_idx, const std::byte *bytes,
+                                        u32 n) const;
+
+  // Searches the key array for a key without reading any cell
+  bool FindFixedKey(const std::byte *key, u32 key_size, u16 &lower_bound,
+                    bool &found) const;
+
   // Public function for BasePage inheritance
   static std::unique_ptr<BasePage> CreateDerivedPage();
 };
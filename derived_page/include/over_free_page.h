@@ -37,7 +37,20 @@ struct FreeListInfoHeaderByteView {
   PageNumber num_free_pages;
 };
 
-constexpr u16 kOverflowSize = kPageSize - sizeof(OverflowPageHeaderByteView);
+// The number of payload bytes an overflow page of page_size bytes holds
+constexpr u32 OverflowSize(u32 page_size) {
+  return page_size - sizeof(OverflowPageHeaderByteView);
+}
+
+// It stores the number of bits that are set on a free map page
+struct FreeMapHeaderByteView {
+  u32 num_free_pages;
+};
+
+// The number of pages whose state one free map page of page_size bytes holds
+constexpr u32 FreeMapNumBits(u32 page_size) {
+  return (page_size - sizeof(FreeMapHeaderByteView)) * 8;
+}
 
 /**
  * @class OverFreePage
@@ -45,12 +58,15 @@ constexpr u16 kOverflowSize = kPageSize - sizeof(OverflowPageHeaderByteView);
  * This class represents an entity that can modify the content of its page image
  * byte array as both an Overflow Page (contains payload of overflow cells), a
  * FreeListInfoPage (contains page numbers to free list leaf pages, also known
- * as FreeListTrunkPage in some books), and a FreePage (contains pure garbage
- * data ready to be overwritten, FreeListLeafPage ).
+ * as FreeListTrunkPage in some books), a FreePage (contains pure garbage
+ * data ready to be overwritten, FreeListLeafPage ), and a FreeMapPage (one bit
+ * per page of a range of page numbers, set if the page is free).
  */
 class OverFreePage : public BasePage {
  public:
   OverFreePage() = default;
+  explicit OverFreePage(WithoutImage without_image)
+      : BasePage(without_image) {}
 
   void SetOverflowPageHeaderByteView(
       OverflowPageHeaderByteView &overflow_page_header_byte_view_in);
@@ -67,5 +83,11 @@ class OverFreePage : public BasePage {
   void SetFreeListInfoPageNumber(u16 free_list_idx, PageNumber page_number);
   bool CanInsertPageNumber();
   void InsertPageNumber(PageNumber page_number);
+
+  FreeMapHeaderByteView GetFreeMapHeaderByteView();
+  void SetFreeMapHeaderByteView(FreeMapHeaderByteView &free_map_header);
+  bool IsFreeMapBitSet(u32 bit_idx);
+  void SetFreeMapBit(u32 bit_idx, bool is_set);
+  u32 FindFreeMapBit(u32 start_bit_idx);
   void DestroyExtra() override;
 };
\ No newline at end of file
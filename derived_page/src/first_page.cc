@@ -2,13 +2,13 @@
 
 FirstPageByteView FirstPage::GetFirstPageByteView() const {
   FirstPageByteView byte_view{};
-  std::memcpy(&byte_view, p_image_->data(), sizeof(FirstPageByteView));
+  std::memcpy(&byte_view, p_image_.data(), sizeof(FirstPageByteView));
   return byte_view;
 }
 
 void FirstPage::SetFirstPageByteView(
     FirstPageByteView &first_page_byte_view_in) {
-  std::memcpy(p_image_->data(), &first_page_byte_view_in,
+  std::memcpy(p_image_.data(), &first_page_byte_view_in,
               sizeof(FirstPageByteView));
 }
 
@@ -41,7 +41,7 @@ void FirstPage::GetMeta(std::array<int, kMetaIntArraySize> &meta_int_arr) {
   for (size_t i = 0; i < kMetaIntArraySize - 1; i++) {
     int meta_int;
     std::memcpy(&meta_int,
-                p_image_->data() + sizeof(FirstPageByteView) + i * sizeof(int),
+                p_image_.data() + sizeof(FirstPageByteView) + i * sizeof(int),
                 sizeof(int));
     meta_int_arr[i + 1] = meta_int;
   }
@@ -50,13 +50,92 @@ void FirstPage::GetMeta(std::array<int, kMetaIntArraySize> &meta_int_arr) {
 
 void FirstPage::UpdateMeta(std::array<int, kMetaIntArraySize> &meta_int_arr) {
   for (size_t i = 0; i < kMetaIntArraySize - 1; i++) {
-    std::memcpy(p_image_->data() + sizeof(FirstPageByteView) + i * sizeof(int),
+    std::memcpy(p_image_.data() + sizeof(FirstPageByteView) + i * sizeof(int),
                 &meta_int_arr[i + 1], sizeof(int));
   }
 }
 
+FreeSpaceFormat FirstPage::GetFreeSpaceFormat() const {
+  FreeSpaceFormat format;
+  std::memcpy(&format, p_image_.data() + kFreeSpaceFormatIdx,
+              sizeof(FreeSpaceFormat));
+  return format;
+}
+
+void FirstPage::SetFreeSpaceFormat(FreeSpaceFormat format) {
+  std::memcpy(p_image_.data() + kFreeSpaceFormatIdx, &format,
+              sizeof(FreeSpaceFormat));
+}
+
+// Files written before the page size was recorded hold 0 and 1024-byte pages
+u32 FirstPage::GetPageSize() const {
+  u32 page_size;
+  std::memcpy(&page_size, p_image_.data() + kPageSizeIdx, sizeof(u32));
+  return page_size == 0 ? 1024 : page_size;
+}
+
+/**
+ * Returns the page size recorded in image, which holds at least the first
+ * kMinPageSize bytes of a database file, or 0 if image is not the start of a
+ * database file.
+ */
+u32 FirstPage::GetPageSizeOfImage(const PageImage &image) {
+  FirstPage first_page{WithoutImage{}};
+  first_page.p_image_ = image;
+  return first_page.HasCorrectMagicInt() ? first_page.GetPageSize() : 0;
+}
+
+void FirstPage::SetPageSize(u32 page_size) {
+  std::memcpy(p_image_.data() + kPageSizeIdx, &page_size, sizeof(u32));
+}
+
+// The number of page numbers the stack of pending drops holds
+u32 FirstPage::GetMaxPendingDrops() const {
+  return (p_image_.size() - kPendingDropsIdx - sizeof(u32)) /
+         sizeof(PageNumber);
+}
+
+u32 FirstPage::GetNumPendingDrops() const {
+  u32 num_pending_drops;
+  std::memcpy(&num_pending_drops, p_image_.data() + kPendingDropsIdx,
+              sizeof(u32));
+  return num_pending_drops;
+}
+
+PageNumber FirstPage::GetPendingDrop(u32 pending_idx) const {
+  PageNumber page_number;
+  std::memcpy(&page_number,
+              p_image_.data() + kPendingDropsIdx + sizeof(u32) +
+                  pending_idx * sizeof(PageNumber),
+              sizeof(PageNumber));
+  return page_number;
+}
+
+// The caller makes sure that there is room, see GetMaxPendingDrops()
+void FirstPage::PushPendingDrop(PageNumber page_number) {
+  u32 num_pending_drops = GetNumPendingDrops();
+  std::memcpy(p_image_.data() + kPendingDropsIdx + sizeof(u32) +
+                  num_pending_drops * sizeof(PageNumber),
+              &page_number, sizeof(PageNumber));
+  num_pending_drops++;
+  std::memcpy(p_image_.data() + kPendingDropsIdx, &num_pending_drops,
+              sizeof(u32));
+}
+
+// Returns 0 if the stack is empty
+PageNumber FirstPage::PopPendingDrop() {
+  u32 num_pending_drops = GetNumPendingDrops();
+  if (num_pending_drops == 0) {
+    return 0;
+  }
+  num_pending_drops--;
+  std::memcpy(p_image_.data() + kPendingDropsIdx, &num_pending_drops,
+              sizeof(u32));
+  return GetPendingDrop(num_pending_drops);
+}
+
 std::unique_ptr<BasePage> FirstPage::CreateDerivedPage() {
-  return std::make_unique<FirstPage>();
+  return std::make_unique<FirstPage>(WithoutImage{});
 }
 
 /**
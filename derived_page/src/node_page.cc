@@ -1,10 +1,14 @@
 
 #include "node_page.h"
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 /**
  * Default constructor
  */
-Cell::Cell() : cell_header_({0, 0, 0, 0, 0}) {}
+Cell::Cell() : cell_header_({0, 0, 0, 0}) {}
 
 /**
  * Constructor for internal node
@@ -12,7 +16,7 @@ Cell::Cell() : cell_header_({0, 0, 0, 0, 0}) {}
  */
 Cell::Cell(const std::vector<std::byte> &key_in) :
   cell_header_({0, static_cast<u32>(key_in.size()),
-                    0, 0, 0}) {
+                    0, 0}) {
   payload_.reserve(cell_header_.key_size);
   payload_.insert(payload_.end(), key_in.begin(), key_in.end());
 }
@@ -24,7 +28,7 @@ Cell::Cell(const std::vector<std::byte> &key_in) :
 Cell::Cell(const std::vector<std::byte> &key_in,
            const std::vector<std::byte> &data_in)
     : cell_header_({0, static_cast<u32>(key_in.size()),
-                    static_cast<u32>(data_in.size()), 0, 0}) {
+                    static_cast<u32>(data_in.size()), 0}) {
   payload_.reserve(cell_header_.key_size + cell_header_.data_size);
   payload_.insert(payload_.end(), key_in.begin(), key_in.end());
   payload_.insert(payload_.end(), data_in.begin(), data_in.end());
@@ -50,23 +54,24 @@ u32 Cell::GetPayloadSize() { return payload_.size(); }
  *
  * Calculates the size of the cell in bytes for the current payload
  */
-u32 Cell::GetCellSize() const {
-  if (NeedOverflowPage()) {
+u32 Cell::GetCellSize(u32 page_size) const {
+  if (NeedOverflowPage(page_size)) {
     return sizeof(CellHeaderByteView);
   }
   return sizeof(CellHeaderByteView) + cell_header_.key_size +
          cell_header_.data_size;
 }
 
-u32 CellHeaderByteView::GetCellSize() const {
-  if (key_size + data_size > kMaxLocalPayload) {
+u32 CellHeaderByteView::GetCellSize(u32 page_size) const {
+  if (key_size + data_size > MaxLocalPayload(page_size)) {
     return sizeof(CellHeaderByteView);
   }
   return sizeof(CellHeaderByteView) + key_size + data_size;
 }
 
-bool Cell::NeedOverflowPage() const {
-  return cell_header_.key_size + cell_header_.data_size > kMaxLocalPayload;
+bool Cell::NeedOverflowPage(u32 page_size) const {
+  return cell_header_.key_size + cell_header_.data_size >
+         MaxLocalPayload(page_size);
 }
 
 CellTracker::CellTracker() : image_idx(0), cell(Cell()) {}
@@ -82,11 +87,18 @@ NodePage::NodePage()
       num_free_bytes_(0),
       is_overfull_(false) {}
 
+NodePage::NodePage(WithoutImage without_image)
+    : OverFreePage(without_image),
+      is_init_(false),
+      p_parent_(nullptr),
+      num_free_bytes_(0),
+      is_overfull_(false) {}
+
 /**
  * Function called by pager to initialize the page
  */
 std::unique_ptr<BasePage> NodePage::CreateDerivedPage() {
-  return std::make_unique<NodePage>();
+  return std::make_unique<NodePage>(WithoutImage{});
 }
 
 /**
@@ -94,7 +106,7 @@ std::unique_ptr<BasePage> NodePage::CreateDerivedPage() {
  */
 NodePageHeaderByteView NodePage::GetNodePageHeaderByteView() const {
   NodePageHeaderByteView node_page_header{};
-  std::memcpy(&node_page_header, p_image_->data(),
+  std::memcpy(&node_page_header, p_image_.data(),
               sizeof(NodePageHeaderByteView));
   return node_page_header;
 }
@@ -104,7 +116,7 @@ NodePageHeaderByteView NodePage::GetNodePageHeaderByteView() const {
  */
 void NodePage::SetNodePageHeaderByteView(
     NodePageHeaderByteView &node_page_header_byte_view_in) {
-  std::memcpy(p_image_->data(), &node_page_header_byte_view_in,
+  std::memcpy(p_image_.data(), &node_page_header_byte_view_in,
               sizeof(NodePageHeaderByteView));
 }
 
@@ -113,7 +125,7 @@ void NodePage::SetNodePageHeaderByteView(
  */
 void NodePage::SetFreeBlockByteView(
     ImageIndex start_idx, FreeBlockByteView &free_block_byte_view_in) {
-  std::memcpy(p_image_->data() + start_idx, &free_block_byte_view_in,
+  std::memcpy(p_image_.data() + start_idx, &free_block_byte_view_in,
               sizeof(FreeBlockByteView));
 }
 
@@ -122,28 +134,164 @@ void NodePage::SetFreeBlockByteView(
  */
 FreeBlockByteView NodePage::GetFreeBlockByteView(ImageIndex start_idx) const {
   FreeBlockByteView free_block_byte_view{};
-  std::memcpy(&free_block_byte_view, p_image_->data() + start_idx,
+  std::memcpy(&free_block_byte_view, p_image_.data() + start_idx,
               sizeof(FreeBlockByteView));
   return free_block_byte_view;
 }
 
+
 /**
- * Returns the number of cells tracked with cell_header_indexes_
+ * Returns the number of cells on the page. For an overfull page, this includes
+ * the cells that are not written into the page image yet.
  */
-u32 NodePage::GetNumCells() { return cell_trackers_.size(); }
+u32 NodePage::GetNumCells() const {
+  if (is_overfull_) {
+    return cell_trackers_.size();
+  }
+  return GetNodePageHeaderByteView().num_cells;
+}
 
 /**
- * Returns the CellHeaderByteView that corresponds to the starting index
- * tracked in cell_header_indexes_
+ * Returns the index in p_image_ where a cell starts, read from the cell
+ * directory. Returns 0 for a cell of an overfull page that is not written into
+ * the page image.
+ */
+ImageIndex NodePage::GetCellImageIndex(u16 cell_idx) const {
+  if (is_overfull_) {
+    return cell_trackers_[cell_idx].image_idx;
+  }
+  NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
+  ImageIndex image_idx = 0;
+  std::memcpy(&image_idx,
+              p_image_.data() + sizeof(NodePageHeaderByteView) +
+                  page_header.num_cells * page_header.fixed_key_size +
+                  cell_idx * kCellDirectoryEntrySize,
+              kCellDirectoryEntrySize);
+  return image_idx;
+}
+
+/**
+ * Returns the number of bytes between the end of the cell directory and the
+ * start of the cell content area
+ */
+u32 NodePage::GetNumUnallocatedBytes() const {
+  NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
+  return page_header.cell_content_idx - sizeof(NodePageHeaderByteView) -
+         page_header.num_cells * GetCellDirectoryEntrySize();
+}
+
+/**
+ * Returns the number of bytes the cell directory takes for each cell
+ */
+u16 NodePage::GetCellDirectoryEntrySize() const {
+  return kCellDirectoryEntrySize + GetNodePageHeaderByteView().fixed_key_size;
+}
+
+/*
+ * Reads a key of the key array from the bytes of the key, as a big-endian
+ * integer
+ */
+static u64 ReadFixedKey(const std::byte *key, u32 key_size) {
+  u64 value = 0;
+  for (u32 i = 0; i < key_size; ++i) {
+    value = (value << 8) | std::to_integer<u64>(key[i]);
+  }
+  return value;
+}
+
+/**
+ * Inserts the cell starting at image_idx into the cell directory at position
+ * cell_idx. The directory grows into the unallocated space, which must have
+ * room for one more entry. If the page has a key array, key is the key of the
+ * cell.
+ *
+ * Both parts of the directory move: the key array grows by one key, so every
+ * ImageIndex moves one key further, and the entries after cell_idx move one
+ * entry further on top of that. The moves start with the last bytes.
+ */
+void NodePage::InsertCellDirectoryEntry(u16 cell_idx, ImageIndex image_idx,
+                                        const std::byte *key) {
+  NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
+  u16 num_cells = page_header.num_cells;
+  u16 key_size = page_header.fixed_key_size;
+  std::byte *p_keys = p_image_.data() + sizeof(NodePageHeaderByteView);
+  std::byte *p_old_entries = p_keys + num_cells * key_size;
+  std::byte *p_new_entries = p_old_entries + key_size;
+  std::memmove(p_new_entries + (cell_idx + 1) * kCellDirectoryEntrySize,
+               p_old_entries + cell_idx * kCellDirectoryEntrySize,
+               (num_cells - cell_idx) * kCellDirectoryEntrySize);
+  std::memmove(p_new_entries, p_old_entries,
+               cell_idx * kCellDirectoryEntrySize);
+  std::memcpy(p_new_entries + cell_idx * kCellDirectoryEntrySize, &image_idx,
+              kCellDirectoryEntrySize);
+  if (key_size > 0) {
+    std::memmove(p_keys + (cell_idx + 1) * key_size,
+                 p_keys + cell_idx * key_size, (num_cells - cell_idx) * key_size);
+    u64 value = ReadFixedKey(key, key_size);
+    if (key_size == sizeof(u32)) {
+      u32 value_32 = value;
+      std::memcpy(p_keys + cell_idx * key_size, &value_32, key_size);
+    } else {
+      std::memcpy(p_keys + cell_idx * key_size, &value, key_size);
+    }
+  }
+  page_header.num_cells++;
+  SetNodePageHeaderByteView(page_header);
+  num_free_bytes_ -= kCellDirectoryEntrySize + key_size;
+}
+
+/**
+ * Removes the entry at position cell_idx from the cell directory. The cell
+ * itself is left in the page image. The moves mirror the ones of
+ * InsertCellDirectoryEntry and start with the first bytes.
+ */
+void NodePage::RemoveCellDirectoryEntry(u16 cell_idx) {
+  NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
+  u16 num_cells = page_header.num_cells;
+  u16 key_size = page_header.fixed_key_size;
+  std::byte *p_keys = p_image_.data() + sizeof(NodePageHeaderByteView);
+  std::byte *p_old_entries = p_keys + num_cells * key_size;
+  std::byte *p_new_entries = p_old_entries - key_size;
+  std::memmove(p_keys + cell_idx * key_size, p_keys + (cell_idx + 1) * key_size,
+               (num_cells - cell_idx - 1) * key_size);
+  std::memmove(p_new_entries, p_old_entries,
+               cell_idx * kCellDirectoryEntrySize);
+  std::memmove(p_new_entries + cell_idx * kCellDirectoryEntrySize,
+               p_old_entries + (cell_idx + 1) * kCellDirectoryEntrySize,
+               (num_cells - cell_idx - 1) * kCellDirectoryEntrySize);
+  page_header.num_cells--;
+  SetNodePageHeaderByteView(page_header);
+  num_free_bytes_ += kCellDirectoryEntrySize + key_size;
+}
+
+/**
+ * Gives every cell in the cell directory a CellTracker. This is done when the
+ * page turns overfull, since the cells that do not fit cannot be in the
+ * directory.
+ */
+void NodePage::LoadCellTrackers() {
+  u16 num_cells = GetNodePageHeaderByteView().num_cells;
+  cell_trackers_.assign(num_cells, CellTracker());
+  for (u16 i = 0; i < num_cells; ++i) {
+    cell_trackers_[i].image_idx = GetCellImageIndex(i);
+  }
+}
+
+/**
+ * Returns the CellHeaderByteView of the cell at position cell_idx. On a
+ * prefix-compressed page, key_size includes the key prefix.
  */
 CellHeaderByteView NodePage::GetCellHeaderByteView(u16 cell_idx) const {
-  const CellTracker tracker = cell_trackers_[cell_idx];
-  if (!tracker.IsCellWrittenIntoImage()) {
-    return tracker.cell.cell_header_;
+  ImageIndex image_idx = GetCellImageIndex(cell_idx);
+  if (image_idx == 0) {
+    return cell_trackers_[cell_idx].cell.cell_header_;
   }
   CellHeaderByteView cell_header_byte_view{};
-  std::memcpy(&cell_header_byte_view, p_image_->data() + tracker.image_idx,
+  std::memcpy(&cell_header_byte_view, p_image_.data() + image_idx,
               sizeof(CellHeaderByteView));
+  if (IsPayloadLocal(cell_header_byte_view)) {
+    cell_header_byte_view.key_size += GetKeyPrefixSize();
+  }
   return cell_header_byte_view;
 }
 
@@ -154,25 +302,29 @@ CellHeaderByteView NodePage::GetCellHeaderByteView(u16 cell_idx) const {
 CellHeaderByteView NodePage::GetCellHeaderByteViewByImageIndex(
     ImageIndex image_idx) const {
   CellHeaderByteView cell_header_byte_view{};
-  std::memcpy(&cell_header_byte_view, p_image_->data() + image_idx,
+  std::memcpy(&cell_header_byte_view, p_image_.data() + image_idx,
               sizeof(CellHeaderByteView));
   return cell_header_byte_view;
 }
 
 /**
- * Sets the CellHeaderByteView that corresponds to the starting index
- * tracked in cell_header_indexes_
+ * Sets the CellHeaderByteView of the cell at position cell_idx. On a
+ * prefix-compressed page, key_size must include the key prefix, as returned by
+ * GetCellHeaderByteView.
  */
 void NodePage::SetCellHeaderByteView(
     u16 cell_idx, CellHeaderByteView &cell_header_byte_view_in) {
-  CellTracker tracker = cell_trackers_[cell_idx];
-  if (!tracker.IsCellWrittenIntoImage()) {
-    tracker.cell.cell_header_ = cell_header_byte_view_in;
-    cell_trackers_[cell_idx] = tracker;
+  ImageIndex image_idx = GetCellImageIndex(cell_idx);
+  if (image_idx == 0) {
+    cell_trackers_[cell_idx].cell.cell_header_ = cell_header_byte_view_in;
     return;
   }
 
-  std::memcpy(p_image_->data() + tracker.image_idx, &cell_header_byte_view_in,
+  CellHeaderByteView stored_cell_header = cell_header_byte_view_in;
+  if (IsPayloadLocal(stored_cell_header)) {
+    stored_cell_header.key_size -= GetKeyPrefixSize();
+  }
+  std::memcpy(p_image_.data() + image_idx, &stored_cell_header,
               sizeof(CellHeaderByteView));
 }
 
@@ -181,7 +333,7 @@ void NodePage::SetCellHeaderByteView(
  */
 void NodePage::SetCellHeaderByteViewByImageIndex(
     ImageIndex image_idx, CellHeaderByteView &cell_header_byte_view_in) {
-  std::memcpy(p_image_->data() + image_idx, &cell_header_byte_view_in,
+  std::memcpy(p_image_.data() + image_idx, &cell_header_byte_view_in,
               sizeof(CellHeaderByteView));
 }
 
@@ -189,254 +341,302 @@ void NodePage::SetCellHeaderByteViewByImageIndex(
  * CHAOS: (CHANGE) Resets the content of the page image and other member variables
  */
 void NodePage::ZeroPage() {
-  memset(p_image_->data(), 0, kPageSize);
+  memset(p_image_.data(), 0, p_image_.size());
 
-  // Step 1: Reset the NodePageHeader
+  // Step 1: Reset the NodePageHeader. The cell directory is empty and the rest
+  // of the page is unallocated.
   NodePageHeaderByteView node_page_header{};
   node_page_header.right_child = 0;
-  node_page_header.first_cell_idx = 0;
-  node_page_header.first_free_block_idx = sizeof(NodePageHeaderByteView);
+  node_page_header.cell_content_idx = NodePageEnd(p_image_.size());
+  node_page_header.first_free_block_idx = 0;
   // CHAOS: change here
   node_page_header.is_internal_ = false;
+  node_page_header.num_cells = 0;
   SetNodePageHeaderByteView(node_page_header);
 
-  // Step 2: Reset the first free block in the page
-  FreeBlockByteView free_block{};
-  free_block.size = kPageSize - sizeof(NodePageHeaderByteView);
-  free_block.next_block_idx = 0;
-  ImageIndex free_block_offset = sizeof(NodePageHeaderByteView);
-  SetFreeBlockByteView(free_block_offset, free_block);
-
-  // Step 3: Reset the cell header start indexes
+  // Step 2: Reset the cell trackers
   cell_trackers_.clear();
   is_overfull_ = false;
 
-  // Step 4: Set num_free_bytes_ to default
-  num_free_bytes_ = free_block.size;
+  // Step 3: Set num_free_bytes_ to default
+  num_free_bytes_ = UsableSpace(p_image_.size());
 
-  // Step 5: Set p_parent to nullptr
+  // Step 4: Set p_parent to nullptr
   p_parent_ = nullptr;
 }
 
 /**
- * This function moves all the cells to the front of the page image.
- * This is done by creating a new page image called new_page and copying the
- * cells found in the old page image to the new page.
+ * This function moves all the cells and the key prefix to the end of the page
+ * image, so that all the free space on the page becomes unallocated space.
+ * This is done by creating a new page image and copying the cells into it in
+ * cell directory order.
  */
 void NodePage::DefragmentPage() {
-  // Step 1: Create a new page image
+  if (is_overfull_) {
+    return;  // The cell directory is not complete, Balance rebuilds the page
+  }
+
+  // Step 1: Create a new page image with the same header and cell directory
+  std::vector<std::byte> new_image(p_image_.size());
   NodePageHeaderByteView node_page_header = GetNodePageHeaderByteView();
-  node_page_header.first_cell_idx = sizeof(NodePageHeaderByteView);
-  NodePage new_page{};
-  std::memcpy(new_page.p_image_->data(), p_image_->data(), kPageSize);
-
-  // Step 2: Copy the cells from the old page image to the new page image
-  CellHeaderByteView cell_header{};
-  ImageIndex new_cell_start_idx = sizeof(NodePageHeaderByteView);
-  for (auto &tracker : cell_trackers_) {
-    //    std::memcpy(&cell_header, new_page.data() + old_cell_start_idx,
-    //    sizeof(CellHeaderByteView));
-    ImageIndex old_cell_start_idx = tracker.image_idx;
-    cell_header = GetCellHeaderByteViewByImageIndex(old_cell_start_idx);
-    u16 payload_size;
-    if (cell_header.key_size + cell_header.data_size > kMaxLocalPayload) {
-      payload_size = 0;
-    } else {
-      payload_size = cell_header.key_size + cell_header.data_size;
-    }
-    // Note that the payload is located after the cell header, so we need to add
-    // the size of the cell header
-    ImageIndex old_payload_start_idx =
-        old_cell_start_idx + sizeof(CellHeaderByteView);
-    ImageIndex new_payload_start_idx =
-        new_cell_start_idx + sizeof(CellHeaderByteView);
-    if (payload_size > 0) {
-      std::memcpy(new_page.p_image_->data() + new_payload_start_idx,
-                  p_image_->data() + old_payload_start_idx, payload_size);
-    }
-    cell_header.next_cell_start_idx =
-        new_cell_start_idx + sizeof(CellHeaderByteView) + payload_size;
-    //    std::memcpy(new_page.data() + new_cell_start_idx, &cell_header,
-    //    sizeof(CellHeaderByteView));
-    new_page.SetCellHeaderByteViewByImageIndex(new_cell_start_idx, cell_header);
-    // Since we are looping through the vector by reference, we can update the
-    // old cell start index
-    CellTracker new_tracker;
-    new_tracker.image_idx = new_cell_start_idx;
-    new_page.cell_trackers_.push_back(new_tracker);
-    new_cell_start_idx = cell_header.next_cell_start_idx;
-  }
-  num_free_bytes_ = kPageSize - new_cell_start_idx;
-
-  // Step 3: Replace the old page image with the new page image
-  std::memcpy(p_image_->data(), new_page.p_image_->data(), kPageSize);
-  cell_trackers_ = new_page.cell_trackers_;
-
-  // Update the final cell's next_cell_start_idx to 0
-  if (!cell_trackers_.empty()) {
-    cell_header = GetCellHeaderByteView(cell_trackers_.size() - 1);
-    cell_header.next_cell_start_idx = 0;
-    SetCellHeaderByteView(cell_trackers_.size() - 1, cell_header);
-    node_page_header = GetNodePageHeaderByteView();
-    node_page_header.first_cell_idx = cell_trackers_[0].image_idx;
-    SetNodePageHeaderByteView(node_page_header);
+  u32 entries_start_idx =
+      sizeof(NodePageHeaderByteView) +
+      node_page_header.num_cells * node_page_header.fixed_key_size;
+  u32 directory_end_idx =
+      entries_start_idx + node_page_header.num_cells * kCellDirectoryEntrySize;
+  std::memcpy(new_image.data(), p_image_.data(), directory_end_idx);
+
+  // Step 2: Copy the cells and the key prefix to the end of the new page image
+  ImageIndex new_cell_start_idx = NodePageEnd(p_image_.size());
+  for (u16 i = 0; i < node_page_header.num_cells; ++i) {
+    ImageIndex old_cell_start_idx = GetCellImageIndex(i);
+    u32 cell_size =
+        GetCellHeaderByteViewByImageIndex(old_cell_start_idx)
+            .GetCellSize(p_image_.size());
+    new_cell_start_idx -= cell_size;
+    std::memcpy(new_image.data() + new_cell_start_idx,
+                p_image_.data() + old_cell_start_idx, cell_size);
+    std::memcpy(new_image.data() + entries_start_idx +
+                    i * kCellDirectoryEntrySize,
+                &new_cell_start_idx, kCellDirectoryEntrySize);
+  }
+  if (node_page_header.key_prefix_size > 0) {
+    new_cell_start_idx -= node_page_header.key_prefix_size;
+    std::memcpy(new_image.data() + new_cell_start_idx,
+                p_image_.data() + node_page_header.key_prefix_idx,
+                node_page_header.key_prefix_size);
+    node_page_header.key_prefix_idx = new_cell_start_idx;
   }
 
-  // Step 4: Create a free block at the end of the page
-  FreeBlockByteView free_block{};
-  free_block.size = num_free_bytes_;
-  free_block.next_block_idx = 0;
-  node_page_header.first_free_block_idx = new_cell_start_idx;
+  // Step 3: Replace the old page image with the new page image. There are no
+  // free blocks or fragmented bytes left.
+  std::memcpy(p_image_.data(), new_image.data(), p_image_.size());
+  node_page_header.cell_content_idx = new_cell_start_idx;
+  node_page_header.first_free_block_idx = 0;
+  node_page_header.num_fragmented_bytes = 0;
   SetNodePageHeaderByteView(node_page_header);
-
-  if (new_cell_start_idx + sizeof(FreeBlockByteView) < kPageSize) {
-    SetFreeBlockByteView(new_cell_start_idx, free_block);
-  }
+  num_free_bytes_ = new_cell_start_idx - directory_end_idx;
 }
 
 /**
- * AllocateSpace(const u32 num_bytes_in)
+ * AllocateSpace(const u32 num_bytes_in, const u32 num_bytes_to_keep)
  *
  * Allocates enough space in p_image_ to fit a number of bytes requested by
- * num_bytes_in
- */
-ImageIndex NodePage::AllocateSpace(const u32 num_bytes_in) {
-  // Step 1: Iterate through the free blocks from the start of p_image_.
-  // Only stop when a free block with enough space is found.
-  ImageIndex free_block_idx = GetNodePageHeaderByteView().first_free_block_idx;
-  FreeBlockByteView old_free_block = GetFreeBlockByteView(free_block_idx);
-  if (num_free_bytes_ < num_bytes_in || IsOverfull()) {
+ * num_bytes_in, and leaves at least num_bytes_to_keep unallocated bytes for
+ * the cell directory to grow into. Returns 0 if the page does not have enough
+ * free space.
+ */
+ImageIndex NodePage::AllocateSpace(const u32 num_bytes_in,
+                                   const u32 num_bytes_to_keep) {
+  if (num_free_bytes_ < num_bytes_in + num_bytes_to_keep || IsOverfull()) {
     return 0;
   }
-  while (old_free_block.size < num_bytes_in) {
-    if (old_free_block.next_block_idx == 0) {
-      DefragmentPage();
-      free_block_idx = GetNodePageHeaderByteView().first_free_block_idx;
-    } else {
-      free_block_idx = old_free_block.next_block_idx;
+  NodePageHeaderByteView node_page_header = GetNodePageHeaderByteView();
+
+  // Step 1: Use the first free block with enough space. The space is taken
+  // from the end of the block, so the block itself stays where it is. A block
+  // with less than a FreeBlockByteView left is used whole, and the bytes left
+  // over are counted as fragmented.
+  ImageIndex prev_block_idx = 0;
+  ImageIndex free_block_idx = node_page_header.first_free_block_idx;
+  while (free_block_idx != 0 && GetNumUnallocatedBytes() >= num_bytes_to_keep) {
+    FreeBlockByteView free_block = GetFreeBlockByteView(free_block_idx);
+    if (free_block.size >= num_bytes_in) {
+      u32 num_bytes_left = free_block.size - num_bytes_in;
+      if (num_bytes_left >= sizeof(FreeBlockByteView)) {
+        free_block.size = num_bytes_left;
+        SetFreeBlockByteView(free_block_idx, free_block);
+        num_free_bytes_ -= num_bytes_in;
+        return free_block_idx + num_bytes_left;
+      }
+      if (node_page_header.num_fragmented_bytes + num_bytes_left <=
+          UINT8_MAX) {
+        if (prev_block_idx == 0) {
+          node_page_header.first_free_block_idx = free_block.next_block_idx;
+        } else {
+          FreeBlockByteView prev_block = GetFreeBlockByteView(prev_block_idx);
+          prev_block.next_block_idx = free_block.next_block_idx;
+          SetFreeBlockByteView(prev_block_idx, prev_block);
+        }
+        node_page_header.num_fragmented_bytes += num_bytes_left;
+        SetNodePageHeaderByteView(node_page_header);
+        num_free_bytes_ -= num_bytes_in;
+        return free_block_idx;
+      }
     }
-    old_free_block = GetFreeBlockByteView(free_block_idx);
+    prev_block_idx = free_block_idx;
+    free_block_idx = free_block.next_block_idx;
   }
-  NodePageHeaderByteView node_page_header = GetNodePageHeaderByteView();
-  ImageIndex next_insertion_idx = free_block_idx;
-  if (old_free_block.size == num_bytes_in) {
-    node_page_header.first_free_block_idx = old_free_block.next_block_idx;
-    SetNodePageHeaderByteView(node_page_header);
-  } else {
-    FreeBlockByteView new_free_block{};
-    new_free_block.next_block_idx = old_free_block.next_block_idx;
-    new_free_block.size = old_free_block.size - num_bytes_in;
-    //    memcpy(p_image_->data() + next_insertion_idx + num_bytes_in,
-    //           &new_free_block,
-    //           sizeof(FreeBlockByteView));
-    SetFreeBlockByteView(next_insertion_idx + num_bytes_in, new_free_block);
-    node_page_header.first_free_block_idx = next_insertion_idx + num_bytes_in;
-    SetNodePageHeaderByteView(node_page_header);
+
+  // Step 2: Take the space from the start of the cell content area,
+  // defragmenting the page first if the unallocated space is too small
+  if (GetNumUnallocatedBytes() < num_bytes_in + num_bytes_to_keep) {
+    DefragmentPage();
+    node_page_header = GetNodePageHeaderByteView();
   }
+  node_page_header.cell_content_idx -= num_bytes_in;
+  SetNodePageHeaderByteView(node_page_header);
   num_free_bytes_ -= num_bytes_in;
-  return next_insertion_idx;
+  return node_page_header.cell_content_idx;
 }
 
 void NodePage::DropCell(u16 cell_idx) {
-  CellHeaderByteView cell_header = GetCellHeaderByteView(cell_idx);
-  CellTracker tracker = cell_trackers_[cell_idx];
-  if (tracker.IsCellWrittenIntoImage()) {
-    FreeSpace(tracker.image_idx, cell_header.GetCellSize());
+  ImageIndex image_idx = GetCellImageIndex(cell_idx);
+  u32 cell_size = 0;
+  if (image_idx != 0) {
+    cell_size = GetCellHeaderByteViewByImageIndex(image_idx).GetCellSize(
+        p_image_.size());
   }
-  cell_trackers_.erase(cell_trackers_.begin() + cell_idx);
-  ImageIndex first_cell_start_idx = 0;
-  if (!cell_trackers_.empty()) {
-    first_cell_start_idx = cell_trackers_[0].image_idx;
+  if (is_overfull_) {
+    cell_trackers_.erase(cell_trackers_.begin() + cell_idx);
+  } else {
+    RemoveCellDirectoryEntry(cell_idx);
+  }
+  if (image_idx != 0) {
+    FreeSpace(image_idx, cell_size);
   }
-  NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
-  page_header.first_cell_idx = first_cell_start_idx;
-  SetNodePageHeaderByteView(page_header);
 }
 
 void NodePage::InsertCell(Cell &cell_in, u16 cell_idx) {
   if (cell_idx > GetNumCells()) {
     return;
   }
-  u32 cell_size = cell_in.GetCellSize();
-  ImageIndex allocated_start_idx = AllocateSpace(cell_size);
+  // On a prefix-compressed page, a local payload is stored without the key
+  // prefix. A key without the prefix turns the compression off for the page.
+  u32 prefix_size = 0;
+  if (!cell_in.NeedOverflowPage(p_image_.size()) && GetKeyPrefixSize() > 0) {
+    prefix_size = GetKeyPrefixSize();
+    NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
+    if (cell_in.cell_header_.key_size < prefix_size ||
+        std::memcmp(cell_in.payload_.data(),
+                    p_image_.data() + page_header.key_prefix_idx,
+                    prefix_size) != 0) {
+      ClearKeyPrefix();
+      prefix_size = 0;
+    }
+  }
+  // The key array needs the key of every cell. The first cell of a page decides
+  // whether the page has one, and a cell whose key does not fit in it turns
+  // it off for the page.
+  if (!is_overfull_) {
+    NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
+    u16 fixed_key_size = GetFixedKeySize(cell_in, p_image_.size());
+    if (page_header.num_cells == 0) {
+      page_header.fixed_key_size = fixed_key_size;
+      SetNodePageHeaderByteView(page_header);
+    } else if (page_header.fixed_key_size != fixed_key_size &&
+               page_header.fixed_key_size != 0) {
+      ClearFixedKeys();
+    }
+  }
+  u32 cell_size = cell_in.GetCellSize(p_image_.size()) - prefix_size;
+  ImageIndex allocated_start_idx =
+      AllocateSpace(cell_size, GetCellDirectoryEntrySize());
   if (allocated_start_idx == 0) {
+    if (!is_overfull_) {
+      LoadCellTrackers();
+      is_overfull_ = true;
+    }
     CellTracker tracker;
     tracker.cell = cell_in;
     cell_trackers_.insert(cell_trackers_.begin() + cell_idx, tracker);
-    is_overfull_ = true;
   } else {
-    CellTracker tracker;
-    tracker.image_idx = allocated_start_idx;
-    cell_trackers_.insert(cell_trackers_.begin() + cell_idx, tracker);
-    SetCellHeaderByteView(cell_idx, cell_in.cell_header_);
+    CellHeaderByteView stored_cell_header = cell_in.cell_header_;
+    if (!cell_in.NeedOverflowPage(p_image_.size())) {
+      stored_cell_header.key_size -= prefix_size;
+    }
+    SetCellHeaderByteViewByImageIndex(allocated_start_idx, stored_cell_header);
     u32 final_offset = allocated_start_idx + sizeof(CellHeaderByteView);
-    if (!cell_in.NeedOverflowPage()) {
-      std::memcpy(p_image_->data() + final_offset, cell_in.payload_.data(),
-                  cell_in.GetPayloadSize());
+    if (!cell_in.NeedOverflowPage(p_image_.size())) {
+      std::memcpy(p_image_.data() + final_offset,
+                  cell_in.payload_.data() + prefix_size,
+                  cell_in.GetPayloadSize() - prefix_size);
     }
-    ImageIndex first_cell_start_idx = cell_trackers_[0].image_idx;
-    NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
-    page_header.first_cell_idx = first_cell_start_idx;
-    SetNodePageHeaderByteView(page_header);
+    InsertCellDirectoryEntry(cell_idx, allocated_start_idx,
+                             cell_in.payload_.data());
   }
 }
 
+/**
+ * Gives num_bytes_to_free bytes starting at free_start_idx back to the page.
+ * Space at the start of the cell content area becomes unallocated space.
+ * Other space becomes a free block, merged with the free blocks around it; the
+ * free blocks are kept in order of their index.
+ */
 void NodePage::FreeSpace(ImageIndex free_start_idx, u16 num_bytes_to_free) {
-  // Step 1: Find the index that is 1 pass the last byte to free
-  ImageIndex free_end_idx = free_start_idx + num_bytes_to_free;
-
-  // Step 2: Find the first free block and its starting index
-  FreeBlockByteView current_free_block{};
-  FreeBlockByteView next_free_block{};
-  ImageIndex first_free_block_idx =
-      GetNodePageHeaderByteView().first_free_block_idx;
-  ImageIndex iterator_idx = first_free_block_idx;
-
-  // Step 3: Iterate through the free blocks before the start of the space we
-  // want to free
-  while (iterator_idx != 0 && iterator_idx < free_start_idx) {
-    current_free_block = GetFreeBlockByteView(iterator_idx);
-
-    // Step 3a: If the current free block is adjacent to the space we want to
-    // free, merge them and update the free block's size and next_block_idx
-    if (iterator_idx + current_free_block.size == free_start_idx) {
-      current_free_block.size += num_bytes_to_free;
-      if (iterator_idx + current_free_block.size ==
-          current_free_block.next_block_idx) {
-        next_free_block =
-            GetFreeBlockByteView(current_free_block.next_block_idx);
-        current_free_block.size += next_free_block.size;
-        current_free_block.next_block_idx = next_free_block.next_block_idx;
-      }
-      SetFreeBlockByteView(iterator_idx, current_free_block);
-      num_free_bytes_ += num_bytes_to_free;
-      return;
+  NodePageHeaderByteView node_page_header = GetNodePageHeaderByteView();
+  num_free_bytes_ += num_bytes_to_free;
+
+  // Step 1: Space at the start of the cell content area is unallocated, along
+  // with the free block that follows it, if any
+  if (free_start_idx == node_page_header.cell_content_idx) {
+    node_page_header.cell_content_idx += num_bytes_to_free;
+    if (node_page_header.first_free_block_idx ==
+        node_page_header.cell_content_idx) {
+      FreeBlockByteView free_block =
+          GetFreeBlockByteView(node_page_header.first_free_block_idx);
+      node_page_header.cell_content_idx += free_block.size;
+      node_page_header.first_free_block_idx = free_block.next_block_idx;
     }
-    iterator_idx = current_free_block.next_block_idx;
+    SetNodePageHeaderByteView(node_page_header);
+    return;
   }
 
-  // Step 4: Create a new free block starting at free_start_idx
+  // Step 2: Find the free blocks before and after the space to free
+  ImageIndex prev_block_idx = 0;
+  ImageIndex next_block_idx = node_page_header.first_free_block_idx;
+  while (next_block_idx != 0 && next_block_idx < free_start_idx) {
+    prev_block_idx = next_block_idx;
+    next_block_idx = GetFreeBlockByteView(next_block_idx).next_block_idx;
+  }
+
+  // Step 3: Merge the space with the free block after it
   FreeBlockByteView new_free_block{};
-  if (iterator_idx != free_end_idx) {
-    new_free_block.size = num_bytes_to_free;
-    new_free_block.next_block_idx = iterator_idx;
-  } else {
-    next_free_block = GetFreeBlockByteView(iterator_idx);
-    new_free_block.size = num_bytes_to_free + next_free_block.size;
+  new_free_block.size = num_bytes_to_free;
+  new_free_block.next_block_idx = next_block_idx;
+  if (next_block_idx != 0 && free_start_idx + num_bytes_to_free == next_block_idx) {
+    FreeBlockByteView next_free_block = GetFreeBlockByteView(next_block_idx);
+    new_free_block.size += next_free_block.size;
     new_free_block.next_block_idx = next_free_block.next_block_idx;
   }
-  SetFreeBlockByteView(free_start_idx, new_free_block);
 
-  // Step 5: Update the NodePageHeader and num_free_bytes_
-  NodePageHeaderByteView node_page_header = GetNodePageHeaderByteView();
-  node_page_header.first_free_block_idx = free_start_idx;
-  SetNodePageHeaderByteView(node_page_header);
-  num_free_bytes_ += num_bytes_to_free;
+  // Step 4: Merge the space with the free block before it
+  if (prev_block_idx != 0) {
+    FreeBlockByteView prev_free_block = GetFreeBlockByteView(prev_block_idx);
+    if (prev_block_idx + prev_free_block.size == free_start_idx) {
+      prev_free_block.size += new_free_block.size;
+      prev_free_block.next_block_idx = new_free_block.next_block_idx;
+      SetFreeBlockByteView(prev_block_idx, prev_free_block);
+      return;
+    }
+  }
+
+  // Step 5: Otherwise, the space becomes a free block of its own. Space too
+  // small for a FreeBlockByteView is counted as fragmented.
+  if (new_free_block.size < sizeof(FreeBlockByteView) &&
+      node_page_header.num_fragmented_bytes + new_free_block.size <=
+          UINT8_MAX) {
+    node_page_header.num_fragmented_bytes += new_free_block.size;
+    SetNodePageHeaderByteView(node_page_header);
+    return;
+  }
+  if (new_free_block.size < sizeof(FreeBlockByteView)) {
+    DefragmentPage();
+    return;
+  }
+  SetFreeBlockByteView(free_start_idx, new_free_block);
+  if (prev_block_idx == 0) {
+    node_page_header.first_free_block_idx = free_start_idx;
+    SetNodePageHeaderByteView(node_page_header);
+  } else {
+    FreeBlockByteView prev_free_block = GetFreeBlockByteView(prev_block_idx);
+    prev_free_block.next_block_idx = free_start_idx;
+    SetFreeBlockByteView(prev_block_idx, prev_free_block);
+  }
 }
 
 void NodePage::CopyPage(NodePage &dest) {
-  auto &dest_p_image = *dest.p_image_;
-  memcpy(dest_p_image.data(), p_image_->data(), p_image_->size());
+  memcpy(dest.p_image_.data(), p_image_.data(), p_image_.size());
   dest.p_parent_ = p_parent_;
   dest.is_init_ = true;
   dest.num_free_bytes_ = num_free_bytes_;
@@ -444,47 +644,284 @@ void NodePage::CopyPage(NodePage &dest) {
   dest.cell_trackers_ = cell_trackers_;
 }
 
-void NodePage::RelinkCellList() {
-  if (cell_trackers_.empty()) {
-    return;
-  }
-  if (is_overfull_) {
-    return;  // If the page is overfull, we don't want to relink the cells
-  }
-  NodePageHeaderByteView node_page_header = GetNodePageHeaderByteView();
-  node_page_header.first_cell_idx = cell_trackers_[0].image_idx;
-  SetNodePageHeaderByteView(node_page_header);
-  for (size_t i = 0; i < cell_trackers_.size() - 1; ++i) {
-    CellHeaderByteView current_cell_header = GetCellHeaderByteView(i);
-    current_cell_header.next_cell_start_idx = cell_trackers_[i + 1].image_idx;
-    SetCellHeaderByteView(i, current_cell_header);
-  }
-  CellHeaderByteView last_cell_header =
-      GetCellHeaderByteView(cell_trackers_.size() - 1);
-  last_cell_header.next_cell_start_idx = 0;
-  SetCellHeaderByteView(cell_trackers_.size() - 1, last_cell_header);
-}
-
 Cell NodePage::GetCell(u16 cell_idx) {
   if (cell_idx >= GetNumCells()) {
     return {};
   }
-  CellTracker tracker = cell_trackers_[cell_idx];
-  if (tracker.image_idx == 0) {
-    return tracker.cell;
+  if (GetCellImageIndex(cell_idx) == 0) {
+    return cell_trackers_[cell_idx].cell;
   }
   CellHeaderByteView cell_header = GetCellHeaderByteView(cell_idx);
   if (cell_header.overflow_page != 0) {
     return Cell(cell_header, std::vector<std::byte>());
   }
   std::vector<std::byte> result(cell_header.key_size + cell_header.data_size);
-  ImageIndex start_idx = tracker.image_idx + sizeof(CellHeaderByteView);
-  memcpy(result.data(), p_image_->data() + start_idx,
-         cell_header.key_size + cell_header.data_size);
+  ReadLocalPayload(cell_idx, 0, cell_header.key_size + cell_header.data_size,
+                   result.data());
   Cell cell(cell_header, result);
   return cell;
 }
 
+bool NodePage::IsPayloadLocal(const CellHeaderByteView &cell_header) const {
+  return cell_header.key_size + cell_header.data_size <=
+         MaxLocalPayload(p_image_.size());
+}
+
+/**
+ * Makes the page prefix-compressed: every cell with a local payload inserted
+ * from now on is stored without the first prefix.size() bytes of its key.
+ * Inserting a cell whose key does not start with the prefix rewrites the page
+ * without it, so the prefix only saves space and never rejects a cell.
+ *
+ * The prefix can only be set on a page without cells, and is at most 255
+ * bytes long.
+ *
+ * @return: false if the prefix could not be set
+ */
+bool NodePage::SetKeyPrefix(const std::vector<std::byte> &prefix) {
+  NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
+  if (GetNumCells() != 0 || page_header.key_prefix_size != 0 ||
+      prefix.size() > UINT8_MAX) {
+    return false;
+  }
+  if (prefix.empty()) {
+    return true;
+  }
+  ImageIndex prefix_idx = AllocateSpace(prefix.size());
+  if (prefix_idx == 0) {
+    return false;
+  }
+  std::memcpy(p_image_.data() + prefix_idx, prefix.data(), prefix.size());
+  page_header = GetNodePageHeaderByteView();
+  page_header.key_prefix_size = prefix.size();
+  page_header.key_prefix_idx = prefix_idx;
+  SetNodePageHeaderByteView(page_header);
+  return true;
+}
+
+u32 NodePage::GetKeyPrefixSize() const {
+  return GetNodePageHeaderByteView().key_prefix_size;
+}
+
+/**
+ * Rewrites the page with every cell holding its whole key. The cells that do
+ * not fit anymore wait in their trackers for Balance, like any other cell on
+ * an overfull page.
+ */
+void NodePage::ClearKeyPrefix() {
+  std::vector<Cell> cells;
+  u16 num_cells = GetNumCells();
+  cells.reserve(num_cells);
+  for (u16 i = 0; i < num_cells; ++i) {
+    cells.push_back(GetCell(i));
+  }
+  NodePageHeaderByteView old_page_header = GetNodePageHeaderByteView();
+  NodePage *p_parent = p_parent_;
+  ZeroPage();
+  p_parent_ = p_parent;
+  NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
+  page_header.right_child = old_page_header.right_child;
+  page_header.is_internal_ = old_page_header.is_internal_;
+  SetNodePageHeaderByteView(page_header);
+  for (Cell &cell : cells) {
+    InsertCell(cell, GetNumCells());
+  }
+}
+
+/**
+ * Copies amount bytes of the local payload of a cell, starting at offset, as
+ * if the key prefix were stored in the cell.
+ */
+void NodePage::ReadLocalPayload(u16 cell_idx, u32 offset, u32 amount,
+                                std::byte *out) const {
+  ImageIndex image_idx = GetCellImageIndex(cell_idx);
+  if (image_idx == 0) {
+    std::memcpy(out, cell_trackers_[cell_idx].cell.payload_.data() + offset,
+                amount);
+    return;
+  }
+  u32 prefix_size = GetKeyPrefixSize();
+  if (offset < prefix_size) {
+    u32 a = amount < prefix_size - offset ? amount : prefix_size - offset;
+    std::memcpy(out,
+                p_image_.data() + GetNodePageHeaderByteView().key_prefix_idx +
+                    offset,
+                a);
+    out += a;
+    offset += a;
+    amount -= a;
+  }
+  std::memcpy(out,
+              p_image_.data() + image_idx + sizeof(CellHeaderByteView) +
+                  offset - prefix_size,
+              amount);
+}
+
+/**
+ * Compares the first n bytes of the local payload of a cell with bytes, as
+ * std::memcmp would, without copying the key prefix.
+ */
+int NodePage::CompareLocalPayload(u16 cell_idx, const std::byte *bytes,
+                                  u32 n) const {
+  ImageIndex image_idx = GetCellImageIndex(cell_idx);
+  if (image_idx == 0) {
+    return std::memcmp(cell_trackers_[cell_idx].cell.payload_.data(), bytes,
+                       n);
+  }
+  u32 prefix_size = GetKeyPrefixSize();
+  u32 a = n < prefix_size ? n : prefix_size;
+  int c = 0;
+  if (a > 0) {
+    c = std::memcmp(
+        p_image_.data() + GetNodePageHeaderByteView().key_prefix_idx, bytes,
+        a);
+  }
+  if (c == 0 && n > a) {
+    c = std::memcmp(
+        p_image_.data() + image_idx + sizeof(CellHeaderByteView),
+        bytes + a, n - a);
+  }
+  return c;
+}
+
+/**
+ * Returns the size of the key of the cell if it can go in a key array, 0
+ * otherwise. The key has to be 4 or 8 bytes long and stored on the page.
+ */
+u16 NodePage::GetFixedKeySize(const Cell &cell, u32 page_size) {
+  u32 key_size = cell.cell_header_.key_size;
+  if (cell.NeedOverflowPage(page_size) ||
+      (key_size != sizeof(u32) && key_size != sizeof(u64))) {
+    return 0;
+  }
+  return key_size;
+}
+
+/**
+ * Returns the key at position cell_idx of the key array
+ */
+u64 NodePage::GetFixedKey(u16 cell_idx) const {
+  u16 key_size = GetNodePageHeaderByteView().fixed_key_size;
+  const std::byte *p_key =
+      p_image_.data() + sizeof(NodePageHeaderByteView) + cell_idx * key_size;
+  if (key_size == sizeof(u32)) {
+    u32 key = 0;
+    std::memcpy(&key, p_key, sizeof(u32));
+    return key;
+  }
+  u64 key = 0;
+  std::memcpy(&key, p_key, sizeof(u64));
+  return key;
+}
+
+/**
+ * Drops the key array. The cells stay where they are, only the ImageIndexes
+ * of the cell directory move to the start of the directory.
+ */
+void NodePage::ClearFixedKeys() {
+  NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
+  u32 key_array_size = page_header.num_cells * page_header.fixed_key_size;
+  std::byte *p_directory = p_image_.data() + sizeof(NodePageHeaderByteView);
+  std::memmove(p_directory, p_directory + key_array_size,
+               page_header.num_cells * kCellDirectoryEntrySize);
+  page_header.fixed_key_size = 0;
+  SetNodePageHeaderByteView(page_header);
+  num_free_bytes_ += key_array_size;
+}
+
+/*
+ * The number of 4-byte keys in the key array that are smaller than key. The
+ * array is sorted, so this is where key is or would be. SSE2 and AVX2 compare
+ * 4 and 8 keys at a time; they only compare signed integers, so both sides are
+ * flipped into signed order first.
+ */
+static u16 CountSmallerKeys(const std::byte *p_keys, u16 num_keys, u32 key) {
+  u16 i = 0;
+  u16 count = 0;
+#if defined(__AVX2__)
+  const __m256i bias_256 = _mm256_set1_epi32(INT32_MIN);
+  const __m256i key_256 =
+      _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(key)), bias_256);
+  for (; i + 8 <= num_keys; i += 8) {
+    __m256i keys = _mm256_xor_si256(
+        _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(p_keys + i * sizeof(u32))),
+        bias_256);
+    count += __builtin_popcount(_mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(key_256, keys))));
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i bias_128 = _mm_set1_epi32(INT32_MIN);
+  const __m128i key_128 =
+      _mm_xor_si128(_mm_set1_epi32(static_cast<int>(key)), bias_128);
+  for (; i + 4 <= num_keys; i += 4) {
+    __m128i keys = _mm_xor_si128(
+        _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(p_keys + i * sizeof(u32))),
+        bias_128);
+    count += __builtin_popcount(
+        _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(keys, key_128))));
+  }
+#endif
+  for (; i < num_keys; ++i) {
+    u32 array_key = 0;
+    std::memcpy(&array_key, p_keys + i * sizeof(u32), sizeof(u32));
+    count += array_key < key;
+  }
+  return count;
+}
+
+/*
+ * Same as above for 8-byte keys, which SSE2 cannot compare. This is a binary
+ * search without branches: the range halves every step whatever the outcome
+ * of the comparison, so there is nothing to mispredict.
+ */
+static u16 CountSmallerKeys(const std::byte *p_keys, u16 num_keys, u64 key) {
+  if (num_keys == 0) {
+    return 0;
+  }
+  u16 base = 0;
+  u16 length = num_keys;
+  u64 array_key = 0;
+  while (length > 1) {
+    u16 half = length / 2;
+    std::memcpy(&array_key, p_keys + (base + half) * sizeof(u64), sizeof(u64));
+    base += (array_key < key) * half;
+    length -= half;
+  }
+  std::memcpy(&array_key, p_keys + base * sizeof(u64), sizeof(u64));
+  return base + (array_key < key);
+}
+
+/**
+ * Searches the key array for key, which must be as long as the keys in it.
+ * This neither reads the cells nor allocates memory.
+ *
+ * @param lower_bound: set to the number of cells with a smaller key
+ * @param found: set to whether the cell at lower_bound has key
+ * @return: false if the page has no key array for keys of key_size bytes
+ */
+bool NodePage::FindFixedKey(const std::byte *key, u32 key_size,
+                            u16 &lower_bound, bool &found) const {
+  NodePageHeaderByteView page_header = GetNodePageHeaderByteView();
+  if (is_overfull_ || page_header.fixed_key_size == 0 ||
+      page_header.fixed_key_size != key_size) {
+    return false;
+  }
+  u64 value = ReadFixedKey(key, key_size);
+  const std::byte *p_keys = p_image_.data() + sizeof(NodePageHeaderByteView);
+  if (key_size == sizeof(u32)) {
+    lower_bound = CountSmallerKeys(p_keys, page_header.num_cells,
+                                   static_cast<u32>(value));
+  } else {
+    lower_bound = CountSmallerKeys(p_keys, page_header.num_cells, value);
+  }
+  found = lower_bound < page_header.num_cells &&
+          GetFixedKey(lower_bound) == value;
+  return true;
+}
+
 bool NodePage::IsOverfull() const { return is_overfull_; }
 
 /**
@@ -498,4 +935,4 @@ void NodePage::DestroyExtra() {
   num_free_bytes_ = 0;
   cell_trackers_.clear();
   is_overfull_ = false;
-}
\ No newline at end of file
+}
@@ -2,20 +2,20 @@
 
 OverflowPageHeaderByteView OverFreePage::GetOverflowPageHeaderByteView() {
   OverflowPageHeaderByteView byte_view{};
-  std::memcpy(&byte_view, p_image_->data(), sizeof(OverflowPageHeaderByteView));
+  std::memcpy(&byte_view, p_image_.data(), sizeof(OverflowPageHeaderByteView));
   return byte_view;
 }
 
 void OverFreePage::SetOverflowPageHeaderByteView(
     OverflowPageHeaderByteView &overflow_page_header_byte_view_in) {
-  std::memcpy(p_image_->data(), &overflow_page_header_byte_view_in,
+  std::memcpy(p_image_.data(), &overflow_page_header_byte_view_in,
               sizeof(OverflowPageHeaderByteView));
 }
 
 FreeListInfoHeaderByteView OverFreePage::GetFreeListInfoHeaderByteView() {
   FreeListInfoHeaderByteView byte_view{};
   ImageIndex start_idx = sizeof(OverflowPageHeaderByteView);
-  std::memcpy(&byte_view, p_image_->data() + start_idx,
+  std::memcpy(&byte_view, p_image_.data() + start_idx,
               sizeof(FreeListInfoHeaderByteView));
   return byte_view;
 }
@@ -29,7 +29,7 @@ u16 OverFreePage::GetNumberOfFreeListPages() {
 void OverFreePage::SetFreeListInfoHeaderByteView(
     FreeListInfoHeaderByteView &info_header_byte_view) {
   ImageIndex start_idx = sizeof(OverflowPageHeaderByteView);
-  std::memcpy(p_image_->data() + start_idx, &info_header_byte_view,
+  std::memcpy(p_image_.data() + start_idx, &info_header_byte_view,
               sizeof(FreeListInfoHeaderByteView));
 }
 
@@ -56,7 +56,7 @@ PageNumber OverFreePage::GetFreeListInfoPageNumber(u16 free_list_idx) {
   }
   PageNumber page_number = 0;
   std::memcpy(&page_number,
-              p_image_->data() + start_idx +
+              p_image_.data() + start_idx +
                   sizeof(FreeListInfoHeaderByteView) +
                   free_list_idx * sizeof(PageNumber),
               sizeof(PageNumber));
@@ -72,14 +72,14 @@ void OverFreePage::SetFreeListInfoPageNumber(u16 free_list_idx,
                                              PageNumber page_number) {
   ImageIndex start_idx =
       sizeof(OverflowPageHeaderByteView) + sizeof(FreeListInfoHeaderByteView);
-  std::memcpy(p_image_->data() + start_idx + free_list_idx * sizeof(PageNumber),
+  std::memcpy(p_image_.data() + start_idx + free_list_idx * sizeof(PageNumber),
               &page_number, sizeof(PageNumber));
 }
 
 bool OverFreePage::CanInsertPageNumber() {
   ImageIndex start_idx = sizeof(OverflowPageHeaderByteView);
-  u16 usable_space =
-      kPageSize - (start_idx + sizeof(FreeListInfoHeaderByteView));
+  u32 usable_space =
+      p_image_.size() - (start_idx + sizeof(FreeListInfoHeaderByteView));
   u16 num_free_list_pages = GetNumberOfFreeListPages();
   return num_free_list_pages < usable_space / sizeof(PageNumber);
 }
@@ -93,6 +93,67 @@ void OverFreePage::InsertPageNumber(PageNumber page_number) {
   IncrementFreeListNumPages();
 }
 
+FreeMapHeaderByteView OverFreePage::GetFreeMapHeaderByteView() {
+  FreeMapHeaderByteView byte_view{};
+  std::memcpy(&byte_view, p_image_.data(), sizeof(FreeMapHeaderByteView));
+  return byte_view;
+}
+
+void OverFreePage::SetFreeMapHeaderByteView(
+    FreeMapHeaderByteView &free_map_header) {
+  std::memcpy(p_image_.data(), &free_map_header,
+              sizeof(FreeMapHeaderByteView));
+}
+
+bool OverFreePage::IsFreeMapBitSet(u32 bit_idx) {
+  std::byte bits = p_image_[sizeof(FreeMapHeaderByteView) + bit_idx / 8];
+  return (bits & std::byte{static_cast<u8>(1 << (bit_idx % 8))}) !=
+         std::byte{0};
+}
+
+/**
+ * Sets or clears the bit of a page, and keeps the number of set bits in the
+ * header in step
+ */
+void OverFreePage::SetFreeMapBit(u32 bit_idx, bool is_set) {
+  if (IsFreeMapBitSet(bit_idx) == is_set) {
+    return;
+  }
+  std::byte &bits = p_image_[sizeof(FreeMapHeaderByteView) + bit_idx / 8];
+  bits ^= std::byte{static_cast<u8>(1 << (bit_idx % 8))};
+  FreeMapHeaderByteView free_map_header = GetFreeMapHeaderByteView();
+  if (is_set) {
+    free_map_header.num_free_pages++;
+  } else {
+    free_map_header.num_free_pages--;
+  }
+  SetFreeMapHeaderByteView(free_map_header);
+}
+
+/**
+ * Returns the first set bit at or after start_bit_idx, or FreeMapNumBits() of
+ * the page size if there is none. Bytes without a set bit are skipped whole.
+ */
+u32 OverFreePage::FindFreeMapBit(u32 start_bit_idx) {
+  u32 num_bits = FreeMapNumBits(p_image_.size());
+  u32 bit_idx = start_bit_idx;
+  while (bit_idx < num_bits) {
+    std::byte bits =
+        p_image_[sizeof(FreeMapHeaderByteView) + bit_idx / 8] >>
+        (bit_idx % 8);
+    if (bits == std::byte{0}) {
+      bit_idx += 8 - bit_idx % 8;
+      continue;
+    }
+    while ((bits & std::byte{1}) == std::byte{0}) {
+      bits >>= 1;
+      bit_idx++;
+    }
+    return bit_idx;
+  }
+  return num_bits;
+}
+
 /**
  * Since there is no extra space to destroy, this function does nothing
  */
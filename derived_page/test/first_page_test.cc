@@ -23,7 +23,7 @@ TEST(FirstPageTest, DetectsIncorrectMagicInt) {
   // Step 2: Corrupt the magic int
   FirstPageByteView corrupted_byte_view{};
   corrupted_byte_view.magic_int = 321;
-  std::memcpy(first_page.p_image_->data(), &corrupted_byte_view, sizeof(FirstPageByteView));
+  std::memcpy(first_page.p_image_.data(), &corrupted_byte_view, sizeof(FirstPageByteView));
 
   // Step 3: Check that the magic int is incorrect
   EXPECT_FALSE(first_page.HasCorrectMagicInt());
@@ -43,3 +43,38 @@ TEST(PagerInteractionTest, CanModifyPageContent) {
   EXPECT_TRUE(p_first_page->HasCorrectMagicInt());
 }
 
+
+TEST(FirstPageTest, KeepsFreeSpaceFormatApartFromMeta) {
+  // Step 1: A zeroed first page, as in a file written before the format
+  // existed, uses the free list
+  FirstPage first_page{};
+  std::memset(first_page.p_image_.data(), 0, kDefaultPageSize);
+  first_page.SetDefaultByteView();
+  EXPECT_EQ(first_page.GetFreeSpaceFormat(), FreeSpaceFormat::kFreeList);
+
+  // Step 2: Setting the format leaves the meta integers alone
+  std::array<int, kMetaIntArraySize> meta_int_arr = {0, 200, 300, 400};
+  first_page.UpdateMeta(meta_int_arr);
+  first_page.SetFreeSpaceFormat(FreeSpaceFormat::kBitmap);
+  std::array<int, kMetaIntArraySize> retrieved_meta_int_arr{};
+  first_page.GetMeta(retrieved_meta_int_arr);
+  EXPECT_EQ(retrieved_meta_int_arr, meta_int_arr);
+  EXPECT_EQ(first_page.GetFreeSpaceFormat(), FreeSpaceFormat::kBitmap);
+}
+
+TEST(FirstPageTest, RecordsPageSize) {
+  // Step 1: A file written before the page size was recorded has 1024-byte
+  // pages
+  FirstPage first_page{};
+  std::memset(first_page.p_image_.data(), 0, kDefaultPageSize);
+  first_page.SetDefaultByteView();
+  EXPECT_EQ(first_page.GetPageSize(), 1024);
+
+  // Step 2: The page size is kept apart from the format and the pending drops
+  first_page.SetFreeSpaceFormat(FreeSpaceFormat::kBitmap);
+  first_page.SetPageSize(4096);
+  first_page.PushPendingDrop(7);
+  EXPECT_EQ(first_page.GetPageSize(), 4096);
+  EXPECT_EQ(first_page.GetFreeSpaceFormat(), FreeSpaceFormat::kBitmap);
+  EXPECT_EQ(first_page.PopPendingDrop(), 7);
+}
@@ -38,4 +38,29 @@ TEST(DestroyExtraTest, OverFreePageDestroyExtra) {
   FreeListInfoHeaderByteView header_after_destroy = over_free_page.GetFreeListInfoHeaderByteView();
   EXPECT_EQ(header_after_destroy.num_free_pages, header_before_destroy.num_free_pages);
 
-}
\ No newline at end of file
+}
+TEST(FreeMapPageTest, SetsCountsAndFindsBits) {
+  // Step 1: Create an OverFreePage with an empty map
+  OverFreePage over_free_page;
+  std::memset(over_free_page.p_image_.data(), 0, kDefaultPageSize);
+  EXPECT_EQ(over_free_page.FindFreeMapBit(0), FreeMapNumBits(kDefaultPageSize));
+
+  // Step 2: Set a few bits, one of them twice
+  for (u32 bit_idx : {5u, 9u, 9u, 200u, FreeMapNumBits(kDefaultPageSize) - 1}) {
+    over_free_page.SetFreeMapBit(bit_idx, true);
+  }
+  EXPECT_EQ(over_free_page.GetFreeMapHeaderByteView().num_free_pages, 4);
+  EXPECT_TRUE(over_free_page.IsFreeMapBitSet(9));
+  EXPECT_FALSE(over_free_page.IsFreeMapBitSet(10));
+
+  // Step 3: Find them in order, from anywhere in the map
+  EXPECT_EQ(over_free_page.FindFreeMapBit(0), 5);
+  EXPECT_EQ(over_free_page.FindFreeMapBit(6), 9);
+  EXPECT_EQ(over_free_page.FindFreeMapBit(10), 200);
+  EXPECT_EQ(over_free_page.FindFreeMapBit(201), FreeMapNumBits(kDefaultPageSize) - 1);
+
+  // Step 4: Clear one and check the count follows
+  over_free_page.SetFreeMapBit(200, false);
+  EXPECT_EQ(over_free_page.GetFreeMapHeaderByteView().num_free_pages, 3);
+  EXPECT_EQ(over_free_page.FindFreeMapBit(10), FreeMapNumBits(kDefaultPageSize) - 1);
+}
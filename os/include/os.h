@@ -146,7 +146,23 @@ class OsFile {
 
   ResultCode OsWrite(const std::vector<std::byte> &data, u32 amount);
 
-  ResultCode OsWrite(const std::array<std::byte, kPageSize> &data);
+  ResultCode OsWrite(const std::byte *p_data, u32 amount);
+
+  ResultCode OsReadAt(std::vector<std::byte> &data, u32 amount, u32 offset);
+
+  ResultCode OsWriteAt(const std::vector<std::byte> &data, u32 amount,
+                       u32 offset);
+
+  ResultCode OsReadAt(std::byte *p_data, u32 amount, u32 offset);
+
+  ResultCode OsWriteAt(const std::byte *p_data, u32 amount, u32 offset);
+
+  ResultCode OsWriteV(const std::vector<const std::byte *> &buffers,
+                      u32 buffer_size, u32 offset, u32 &num_syscalls);
+
+  ResultCode OsMapReadOnly(u32 size, std::byte *&p_map);
+
+  static ResultCode OsUnmap(std::byte *p_map, u32 size);
 
   ResultCode OsDisplay();
 
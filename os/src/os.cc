@@ -5,6 +5,9 @@
 #include "os.h"
 #include <unistd.h>
 #include <fcntl.h>
+#include <climits>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <ctime>
 #include <fstream>
@@ -303,28 +306,28 @@ ResultCode OsFile::OsWrite(const std::vector<std::byte> &data) {
 }
 
 /*
- * Writes an array of kPageSize to a file
+ * Writes a specified amount of data from a buffer to the file
  *
  * This function was added to such that p_image could be directly written
  * into the file without having to convert it into a vector of bytes.
  *
  */
-ResultCode OsFile::OsWrite(const std::array<std::byte, kPageSize> &data) {
+ResultCode OsFile::OsWrite(const std::byte *p_data, u32 amount) {
 #if OS_UNIX
   int wrote;
-  wrote = write(fd_, data.data(), kPageSize);
+  wrote = write(fd_, p_data, amount);
   if (wrote < 0) {
     return ResultCode::kFull;
   }
-  return ResultCode::kOk;
+  return (u32) wrote == amount ? ResultCode::kOk : ResultCode::kIOError;
 #endif
 
 #if OS_WIN
   DWORD wrote;
-  if (!WriteFile(h_, data.data(), kPageSize, &wrote, nullptr)) {
+  if (!WriteFile(h_, p_data, amount, &wrote, nullptr)) {
     return ResultCode::kFull;
   }
-  return ResultCode::kOk;
+  return (u32) wrote == amount ? ResultCode::kOk : ResultCode::kIOError;
 #endif
 
 }
@@ -351,6 +354,227 @@ ResultCode OsFile::OsWrite(const std::vector<std::byte> &data, u32 amount) {
 
 }
 
+/*
+ * Reads a specified amount of data starting at an absolute offset of the file
+ *
+ * Unlike OsSeek() followed by OsRead(), this does not move the shared file
+ * position, so it takes a single system call and is safe to issue from
+ * several threads that share one OsFile.
+ */
+ResultCode OsFile::OsReadAt(std::vector<std::byte> &data, u32 amount,
+                            u32 offset) {
+  if (data.size() < amount) {
+    data.resize(amount);
+  }
+
+#if OS_UNIX
+  ssize_t got;
+  got = pread(fd_, data.data(), amount, offset);
+  if (got < 0) {
+    return ResultCode::kIOError;
+  }
+  return (u32) got == amount ? ResultCode::kOk : ResultCode::kIOError;
+#endif
+
+#if OS_WIN
+  DWORD got;
+  OVERLAPPED overlapped{};
+  overlapped.Offset = offset;
+  if (!ReadFile(h_, data.data(), amount, &got, &overlapped)) {
+    got = 0;
+  }
+  return (u32) got == amount ? ResultCode::kOk : ResultCode::kIOError;
+#endif
+}
+
+/*
+ * Writes a specified amount of data from a vector at an absolute offset of
+ * the file without moving the shared file position
+ */
+ResultCode OsFile::OsWriteAt(const std::vector<std::byte> &data, u32 amount,
+                             u32 offset) {
+#if OS_UNIX
+  ssize_t wrote;
+  wrote = pwrite(fd_, data.data(), amount, offset);
+  if (wrote < 0) {
+    return ResultCode::kFull;
+  }
+  return (u32) wrote == amount ? ResultCode::kOk : ResultCode::kIOError;
+#endif
+
+#if OS_WIN
+  DWORD wrote;
+  OVERLAPPED overlapped{};
+  overlapped.Offset = offset;
+  if (!WriteFile(h_, data.data(), amount, &wrote, &overlapped)) {
+    return ResultCode::kFull;
+  }
+  return (u32) wrote == amount ? ResultCode::kOk : ResultCode::kIOError;
+#endif
+}
+
+/*
+ * Reads a specified amount of data at an absolute offset directly into a
+ * buffer
+ *
+ * This overload lets the pager fill BasePage::p_image_ in place, without
+ * staging the page in a temporary vector.
+ */
+ResultCode OsFile::OsReadAt(std::byte *p_data, u32 amount, u32 offset) {
+#if OS_UNIX
+  ssize_t got;
+  got = pread(fd_, p_data, amount, offset);
+  if (got < 0) {
+    return ResultCode::kIOError;
+  }
+  return (u32) got == amount ? ResultCode::kOk : ResultCode::kIOError;
+#endif
+
+#if OS_WIN
+  DWORD got;
+  OVERLAPPED overlapped{};
+  overlapped.Offset = offset;
+  if (!ReadFile(h_, p_data, amount, &got, &overlapped)) {
+    got = 0;
+  }
+  return (u32) got == amount ? ResultCode::kOk : ResultCode::kIOError;
+#endif
+}
+
+// Writes a buffer at an absolute offset of the file, in place
+ResultCode OsFile::OsWriteAt(const std::byte *p_data, u32 amount,
+                             u32 offset) {
+#if OS_UNIX
+  ssize_t wrote;
+  wrote = pwrite(fd_, p_data, amount, offset);
+  if (wrote < 0) {
+    return ResultCode::kFull;
+  }
+  return (u32) wrote == amount ? ResultCode::kOk : ResultCode::kIOError;
+#endif
+
+#if OS_WIN
+  DWORD wrote;
+  OVERLAPPED overlapped{};
+  overlapped.Offset = offset;
+  if (!WriteFile(h_, p_data, amount, &wrote, &overlapped)) {
+    return ResultCode::kFull;
+  }
+  return (u32) wrote == amount ? ResultCode::kOk : ResultCode::kIOError;
+#endif
+}
+
+/*
+ * Writes a run of equally sized buffers to consecutive positions of the file,
+ * starting at an absolute offset
+ *
+ * Buffer i lands at offset + i * buffer_size. On UNIX the whole run is handed
+ * to pwritev(), split only when it exceeds IOV_MAX entries, so a run of
+ * adjacent pages costs one system call instead of one per page.
+ * num_syscalls is set to the number of write calls that were issued.
+ */
+ResultCode OsFile::OsWriteV(const std::vector<const std::byte *> &buffers,
+                            u32 buffer_size, u32 offset, u32 &num_syscalls) {
+  num_syscalls = 0;
+
+#if OS_UNIX
+  std::vector<struct iovec> iov(buffers.size());
+  for (size_t i = 0; i < buffers.size(); i++) {
+    iov[i].iov_base = const_cast<std::byte *>(buffers[i]);
+    iov[i].iov_len = buffer_size;
+  }
+  size_t done = 0;
+  while (done < iov.size()) {
+    int count = (int) std::min<size_t>(iov.size() - done, IOV_MAX);
+    ssize_t expected = (ssize_t) count * buffer_size;
+    ssize_t wrote = pwritev(fd_, iov.data() + done, count,
+                            offset + (off_t) done * buffer_size);
+    num_syscalls++;
+    if (wrote < 0) {
+      return ResultCode::kFull;
+    }
+    if (wrote != expected) {
+      return ResultCode::kIOError;
+    }
+    done += count;
+  }
+  return ResultCode::kOk;
+#endif
+
+#if OS_WIN
+  for (size_t i = 0; i < buffers.size(); i++) {
+    DWORD wrote;
+    OVERLAPPED overlapped{};
+    overlapped.Offset = offset + (u32) i * buffer_size;
+    num_syscalls++;
+    if (!WriteFile(h_, buffers[i], buffer_size, &wrote, &overlapped)) {
+      return ResultCode::kFull;
+    }
+    if (wrote != buffer_size) {
+      return ResultCode::kIOError;
+    }
+  }
+  return ResultCode::kOk;
+#endif
+}
+
+/*
+ * Maps the first size bytes of the file read-only and shared into memory
+ *
+ * On UNIX the mapping may extend past the current end of the file; the tail
+ * becomes readable as the file grows, but touching it before that raises
+ * SIGBUS, so callers must only read pages that are known to be in the file.
+ * Windows cannot map past the end of a read-only file, so the view is
+ * clamped to the file size there.
+ */
+ResultCode OsFile::OsMapReadOnly(u32 size, std::byte *&p_map) {
+  p_map = nullptr;
+  if (size == 0) {
+    return ResultCode::kIOErrorMMap;
+  }
+
+#if OS_UNIX
+  void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd_, 0);
+  if (p == MAP_FAILED) {
+    return ResultCode::kIOErrorMMap;
+  }
+  p_map = static_cast<std::byte *>(p);
+  return ResultCode::kOk;
+#endif
+
+#if OS_WIN
+  DWORD file_size = GetFileSize(h_, nullptr);
+  if (size > file_size) {
+    size = file_size;
+  }
+  HANDLE h_map = CreateFileMapping(h_, nullptr, PAGE_READONLY, 0, size,
+                                   nullptr);
+  if (h_map == nullptr) {
+    return ResultCode::kIOErrorMMap;
+  }
+  void *p = MapViewOfFile(h_map, FILE_MAP_READ, 0, 0, size);
+  // The view keeps the mapping object alive
+  CloseHandle(h_map);
+  if (p == nullptr) {
+    return ResultCode::kIOErrorMMap;
+  }
+  p_map = static_cast<std::byte *>(p);
+  return ResultCode::kOk;
+#endif
+}
+
+// Releases a mapping created by OsMapReadOnly()
+ResultCode OsFile::OsUnmap(std::byte *p_map, u32 size) {
+#if OS_UNIX
+  return munmap(p_map, size) == 0 ? ResultCode::kOk
+                                  : ResultCode::kIOErrorMMap;
+#endif
+
+#if OS_WIN
+  return UnmapViewOfFile(p_map) ? ResultCode::kOk : ResultCode::kIOErrorMMap;
+#endif
+}
+
 // Displays the file contents to the standard output
 ResultCode OsFile::OsDisplay() {
 
@@ -402,7 +402,7 @@ TEST(WriteLockFile, AttemptReadLockAfterWriteLockRelease) {
   file_2.OsUnlock();
 }
 
-// Tests writing to a file using a fixed-size byte array
+// Tests writing to a file from a raw buffer
 TEST(WriteFunction, WriteByArray) {
   std::string filename = "test_WriteByArray.db";
   std::remove(filename.c_str());
@@ -411,15 +411,80 @@ TEST(WriteFunction, WriteByArray) {
   ResultCode rc = file.OsOpenReadWrite(filename, read_only);
   EXPECT_EQ(ResultCode::kOk, rc);
 
-  const std::array<std::byte, kPageSize> data = {std::byte(0x41), std::byte(0x42), std::byte(0x43)};
+  const std::array<std::byte, kDefaultPageSize> data = {std::byte(0x41), std::byte(0x42), std::byte(0x43)};
 
-  rc = file.OsWrite(data);
+  rc = file.OsWrite(data.data(), data.size());
   EXPECT_EQ(ResultCode::kOk, rc);
 
   rc = file.OsDisplay();
   EXPECT_EQ(ResultCode::kOk, rc);
 }
 
+// Tests positional writes and reads, which must not depend on the file
+// position left by earlier calls
+TEST(PositionalIO, WriteAtReadAt) {
+  std::string filename = "test_WriteAtReadAt.db";
+  std::remove(filename.c_str());
+  OsFile file;
+  bool read_only = false;
+  ResultCode rc = file.OsOpenReadWrite(filename, read_only);
+  EXPECT_EQ(ResultCode::kOk, rc);
+
+  std::vector<std::byte> first(kDefaultPageSize, std::byte(0x11));
+  std::vector<std::byte> second(kDefaultPageSize, std::byte(0x22));
+
+  // Write the second page before the first one to leave a hole in between
+  rc = file.OsWriteAt(second, kDefaultPageSize, kDefaultPageSize);
+  EXPECT_EQ(ResultCode::kOk, rc);
+  rc = file.OsWriteAt(first, kDefaultPageSize, 0);
+  EXPECT_EQ(ResultCode::kOk, rc);
+
+  u32 size;
+  rc = file.OsFileSize(size);
+  EXPECT_EQ(ResultCode::kOk, rc);
+  EXPECT_EQ(2 * kDefaultPageSize, size);
+
+  // The file position is untouched by positional I/O
+  EXPECT_EQ(0, file.GetCurrentPosition());
+
+  std::vector<std::byte> buffer;
+  rc = file.OsReadAt(buffer, kDefaultPageSize, kDefaultPageSize);
+  EXPECT_EQ(ResultCode::kOk, rc);
+  EXPECT_EQ(second, buffer);
+  rc = file.OsReadAt(buffer, kDefaultPageSize, 0);
+  EXPECT_EQ(ResultCode::kOk, rc);
+  EXPECT_EQ(first, buffer);
+
+  // Reading past the end of the file is a short read
+  rc = file.OsReadAt(buffer, kDefaultPageSize, 2 * kDefaultPageSize);
+  EXPECT_EQ(ResultCode::kIOError, rc);
+}
+
+// Tests positional I/O that goes straight to and from a page image
+TEST(PositionalIO, PageImageInPlace) {
+  std::string filename = "test_PageImageInPlace.db";
+  std::remove(filename.c_str());
+  OsFile file;
+  bool read_only = false;
+  ResultCode rc = file.OsOpenReadWrite(filename, read_only);
+  EXPECT_EQ(ResultCode::kOk, rc);
+
+  std::array<std::byte, kDefaultPageSize> image{};
+  image.fill(std::byte(0x33));
+  rc = file.OsWriteAt(image.data(), image.size(), 3 * kDefaultPageSize);
+  EXPECT_EQ(ResultCode::kOk, rc);
+
+  std::array<std::byte, kDefaultPageSize> read_back{};
+  rc = file.OsReadAt(read_back.data(), read_back.size(), 3 * kDefaultPageSize);
+  EXPECT_EQ(ResultCode::kOk, rc);
+  EXPECT_EQ(image, read_back);
+
+  // The hole before the page reads back as zeros
+  rc = file.OsReadAt(read_back.data(), read_back.size(), 0);
+  EXPECT_EQ(ResultCode::kOk, rc);
+  EXPECT_EQ(std::byte(0), read_back[0]);
+}
+
 TEST(OsFileTest, SleepFunction) {
   std::string filename = "test_sleep.db";
   std::remove(filename.c_str());
@@ -3,12 +3,24 @@
 //
 
 #pragma once
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <boost/dynamic_bitset.hpp>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
 #include <list>
-#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -23,9 +35,22 @@ static const std::vector<std::byte> kAJournalMagic{
     std::byte{0x20}, std::byte{0xa1}, std::byte{0x63}, std::byte{0xd4},
 };
 
+// Magic string at the start of the write-ahead log
+static const std::vector<std::byte> kWalMagic{
+    std::byte{0x37}, std::byte{0x7f}, std::byte{0x06}, std::byte{0x82},
+    std::byte{0x57}, std::byte{0x41}, std::byte{0x4c}, std::byte{0x00},
+};
+
 // Since the database is 1-indexed, we have to make extra room for bitmap
 static constexpr int kBitMapPlaceHolder = 1;
 static constexpr int kMaxPageNum = 10;
+// Smallest mapping set up in memory-mapped mode, in pages, so that a small,
+// growing database file is not remapped on every new page
+static constexpr u32 kMinMapPages = 256;
+// Most page images the prefetch thread keeps ready for SqlitePagerGet
+static constexpr u32 kMaxPrefetchedPages = 64;
+// Committed WAL frames after which a commit wakes the background checkpointer
+static constexpr u32 kWalAutoCheckpointFrames = 1000;
 
 // Definition of lock state
 enum class SqliteLockState : u8 {
@@ -45,7 +70,113 @@ enum class SqlitePagerError : u8 {
 // Define the eviction policy
 enum class EvictionPolicy {
   FIRST_NON_DIRTY,
-  LRU  // Least Frequently Used
+  LRU,         // Least Recently Used
+  TWO_QUEUE,   // 2Q: a FIFO probation queue guarding an LRU queue of hot pages
+  ARC          // Adaptive Replacement Cache
+};
+
+// Which of the queues kept by TWO_QUEUE and ARC a cached page is on. For 2Q
+// they are A1in and Am, for ARC they are T1 and T2.
+enum class PolicyQueueId : u8 {
+  NONE = 0,
+  RECENT = 1,   // pages seen once recently
+  FREQUENT = 2  // pages seen at least twice
+};
+
+// Cache counters of one Pager, tagged with the policy that produced them
+struct PagerCacheStats {
+  EvictionPolicy policy;
+  u32 num_hits;        // SqlitePagerGet calls served from the cache
+  u32 num_misses;      // SqlitePagerGet calls that had to create a page
+  u32 num_evictions;   // pages dropped to make room
+  u32 num_ghost_hits;  // misses on pages the policy still remembered
+};
+
+// Counters of the write-ahead log, see SqlitePagerSetJournalMode
+struct PagerWalStats {
+  u32 num_commits;         // transactions committed to the log
+  u32 num_syncs;           // syncs of the log
+  u32 num_shared_syncs;    // group syncs that also covered other pagers
+  u32 num_frames;          // committed frames in the log right now
+  double commits_per_sync;  // how many commits a sync made durable on average
+};
+
+// How a write transaction is made durable
+enum class JournalMode {
+  ROLLBACK,  // original pages go to the -journal file, then the file is
+             // written in place
+  WAL,       // new page images are appended to the -wal file
+};
+
+/*
+ * WalFrameHeader
+ *
+ * This trivially copyable struct precedes every page image in the -wal file.
+ * commit_size is non-zero only on the last frame of a transaction, where it
+ * is the database size in pages after the commit. A frame belongs to the
+ * current log only if its salt matches the log header and its checksum
+ * matches its contents.
+ */
+struct WalFrameHeader {
+  PageNumber page_number;
+  u32 commit_size;
+  u32 salt;
+  u32 checksum;
+};
+
+// The -wal file: [kWalMagic][page size][salt] followed by the frames, each a
+// WalFrameHeader and a page image
+static constexpr u32 kWalHeaderSize = 16;
+
+// Counters of the read-ahead done through SqlitePagerPrefetch
+struct PagerPrefetchStats {
+  u32 num_issued;  // pages read by the prefetch thread
+  u32 num_hits;    // cache misses served from a prefetched image
+  u32 num_wasted;  // prefetched images dropped before any miss used them
+};
+
+/**
+ * @class PageImage
+ * @brief A view of the bytes of one page, which are page size bytes long.
+ *
+ * The pager owns the bytes; copying a PageImage copies the view, not the
+ * bytes. at() checks the index like std::array::at() does.
+ */
+class PageImage {
+ public:
+  PageImage() = default;
+  PageImage(std::byte *p_data, u32 size) : p_data_(p_data), size_(size) {}
+
+  [[nodiscard]] std::byte *data() const { return p_data_; }
+  [[nodiscard]] u32 size() const { return size_; }
+  [[nodiscard]] std::byte *begin() const { return p_data_; }
+  [[nodiscard]] std::byte *end() const { return p_data_ + size_; }
+  std::byte &operator[](u32 idx) const { return p_data_[idx]; }
+  std::byte &at(u32 idx) const {
+    if (idx >= size_) {
+      throw std::out_of_range("PageImage::at");
+    }
+    return p_data_[idx];
+  }
+
+ private:
+  std::byte *p_data_{};
+  u32 size_{};
+};
+
+// Given the image of a page, returns the number of the page to read after it,
+// or 0 to stop. Used by SqlitePagerPrefetch to follow chains of pages.
+using NextPageFunction = std::function<PageNumber(const PageImage &)>;
+
+// Told the outcome of a commit once it is durable (or failed), see
+// SqlitePagerCommit(const CommitCallback &)
+using CommitCallback = std::function<void(ResultCode)>;
+
+
+// Define how page images are read from the database file
+enum class PageIoMode {
+  POSITIONAL_IO,  // every page owns a private image filled by OsReadAt
+  MEMORY_MAPPED   // clean pages are views into a shared read-only mapping
 };
 
 // Added static const to fix linker error
@@ -54,20 +185,206 @@ static constexpr int kPagerErrorFull = 0x01;
 class Pager;
 class BasePage;
 
+/**
+ * @class WalReadMarks
+ * @brief The snapshots the pagers of this process read from one -wal file.
+ *
+ * A pager holding a read lock in JournalMode::WAL keeps a read mark: the salt
+ * of the log it read, how many of its frames it sees and the database size in
+ * its snapshot. A checkpoint copies no frame past the oldest mark and does not
+ * cut the database file below the size a mark still reads, and the log is
+ * only started over when no other pager reads its frames. There is no shared
+ * memory, so the pagers of one file find their marks through a table keyed by
+ * the file name, as OsFile finds its locks.
+ *
+ * mutex_ must be held around every call. A pager also holds it while it reads
+ * the log and sets its mark, and while it starts the log over, so a snapshot
+ * is never taken of a log that is about to go.
+ */
+class WalReadMarks {
+ public:
+  std::mutex mutex_;
+
+  static std::shared_ptr<WalReadMarks> Find(const std::string &wal_file_name);
+  void Set(const Pager *p_pager, u32 salt, u32 num_frames, u32 db_size);
+  void Clear(const Pager *p_pager);
+  // how many frames of the log with the given salt every reader sees, and the
+  // largest database size a reader sees
+  void GetCheckpointLimit(u32 salt, u32 &num_frames, u32 &db_size) const;
+  // whether a pager other than p_pager sees frames of the log with that salt
+  [[nodiscard]] bool IsReadByOthers(const Pager *p_pager, u32 salt) const;
+
+ private:
+  struct ReadMark {
+    u32 salt;
+    u32 num_frames;
+    u32 db_size;
+  };
+  std::unordered_map<const Pager *, ReadMark> marks_;
+
+  static std::mutex table_mutex_;
+  static std::unordered_map<std::string, std::weak_ptr<WalReadMarks>> table_;
+};
+
+/**
+ * @class WalGroupCommit
+ * @brief The commits of this process that wait for a sync of one -wal file.
+ *
+ * With a group commit window set (see Pager::SqlitePagerSetGroupCommit), a
+ * commit appended to the log is queued here instead of syncing the log. The
+ * first commit of a group starts the window, and when it closes one sync
+ * makes every commit of the group durable, whichever pager it came from. The
+ * pagers of one file find the queue through a table keyed by the file name,
+ * as they find their WalReadMarks, so transactions of separate handles share
+ * syncs as well as consecutive transactions of one handle.
+ *
+ * The group commit thread syncs the log through the handle of a pager in the
+ * group. A pager therefore calls Flush before it closes its log, which syncs
+ * its waiting commits at once instead of at the end of the window.
+ */
+class WalGroupCommit {
+ public:
+  struct Waiter {
+    Pager *p_pager;
+    // the log the commit went to, and how many frames the log had after its
+    // commit frame, so the sync tells how far the log is durable
+    u32 salt;
+    u32 num_frames;
+    CommitCallback on_durable;
+  };
+
+  ~WalGroupCommit();
+  static std::shared_ptr<WalGroupCommit> Find(const std::string &wal_file_name);
+  void Enqueue(Waiter waiter, std::chrono::microseconds window);
+  // returns once every commit p_pager queued is synced and told
+  void Flush(const Pager *p_pager);
+
+ private:
+  void Loop();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Waiter> waiters_;
+  std::chrono::steady_clock::time_point deadline_;
+  // commits of each pager that are queued or being synced
+  std::unordered_map<const Pager *, u32> num_unsynced_;
+  u32 num_flushing_{};  // Flush calls waiting, which close the window early
+  std::thread thread_;
+  bool is_stopping_{};
+
+  static std::mutex table_mutex_;
+  static std::unordered_map<std::string, std::weak_ptr<WalGroupCommit>> table_;
+};
+
 class PageRecord {
  public:
   PageNumber page_number_;
-  std::array<std::byte, kPageSize> p_image_;
+  std::vector<std::byte> p_image_;
   std::vector<std::byte> ImageVector();
 };
 
+/**
+ * @class PageHashTable
+ * @brief Maps page numbers to the cached pages, and owns them.
+ *
+ * A flat open-addressing table with linear probing, so a cache hit is a hash
+ * and a short scan over contiguous slots instead of a walk down a tree. Page
+ * number 0 is never a valid page and marks an empty slot.
+ */
+class PageHashTable {
+ public:
+  PageHashTable();
+  ~PageHashTable();
+
+  [[nodiscard]] BasePage *Find(PageNumber page_number) const;
+  BasePage *Insert(PageNumber page_number, std::unique_ptr<BasePage> p_page);
+  void Erase(PageNumber page_number);
+  void Clear();
+  [[nodiscard]] u32 Size() const { return num_entries_; }
+
+ private:
+  struct Slot {
+    PageNumber page_number{};
+    std::unique_ptr<BasePage> p_page;
+  };
+  std::vector<Slot> slots_;  // the size is always a power of two
+  u32 num_entries_;
+  u32 shift_;  // 32 - log2(slots_.size())
+
+  [[nodiscard]] u32 HomeSlot(PageNumber page_number) const;
+  void Grow();
+};
+
+/**
+ * @class PolicyPageQueue
+ * @brief One of the queues of TWO_QUEUE and ARC. size_ counts every page on
+ * the queue, but like the free list only the pages nobody references are
+ * linked through PageHeader::p_prev_policy_/p_next_policy_, in the order they
+ * were released, so the first one is always the eviction candidate.
+ */
+class PolicyPageQueue {
+ public:
+  BasePage *p_first_{}, *p_last_{};
+  u32 size_{};
+
+  void Add(BasePage *p_page, PolicyQueueId id);
+  void Remove(BasePage *p_page);
+  void Link(BasePage *p_page);
+  void Unlink(BasePage *p_page);
+  void Clear();
+
+ private:
+  [[nodiscard]] bool IsLinked(BasePage *p_page) const;
+};
+
+/**
+ * @class GhostQueue
+ * @brief The page numbers of recently evicted pages, oldest first, with O(1)
+ * membership tests. Only page numbers are kept, never images.
+ *
+ * The numbers sit in a ring in the order they were pushed, and an open
+ * addressing index maps each number to its position. A removed number leaves
+ * a stale entry in the ring, which PopFront skips and which is dropped when
+ * the ring fills up.
+ */
+class GhostQueue {
+ public:
+  GhostQueue();
+  [[nodiscard]] bool Contains(PageNumber page_number) const;
+  bool Remove(PageNumber page_number);
+  void PushBack(PageNumber page_number);
+  void PopFront();
+  void Clear();
+  [[nodiscard]] u32 Size() const { return num_entries_; }
+
+ private:
+  struct Slot {
+    PageNumber page_number{};  // 0 marks an empty slot
+    u32 position{};            // where the page number is in the ring
+  };
+  std::vector<PageNumber> ring_;  // its size is a power of two
+  u32 head_{}, tail_{};           // positions, taken modulo the ring size
+  std::vector<Slot> slots_;       // twice the ring size
+  u32 num_entries_{};
+  u32 shift_{};
+
+  [[nodiscard]] u32 HomeSlot(PageNumber page_number) const;
+  [[nodiscard]] u32 FindSlot(PageNumber page_number) const;
+  void InsertSlot(PageNumber page_number, u32 position);
+  void EraseSlot(u32 hole);
+  void Rebuild(u32 ring_size);
+};
+
 class PageHeader {
  public:
   Pager *p_pager_;                        // the Pager this page belongs to
   PageNumber page_number_;                // the page number of this page
-  u32 num_ref_;                           // number of references to this page
-  BasePage *p_prev_free_, *p_next_free_;  // free linked list for pages
+  std::atomic<u32> num_ref_;              // number of references to this page
+  BasePage *p_prev_free_, *p_next_free_;  // free linked list for pages, which
+                                          // is also the LRU order
   BasePage *p_prev_all_, *p_next_all_;    // all linked list for pages
+  BasePage *p_prev_policy_, *p_next_policy_;  // TWO_QUEUE / ARC queue links
+  PolicyQueueId policy_queue_;                // the queue the page is on
   bool is_in_journal_;     // true if the page is currently in the journal file
   bool is_in_checkpoint_;  // true if the page is in the checkpoint journal file
   bool is_dirty_;  // true if the page has been modified since the last journal
@@ -85,6 +402,9 @@ class PageHeader {
         p_next_free_(nullptr),
         p_prev_all_(nullptr),
         p_next_all_(nullptr),
+        p_prev_policy_(nullptr),
+        p_next_policy_(nullptr),
+        policy_queue_(PolicyQueueId::NONE),
         is_in_journal_(false),
         is_in_checkpoint_(false),
         is_dirty_(false) {};
@@ -105,6 +425,8 @@ class PageHeader {
  * datafile, i.e., database connection.)
  */
 class Pager {
+  friend class WalGroupCommit;
+
  public:
   std::string file_name_;
   std::string journal_file_name_;
@@ -115,12 +437,20 @@ class Pager {
   // sizeof(page_image), TODO-Delete;
   u32 n_extra_size_{};
   u32 num_mem_pages_{};               // number of pages in memory
-  u32 num_mem_pages_ref_positive_{};  // number of pages in memory with positive
-                                      // reference count
+  // number of pages in memory with positive reference count
+  std::atomic<u32> num_mem_pages_ref_positive_{};
   u32 num_mem_pages_max_{};  // maximum number of pages allowed in memory
+  u32 page_size_{kDefaultPageSize};  // bytes in a page, see
+                                     // SqlitePagerSetPageSize
 
   /* Cache hits, missing, and LRU overflows */
-  u32 num_pages_hit_{}, num_pages_miss_{}, num_pages_overflow_{};
+  std::atomic<u32> num_pages_hit_{};
+  u32 num_pages_miss_{}, num_pages_overflow_{};
+  /* Pages written back to the database file, and the write calls it took */
+  u32 num_pages_flushed_{}, num_flush_syscalls_{};
+  /* Bumped by every page write, rollback, truncation and cache reset, and by
+  ** every commit of another pager read from the log */
+  std::atomic<u64> data_version_{};
   int num_database_original_size_{};  // original size of the database file
   int num_database_size_{};           // The number of pages in the file
   bool is_journal_open_{};            // true if the journal file is open
@@ -151,27 +481,133 @@ class Pager {
   BasePage *p_all_page_first_{};
   EvictionPolicy eviction_policy_;
 
-  // TO_TESTIFY: this is a hash table to find a page by page number, when the
-  // map loss the reference to the page, the page will be deleted.
-  std::unique_ptr<std::map<PageNumber, std::unique_ptr<BasePage>>>
-      page_hash_table_;
-  std::list<BasePage *> lru_list_;  // Maintain the LRU list
+  // Memory-mapped mode. Clean pages point into p_map_, which covers map_size_
+  // bytes of the file, of which map_file_size_ bytes were known to exist the
+  // last time the file size was checked. A mapping that had to be replaced by
+  // a larger one stays alive in retired_maps_ until the cache is reset, since
+  // cached pages may still point into it.
+  PageIoMode io_mode_;
+  std::byte *p_map_{};
+  u32 map_size_{}, map_file_size_{};
+  std::vector<std::pair<std::byte *, u32>> retired_maps_;
+  u32 num_pages_mapped_{};  // number of page reads served from the mapping
+
+  // these are hash tables to find a page by page number, when a table loses
+  // the reference to a page, the page will be deleted. Page n lives in table
+  // n % page_hash_tables_.size(); there is a single table unless the pager
+  // runs in concurrent mode.
+  std::vector<PageHashTable> page_hash_tables_;
+
+  // Concurrent mode (see SqlitePagerSetConcurrent). shard_latches_[i] guards
+  // page_hash_tables_[i] and the reference counts of the pages in it;
+  // cache_latch_ guards everything else: the free list, the list of all
+  // pages, the policy queues, the journal and the lock state. A thread that
+  // needs both takes the shard latch first, and only ever try-locks a second
+  // shard latch.
+  bool is_concurrent_{};
+  std::unique_ptr<std::mutex[]> shard_latches_;
+  std::recursive_mutex cache_latch_;
+
+  // Read-ahead (see SqlitePagerPrefetch). The prefetch thread is started by
+  // the first hint; prefetch_mutex_ guards everything below. Images it has
+  // read wait in prefetched_images_, oldest first in prefetched_order_, until
+  // a cache miss takes them. Writing the database file bumps
+  // prefetch_generation_, which discards every image read before the write.
+  struct PrefetchRequest {
+    PageNumber page_number;
+    u32 depth;
+    NextPageFunction next_page;
+  };
+  struct PrefetchedImage {
+    std::list<PageNumber>::iterator order;
+    std::unique_ptr<std::byte[]> p_image;
+  };
+  std::thread prefetch_thread_;
+  std::atomic<bool> is_prefetch_started_{};
+  mutable std::mutex prefetch_mutex_;
+  std::condition_variable prefetch_cv_;
+  std::deque<PrefetchRequest> prefetch_queue_;
+  std::list<PageNumber> prefetched_order_;
+  std::unordered_map<PageNumber, PrefetchedImage> prefetched_images_;
+  PageNumber prefetch_in_flight_{};  // page being read by the thread, or 0
+  u64 prefetch_generation_{};
+  bool is_prefetch_stopping_{};
+  u32 num_prefetch_issued_{}, num_prefetch_hits_{}, num_prefetch_wasted_{};
+
+  // Write-ahead log mode (see SqlitePagerSetJournalMode). wal_index_ maps a
+  // page to its latest committed frame, and wal_pending_index_ to the frames
+  // the open write transaction spilled to the log before its commit frame.
+  // Frame n starts at kWalHeaderSize + n * SqlitePagerPrivateWalFrameSize().
+  JournalMode journal_mode_{JournalMode::ROLLBACK};
+  std::string wal_file_name_;
+  std::unique_ptr<OsFile> wal_fd_;
+  std::unordered_map<PageNumber, u32> wal_index_, wal_pending_index_;
+  u32 wal_num_frames_{};          // committed frames in the log
+  u32 wal_num_pending_frames_{};  // frames written after them, uncommitted
+  u32 wal_db_size_{};  // database size as of the last commit frame, 0 if none
+  u32 wal_salt_{};
+  std::atomic<u32> num_wal_commits_{}, num_wal_syncs_{};
+  std::shared_ptr<WalReadMarks> wal_read_marks_;  // shared by the file's pagers
+
+  // Group commit (see SqlitePagerSetGroupCommit). Commits appended to the log
+  // but not yet synced wait in wal_group_commit_, shared by the pagers of the
+  // file, until its thread syncs the log for the whole group.
+  std::chrono::microseconds group_commit_window_{0};
+  std::shared_ptr<WalGroupCommit> wal_group_commit_;
+  std::atomic<u32> num_wal_shared_syncs_{};
+
+  // The background checkpointer copies a job, a range of synced frames, back
+  // into the database file; the log is restarted by the next write
+  // transaction once every committed frame has been copied.
+  // wal_checkpoint_mutex_ guards the job and the frame counts below, which
+  // belong to the log with salt wal_checkpoint_salt_: the first
+  // wal_num_synced_frames_ frames are durable, the first
+  // wal_num_checkpointed_frames_ are in the database file.
+  std::thread wal_checkpoint_thread_;
+  std::mutex wal_checkpoint_mutex_;
+  std::condition_variable wal_checkpoint_cv_;
+  u32 wal_checkpoint_job_salt_{}, wal_checkpoint_job_first_frame_{},
+      wal_checkpoint_job_frames_{}, wal_checkpoint_job_min_db_size_{};
+  bool has_wal_checkpoint_job_{};
+  u32 wal_checkpoint_salt_{};
+  u32 wal_num_synced_frames_{}, wal_num_checkpointed_frames_{};
+  bool is_wal_checkpoint_running_{}, is_wal_checkpoint_stopping_{};
+
+  // Queues of the scan-resistant policies. TWO_QUEUE keeps A1in in
+  // recent_queue_, Am in frequent_queue_ and A1out in recent_ghosts_. ARC
+  // keeps T1/T2 in recent_queue_/frequent_queue_ and B1/B2 in
+  // recent_ghosts_/frequent_ghosts_, and adapts arc_target_recent_, its
+  // target size for T1.
+  PolicyPageQueue recent_queue_, frequent_queue_;
+  GhostQueue recent_ghosts_, frequent_ghosts_;
+  u32 arc_target_recent_{};
+  u32 num_ghost_hits_{};
+  // where the page being loaded by SqlitePagerGet goes, decided on the miss
+  PolicyQueueId incoming_queue_{PolicyQueueId::RECENT};
+  bool is_incoming_frequent_ghost_{};
 
-  // Map page numbers to their position in the LRU list
-  std::unordered_map<PageNumber, std::list<BasePage *>::iterator> lru_map_;
-
-  // Update the LRU list when a page is accessed
-  void updateLRU(BasePage *p_page);
   // get the page to evict according to the eviction policy
   BasePage *evictPage();
 
   // constructors
   Pager(std::string &file_name, int max_page_num,
-        EvictionPolicy policy = EvictionPolicy::FIRST_NON_DIRTY);
+        EvictionPolicy policy = EvictionPolicy::FIRST_NON_DIRTY,
+        PageIoMode io_mode = PageIoMode::POSITIONAL_IO);
+  ~Pager();
 
   void SqlitePagerSetCachesize(
       int max_page_num);  // TO_DELETE: seems like we don't need to dynamically
                           // change the cache size
+  ResultCode SqlitePagerSetPageSize(
+      u32 page_size);  // read and write pages of another size
+  [[nodiscard]] u32 SqlitePagerPageSize() const;  // bytes in a page
+  ResultCode SqlitePagerReadFileHeader(
+      std::vector<std::byte> &header);  // read the start of the file directly
+  ResultCode SqlitePagerSetConcurrent(
+      u32 num_shards);  // let many threads get pages at the same time
+  ResultCode SqlitePagerSetJournalMode(
+      JournalMode mode);  // switch between the rollback journal and the WAL
+  ResultCode SqlitePagerWalCheckpoint();  // copy the WAL into the file now
   ResultCode SqlitePagerGet(
       PageNumber page_number, BasePage **pp_page,
       const std::function<std::unique_ptr<BasePage>()> &create_page);
@@ -194,6 +630,10 @@ class Pager {
   ResultCode SqlitePagerBegin(
       BasePage *p_page);             // this is to begin a transaction
   ResultCode SqlitePagerCommit();    // this is to commit a transaction
+  ResultCode SqlitePagerCommit(
+      const CommitCallback &on_durable);  // commit without waiting for sync
+  ResultCode SqlitePagerSetGroupCommit(
+      std::chrono::microseconds window);  // share log syncs between commits
   ResultCode SqlitePagerRollback();  // this is to rollback a transaction
   bool SqlitePagerIsReadOnly();  // TO_DELETE: return true if the pager is read
                                  // only, we don't want readonly pager
@@ -202,36 +642,103 @@ class Pager {
   ResultCode SqlitePagerCkptRollback();  // this is to rollback a checkpoint
   void SqlitePagerDontWrite(
       PageNumber page_number);  // TO_DELETE: seems like we don't need this
+  ResultCode SqlitePagerTruncate(
+      u32 num_pages);  // shrink the database, the file is cut at commit
+  PagerCacheStats SqlitePagerCacheStats() const;  // cache counters
+  ResultCode SqlitePagerPrefetch(
+      PageNumber page_number, u32 depth = 1,
+      const NextPageFunction &next_page = nullptr);  // read pages ahead
+  PagerPrefetchStats SqlitePagerPrefetchStats() const;  // read-ahead counters
+  PagerWalStats SqlitePagerWalStats() const;  // write-ahead log counters
+  u32 SqlitePagerFlushSyscallsSaved() const;  // write calls saved by
+                                              // coalescing page flushes
+  u64 SqlitePagerDataVersion() const;  // changes whenever the content of
+                                       // any page may have changed
 
  private:
   ResultCode SqlitePagerPrivatePlayback();
   ResultCode SqlitePagerPrivateCkptPlayback();
   ResultCode SqlitePagerPrivatePlaybackOnePage(OsFile *fd);
   BasePage *SqlitePagerPrivateCacheLookup(PageNumber page_number) const;
+  [[nodiscard]] u32 SqlitePagerPrivateShardOf(PageNumber page_number) const {
+    return page_number % page_hash_tables_.size();
+  }
   ResultCode SqlitePagerPrivateSyncAllPages();
+  ResultCode SqlitePagerPrivateWritePages(std::vector<BasePage *> &pages);
+  bool SqlitePagerPrivateMapPage(BasePage *p_page, PageNumber page_number);
+  void SqlitePagerPrivateUnmapAll();
   void SqlitePagerRefPrivate(BasePage *p_page);
   void SqlitePagerPrivatePagerReset();
   ResultCode SqlitePagerPrivateUnWriteLock();
   ResultCode SqlitePagerPrivateRetrieveError() const;
   ResultCode SqlitePagerPrivateCommitAbort();
   void SqlitePagerPrivateAddCreatedPageToCache(PageNumber page_number,
-                                               BasePage *&p_page);
-  void SqlitePagerPrivateRemovePageFromCache(PageNumber page_number,
-                                             BasePage *p_page);
+                                               BasePage *p_page);
+  void SqlitePagerPrivateRemovePageFromCache(BasePage *p_page);
+  void SqlitePagerPrivateUnlinkFreePage(BasePage *p_page);
+  void SqlitePagerPrivateAppendFreePage(BasePage *p_page);
+  void SqlitePagerPrivatePolicyOnHit(BasePage *p_page);
+  void SqlitePagerPrivatePolicyOnMiss(PageNumber page_number);
+  void SqlitePagerPrivatePolicyOnInsert(BasePage *p_page);
+  void SqlitePagerPrivatePolicyOnRemove(BasePage *p_page);
+  void SqlitePagerPrivatePolicyTrimGhosts();
+  void SqlitePagerPrivatePolicyReset();
+  BasePage *SqlitePagerPrivatePolicyFindVictim();
+  void SqlitePagerPrivatePrefetchLoop();
+  bool SqlitePagerPrivateTakePrefetched(
+      PageNumber page_number, std::byte *p_image);
+  void SqlitePagerPrivateDropPrefetched();
+  void SqlitePagerPrivateStopPrefetch();
+  ResultCode SqlitePagerPrivateWalRefresh(bool &has_changed);
+  bool SqlitePagerPrivateWalFindFrame(PageNumber page_number, u32 &frame);
+  [[nodiscard]] u32 SqlitePagerPrivateWalFrameSize() const {
+    return sizeof(WalFrameHeader) + page_size_;
+  }
+  ResultCode SqlitePagerPrivateWalReadFrame(PageNumber page_number, u32 frame,
+                                            std::byte *p_image);
+  ResultCode SqlitePagerPrivateWalAppendFrames(
+      std::vector<std::pair<PageNumber, const std::byte *>> &pages,
+      u32 commit_size);
+  ResultCode SqlitePagerPrivateWalBegin();
+  ResultCode SqlitePagerPrivateWalReloadCache();
+  ResultCode SqlitePagerPrivateWalWrite(BasePage *p_page);
+  ResultCode SqlitePagerPrivateWalSpill(std::vector<BasePage *> &pages);
+  ResultCode SqlitePagerPrivateCommit(const CommitCallback &on_durable,
+                                      bool &is_queued);
+  ResultCode SqlitePagerPrivateWalCommit(const CommitCallback &on_durable,
+                                         bool &is_queued);
+  void SqlitePagerPrivateStopGroupCommit();
+  ResultCode SqlitePagerPrivateWalRollback();
+  void SqlitePagerPrivateWalEndWrite();
+  ResultCode SqlitePagerPrivateWalRestart();
+  void SqlitePagerPrivateWalSetReadMark();
+  void SqlitePagerPrivateWalClearReadMark();
+  ResultCode SqlitePagerPrivateWalBackfill(bool &is_done);
+  ResultCode SqlitePagerPrivateWalCopyFrames(u32 salt, u32 first_frame,
+                                             u32 num_frames, u32 min_db_size);
+  ResultCode SqlitePagerPrivateWalSyncAll();
+  void SqlitePagerPrivateWalSetSynced(u32 salt, u32 num_frames);
+  void SqlitePagerPrivateWalScheduleCheckpoint();
+  void SqlitePagerPrivateWalWaitCheckpoint();
+  void SqlitePagerPrivateWalCheckpointLoop();
+  void SqlitePagerPrivateWalStopCheckpoint();
 };
 
+// Tag for the constructor of a page that starts without an image
+struct WithoutImage {};
+
 /**
  * @class BasePage
  * @brief Represents a page content in memory.
  *
  * Every derived Page class should implement a static `create` method that
- * constructs an instance of the derived class and returns it as a
- * `std::unique_ptr<BasePage>`.
+ * constructs an instance of the derived class without an image and returns it
+ * as a `std::unique_ptr<BasePage>`.
  *
  * Example usage in a derived class:
  * @code
  *   static std::unique_ptr<BasePage> create() {
- *       return std::make_unique<DerivedPage>();
+ *       return std::make_unique<DerivedPage>(WithoutImage{});
  *   }
  * @endcode
  *
@@ -243,11 +750,22 @@ class Pager {
  */
 class BasePage {
  public:
-  // Image data that holds the content of a page
-  std::unique_ptr<std::array<std::byte, kPageSize>> p_image_;
-
-  BasePage()
-      : p_image_(std::make_unique<std::array<std::byte, kPageSize>>()) {};
+  // Image data that holds the content of a page. It normally points at the
+  // page's own buffer; in PageIoMode::MEMORY_MAPPED a clean page points
+  // straight into the mapping of the database file, and must not be modified
+  // before SqlitePagerWrite() has given it a private copy. Its size is the
+  // page size of the database.
+  PageImage p_image_;
+
+  // A page that is not in a cache gets an image of kDefaultPageSize bytes
+  BasePage() : BasePage(kDefaultPageSize) {}
+  explicit BasePage(u32 page_size)
+      : p_image_buffer_(std::make_unique<std::byte[]>(page_size)) {
+    p_image_ = PageImage(p_image_buffer_.get(), page_size);
+  }
+  // For the factories the pager calls: p_image_ stays empty until the pager
+  // loads the page, so a page served from the mapping allocates no buffer
+  explicit BasePage(WithoutImage) {}
 
   // Virtual destructor to allow for polymorphism
   virtual ~BasePage() = default;
@@ -265,8 +783,15 @@ class BasePage {
   // TO_TESTIFY: pointer to the page header, useful for Pager layer since btree
   // layer only has access to the page content
   std::unique_ptr<PageHeader> p_header_;
+  // the private image buffer, empty while p_image_ points into a mapping
+  std::unique_ptr<std::byte[]> p_image_buffer_;
   // retrieve vector of byte pointer to p image
   std::vector<std::byte> ImageVector();
+  [[nodiscard]] bool IsImageMapped() const {
+    return p_image_.data() != nullptr && p_image_buffer_ == nullptr;
+  }
+  void MapImage(std::byte *p_view, u32 page_size);
+  void PrivatizeImage(u32 page_size);
 
   friend class Pager;
   friend class PageHeader;
@@ -288,8 +813,11 @@ class BasePage {
  */
 class SampleMemPage : public BasePage {
  public:
+  SampleMemPage() = default;
+  explicit SampleMemPage(WithoutImage without_image)
+      : BasePage(without_image) {}
   static std::unique_ptr<BasePage> create() {
-    return std::make_unique<SampleMemPage>();
+    return std::make_unique<SampleMemPage>(WithoutImage{});
   }
   void DestroyExtra() override {
     // destroy extra data here
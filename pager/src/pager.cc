@@ -1,5 +1,16 @@
 #include "pager.h"
 
+// Takes the latch only when the pager runs in concurrent mode
+template <typename Mutex>
+static std::unique_lock<Mutex> LatchIfConcurrent(bool is_concurrent,
+                                                 Mutex &latch) {
+  std::unique_lock<Mutex> lock(latch, std::defer_lock);
+  if (is_concurrent) {
+    lock.lock();
+  }
+  return lock;
+}
+
 std::vector<std::byte> PageRecord::ImageVector() {
   return {p_image_.begin(), p_image_.end()};
 }
@@ -15,7 +26,8 @@ std::vector<std::byte> PageRecord::ImageVector() {
  * By calling the constructor of NodePage, it will automatically allocate the
  * extra bytes needed. Hence, the Pager does not need to know the extra size.
  */
-Pager::Pager(std::string &file_name, int max_page_num, EvictionPolicy policy) {
+Pager::Pager(std::string &file_name, int max_page_num, EvictionPolicy policy,
+             PageIoMode io_mode) {
   // We are using the OsFile(std::string) constructor
   // such that OsOpenReadWrite/Exclusive/Readonly will have filename_
   // initialized when it is called.
@@ -33,6 +45,8 @@ Pager::Pager(std::string &file_name, int max_page_num, EvictionPolicy policy) {
   checkpoint_journal_file_name_ = file_name + "-checkpoint";
   fd_ = std::move(fd);
   journal_fd_ = std::make_unique<OsFile>(journal_file_name_);
+  wal_file_name_ = file_name + "-wal";
+  wal_fd_ = std::make_unique<OsFile>(wal_file_name_);
   is_journal_open_ = false;
   is_checkpoint_journal_open_ = false;
   is_checkpoint_journal_use_ = false;
@@ -48,9 +62,22 @@ Pager::Pager(std::string &file_name, int max_page_num, EvictionPolicy policy) {
   is_journal_need_sync_ = false;
   p_free_page_first_ = nullptr;
   p_free_page_last_ = nullptr;
-  page_hash_table_ =
-      std::make_unique<std::map<PageNumber, std::unique_ptr<BasePage>>>();
   eviction_policy_ = policy;
+  io_mode_ = io_mode;
+  page_hash_tables_ = std::vector<PageHashTable>(1);
+  shard_latches_ = std::make_unique<std::mutex[]>(1);
+}
+
+Pager::~Pager() {
+  // the prefetch thread reads through fd_, so it goes first
+  SqlitePagerPrivateStopPrefetch();
+  // commits still waiting for their group are synced here
+  SqlitePagerPrivateStopGroupCommit();
+  SqlitePagerPrivateWalStopCheckpoint();
+  SqlitePagerPrivateWalClearReadMark();
+  // The cached pages are destroyed after this body runs, but they never touch
+  // their image on destruction, so the mappings can go first.
+  SqlitePagerPrivateUnmapAll();
 }
 
 /*
@@ -61,6 +88,101 @@ void Pager::SqlitePagerSetCachesize(int max_page_num) {
   if (max_page_num > kMaxPageNum) num_mem_pages_max_ = max_page_num;
 }
 
+/**
+ * Makes the pager read and write pages of page_size bytes, a power of two
+ * from kMinPageSize to kMaxPageSize. The page size belongs to the database
+ * file: the Btree records it on page 1 and sets it here before it reads any
+ * other page, so that every page is read with the size it was written with.
+ *
+ * It may only change while no page is referenced and no write transaction is
+ * open, otherwise kMisuse is returned. The pages still in the cache have the
+ * old size and are dropped.
+ */
+ResultCode Pager::SqlitePagerSetPageSize(u32 page_size) {
+  if (!IsValidPageSize(page_size)) {
+    return ResultCode::kMisuse;
+  }
+  auto cache_latch = LatchIfConcurrent(is_concurrent_, cache_latch_);
+  if (page_size == page_size_) {
+    return ResultCode::kOk;
+  }
+  if (num_mem_pages_ref_positive_ != 0 ||
+      lock_state_ == SqliteLockState::K_SQLITE_WRITE_LOCK) {
+    return ResultCode::kMisuse;
+  }
+  for (PageHashTable &page_hash_table : page_hash_tables_) {
+    page_hash_table.Clear();
+  }
+  SqlitePagerPrivatePolicyReset();
+  p_all_page_first_ = nullptr;
+  p_free_page_first_ = nullptr;
+  p_free_page_last_ = nullptr;
+  num_mem_pages_ = 0;
+  SqlitePagerPrivateUnmapAll();
+  SqlitePagerPrivateDropPrefetched();
+  {
+    // the prefetch thread reads the page size under prefetch_mutex_
+    std::lock_guard<std::mutex> prefetch_lock(prefetch_mutex_);
+    page_size_ = page_size;
+  }
+  num_database_size_ = -1;
+  data_version_++;
+  return ResultCode::kOk;
+}
+
+// Returns the number of bytes in a page
+u32 Pager::SqlitePagerPageSize() const { return page_size_; }
+
+/**
+ * Reads the first header.size() bytes of the database file straight from the
+ * file, bypassing the cache and without taking a lock. Bytes past the end of
+ * the file read as zeros. The Btree uses it to learn the page size of a file
+ * before it reads page 1 through the cache.
+ */
+ResultCode Pager::SqlitePagerReadFileHeader(std::vector<std::byte> &header) {
+  u32 file_size = 0;
+  ResultCode rc = fd_->OsFileSize(file_size);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  u32 amount = std::min<u32>(file_size, header.size());
+  std::fill(header.begin() + amount, header.end(), std::byte{0});
+  if (amount == 0) {
+    return ResultCode::kOk;
+  }
+  return fd_->OsReadAt(header.data(), amount, 0);
+}
+
+/**
+ * Switches the pager to concurrent mode, in which SqlitePagerGet,
+ * SqlitePagerLookup, SqlitePagerRef and SqlitePagerUnref may be called from
+ * any number of threads at once. It must be called before the first page is
+ * loaded, otherwise kMisuse is returned.
+ *
+ * The page table is split into num_shards tables, each behind its own latch,
+ * and the reference counts are atomic. A hit on a page that some thread
+ * already references only takes the latch of its shard, so readers of hot
+ * pages do not contend with each other. Everything that touches the shared
+ * lists (the first reference to a page, the last unreference, misses and
+ * eviction) also takes the cache latch, which is released again before a
+ * miss reads the page from the file.
+ *
+ * SqlitePagerWrite, SqlitePagerCommit and SqlitePagerRollback take the cache
+ * latch as well, but changing a page image that other threads are reading
+ * still has to be coordinated by the caller. Unlike the default mode, the
+ * cache is not reset when the last reference is dropped, since another
+ * thread may be about to take one.
+ */
+ResultCode Pager::SqlitePagerSetConcurrent(u32 num_shards) {
+  if (num_shards == 0 || num_mem_pages_ != 0) {
+    return ResultCode::kMisuse;
+  }
+  page_hash_tables_ = std::vector<PageHashTable>(num_shards);
+  shard_latches_ = std::make_unique<std::mutex[]>(num_shards);
+  is_concurrent_ = true;
+  return ResultCode::kOk;
+}
+
 /**
  * Loads a page into the cache by its page number.
  * If the page is already in the cache, it returns a pointer to the page.
@@ -81,14 +203,35 @@ ResultCode Pager::SqlitePagerGet(
   // first check if page_number is valid
   if (page_number == 0) return ResultCode::kError;
 
+  u32 shard = SqlitePagerPrivateShardOf(page_number);
+  auto shard_latch = LatchIfConcurrent(is_concurrent_, shard_latches_[shard]);
+  if (is_concurrent_ && (eviction_policy_ == EvictionPolicy::FIRST_NON_DIRTY ||
+                         eviction_policy_ == EvictionPolicy::LRU)) {
+    // A page some other thread references is on no list, and these policies
+    // only reorder pages when they are released, so one more reference only
+    // needs the shard latch
+    p_page = page_hash_tables_[shard].Find(page_number);
+    if (p_page != nullptr && p_page->p_header_->num_ref_ > 0) {
+      p_page->p_header_->num_ref_++;
+      num_pages_hit_++;
+      *pp_page = p_page;
+      return ResultCode::kOk;
+    }
+    p_page = nullptr;
+  }
+  auto cache_latch = LatchIfConcurrent(is_concurrent_, cache_latch_);
+
   if (err_mask_.size() >
       err_mask_.count(SqlitePagerError::K_PAGER_ERROR_FULL)) {
     return SqlitePagerPrivateRetrieveError();
   }
 
   // If the number of pages with positive reference count is 0, then this is the
-  // first page accessed. In that case, we apply a read lock.
-  if (num_mem_pages_ref_positive_ == 0) {
+  // first page accessed. In that case, we apply a read lock. In concurrent mode
+  // the cache (and the read lock) outlive the last reference, so only the very
+  // first access takes it.
+  if (num_mem_pages_ref_positive_ == 0 &&
+      !(is_concurrent_ && lock_state_ != SqliteLockState::K_SQLITE_UNLOCK)) {
     ResultCode rc = fd_->OsReadLock();
     if (rc != ResultCode::kOk) {
       return rc;
@@ -119,6 +262,14 @@ ResultCode Pager::SqlitePagerGet(
         return rc;
       }
     }
+    if (journal_mode_ == JournalMode::WAL) {
+      // pick up the transactions other pagers committed to the log
+      bool has_changed = false;
+      rc = SqlitePagerPrivateWalRefresh(has_changed);
+      if (rc != ResultCode::kOk) {
+        return rc;
+      }
+    }
   } else {
     // if it is not the first page accessed
     // check if the page is in the cache
@@ -131,39 +282,63 @@ ResultCode Pager::SqlitePagerGet(
   if (p_page == nullptr) {
     // if the page is not in the cache
     num_pages_miss_++;
-    // create a new page
-    if (num_mem_pages_ < num_mem_pages_max_ || p_free_page_first_ == nullptr) {
-      try {
-        page_hash_table_->operator[](page_number) = create_page();
-      } catch (const std::bad_alloc &) {
-        *pp_page = nullptr;
-        SqlitePagerPrivateUnWriteLock();
-        err_mask_.insert(SqlitePagerError::K_PAGER_ERROR_MEM);
-        return ResultCode::kNoMem;
-      } catch (const SqliteException &e) {
-        return e.code();
-      }
-      SqlitePagerPrivateAddCreatedPageToCache(page_number, p_page);
-      num_mem_pages_++;
-    } else {
+    SqlitePagerPrivatePolicyOnMiss(page_number);
+    // create a new page. A page served from the mapping costs no image
+    // buffer, but its object still counts against num_mem_pages_max_.
+    if (num_database_size_ < 0) {
+      SqlitePagerPageCount();
+    }
+    u32 wal_frame = 0;
+    bool is_in_wal = journal_mode_ == JournalMode::WAL &&
+                     SqlitePagerPrivateWalFindFrame(page_number, wal_frame);
+    if (num_mem_pages_ >= num_mem_pages_max_ && p_free_page_first_ != nullptr) {
       // this means that the cache is currently full, we have to evict one page
       // to make room
-      p_page = evictPage();
-      if (p_page == nullptr) {
-        // this means that all pages are dirty, we have to sync the journal fill
+      BasePage *p_victim = evictPage();
+      std::unique_lock<std::mutex> victim_latch;
+      if (p_victim == nullptr) {
+        // this means that the policy found no clean page, we have to sync the
+        // journal and write the dirty pages out first
         ResultCode rc = SqlitePagerPrivateSyncAllPages();
         if (rc != ResultCode::kOk) {
           // if the sync is unsuccessful, rollback.
           SqlitePagerRollback();
           return ResultCode::kIOError;
         }
-        p_page = p_free_page_first_;
+        p_victim = evictPage();
+        if (p_victim == nullptr) {
+          p_victim = p_free_page_first_;
+        }
+      }
+      u32 victim_shard =
+          SqlitePagerPrivateShardOf(p_victim->p_header_->page_number_);
+      if (is_concurrent_ && victim_shard != shard) {
+        // waiting for a second shard latch could deadlock; if its shard is
+        // busy the victim is spared and the cache grows by one page instead
+        victim_latch = std::unique_lock<std::mutex>(
+            shard_latches_[victim_shard], std::try_to_lock);
+        if (!victim_latch.owns_lock()) {
+          p_victim = nullptr;
+        }
       }
-      SqlitePagerPrivateRemovePageFromCache(page_number, p_page);
-      num_pages_overflow_++;
+      if (p_victim != nullptr) {
+        SqlitePagerPrivateRemovePageFromCache(p_victim);
+        num_pages_overflow_++;
+      }
+    }
+    try {
+      p_page = page_hash_tables_[shard].Insert(page_number, create_page());
+    } catch (const std::bad_alloc &) {
+      *pp_page = nullptr;
+      SqlitePagerPrivateUnWriteLock();
+      err_mask_.insert(SqlitePagerError::K_PAGER_ERROR_MEM);
+      return ResultCode::kNoMem;
+    } catch (const SqliteException &e) {
+      return e.code();
     }
+    SqlitePagerPrivateAddCreatedPageToCache(page_number, p_page);
+    num_mem_pages_++;
 
-    p_page->p_header_->page_number_ = page_number;
     // set in journal and in checkpoint
     if (page_journal_bit_map_.count() &&
         page_number <= num_database_original_size_) {
@@ -189,27 +364,60 @@ ResultCode Pager::SqlitePagerGet(
     if (num_database_size_ < 0) {
       SqlitePagerPageCount();
     }
-    if (num_database_size_ >= page_number) {
-      // this means that the page is in the database file, and we have to read
-      // the page from the database file should OS seek take a u32 instead of a
-      // int?
-      fd_->OsSeek((page_number - 1) * kPageSize);
-      // we should transfer string stream back to a byte array
-      std::vector<std::byte> img_vec = p_page->ImageVector();
-      ResultCode rc = fd_->OsRead(img_vec, kPageSize);
-      std::copy(img_vec.begin(), img_vec.end(), p_page->p_image_->begin());
-
+    if (is_in_wal) {
+      // the log holds a newer image than the file. The cache latch stays held,
+      // since the log is only started over under it.
+      p_page->PrivatizeImage(page_size_);
+      ResultCode rc = SqlitePagerPrivateWalReadFrame(page_number, wal_frame,
+                                                     p_page->p_image_.data());
       if (rc != ResultCode::kOk) {
         return rc;
       }
+    } else if (num_database_size_ >= page_number) {
+      // this means that the page is in the database file, and we have to read
+      // the page from the database file, straight into the page image, unless
+      // it can be viewed in place through the mapping
+      if (io_mode_ == PageIoMode::MEMORY_MAPPED &&
+          SqlitePagerPrivateMapPage(p_page, page_number)) {
+        num_pages_mapped_++;
+      } else {
+        p_page->PrivatizeImage(page_size_);
+        // the page is referenced and its shard stays latched until it is
+        // read, so the read itself does not need to hold up other misses
+        if (cache_latch.owns_lock()) {
+          cache_latch.unlock();
+        }
+        ResultCode rc = ResultCode::kOk;
+        if (!SqlitePagerPrivateTakePrefetched(page_number,
+                                              p_page->p_image_.data())) {
+          rc = fd_->OsReadAt(p_page->p_image_.data(), page_size_,
+                             (page_number - 1) * page_size_);
+          // a page inside the database that the file does not reach yet,
+          // because no page from it onwards has been written, reads as zeros
+          u32 file_size = 0;
+          if (rc == ResultCode::kIOError &&
+              fd_->OsFileSize(file_size) == ResultCode::kOk &&
+              file_size <= (page_number - 1) * page_size_) {
+            std::fill(p_page->p_image_.begin(), p_page->p_image_.end(),
+                      std::byte{0});
+            rc = ResultCode::kOk;
+          }
+        }
+
+        if (rc != ResultCode::kOk) {
+          return rc;
+        }
+      }
+    } else {
+      p_page->PrivatizeImage(page_size_);
     }
     // the extra set has been completed in the factory create_pag
   } else {
     // if the page is in the cache
     num_pages_hit_++;
     SqlitePagerRefPrivate(p_page);
+    SqlitePagerPrivatePolicyOnHit(p_page);
   }
-  updateLRU(p_page);  // Update LRU for accessed page
   *pp_page = p_page;
   return ResultCode::kOk;
 }
@@ -238,16 +446,17 @@ ResultCode Pager::SqlitePagerLookup(PageNumber page_number,
     return ResultCode::kError;
   }
 
-  if (num_mem_pages_ref_positive_ == 0) {
+  if (num_mem_pages_ref_positive_ == 0 && !is_concurrent_) {
     return ResultCode::kEmpty;
   }
 
+  auto shard_latch = LatchIfConcurrent(
+      is_concurrent_, shard_latches_[SqlitePagerPrivateShardOf(page_number)]);
   *pp_page = SqlitePagerPrivateCacheLookup(page_number);
 
   // If the page is in the cache, increase its reference count
-  if (pp_page) {
+  if (*pp_page) {
     SqlitePagerRefPrivate(*pp_page);
-    updateLRU(*pp_page);  // Update LRU when page is found
   }
 
   return ResultCode::kOk;
@@ -257,39 +466,32 @@ ResultCode Pager::SqlitePagerLookup(PageNumber page_number,
  * Increases the reference count of a page.
  */
 ResultCode Pager::SqlitePagerRef(BasePage *p_page) {
+  auto shard_latch = LatchIfConcurrent(
+      is_concurrent_,
+      shard_latches_[SqlitePagerPrivateShardOf(p_page->p_header_->page_number_)]);
   SqlitePagerRefPrivate(p_page);
-  updateLRU(p_page);  // Update LRU when page is referenced
   return ResultCode::kOk;
 }
 
 /*
- * Release a page, if the ref is down to 0, add the page to LRU list, when pager
- * ref is 0, release all, do a rollback and remove all the locks
+ * Release a page, if the ref is down to 0, add the page to the tail of the
+ * free list (its most recently used end), when pager ref is 0, release all, do
+ * a rollback and remove all the locks
  */
 ResultCode Pager::SqlitePagerUnref(BasePage *p_page) {
+  auto shard_latch = LatchIfConcurrent(
+      is_concurrent_,
+      shard_latches_[SqlitePagerPrivateShardOf(p_page->p_header_->page_number_)]);
   p_page->p_header_->num_ref_--;
   if (p_page->p_header_->num_ref_ == 0) {
-    if (eviction_policy_ == EvictionPolicy::LRU) {
-      lru_list_.push_front(p_page);
-      lru_map_[p_page->p_header_->page_number_] = lru_list_.begin();
-    } else {
-      // Original handling for FIRST_NON_DIRTY
-      p_page->p_header_->p_next_free_ = nullptr;
-      p_page->p_header_->p_prev_free_ = p_free_page_last_;
-      p_free_page_first_ = p_page;
-
-      if (p_page->p_header_->p_prev_free_ != nullptr) {
-        p_page->p_header_->p_prev_free_->p_header_->p_next_free_ = p_page;
-      } else {
-        p_free_page_first_ = p_page;
-      }
+    auto cache_latch = LatchIfConcurrent(is_concurrent_, cache_latch_);
+    SqlitePagerPrivateAppendFreePage(p_page);
 
-      /* When all pages reach the freelist, drop the read lock from
-      ** the database file.
-      */
-      if (--num_mem_pages_ref_positive_ == 0) {
-        SqlitePagerPrivatePagerReset();
-      }
+    /* When all pages reach the freelist, drop the read lock from
+    ** the database file. In concurrent mode the cache is kept.
+    */
+    if (--num_mem_pages_ref_positive_ == 0 && !is_concurrent_) {
+      SqlitePagerPrivatePagerReset();
     }
   }
   return ResultCode::kOk;
@@ -308,14 +510,22 @@ ResultCode Pager::SqlitePagerUnref(BasePage *p_page) {
  * is_journal_need_sync_ is set if syncing is needed.
  */
 ResultCode Pager::SqlitePagerWrite(BasePage *p_page) {
+  auto cache_latch = LatchIfConcurrent(is_concurrent_, cache_latch_);
   // if there is any other error
   if (!err_mask_.empty()) return ResultCode::kError;
   if (is_read_only_) return ResultCode::kPerm;
+  data_version_++;
+  if (journal_mode_ == JournalMode::WAL) {
+    return SqlitePagerPrivateWalWrite(p_page);
+  }
   /* Mark the page as dirty.  If the page has already been written
   ** to the journal then we can return right away.
   */
   p_page->p_header_->is_dirty_ = true;
-  updateLRU(p_page);  // Update LRU when page is modified
+
+  // a page viewed through the mapping gets its private copy before the caller
+  // is allowed to change it
+  p_page->PrivatizeImage(page_size_);
 
   // if page is in journal already, and it is in checkpoint, or we don't use
   // checkpoint
@@ -340,7 +550,7 @@ ResultCode Pager::SqlitePagerWrite(BasePage *p_page) {
     // if the page is not in journal
     rc = journal_fd_->OsWrite(p_page->p_header_->PageNumberVector());
     if (rc == ResultCode::kOk) {
-      rc = journal_fd_->OsWrite(*p_page->p_image_);
+      rc = journal_fd_->OsWrite(p_page->p_image_.data(), page_size_);
     }
     if (rc != ResultCode::kOk) {
       SqlitePagerRollback();
@@ -362,7 +572,7 @@ ResultCode Pager::SqlitePagerWrite(BasePage *p_page) {
       p_page->p_header_->page_number_ <= num_database_original_size_) {
     rc = checkpoint_journal_fd_->OsWrite(p_page->p_header_->PageNumberVector());
     if (rc == ResultCode::kOk) {
-      rc = checkpoint_journal_fd_->OsWrite(p_page->ImageVector());
+      rc = checkpoint_journal_fd_->OsWrite(p_page->p_image_.data(), page_size_);
     }
     if (rc != ResultCode::kOk) {
       SqlitePagerRollback();
@@ -412,7 +622,11 @@ u32 Pager::SqlitePagerPageCount() {
     err_mask_.insert(SqlitePagerError::K_PAGER_ERROR_DISK);
     return 0;
   }
-  db_file_size /= kPageSize;
+  db_file_size /= page_size_;
+  if (journal_mode_ == JournalMode::WAL && wal_db_size_ != 0) {
+    // the last commit in the log says how large the database is
+    db_file_size = wal_db_size_;
+  }
   if (lock_state_ != SqliteLockState::K_SQLITE_UNLOCK) {
     num_database_size_ = (int)db_file_size;
   }
@@ -451,6 +665,13 @@ ResultCode Pager::SqlitePagerBegin(BasePage *p_page) {
   ResultCode rc = ResultCode::kOk;
   assert(p_page->p_header_->num_ref_ > 0);
   assert(lock_state_ != SqliteLockState::K_SQLITE_UNLOCK);
+  if (journal_mode_ == JournalMode::WAL) {
+    // nothing is journaled, the transaction only takes the writer lock
+    if (lock_state_ == SqliteLockState::K_SQLITE_READ_LOCK) {
+      rc = SqlitePagerPrivateWalBegin();
+    }
+    return rc;
+  }
   if (lock_state_ == SqliteLockState::K_SQLITE_READ_LOCK) {
     // if the pager is in read lock, it means that the journal is empty, we
     // should create new one
@@ -460,9 +681,9 @@ ResultCode Pager::SqlitePagerBegin(BasePage *p_page) {
       return rc;
     }
 
-    // SqlitePagerPageCount(); // in theory, we cannot have a -1 here
-    //  A bad_alloc occurs when calling boost::dynamic_bitset<>(-1)
-    //  it shouldn't be -1 since the pager
+    // the size is -1 after a commit that kept pages cached, and a
+    // bad_alloc occurs when calling boost::dynamic_bitset<>(-1)
+    SqlitePagerPageCount();
     page_journal_bit_map_ = boost::dynamic_bitset<>(
         std::max(kBitMapPlaceHolder, kBitMapPlaceHolder + num_database_size_));
 
@@ -521,6 +742,35 @@ ResultCode Pager::SqlitePagerBegin(BasePage *p_page) {
  * K_SQLITE_READ_LOCK.
  */
 ResultCode Pager::SqlitePagerCommit() {
+  std::promise<ResultCode> durable;
+  std::future<ResultCode> result = durable.get_future();
+  ResultCode rc = SqlitePagerCommit(
+      [&durable](ResultCode sync_rc) { durable.set_value(sync_rc); });
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  return result.get();
+}
+
+/**
+ * Commits like SqlitePagerCommit(), but with group commit on (see
+ * SqlitePagerSetGroupCommit) it returns as soon as the commit is in the log.
+ * on_durable is called exactly once with the outcome: before returning when
+ * the commit is synced (or fails) right away, or later from the group commit
+ * thread, which must then not call back into the pager.
+ */
+ResultCode Pager::SqlitePagerCommit(const CommitCallback &on_durable) {
+  bool is_queued = false;
+  ResultCode rc = SqlitePagerPrivateCommit(on_durable, is_queued);
+  if (!is_queued && on_durable) {
+    on_durable(rc);
+  }
+  return rc;
+}
+
+ResultCode Pager::SqlitePagerPrivateCommit(const CommitCallback &on_durable,
+                                           bool &is_queued) {
+  auto cache_latch = LatchIfConcurrent(is_concurrent_, cache_latch_);
   ResultCode rc;
 
   if (err_mask_.count(SqlitePagerError::K_PAGER_ERROR_FULL)) {
@@ -535,6 +785,9 @@ ResultCode Pager::SqlitePagerCommit() {
   if (lock_state_ != SqliteLockState::K_SQLITE_WRITE_LOCK) {
     return ResultCode::kError;
   }
+  if (journal_mode_ == JournalMode::WAL) {
+    return SqlitePagerPrivateWalCommit(on_durable, is_queued);
+  }
   assert(is_journal_open_);
   if (is_dirty_ == 0) {
     /* Exit early (without doing the time-consuming sqliteOsSync() calls)
@@ -548,15 +801,22 @@ ResultCode Pager::SqlitePagerCommit() {
   if (is_journal_need_sync_ && journal_fd_->OsSync() != ResultCode::kOk)
     SqlitePagerPrivateCommitAbort();
 
-  // Iterate through the linked list of page headers and write the page image
-  // associated with each page header into the disk
+  // Collect the dirty pages from the linked list of page headers and write
+  // their images into the disk
+  std::vector<BasePage *> dirty_pages;
   for (BasePage *cur_page = p_all_page_first_; cur_page != nullptr;
        cur_page = cur_page->p_header_->p_next_all_) {
     if (cur_page->p_header_->is_dirty_ == 0) continue;
-    rc = fd_->OsSeek((cur_page->p_header_->page_number_ - 1) * kPageSize);
-    if (rc != ResultCode::kOk) SqlitePagerPrivateCommitAbort();
-    rc = fd_->OsWrite(cur_page->ImageVector());
-    if (rc != ResultCode::kOk) SqlitePagerPrivateCommitAbort();
+    dirty_pages.push_back(cur_page);
+  }
+  rc = SqlitePagerPrivateWritePages(dirty_pages);
+  if (rc != ResultCode::kOk) return SqlitePagerPrivateCommitAbort();
+  // the database was truncated during the transaction
+  if (num_database_size_ >= 0 &&
+      num_database_size_ < num_database_original_size_) {
+    rc = fd_->OsTruncate(num_database_size_ * page_size_);
+    if (rc != ResultCode::kOk) return SqlitePagerPrivateCommitAbort();
+    map_file_size_ = std::min(map_file_size_, num_database_size_ * page_size_);
   }
   if (is_journal_sync_allowed_ && fd_->OsSync() != ResultCode::kOk)
     SqlitePagerPrivateCommitAbort();
@@ -577,13 +837,19 @@ ResultCode Pager::SqlitePagerCommit() {
  * database state.
  */
 ResultCode Pager::SqlitePagerRollback() {
+  auto cache_latch = LatchIfConcurrent(is_concurrent_, cache_latch_);
   ResultCode rc;
+  data_version_++;
   if (err_mask_.size() >
       err_mask_.count(SqlitePagerError::K_PAGER_ERROR_FULL)) {
     // have pager error_full, make pager cache small to test this branch
     if (lock_state_ == SqliteLockState::K_SQLITE_WRITE_LOCK) {
       // pager is in write lock
-      SqlitePagerPrivatePlayback();
+      if (journal_mode_ == JournalMode::WAL) {
+        SqlitePagerPrivateWalRollback();
+      } else {
+        SqlitePagerPrivatePlayback();
+      }
     }
     return SqlitePagerPrivateRetrieveError();
   }
@@ -591,6 +857,9 @@ ResultCode Pager::SqlitePagerRollback() {
     // when pager is not in write lock, do nothing
     return ResultCode::kOk;
   }
+  if (journal_mode_ == JournalMode::WAL) {
+    return SqlitePagerPrivateWalRollback();
+  }
   // play back one page
   rc = SqlitePagerPrivatePlayback();
   if (rc != ResultCode::kOk) {
@@ -605,6 +874,42 @@ ResultCode Pager::SqlitePagerRollback() {
 
 bool Pager::SqlitePagerIsReadOnly() { return is_read_only_; }
 
+/**
+ * Shrinks the database to its first num_pages pages, within a write
+ * transaction. Cached pages past the new end are no longer written back, and
+ * the ones nobody references leave the cache. The file itself is only cut at
+ * commit (or, with the WAL, when the commit is checkpointed), so a rollback
+ * brings back every page past the end that was written, i.e. journaled, before
+ * the truncation.
+ */
+ResultCode Pager::SqlitePagerTruncate(u32 num_pages) {
+  auto cache_latch = LatchIfConcurrent(is_concurrent_, cache_latch_);
+  if (lock_state_ != SqliteLockState::K_SQLITE_WRITE_LOCK) {
+    return ResultCode::kError;
+  }
+  if (num_pages > SqlitePagerPageCount()) {
+    return ResultCode::kMisuse;
+  }
+  BasePage *p_page = p_all_page_first_;
+  while (p_page != nullptr) {
+    BasePage *p_next_page = p_page->p_header_->p_next_all_;
+    if (p_page->p_header_->page_number_ > num_pages) {
+      p_page->p_header_->is_dirty_ = false;
+      if (p_page->p_header_->num_ref_ == 0) {
+        SqlitePagerPrivateRemovePageFromCache(p_page);
+      } else {
+        // the mapping of the file will not reach the page for long
+        p_page->PrivatizeImage(page_size_);
+      }
+    }
+    p_page = p_next_page;
+  }
+  SqlitePagerPrivateDropPrefetched();
+  num_database_size_ = (int)num_pages;
+  data_version_++;
+  return ResultCode::kOk;
+}
+
 void Pager::SqlitePagerDontWrite(PageNumber page_number) {
   BasePage *cur_page = SqlitePagerPrivateCacheLookup(page_number);
   if (cur_page != nullptr) {
@@ -616,19 +921,8 @@ void Pager::SqlitePagerDontWrite(PageNumber page_number) {
 void Pager::SqlitePagerRefPrivate(BasePage *p_page) {
   if (p_page->p_header_->num_ref_ == 0) {
     // page is currently in the free list, so remove it
-    if (p_page->p_header_->p_prev_free_ != nullptr) {
-      p_page->p_header_->p_prev_free_->p_header_->p_next_free_ =
-          p_page->p_header_->p_next_free_;
-    } else {
-      p_free_page_first_ = p_page->p_header_->p_next_free_;
-    }
-
-    if (p_page->p_header_->p_next_free_ != nullptr) {
-      p_page->p_header_->p_next_free_->p_header_->p_prev_free_ =
-          p_page->p_header_->p_prev_free_;
-    } else {
-      p_free_page_last_ = p_page->p_header_->p_prev_free_;
-    }
+    auto cache_latch = LatchIfConcurrent(is_concurrent_, cache_latch_);
+    SqlitePagerPrivateUnlinkFreePage(p_page);
     num_mem_pages_ref_positive_++;
   }
   p_page->p_header_->num_ref_++;
@@ -636,23 +930,29 @@ void Pager::SqlitePagerRefPrivate(BasePage *p_page) {
 
 // TODO-test: reset the page
 void Pager::SqlitePagerPrivatePagerReset() {
-  if (eviction_policy_ == EvictionPolicy::FIRST_NON_DIRTY) {
-    page_hash_table_->clear();
-  } else {
-    lru_map_.clear();
-    lru_list_.clear();
+  for (PageHashTable &page_hash_table : page_hash_tables_) {
+    page_hash_table.Clear();
   }
+  SqlitePagerPrivatePolicyReset();
   p_all_page_first_ = nullptr;
   p_free_page_first_ = nullptr;
   p_free_page_last_ = nullptr;
   num_mem_pages_ = 0;
+  // no page points into a mapping anymore, and the file may change before the
+  // next read lock is taken
+  SqlitePagerPrivateUnmapAll();
+  // the file may change while it is unlocked
+  SqlitePagerPrivateDropPrefetched();
   if (lock_state_ == SqliteLockState::K_SQLITE_WRITE_LOCK) {
     SqlitePagerRollback();
   }
   fd_->OsUnlock();
   lock_state_ = SqliteLockState::K_SQLITE_UNLOCK;
+  // without a read lock, the pager holds no snapshot of the log either
+  SqlitePagerPrivateWalClearReadMark();
   num_database_size_ = -1;
   num_mem_pages_ref_positive_ = 0;
+  data_version_++;
 }
 
 ResultCode Pager::SqlitePagerPrivateRetrieveError() const {
@@ -670,6 +970,130 @@ ResultCode Pager::SqlitePagerPrivateRetrieveError() const {
   return rc;
 }
 
+/**
+ * Writes the images of the given pages to the database file.
+ *
+ * The pages are sorted by page number and every run of consecutive page
+ * numbers is handed to OsFile::OsWriteV() as a single vectored write, so the
+ * file is written front to back and a transaction that dirtied adjacent pages
+ * pays one system call per run instead of one per page. The number of pages
+ * written and of write calls issued are accumulated in num_pages_flushed_ and
+ * num_flush_syscalls_.
+ */
+ResultCode Pager::SqlitePagerPrivateWritePages(std::vector<BasePage *> &pages) {
+  std::sort(pages.begin(), pages.end(), [](BasePage *lhs, BasePage *rhs) {
+    return lhs->p_header_->page_number_ < rhs->p_header_->page_number_;
+  });
+
+  std::vector<const std::byte *> run;
+  size_t run_start = 0;
+  while (run_start < pages.size()) {
+    PageNumber first_page_number = pages[run_start]->p_header_->page_number_;
+    size_t run_end = run_start + 1;
+    while (run_end < pages.size() &&
+           pages[run_end]->p_header_->page_number_ ==
+               first_page_number + (run_end - run_start)) {
+      run_end++;
+    }
+
+    run.clear();
+    for (size_t i = run_start; i < run_end; i++) {
+      run.push_back(pages[i]->p_image_.data());
+    }
+    u32 num_syscalls = 0;
+    ResultCode rc = fd_->OsWriteV(run, page_size_,
+                                  (first_page_number - 1) * page_size_,
+                                  num_syscalls);
+    num_flush_syscalls_ += num_syscalls;
+    SqlitePagerPrivateDropPrefetched();
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    num_pages_flushed_ += run_end - run_start;
+    run_start = run_end;
+  }
+  return ResultCode::kOk;
+}
+
+/**
+ * Points the image of p_page at the page's bytes inside the shared read-only
+ * mapping of the database file.
+ *
+ * The mapping is only ever read within the part of the file known to exist.
+ * When page_number lies past it, the file size is checked again and, if the
+ * page is now in the file but outside the mapping, a larger mapping is set
+ * up; the old one is retired rather than unmapped because cached pages may
+ * still point into it. Returns false when the page cannot be mapped, in which
+ * case the caller reads it into a private image instead.
+ */
+bool Pager::SqlitePagerPrivateMapPage(BasePage *p_page,
+                                      PageNumber page_number) {
+  u32 page_end = page_number * page_size_;
+  if (page_end > map_file_size_) {
+    u32 file_size = 0;
+    if (fd_->OsFileSize(file_size) != ResultCode::kOk || file_size < page_end) {
+      return false;
+    }
+    map_file_size_ = file_size;
+  }
+  if (page_end > map_size_) {
+    // leave room for the file to grow before the next remap
+    u32 new_map_size = std::max(map_file_size_ * 2, kMinMapPages * page_size_);
+    std::byte *p_new_map = nullptr;
+    if (fd_->OsMapReadOnly(new_map_size, p_new_map) != ResultCode::kOk) {
+      return false;
+    }
+    if (p_map_ != nullptr) {
+      retired_maps_.emplace_back(p_map_, map_size_);
+    }
+    p_map_ = p_new_map;
+    map_size_ = new_map_size;
+  }
+  p_page->MapImage(p_map_ + (page_number - 1) * page_size_, page_size_);
+  return true;
+}
+
+/**
+ * Gives every cached page that still views the mapping a private image and
+ * releases all mappings. Called before the database file is truncated, when
+ * the cache is reset, and when the pager is destroyed.
+ */
+void Pager::SqlitePagerPrivateUnmapAll() {
+  if (p_map_ == nullptr) {
+    return;
+  }
+  for (BasePage *cur_page = p_all_page_first_; cur_page != nullptr;
+       cur_page = cur_page->p_header_->p_next_all_) {
+    cur_page->PrivatizeImage(page_size_);
+  }
+  for (auto &[p_map, map_size] : retired_maps_) {
+    OsFile::OsUnmap(p_map, map_size);
+  }
+  retired_maps_.clear();
+  OsFile::OsUnmap(p_map_, map_size_);
+  p_map_ = nullptr;
+  map_size_ = 0;
+  map_file_size_ = 0;
+}
+
+/**
+ * Returns how many write system calls page flushes have avoided so far by
+ * coalescing adjacent pages, compared to writing every page on its own.
+ */
+u32 Pager::SqlitePagerFlushSyscallsSaved() const {
+  return num_pages_flushed_ - num_flush_syscalls_;
+}
+
+/**
+ * Returns a number that stays the same for as long as no page this pager
+ * serves can have changed: no page was written, no transaction or checkpoint
+ * was rolled back, no page was truncated, the cache was not reset (the file
+ * may change while it is unlocked), and no commit of another pager came in
+ * through the log. Callers that derive something from many pages use it to
+ * tell whether what they derived is still current.
+ */
+u64 Pager::SqlitePagerDataVersion() const { return data_version_; }
+
 // TODO-test
 // abort the transaction
 ResultCode Pager::SqlitePagerPrivateCommitAbort() {
@@ -703,9 +1127,30 @@ BasePage *BasePage::GetFirstNonDirtyPage() {
   return p_page;
 }
 
+// Makes the page image a view of page_size bytes starting at p_view
+void BasePage::MapImage(std::byte *p_view, u32 page_size) {
+  p_image_ = PageImage(p_view, page_size);
+  p_image_buffer_.reset();
+}
+
+/**
+ * Gives the page a private buffer of page_size bytes it owns: a copy of the
+ * mapped image, or a zeroed one for a page that has no image yet.
+ */
+void BasePage::PrivatizeImage(u32 page_size) {
+  if (p_image_buffer_ != nullptr) {
+    return;
+  }
+  p_image_buffer_ = std::make_unique<std::byte[]>(page_size);
+  if (p_image_.data() != nullptr) {
+    std::copy(p_image_.begin(), p_image_.end(), p_image_buffer_.get());
+  }
+  p_image_ = PageImage(p_image_buffer_.get(), page_size);
+}
+
 // currently the getter, we copy the array to a vector
 std::vector<std::byte> BasePage::ImageVector() {
-  return {p_image_->begin(), p_image_->end()};
+  return {p_image_.begin(), p_image_.end()};
 }
 
 // below is the implementation of Page Header
@@ -1,93 +1,573 @@
 #include "pager.h"
 
+// below is the implementation of PageHashTable
+
+// The table starts with 64 slots and doubles whenever it is 3/4 full
+static constexpr u32 kPageHashInitialBits = 6;
+
+PageHashTable::PageHashTable()
+    : slots_(1u << kPageHashInitialBits),
+      num_entries_(0),
+      shift_(32 - kPageHashInitialBits) {}
+
+PageHashTable::~PageHashTable() = default;
+
+/**
+ * Fibonacci hashing: the page number is multiplied by 2^32 / phi and the top
+ * bits are kept, which spreads consecutive page numbers across the table.
+ */
+u32 PageHashTable::HomeSlot(PageNumber page_number) const {
+  return (u32)(page_number * 2654435769u) >> shift_;
+}
+
+BasePage *PageHashTable::Find(PageNumber page_number) const {
+  u32 mask = slots_.size() - 1;
+  for (u32 idx = HomeSlot(page_number); slots_[idx].page_number != 0;
+       idx = (idx + 1) & mask) {
+    if (slots_[idx].page_number == page_number) {
+      return slots_[idx].p_page.get();
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Stores p_page under page_number, replacing (and destroying) any page that
+ * was stored under the same number, and returns the stored page.
+ */
+BasePage *PageHashTable::Insert(PageNumber page_number,
+                                std::unique_ptr<BasePage> p_page) {
+  if ((num_entries_ + 1) * 4 > slots_.size() * 3) {
+    Grow();
+  }
+  u32 mask = slots_.size() - 1;
+  u32 idx = HomeSlot(page_number);
+  while (slots_[idx].page_number != 0 &&
+         slots_[idx].page_number != page_number) {
+    idx = (idx + 1) & mask;
+  }
+  if (slots_[idx].page_number == 0) {
+    num_entries_++;
+  }
+  slots_[idx].page_number = page_number;
+  slots_[idx].p_page = std::move(p_page);
+  return slots_[idx].p_page.get();
+}
+
+/**
+ * Destroys the page stored under page_number, if any.
+ *
+ * Deletion uses backward shifting instead of tombstones: every entry after
+ * the hole that would still be reachable from its home slot across the hole
+ * is moved into it, so probe sequences never grow with churn.
+ */
+void PageHashTable::Erase(PageNumber page_number) {
+  u32 mask = slots_.size() - 1;
+  u32 hole = HomeSlot(page_number);
+  while (slots_[hole].page_number != page_number) {
+    if (slots_[hole].page_number == 0) {
+      return;
+    }
+    hole = (hole + 1) & mask;
+  }
+  slots_[hole].p_page.reset();
+  num_entries_--;
+
+  for (u32 idx = (hole + 1) & mask; slots_[idx].page_number != 0;
+       idx = (idx + 1) & mask) {
+    u32 home = HomeSlot(slots_[idx].page_number);
+    // the entry stays put when its home slot lies cyclically in (hole, idx]
+    bool is_reachable = hole <= idx ? (hole < home && home <= idx)
+                                    : (hole < home || home <= idx);
+    if (is_reachable) {
+      continue;
+    }
+    slots_[hole] = std::move(slots_[idx]);
+    hole = idx;
+  }
+  slots_[hole].page_number = 0;
+  slots_[hole].p_page.reset();
+}
+
+// Destroys every page but keeps the slots for reuse
+void PageHashTable::Clear() {
+  for (Slot &slot : slots_) {
+    slot.page_number = 0;
+    slot.p_page.reset();
+  }
+  num_entries_ = 0;
+}
+
+void PageHashTable::Grow() {
+  std::vector<Slot> old_slots(slots_.size() * 2);
+  old_slots.swap(slots_);
+  shift_--;
+  u32 mask = slots_.size() - 1;
+  for (Slot &slot : old_slots) {
+    if (slot.page_number == 0) continue;
+    u32 idx = HomeSlot(slot.page_number);
+    while (slots_[idx].page_number != 0) {
+      idx = (idx + 1) & mask;
+    }
+    slots_[idx] = std::move(slot);
+  }
+}
+
+// below is the implementation of PolicyPageQueue
+
+// Puts a page on the queue; it is linked once nobody references it
+void PolicyPageQueue::Add(BasePage *p_page, PolicyQueueId id) {
+  p_page->GetPageHeader()->policy_queue_ = id;
+  size_++;
+}
+
+void PolicyPageQueue::Remove(BasePage *p_page) {
+  Unlink(p_page);
+  p_page->GetPageHeader()->policy_queue_ = PolicyQueueId::NONE;
+  size_--;
+}
+
+// Links a page that was released at the tail, its most recently used end
+void PolicyPageQueue::Link(BasePage *p_page) {
+  PageHeader *p_header = p_page->GetPageHeader();
+  p_header->p_next_policy_ = nullptr;
+  p_header->p_prev_policy_ = p_last_;
+  if (p_last_ != nullptr) {
+    p_last_->GetPageHeader()->p_next_policy_ = p_page;
+  } else {
+    p_first_ = p_page;
+  }
+  p_last_ = p_page;
+}
+
+void PolicyPageQueue::Unlink(BasePage *p_page) {
+  if (!IsLinked(p_page)) {
+    return;
+  }
+  PageHeader *p_header = p_page->GetPageHeader();
+  if (p_header->p_prev_policy_ != nullptr) {
+    p_header->p_prev_policy_->GetPageHeader()->p_next_policy_ =
+        p_header->p_next_policy_;
+  } else {
+    p_first_ = p_header->p_next_policy_;
+  }
+  if (p_header->p_next_policy_ != nullptr) {
+    p_header->p_next_policy_->GetPageHeader()->p_prev_policy_ =
+        p_header->p_prev_policy_;
+  } else {
+    p_last_ = p_header->p_prev_policy_;
+  }
+  p_header->p_prev_policy_ = p_header->p_next_policy_ = nullptr;
+}
+
+void PolicyPageQueue::Clear() {
+  p_first_ = p_last_ = nullptr;
+  size_ = 0;
+}
+
+bool PolicyPageQueue::IsLinked(BasePage *p_page) const {
+  return p_page->GetPageHeader()->p_prev_policy_ != nullptr ||
+         p_first_ == p_page;
+}
+
+// below is the implementation of GhostQueue
+
+// The ring starts with 64 positions and the index with twice as many slots
+static constexpr u32 kGhostRingInitialBits = 6;
+
+GhostQueue::GhostQueue() { Rebuild(1u << kGhostRingInitialBits); }
+
+// Fibonacci hashing, as in PageHashTable::HomeSlot
+u32 GhostQueue::HomeSlot(PageNumber page_number) const {
+  return (u32)(page_number * 2654435769u) >> shift_;
+}
+
+// Returns the slot holding page_number, or slots_.size() if there is none
+u32 GhostQueue::FindSlot(PageNumber page_number) const {
+  u32 mask = slots_.size() - 1;
+  for (u32 idx = HomeSlot(page_number); slots_[idx].page_number != 0;
+       idx = (idx + 1) & mask) {
+    if (slots_[idx].page_number == page_number) {
+      return idx;
+    }
+  }
+  return slots_.size();
+}
+
+void GhostQueue::InsertSlot(PageNumber page_number, u32 position) {
+  u32 mask = slots_.size() - 1;
+  u32 idx = HomeSlot(page_number);
+  while (slots_[idx].page_number != 0) {
+    idx = (idx + 1) & mask;
+  }
+  slots_[idx] = {page_number, position};
+}
+
+// Empties a slot by backward shifting, see PageHashTable::Erase
+void GhostQueue::EraseSlot(u32 hole) {
+  u32 mask = slots_.size() - 1;
+  for (u32 idx = (hole + 1) & mask; slots_[idx].page_number != 0;
+       idx = (idx + 1) & mask) {
+    u32 home = HomeSlot(slots_[idx].page_number);
+    bool is_reachable = hole <= idx ? (hole < home && home <= idx)
+                                    : (hole < home || home <= idx);
+    if (is_reachable) {
+      continue;
+    }
+    slots_[hole] = slots_[idx];
+    hole = idx;
+  }
+  slots_[hole] = Slot{};
+}
+
+/**
+ * Moves the page numbers still in the queue, oldest first, into a ring of
+ * ring_size positions, dropping the stale entries, and indexes them again.
+ */
+void GhostQueue::Rebuild(u32 ring_size) {
+  std::vector<PageNumber> page_numbers;
+  page_numbers.reserve(num_entries_);
+  for (u32 position = head_; position != tail_; position++) {
+    PageNumber page_number = ring_[position & (ring_.size() - 1)];
+    u32 idx = FindSlot(page_number);
+    if (idx != slots_.size() && slots_[idx].position == position) {
+      page_numbers.push_back(page_number);
+    }
+  }
+  ring_.assign(ring_size, 0);
+  slots_.assign(2 * ring_size, Slot{});
+  shift_ = 32;
+  for (u32 size = slots_.size(); size > 1; size >>= 1) {
+    shift_--;
+  }
+  head_ = tail_ = 0;
+  for (PageNumber page_number : page_numbers) {
+    ring_[tail_] = page_number;
+    InsertSlot(page_number, tail_);
+    tail_++;
+  }
+}
+
+bool GhostQueue::Contains(PageNumber page_number) const {
+  return FindSlot(page_number) != slots_.size();
+}
+
+// Forgets page_number; its entry in the ring goes stale
+bool GhostQueue::Remove(PageNumber page_number) {
+  u32 idx = FindSlot(page_number);
+  if (idx == slots_.size()) {
+    return false;
+  }
+  EraseSlot(idx);
+  num_entries_--;
+  return true;
+}
+
 /**
- * Function to update a page's usage information to achieve the LRU behavior
+ * Appends page_number as the newest entry. A full ring is rebuilt without its
+ * stale entries, at twice the size if more than half of it is still in use.
  */
-void Pager::updateLRU(BasePage *p_page) {
-  /*
-   * TODO: A2 -> Complete the function below
-   * Hint: Think about what needs to be updated about the two data structures
-   * pager maintains
-   */
+void GhostQueue::PushBack(PageNumber page_number) {
+  Remove(page_number);
+  u32 ring_size = ring_.size();
+  if (tail_ - head_ == ring_size) {
+    Rebuild(num_entries_ * 2 > ring_size ? ring_size * 2 : ring_size);
+  }
+  ring_[tail_ & (ring_.size() - 1)] = page_number;
+  InsertSlot(page_number, tail_);
+  tail_++;
+  num_entries_++;
+}
+
+// Forgets the oldest page number, skipping stale entries
+void GhostQueue::PopFront() {
+  while (head_ != tail_) {
+    u32 position = head_++;
+    u32 idx = FindSlot(ring_[position & (ring_.size() - 1)]);
+    if (idx != slots_.size() && slots_[idx].position == position) {
+      EraseSlot(idx);
+      num_entries_--;
+      return;
+    }
+  }
+}
+
+// Forgets every page number but keeps the ring and the index for reuse
+void GhostQueue::Clear() {
+  std::fill(slots_.begin(), slots_.end(), Slot{});
+  head_ = tail_ = 0;
+  num_entries_ = 0;
 }
 
+// below is the implementation of the cache functions of Pager
+
 /**
  * Function to evict a page when the cache is full, returns a pointer to the
- * page to be evicted
+ * page to be evicted, or nullptr if the policy wants the dirty pages synced
+ * first.
+ *
+ * The free list holds exactly the pages nobody references, in the order they
+ * were released: SqlitePagerUnref appends to its tail and a page leaves it as
+ * soon as it is referenced again. Its head is therefore the least recently
+ * used evictable page, which makes LRU eviction O(1).
  */
 BasePage *Pager::evictPage() {
+  if (p_free_page_first_ == nullptr) {
+    return nullptr;
+  }
   if (eviction_policy_ == EvictionPolicy::FIRST_NON_DIRTY) {
     // original caching policy
     return p_free_page_first_->GetFirstNonDirtyPage();
   } else if (eviction_policy_ == EvictionPolicy::LRU) {  // LRU policy
-    /*
-     * TODO: A2 -> Complete this function
-     * Hint: think about how to find the least recently used page?
-     */
+    // a dirty head cannot be dropped before it is written, so ask for a sync;
+    // afterwards the whole free list is clean
+    if (p_free_page_first_->p_header_->is_dirty_) {
+      return nullptr;
+    }
+    return p_free_page_first_;
+  } else {  // TWO_QUEUE and ARC
+    return SqlitePagerPrivatePolicyFindVictim();
   }
   return nullptr;
 }
 
-void Pager::SqlitePagerPrivateAddCreatedPageToCache(PageNumber page_number,
-                                                    BasePage *&p_page) {
-  page_hash_table_->operator[](page_number)->InitPageHeader(this, page_number);
-  p_page = page_hash_table_->operator[](page_number).get();
-  p_all_page_first_ = p_page;
-  if (eviction_policy_ == EvictionPolicy::LRU) {
-    if (p_free_page_first_ == nullptr) {
-      p_free_page_first_ = p_page;
-      p_free_page_last_ = p_page;
-    } else {
-      p_free_page_last_->p_header_->p_next_free_ = p_page;
-      p_page->p_header_->p_prev_free_ = p_free_page_last_;
-      p_free_page_last_ = p_page;
+/**
+ * Returns the cache counters together with the policy that produced them, so
+ * that runs of different policies over the same workload can be compared.
+ */
+PagerCacheStats Pager::SqlitePagerCacheStats() const {
+  return {eviction_policy_, num_pages_hit_, num_pages_miss_,
+          num_pages_overflow_, num_ghost_hits_};
+}
+
+/**
+ * Picks the victim for TWO_QUEUE and ARC.
+ *
+ * 2Q evicts from A1in while it holds more than a quarter of the cache, so
+ * pages touched once (a scan) cycle through A1in without disturbing the hot
+ * pages in Am. ARC evicts from T1 while it is larger than its adaptive target
+ * (or equal to it when the incoming page was found in B2), and from T2
+ * otherwise. Only unreferenced pages are linked on the queues, so the victim
+ * is the first page of the preferred queue, or of the other one when the
+ * preferred queue has none. As with LRU, a dirty first page makes it return
+ * nullptr to ask the caller to sync; afterwards every linked page is clean.
+ */
+BasePage *Pager::SqlitePagerPrivatePolicyFindVictim() {
+  bool prefer_recent;
+  if (eviction_policy_ == EvictionPolicy::TWO_QUEUE) {
+    u32 recent_capacity = std::max<u32>(1, num_mem_pages_max_ / 4);
+    prefer_recent = recent_queue_.size_ > recent_capacity;
+  } else {
+    prefer_recent = recent_queue_.size_ >= 1 &&
+                    (recent_queue_.size_ > arc_target_recent_ ||
+                     (is_incoming_frequent_ghost_ &&
+                      recent_queue_.size_ == arc_target_recent_));
+  }
+  const PolicyPageQueue &first = prefer_recent ? recent_queue_ : frequent_queue_;
+  const PolicyPageQueue &second =
+      prefer_recent ? frequent_queue_ : recent_queue_;
+  BasePage *p_victim =
+      first.p_first_ != nullptr ? first.p_first_ : second.p_first_;
+  if (p_victim == nullptr || p_victim->p_header_->is_dirty_) {
+    return nullptr;
+  }
+  return p_victim;
+}
+
+/**
+ * Called on every cache hit of SqlitePagerGet, once the page is referenced
+ * and so unlinked from its queue. When it is released it is linked again as
+ * the most recent page of its queue, which is all a hit in Am (2Q) or T2 (ARC)
+ * asks for. A1in thereby keeps pages in the order of their last release
+ * rather than of their arrival. ARC moves a page hit in T1 to T2.
+ */
+void Pager::SqlitePagerPrivatePolicyOnHit(BasePage *p_page) {
+  if (eviction_policy_ == EvictionPolicy::ARC &&
+      p_page->p_header_->policy_queue_ == PolicyQueueId::RECENT) {
+    recent_queue_.Remove(p_page);
+    frequent_queue_.Add(p_page, PolicyQueueId::FREQUENT);
+  }
+}
+
+/**
+ * Called on every cache miss of SqlitePagerGet, before a victim is chosen.
+ * Decides which queue the page goes to. A page found in a ghost queue was
+ * evicted too early: 2Q admits it to Am directly, and ARC admits it to T2 and
+ * moves its target for T1 towards the queue whose ghost was hit.
+ */
+void Pager::SqlitePagerPrivatePolicyOnMiss(PageNumber page_number) {
+  incoming_queue_ = PolicyQueueId::RECENT;
+  is_incoming_frequent_ghost_ = false;
+  if (eviction_policy_ == EvictionPolicy::TWO_QUEUE) {
+    if (recent_ghosts_.Remove(page_number)) {
+      num_ghost_hits_++;
+      incoming_queue_ = PolicyQueueId::FREQUENT;
+    }
+  } else if (eviction_policy_ == EvictionPolicy::ARC) {
+    u32 num_recent_ghosts = recent_ghosts_.Size();
+    u32 num_frequent_ghosts = frequent_ghosts_.Size();
+    if (recent_ghosts_.Remove(page_number)) {
+      num_ghost_hits_++;
+      u32 delta = std::max<u32>(1, num_frequent_ghosts / num_recent_ghosts);
+      arc_target_recent_ =
+          std::min(num_mem_pages_max_, arc_target_recent_ + delta);
+      incoming_queue_ = PolicyQueueId::FREQUENT;
+    } else if (frequent_ghosts_.Remove(page_number)) {
+      num_ghost_hits_++;
+      u32 delta = std::max<u32>(1, num_recent_ghosts / num_frequent_ghosts);
+      arc_target_recent_ =
+          arc_target_recent_ > delta ? arc_target_recent_ - delta : 0;
+      incoming_queue_ = PolicyQueueId::FREQUENT;
+      is_incoming_frequent_ghost_ = true;
     }
   }
 }
 
-void Pager::SqlitePagerPrivateRemovePageFromCache(PageNumber page_number,
-                                                  BasePage *p_page) {
-  // unlink the old page from the free list
-  // remove from prev_free
-  if (p_page->p_header_->p_prev_free_ != nullptr) {
-    p_page->p_header_->p_prev_free_->p_header_->p_next_free_ =
-        p_page->p_header_->p_next_free_;
+// Called when a page enters the cache, referenced by the caller
+void Pager::SqlitePagerPrivatePolicyOnInsert(BasePage *p_page) {
+  if (eviction_policy_ != EvictionPolicy::TWO_QUEUE &&
+      eviction_policy_ != EvictionPolicy::ARC) {
+    return;
+  }
+  if (incoming_queue_ == PolicyQueueId::FREQUENT) {
+    frequent_queue_.Add(p_page, PolicyQueueId::FREQUENT);
   } else {
-    p_free_page_first_ = p_page->p_header_->p_next_free_;
+    recent_queue_.Add(p_page, PolicyQueueId::RECENT);
   }
+  incoming_queue_ = PolicyQueueId::RECENT;
+  SqlitePagerPrivatePolicyTrimGhosts();
+}
 
-  // remove from next_free
-  if (p_page->p_header_->p_next_free_ != nullptr) {
-    p_page->p_header_->p_next_free_->p_header_->p_prev_free_ =
-        p_page->p_header_->p_prev_free_;
+/**
+ * Called when a page is evicted. 2Q remembers pages evicted from A1in in
+ * A1out; ARC remembers pages evicted from T1 in B1 and from T2 in B2.
+ */
+void Pager::SqlitePagerPrivatePolicyOnRemove(BasePage *p_page) {
+  PageHeader *p_header = p_page->p_header_.get();
+  PolicyQueueId queue = p_header->policy_queue_;
+  if (queue == PolicyQueueId::RECENT) {
+    recent_queue_.Remove(p_page);
+    recent_ghosts_.PushBack(p_header->page_number_);
+  } else if (queue == PolicyQueueId::FREQUENT) {
+    frequent_queue_.Remove(p_page);
+    if (eviction_policy_ == EvictionPolicy::ARC) {
+      frequent_ghosts_.PushBack(p_header->page_number_);
+    }
+  }
+  SqlitePagerPrivatePolicyTrimGhosts();
+}
+
+/**
+ * Keeps the ghost queues bounded: 2Q keeps A1out at half the cache size, ARC
+ * keeps |T1| + |B1| within the cache size and all four queues within twice
+ * the cache size.
+ */
+void Pager::SqlitePagerPrivatePolicyTrimGhosts() {
+  u32 capacity = num_mem_pages_max_;
+  if (eviction_policy_ == EvictionPolicy::TWO_QUEUE) {
+    u32 ghost_capacity = std::max<u32>(1, capacity / 2);
+    while (recent_ghosts_.Size() > ghost_capacity) {
+      recent_ghosts_.PopFront();
+    }
+  } else if (eviction_policy_ == EvictionPolicy::ARC) {
+    while (recent_ghosts_.Size() > 0 &&
+           recent_queue_.size_ + recent_ghosts_.Size() > capacity) {
+      recent_ghosts_.PopFront();
+    }
+    while (frequent_ghosts_.Size() > 0 &&
+           recent_queue_.size_ + frequent_queue_.size_ +
+                   recent_ghosts_.Size() + frequent_ghosts_.Size() >
+               2 * capacity) {
+      frequent_ghosts_.PopFront();
+    }
+  }
+}
+
+// Forgets every queue, called when the cache is reset
+void Pager::SqlitePagerPrivatePolicyReset() {
+  recent_queue_.Clear();
+  frequent_queue_.Clear();
+  recent_ghosts_.Clear();
+  frequent_ghosts_.Clear();
+  arc_target_recent_ = 0;
+  incoming_queue_ = PolicyQueueId::RECENT;
+  is_incoming_frequent_ghost_ = false;
+}
+
+void Pager::SqlitePagerPrivateAddCreatedPageToCache(PageNumber page_number,
+                                                    BasePage *p_page) {
+  p_page->InitPageHeader(this, page_number);
+  p_all_page_first_ = p_page;
+  SqlitePagerPrivatePolicyOnInsert(p_page);
+}
+
+// Unlinks a page from the free list, and from its policy queue
+void Pager::SqlitePagerPrivateUnlinkFreePage(BasePage *p_page) {
+  PageHeader *p_header = p_page->p_header_.get();
+  if (p_header->policy_queue_ == PolicyQueueId::RECENT) {
+    recent_queue_.Unlink(p_page);
+  } else if (p_header->policy_queue_ == PolicyQueueId::FREQUENT) {
+    frequent_queue_.Unlink(p_page);
+  }
+  if (p_header->p_prev_free_ != nullptr) {
+    p_header->p_prev_free_->p_header_->p_next_free_ = p_header->p_next_free_;
   } else {
-    p_free_page_last_ = p_page->p_header_->p_prev_free_;
+    p_free_page_first_ = p_header->p_next_free_;
   }
 
-  // clean itself
-  p_page->p_header_->p_next_free_ = p_page->p_header_->p_prev_free_ = nullptr;
+  if (p_header->p_next_free_ != nullptr) {
+    p_header->p_next_free_->p_header_->p_prev_free_ = p_header->p_prev_free_;
+  } else {
+    p_free_page_last_ = p_header->p_prev_free_;
+  }
+  p_header->p_next_free_ = p_header->p_prev_free_ = nullptr;
+}
 
-  // move hash table
-  PageNumber old_page_number = p_page->p_header_->page_number_;
-  page_hash_table_->operator[](page_number) =
-      std::move(page_hash_table_->operator[](old_page_number));
-  page_hash_table_->erase(old_page_number);
+// Appends a page to the tail of the free list, its most recently used end,
+// and to the tail of its policy queue
+void Pager::SqlitePagerPrivateAppendFreePage(BasePage *p_page) {
+  PageHeader *p_header = p_page->p_header_.get();
+  if (p_header->policy_queue_ == PolicyQueueId::RECENT) {
+    recent_queue_.Link(p_page);
+  } else if (p_header->policy_queue_ == PolicyQueueId::FREQUENT) {
+    frequent_queue_.Link(p_page);
+  }
+  p_header->p_next_free_ = nullptr;
+  p_header->p_prev_free_ = p_free_page_last_;
+  if (p_free_page_last_ != nullptr) {
+    p_free_page_last_->p_header_->p_next_free_ = p_page;
+  } else {
+    p_free_page_first_ = p_page;
+  }
+  p_free_page_last_ = p_page;
 }
 
-BasePage *Pager::SqlitePagerPrivateCacheLookup(PageNumber page_number) const {
-  // the reason why we do this is that by directly access, we create a nullptr
-  // for the key, which is not that good
-  if (eviction_policy_ == EvictionPolicy::FIRST_NON_DIRTY) {
-    auto it = page_hash_table_->find(page_number);
-    if (it != page_hash_table_->end()) {
-      return it->second.get();
-    } else {
-      return nullptr;
-    }
+/**
+ * Drops an unreferenced page from the cache: it is unlinked from the free
+ * list and from the list of all pages, and destroyed through the hash table.
+ * The page that takes its place is created fresh by the caller, so its
+ * derived type always matches what the caller asked for.
+ */
+void Pager::SqlitePagerPrivateRemovePageFromCache(BasePage *p_page) {
+  SqlitePagerPrivateUnlinkFreePage(p_page);
+  SqlitePagerPrivatePolicyOnRemove(p_page);
+
+  PageHeader *p_header = p_page->p_header_.get();
+  if (p_header->p_prev_all_ != nullptr) {
+    p_header->p_prev_all_->p_header_->p_next_all_ = p_header->p_next_all_;
   } else {
-    /*
-     * TODO: A2 -> Complete the logic here
-     * Hint: How to get a page from the LRU cache using a page number?
-     */
+    p_all_page_first_ = p_header->p_next_all_;
+  }
+  if (p_header->p_next_all_ != nullptr) {
+    p_header->p_next_all_->p_header_->p_prev_all_ = p_header->p_prev_all_;
   }
+
+  page_hash_tables_[SqlitePagerPrivateShardOf(p_header->page_number_)].Erase(
+      p_header->page_number_);
+  num_mem_pages_--;
+}
+
+BasePage *Pager::SqlitePagerPrivateCacheLookup(PageNumber page_number) const {
+  return page_hash_tables_[SqlitePagerPrivateShardOf(page_number)].Find(
+      page_number);
 }
@@ -19,9 +19,10 @@ ResultCode Pager::SqlitePagerPrivatePlayback() {
     err_mask_.insert(SqlitePagerError::K_PAGER_ERROR_CORRUPT);
     return rc;
   }
-  // the journal file's structure is [magicnumber][totalsize][PageRecord]*n
+  // the journal file's structure is [magicnumber][totalsize][PageRecord]*n,
+  // where a PageRecord is a page number followed by a page image
   num_record = (journal_size - kAJournalMagic.size() - sizeof(PageNumber)) /
-               sizeof(PageRecord);
+               (sizeof(PageNumber) + page_size_);
 
   if (num_record == 0) {
     SqlitePagerPrivateUnWriteLock();
@@ -49,8 +50,11 @@ ResultCode Pager::SqlitePagerPrivatePlayback() {
   // Copy the data from the buffer into the max_page variable
   std::memcpy(&max_page, page_number_buffer.data(), sizeof(PageNumber));
 
-  // truncate the database file to the original size recorded in journal
-  rc = fd_->OsTruncate(max_page * kPageSize);
+  // truncate the database file to the original size recorded in journal. No
+  // cached page may view the mapping past the new end of the file.
+  SqlitePagerPrivateUnmapAll();
+  rc = fd_->OsTruncate(max_page * page_size_);
+  SqlitePagerPrivateDropPrefetched();
   if (rc != ResultCode::kOk) {
     SqlitePagerPrivateUnWriteLock();
     err_mask_.insert(SqlitePagerError::K_PAGER_ERROR_CORRUPT);
@@ -91,21 +95,23 @@ ResultCode Pager::SqlitePagerPrivateSyncAllPages() {
     is_journal_need_sync_ = false;
   }
 
+  std::vector<BasePage *> dirty_pages;
   for (BasePage *cur_page = p_free_page_first_; cur_page != nullptr;
        cur_page = cur_page->p_header_->p_next_free_) {
     if (cur_page->p_header_->is_dirty_) {
-      ResultCode rc =
-          fd_->OsSeek((cur_page->p_header_->page_number_ - 1) * kPageSize);
-      if (rc != ResultCode::kOk) {
-        return rc;
-      }
-      rc = fd_->OsWrite(cur_page->ImageVector());
-      if (rc != ResultCode::kOk) {
-        return rc;
-      }
-      cur_page->p_header_->is_dirty_ = false;
+      dirty_pages.push_back(cur_page);
     }
   }
+  // in WAL mode the database file is only written by checkpoints
+  ResultCode rc = journal_mode_ == JournalMode::WAL
+                      ? SqlitePagerPrivateWalSpill(dirty_pages)
+                      : SqlitePagerPrivateWritePages(dirty_pages);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  for (BasePage *cur_page : dirty_pages) {
+    cur_page->p_header_->is_dirty_ = false;
+  }
   return ResultCode::kOk;
 }
 
@@ -113,6 +119,9 @@ ResultCode Pager::SqlitePagerPrivateUnWriteLock() {
   // Add comments
   ResultCode rc = ResultCode::kOk;
   if (lock_state_ != SqliteLockState::K_SQLITE_WRITE_LOCK) return rc;
+  if (journal_mode_ == JournalMode::WAL) {
+    return SqlitePagerPrivateWalRollback();
+  }
   SqlitePagerCkptCommit();
   if (is_checkpoint_journal_open_) {
     checkpoint_journal_fd_->OsClose();
@@ -201,6 +210,7 @@ ResultCode Pager::SqlitePagerCkptCommit() {
 ResultCode Pager::SqlitePagerCkptRollback() {
   ResultCode rc;
   if (is_checkpoint_journal_use_) {
+    data_version_++;
     rc = SqlitePagerPrivateCkptPlayback();
     SqlitePagerCkptCommit();
   } else {
@@ -211,13 +221,17 @@ ResultCode Pager::SqlitePagerCkptRollback() {
 
 ResultCode Pager::SqlitePagerPrivatePlaybackOnePage(OsFile *fd) {
   PageRecord page_record = PageRecord();
-  std::vector<std::byte> buffer(sizeof(PageRecord));
+  std::vector<std::byte> buffer(sizeof(PageNumber));
   ResultCode rc = fd->OsRead(buffer);
   if (rc != ResultCode::kOk) {
     return rc;
   }
-
-  std::memcpy(&page_record, buffer.data(), sizeof(PageRecord));
+  std::memcpy(&page_record.page_number_, buffer.data(), sizeof(PageNumber));
+  page_record.p_image_.resize(page_size_);
+  rc = fd->OsRead(page_record.p_image_);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
 
   /* Sanity checking on the page */
   if (page_record.page_number_ > num_database_size_ ||
@@ -232,18 +246,19 @@ ResultCode Pager::SqlitePagerPrivatePlaybackOnePage(OsFile *fd) {
   BasePage *current_page =
       SqlitePagerPrivateCacheLookup(page_record.page_number_);
   if (current_page) {
-    // the old one would be automatically deleted
-    current_page->p_image_ = std::make_unique<std::array<std::byte, kPageSize>>(
-        page_record.p_image_);
+    current_page->PrivatizeImage(page_size_);
+    std::copy(page_record.p_image_.begin(), page_record.p_image_.end(),
+              current_page->p_image_.begin());
     // TODO: how to accomplish this line is debatable
     // memset(PGHDR_TO_EXTRA(current_page), 0, pPager->nExtra);
   }
 
-  // revise disk
-  rc = fd->OsSeek((page_record.page_number_ - 1) * kPageSize);
-  if (rc == ResultCode::kOk) {
-    rc = fd->OsWrite(page_record.ImageVector());
-  }
+  // revise disk. The record is written to the database file at its page
+  // offset; the journal read position in fd is left where it was, so the
+  // next record can be read sequentially.
+  rc = fd_->OsWriteAt(page_record.p_image_, page_size_,
+                      (page_record.page_number_ - 1) * page_size_);
+  SqlitePagerPrivateDropPrefetched();
 
   return rc;
 }
@@ -0,0 +1,173 @@
+#include "pager.h"
+
+/**
+ * Hints that page_number is about to be read, so that a background thread
+ * reads it from the database file while the caller is busy with other pages.
+ * With depth > 1 and a next_page function, the thread keeps going along the
+ * chain: after reading a page it asks next_page for the page that follows,
+ * until depth pages have been read or next_page returns 0. Pages that are
+ * already cached are not read again, but the chain is still followed through
+ * their cached images.
+ *
+ * A later cache miss on a prefetched page copies the image instead of reading
+ * the file, and waits if the thread is reading that very page. The hint never
+ * fails the caller: pages that cannot be read ahead are simply read by
+ * SqlitePagerGet as before. In memory-mapped mode the hint is ignored, since
+ * the mapping already serves reads.
+ */
+ResultCode Pager::SqlitePagerPrefetch(PageNumber page_number, u32 depth,
+                                      const NextPageFunction &next_page) {
+  if (io_mode_ == PageIoMode::MEMORY_MAPPED) {
+    return ResultCode::kOk;
+  }
+  while (page_number != 0 && depth > 0) {
+    std::unique_lock<std::mutex> shard_latch(
+        shard_latches_[SqlitePagerPrivateShardOf(page_number)],
+        std::defer_lock);
+    if (is_concurrent_) {
+      shard_latch.lock();
+    }
+    BasePage *p_page = SqlitePagerPrivateCacheLookup(page_number);
+    if (p_page == nullptr) {
+      break;
+    }
+    page_number = next_page ? next_page(p_page->p_image_) : 0;
+    depth--;
+  }
+  if (page_number == 0 || depth == 0) {
+    return ResultCode::kOk;
+  }
+
+  std::lock_guard<std::mutex> lock(prefetch_mutex_);
+  if (prefetch_queue_.size() >= kMaxPrefetchedPages) {
+    return ResultCode::kOk;
+  }
+  if (!prefetch_thread_.joinable()) {
+    prefetch_thread_ =
+        std::thread(&Pager::SqlitePagerPrivatePrefetchLoop, this);
+    is_prefetch_started_ = true;
+  }
+  prefetch_queue_.push_back({page_number, depth, next_page});
+  prefetch_cv_.notify_all();
+  return ResultCode::kOk;
+}
+
+PagerPrefetchStats Pager::SqlitePagerPrefetchStats() const {
+  std::lock_guard<std::mutex> lock(prefetch_mutex_);
+  return {num_prefetch_issued_, num_prefetch_hits_, num_prefetch_wasted_};
+}
+
+/**
+ * Body of the prefetch thread. The file is read without holding
+ * prefetch_mutex_; an image whose read overlapped a write to the file (the
+ * generation changed meanwhile) is thrown away. The thread only touches the
+ * file descriptor and the prefetch state, never the page cache.
+ */
+void Pager::SqlitePagerPrivatePrefetchLoop() {
+  std::unique_lock<std::mutex> lock(prefetch_mutex_);
+  while (true) {
+    prefetch_cv_.wait(lock, [this] {
+      return is_prefetch_stopping_ || !prefetch_queue_.empty();
+    });
+    if (is_prefetch_stopping_) {
+      return;
+    }
+    PrefetchRequest request = std::move(prefetch_queue_.front());
+    prefetch_queue_.pop_front();
+
+    u32 page_size = page_size_;
+    PageImage image;
+    auto it = prefetched_images_.find(request.page_number);
+    if (it != prefetched_images_.end()) {
+      image = PageImage(it->second.p_image.get(), page_size);
+    } else {
+      u64 generation = prefetch_generation_;
+      prefetch_in_flight_ = request.page_number;
+      lock.unlock();
+      auto p_new_image = std::make_unique<std::byte[]>(page_size);
+      ResultCode rc = fd_->OsReadAt(p_new_image.get(), page_size,
+                                    (request.page_number - 1) * page_size);
+      lock.lock();
+      prefetch_in_flight_ = 0;
+      prefetch_cv_.notify_all();
+      if (rc != ResultCode::kOk) {
+        // most likely past the end of the file, where Get zero-fills anyway
+        continue;
+      }
+      num_prefetch_issued_++;
+      if (generation != prefetch_generation_) {
+        num_prefetch_wasted_++;
+        continue;
+      }
+      if (prefetched_images_.size() >= kMaxPrefetchedPages) {
+        prefetched_images_.erase(prefetched_order_.front());
+        prefetched_order_.pop_front();
+        num_prefetch_wasted_++;
+      }
+      prefetched_order_.push_back(request.page_number);
+      image = PageImage(p_new_image.get(), page_size);
+      prefetched_images_[request.page_number] = {
+          std::prev(prefetched_order_.end()), std::move(p_new_image)};
+    }
+
+    if (request.depth > 1 && request.next_page) {
+      PageNumber next_page_number = request.next_page(image);
+      if (next_page_number != 0) {
+        prefetch_queue_.push_back({next_page_number, request.depth - 1,
+                                   std::move(request.next_page)});
+      }
+    }
+  }
+}
+
+/**
+ * Called by SqlitePagerGet on a cache miss. Copies the prefetched image of
+ * page_number into p_image and returns true, or returns false when the page
+ * has to be read from the file.
+ */
+bool Pager::SqlitePagerPrivateTakePrefetched(PageNumber page_number,
+                                             std::byte *p_image) {
+  if (!is_prefetch_started_) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(prefetch_mutex_);
+  prefetch_cv_.wait(lock,
+                    [&] { return prefetch_in_flight_ != page_number; });
+  auto it = prefetched_images_.find(page_number);
+  if (it == prefetched_images_.end()) {
+    return false;
+  }
+  std::copy_n(it->second.p_image.get(), page_size_, p_image);
+  prefetched_order_.erase(it->second.order);
+  prefetched_images_.erase(it);
+  num_prefetch_hits_++;
+  return true;
+}
+
+/**
+ * Forgets every prefetched image and pending hint. Called whenever the
+ * database file is written or truncated, and when the cache is reset.
+ */
+void Pager::SqlitePagerPrivateDropPrefetched() {
+  if (!is_prefetch_started_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(prefetch_mutex_);
+  num_prefetch_wasted_ += prefetched_images_.size();
+  prefetched_images_.clear();
+  prefetched_order_.clear();
+  prefetch_queue_.clear();
+  prefetch_generation_++;
+}
+
+void Pager::SqlitePagerPrivateStopPrefetch() {
+  if (!prefetch_thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(prefetch_mutex_);
+    is_prefetch_stopping_ = true;
+  }
+  prefetch_cv_.notify_all();
+  prefetch_thread_.join();
+}
@@ -0,0 +1,1034 @@
+#include "pager.h"
+
+// Where frame number frame starts in a -wal file of pages of page_size bytes
+static u32 WalFrameOffset(u32 frame, u32 page_size) {
+  return kWalHeaderSize + frame * (sizeof(WalFrameHeader) + page_size);
+}
+
+// Checksum of a frame over its header fields (but the checksum) and its image
+static u32 WalChecksum(const WalFrameHeader &header, const std::byte *p_image,
+                       u32 page_size) {
+  u32 sum = header.page_number;
+  sum = sum * 31 + header.commit_size;
+  sum = sum * 31 + header.salt;
+  for (u32 i = 0; i < page_size; i++) {
+    sum = sum * 31 + (u32)p_image[i];
+  }
+  return sum;
+}
+
+// Empties the log and writes a fresh header with the given salt
+static ResultCode WalWriteHeader(OsFile &wal_fd, u32 salt, u32 page_size) {
+  ResultCode rc = wal_fd.OsTruncate(0);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  std::vector<std::byte> header(kWalHeaderSize);
+  std::memcpy(header.data(), kWalMagic.data(), kWalMagic.size());
+  std::memcpy(header.data() + kWalMagic.size(), &page_size, sizeof(u32));
+  std::memcpy(header.data() + kWalMagic.size() + sizeof(u32), &salt,
+              sizeof(u32));
+  return wal_fd.OsWriteAt(header, kWalHeaderSize, 0);
+}
+
+std::mutex WalReadMarks::table_mutex_;
+std::unordered_map<std::string, std::weak_ptr<WalReadMarks>>
+    WalReadMarks::table_;
+
+// Returns the marks of the given -wal file, created by its first pager
+std::shared_ptr<WalReadMarks> WalReadMarks::Find(
+    const std::string &wal_file_name) {
+  std::lock_guard<std::mutex> lock(table_mutex_);
+  std::shared_ptr<WalReadMarks> p_marks = table_[wal_file_name].lock();
+  if (p_marks == nullptr) {
+    p_marks = std::make_shared<WalReadMarks>();
+    table_[wal_file_name] = p_marks;
+  }
+  return p_marks;
+}
+
+void WalReadMarks::Set(const Pager *p_pager, u32 salt, u32 num_frames,
+                       u32 db_size) {
+  marks_[p_pager] = {salt, num_frames, db_size};
+}
+
+void WalReadMarks::Clear(const Pager *p_pager) { marks_.erase(p_pager); }
+
+/**
+ * A mark on an older log sees none of the frames of the log with the given
+ * salt: its snapshot is the database file as that log was started. Without
+ * readers, every frame may be copied.
+ */
+void WalReadMarks::GetCheckpointLimit(u32 salt, u32 &num_frames,
+                                      u32 &db_size) const {
+  num_frames = std::numeric_limits<u32>::max();
+  db_size = 0;
+  for (auto &[p_pager, mark] : marks_) {
+    num_frames = std::min(num_frames, mark.salt == salt ? mark.num_frames : 0);
+    db_size = std::max(db_size, mark.db_size);
+  }
+}
+
+bool WalReadMarks::IsReadByOthers(const Pager *p_pager, u32 salt) const {
+  return std::any_of(marks_.begin(), marks_.end(), [&](auto &entry) {
+    return entry.first != p_pager && entry.second.salt == salt &&
+           entry.second.num_frames != 0;
+  });
+}
+
+std::mutex WalGroupCommit::table_mutex_;
+std::unordered_map<std::string, std::weak_ptr<WalGroupCommit>>
+    WalGroupCommit::table_;
+
+// Returns the group commit queue of the given -wal file, created by its first
+// pager
+std::shared_ptr<WalGroupCommit> WalGroupCommit::Find(
+    const std::string &wal_file_name) {
+  std::lock_guard<std::mutex> lock(table_mutex_);
+  std::shared_ptr<WalGroupCommit> p_group = table_[wal_file_name].lock();
+  if (p_group == nullptr) {
+    p_group = std::make_shared<WalGroupCommit>();
+    table_[wal_file_name] = p_group;
+  }
+  return p_group;
+}
+
+// Every pager flushed its commits before letting go of the queue
+WalGroupCommit::~WalGroupCommit() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopping_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+/**
+ * Queues a commit that is in the log but not synced. The first commit of a
+ * group sets when the group is synced, window after its arrival.
+ */
+void WalGroupCommit::Enqueue(Waiter waiter, std::chrono::microseconds window) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (waiters_.empty()) {
+    deadline_ = std::chrono::steady_clock::now() + window;
+  }
+  num_unsynced_[waiter.p_pager]++;
+  waiters_.push_back(std::move(waiter));
+  if (!thread_.joinable()) {
+    thread_ = std::thread(&WalGroupCommit::Loop, this);
+  }
+  cv_.notify_all();
+}
+
+void WalGroupCommit::Flush(const Pager *p_pager) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  num_flushing_++;
+  cv_.notify_all();
+  cv_.wait(lock, [&] { return num_unsynced_.count(p_pager) == 0; });
+  num_flushing_--;
+}
+
+/**
+ * Body of the group commit thread. The log is synced without holding mutex_,
+ * so commits arriving meanwhile form the next group. Once the sync succeeds,
+ * each pager of the group may checkpoint the frames it committed.
+ */
+void WalGroupCommit::Loop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this] { return is_stopping_ || !waiters_.empty(); });
+    if (waiters_.empty()) {
+      return;
+    }
+    cv_.wait_until(lock, deadline_,
+                   [this] { return is_stopping_ || num_flushing_ != 0; });
+    std::vector<Waiter> group;
+    group.swap(waiters_);
+    lock.unlock();
+
+    // any handle of the file syncs all of it
+    ResultCode rc = group.front().p_pager->wal_fd_->OsSync();
+    std::vector<Pager *> pagers;
+    for (const Waiter &waiter : group) {
+      if (std::find(pagers.begin(), pagers.end(), waiter.p_pager) ==
+          pagers.end()) {
+        pagers.push_back(waiter.p_pager);
+      }
+    }
+    for (Pager *p_pager : pagers) {
+      p_pager->num_wal_syncs_++;
+      if (pagers.size() > 1) {
+        p_pager->num_wal_shared_syncs_++;
+      }
+    }
+    if (rc == ResultCode::kOk) {
+      for (const Waiter &waiter : group) {
+        waiter.p_pager->SqlitePagerPrivateWalSetSynced(waiter.salt,
+                                                       waiter.num_frames);
+      }
+      for (Pager *p_pager : pagers) {
+        p_pager->SqlitePagerPrivateWalScheduleCheckpoint();
+      }
+    }
+    for (const Waiter &waiter : group) {
+      if (waiter.on_durable) {
+        waiter.on_durable(rc);
+      }
+    }
+
+    lock.lock();
+    for (const Waiter &waiter : group) {
+      if (--num_unsynced_[waiter.p_pager] == 0) {
+        num_unsynced_.erase(waiter.p_pager);
+      }
+    }
+    cv_.notify_all();
+  }
+}
+
+/**
+ * Selects how write transactions are made durable. It must be called before
+ * the first page is loaded, otherwise kMisuse is returned.
+ *
+ * In JournalMode::WAL nothing is journaled and the database file is not
+ * written by a commit. Instead the new images of the dirty pages are appended
+ * to the -wal file, the last one marked as the commit frame, and only the log
+ * is synced: one sync and one sequential write per commit. Pages are read
+ * from their latest committed frame when the WAL index has one, and from the
+ * database file otherwise. A writer only locks the log, so it does not block
+ * readers. A background checkpointer copies the log back into the database
+ * file once kWalAutoCheckpointFrames frames have been synced, and the next
+ * write transaction then starts the log over. Neither copies a frame past the
+ * snapshot a reader of this process still reads (see WalReadMarks).
+ *
+ * Opening an existing -wal file recovers it: every transaction whose commit
+ * frame made it to disk is applied, a torn one is ignored. The mode is not
+ * stored in the database, so a file left with a log must be opened in WAL
+ * mode again; switching back to ROLLBACK checkpoints the log and deletes it.
+ */
+ResultCode Pager::SqlitePagerSetJournalMode(JournalMode mode) {
+  if (num_mem_pages_ != 0 || lock_state_ != SqliteLockState::K_SQLITE_UNLOCK) {
+    return ResultCode::kMisuse;
+  }
+  if (mode == journal_mode_) {
+    return ResultCode::kOk;
+  }
+  ResultCode rc;
+  if (mode == JournalMode::WAL) {
+    bool read_only = false;
+    rc = wal_fd_->OsOpenReadWrite(wal_file_name_, read_only);
+    if (rc != ResultCode::kOk || read_only) {
+      return ResultCode::kCantOpen;
+    }
+    journal_mode_ = JournalMode::WAL;
+    wal_read_marks_ = WalReadMarks::Find(wal_file_name_);
+    wal_group_commit_ = WalGroupCommit::Find(wal_file_name_);
+    bool has_changed = false;
+    return SqlitePagerPrivateWalRefresh(has_changed);
+  }
+
+  rc = SqlitePagerWalCheckpoint();
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  SqlitePagerPrivateStopGroupCommit();
+  SqlitePagerPrivateWalStopCheckpoint();
+  wal_read_marks_.reset();
+  wal_group_commit_.reset();
+  wal_fd_->OsClose();
+  wal_fd_->OsDelete();
+  journal_mode_ = JournalMode::ROLLBACK;
+  return ResultCode::kOk;
+}
+
+/**
+ * Copies every committed frame of the log into the database file, syncs the
+ * file and starts the log over. Returns kBusy while a write transaction, of
+ * this pager or of another one, is open, and when another pager still reads
+ * an older snapshot; the frames that snapshot sees are copied nonetheless.
+ */
+ResultCode Pager::SqlitePagerWalCheckpoint() {
+  if (journal_mode_ != JournalMode::WAL) {
+    return ResultCode::kOk;
+  }
+  if (lock_state_ == SqliteLockState::K_SQLITE_WRITE_LOCK ||
+      wal_fd_->OsWriteLock() != ResultCode::kOk) {
+    return ResultCode::kBusy;
+  }
+  SqlitePagerPrivateWalWaitCheckpoint();
+  bool has_changed = false;
+  bool is_done = false;
+  ResultCode rc = SqlitePagerPrivateWalRefresh(has_changed);
+  if (rc == ResultCode::kOk) {
+    rc = SqlitePagerPrivateWalBackfill(is_done);
+  }
+  if (rc == ResultCode::kOk && !is_done) {
+    rc = ResultCode::kBusy;
+  }
+  wal_fd_->OsUnlock();
+  return rc;
+}
+
+PagerWalStats Pager::SqlitePagerWalStats() const {
+  u32 num_commits = num_wal_commits_;
+  u32 num_syncs = num_wal_syncs_;
+  u32 num_shared_syncs = num_wal_shared_syncs_;
+  return {num_commits, num_syncs, num_shared_syncs, wal_num_frames_,
+          num_syncs == 0 ? 0.0 : (double)num_commits / num_syncs};
+}
+
+/**
+ * Brings the WAL index up to date with the -wal file, reading the frames
+ * after the last known commit. A run of valid frames is applied only when its
+ * commit frame is read, so a transaction torn by a crash is never seen. If
+ * the log was started over since (its salt changed), the index is rebuilt
+ * from the first frame; an empty or unrecognizable log, or one without frames
+ * of another page size, gets a fresh header.
+ * has_changed tells whether the committed state of the log moved. A pager
+ * holding a read lock moves its read mark to the new snapshot.
+ */
+ResultCode Pager::SqlitePagerPrivateWalRefresh(bool &has_changed) {
+  std::lock_guard<std::mutex> marks_lock(wal_read_marks_->mutex_);
+  has_changed = false;
+  u32 wal_size = 0;
+  ResultCode rc = wal_fd_->OsFileSize(wal_size);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  std::vector<std::byte> header(kWalHeaderSize);
+  u32 page_size = 0, salt = 0;
+  bool is_valid_header =
+      wal_size >= kWalHeaderSize &&
+      wal_fd_->OsReadAt(header, kWalHeaderSize, 0) == ResultCode::kOk &&
+      std::equal(kWalMagic.begin(), kWalMagic.end(), header.begin());
+  if (is_valid_header) {
+    std::memcpy(&page_size, header.data() + kWalMagic.size(), sizeof(u32));
+    std::memcpy(&salt, header.data() + kWalMagic.size() + sizeof(u32),
+                sizeof(u32));
+    // a log of another page size without frames is started over; one with
+    // frames belongs to a database this pager has not read a page of yet, so
+    // the pager takes its page size
+    if (page_size != page_size_) {
+      if (wal_size <= kWalHeaderSize) {
+        is_valid_header = false;
+      } else if (SqlitePagerSetPageSize(page_size) != ResultCode::kOk) {
+        return ResultCode::kCorrupt;
+      }
+    }
+  }
+  if (!is_valid_header) {
+    salt = wal_salt_ + 1;
+    rc = WalWriteHeader(*wal_fd_, salt, page_size_);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    wal_size = kWalHeaderSize;
+  }
+  if (salt != wal_salt_) {
+    // the frames the index points at belong to an older log
+    SqlitePagerPrivateWalWaitCheckpoint();
+    has_changed = wal_num_frames_ != 0;
+    wal_index_.clear();
+    wal_num_frames_ = 0;
+    wal_db_size_ = 0;
+    wal_salt_ = salt;
+    std::lock_guard<std::mutex> lock(wal_checkpoint_mutex_);
+    wal_checkpoint_salt_ = salt;
+    wal_num_synced_frames_ = 0;
+    wal_num_checkpointed_frames_ = 0;
+  }
+
+  u32 frame_size = SqlitePagerPrivateWalFrameSize();
+  std::vector<std::byte> frame_buffer(frame_size);
+  std::vector<std::pair<PageNumber, u32>> transaction;
+  for (u32 frame = wal_num_frames_;
+       WalFrameOffset(frame + 1, page_size_) <= wal_size; frame++) {
+    if (wal_fd_->OsReadAt(frame_buffer, frame_size,
+                          WalFrameOffset(frame, page_size_)) !=
+        ResultCode::kOk) {
+      break;
+    }
+    WalFrameHeader frame_header{};
+    std::memcpy(&frame_header, frame_buffer.data(), sizeof(WalFrameHeader));
+    if (frame_header.salt != wal_salt_ || frame_header.page_number == 0 ||
+        frame_header.checksum !=
+            WalChecksum(frame_header,
+                        frame_buffer.data() + sizeof(WalFrameHeader),
+                        page_size_)) {
+      break;
+    }
+    transaction.emplace_back(frame_header.page_number, frame);
+    if (frame_header.commit_size != 0) {
+      for (auto &[page_number, page_frame] : transaction) {
+        wal_index_[page_number] = page_frame;
+      }
+      transaction.clear();
+      wal_num_frames_ = frame + 1;
+      wal_db_size_ = frame_header.commit_size;
+      has_changed = true;
+    }
+  }
+  if (has_changed) {
+    data_version_++;
+  }
+  if (lock_state_ != SqliteLockState::K_SQLITE_UNLOCK) {
+    SqlitePagerPrivateWalSetReadMark();
+  }
+  return ResultCode::kOk;
+}
+
+/**
+ * Records the snapshot this pager reads: the committed frames of the log as
+ * of its last refresh or commit. Called with the mutex of wal_read_marks_
+ * held.
+ */
+void Pager::SqlitePagerPrivateWalSetReadMark() {
+  u32 db_size = wal_db_size_;
+  if (db_size == 0) {
+    u32 file_size = 0;
+    fd_->OsFileSize(file_size);
+    db_size = file_size / page_size_;
+  }
+  wal_read_marks_->Set(this, wal_salt_, wal_num_frames_, db_size);
+}
+
+// Lets checkpoints go past the snapshot of this pager, once it holds no lock
+void Pager::SqlitePagerPrivateWalClearReadMark() {
+  if (wal_read_marks_ == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> marks_lock(wal_read_marks_->mutex_);
+  wal_read_marks_->Clear(this);
+}
+
+/**
+ * Finds the frame holding the latest version of a page: one spilled by the
+ * open write transaction, or else the latest committed one.
+ */
+bool Pager::SqlitePagerPrivateWalFindFrame(PageNumber page_number,
+                                           u32 &frame) {
+  auto it = wal_pending_index_.find(page_number);
+  if (it == wal_pending_index_.end()) {
+    it = wal_index_.find(page_number);
+    if (it == wal_index_.end()) {
+      return false;
+    }
+  }
+  frame = it->second;
+  return true;
+}
+
+/**
+ * Reads the image of page_number from a frame of the log. If another pager
+ * started the log over since the index was built, the frame now belongs to a
+ * newer log and kBusy is returned: the snapshot this pager reads is gone.
+ */
+ResultCode Pager::SqlitePagerPrivateWalReadFrame(PageNumber page_number,
+                                                  u32 frame,
+                                                  std::byte *p_image) {
+  u32 frame_size = SqlitePagerPrivateWalFrameSize();
+  std::vector<std::byte> frame_buffer(frame_size);
+  ResultCode rc = wal_fd_->OsReadAt(frame_buffer, frame_size,
+                                    WalFrameOffset(frame, page_size_));
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  WalFrameHeader frame_header{};
+  std::memcpy(&frame_header, frame_buffer.data(), sizeof(WalFrameHeader));
+  if (frame_header.salt != wal_salt_ ||
+      frame_header.page_number != page_number) {
+    return ResultCode::kBusy;
+  }
+  std::memcpy(p_image, frame_buffer.data() + sizeof(WalFrameHeader),
+              page_size_);
+  return ResultCode::kOk;
+}
+
+/**
+ * Appends one frame per page after the frames already in the log, in page
+ * number order, with a single write. Only the last frame carries commit_size,
+ * and only when it is non-zero is the run a complete transaction.
+ */
+ResultCode Pager::SqlitePagerPrivateWalAppendFrames(
+    std::vector<std::pair<PageNumber, const std::byte *>> &pages,
+    u32 commit_size) {
+  std::sort(pages.begin(), pages.end());
+  u32 frame_size = SqlitePagerPrivateWalFrameSize();
+  std::vector<std::byte> frames(pages.size() * frame_size);
+  for (size_t i = 0; i < pages.size(); i++) {
+    WalFrameHeader frame_header{pages[i].first,
+                                i + 1 == pages.size() ? commit_size : 0,
+                                wal_salt_, 0};
+    frame_header.checksum =
+        WalChecksum(frame_header, pages[i].second, page_size_);
+    std::byte *p_frame = frames.data() + i * frame_size;
+    std::memcpy(p_frame, &frame_header, sizeof(WalFrameHeader));
+    std::memcpy(p_frame + sizeof(WalFrameHeader), pages[i].second, page_size_);
+  }
+  u32 first_frame = wal_num_frames_ + wal_num_pending_frames_;
+  ResultCode rc = wal_fd_->OsWriteAt(frames, frames.size(),
+                                     WalFrameOffset(first_frame, page_size_));
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  for (size_t i = 0; i < pages.size(); i++) {
+    wal_pending_index_[pages[i].first] = first_frame + i;
+  }
+  wal_num_pending_frames_ += pages.size();
+  return ResultCode::kOk;
+}
+
+/**
+ * Starts a write transaction in WAL mode by taking the writer lock on the
+ * log. If another pager committed since this one last read the log, its
+ * cached pages are brought up to date first. Once the background
+ * checkpoint has copied the log, the frames committed while it ran are synced
+ * and copied here, while no one else can append, and the log is started over
+ * unless another pager still reads it.
+ */
+ResultCode Pager::SqlitePagerPrivateWalBegin() {
+  if (wal_fd_->OsWriteLock() != ResultCode::kOk) {
+    return ResultCode::kBusy;
+  }
+  bool has_changed = false;
+  ResultCode rc = SqlitePagerPrivateWalRefresh(has_changed);
+  if (rc == ResultCode::kOk && has_changed) {
+    rc = SqlitePagerPrivateWalReloadCache();
+  }
+  u32 num_checkpointed_frames;
+  bool is_running;
+  {
+    std::lock_guard<std::mutex> lock(wal_checkpoint_mutex_);
+    num_checkpointed_frames = wal_num_checkpointed_frames_;
+    is_running = is_wal_checkpoint_running_;
+  }
+  if (rc == ResultCode::kOk && !is_running && num_checkpointed_frames != 0) {
+    // The background checkpoint is done; the frames committed while it ran
+    // are few, and no one can append now, so copy them too and start over
+    bool is_done = false;
+    rc = SqlitePagerPrivateWalBackfill(is_done);
+  }
+  if (rc != ResultCode::kOk) {
+    wal_fd_->OsUnlock();
+    return rc;
+  }
+  lock_state_ = SqliteLockState::K_SQLITE_WRITE_LOCK;
+  is_dirty_ = false;
+  SqlitePagerPageCount();
+  num_database_original_size_ = num_database_size_;
+  return ResultCode::kOk;
+}
+
+/**
+ * Brings the cache up to the snapshot a refresh moved to, when another pager
+ * committed meanwhile. Pages nobody references leave the cache; the images of
+ * the referenced ones (typically page 1, held by the btree between
+ * transactions) are read again, from the log or else from the file.
+ */
+ResultCode Pager::SqlitePagerPrivateWalReloadCache() {
+  SqlitePagerPrivateDropPrefetched();
+  num_database_size_ = -1;
+  BasePage *p_page = p_all_page_first_;
+  while (p_page != nullptr) {
+    BasePage *p_next_page = p_page->p_header_->p_next_all_;
+    PageNumber page_number = p_page->p_header_->page_number_;
+    if (p_page->p_header_->num_ref_ == 0) {
+      SqlitePagerPrivateRemovePageFromCache(p_page);
+      p_page = p_next_page;
+      continue;
+    }
+    p_page->PrivatizeImage(page_size_);
+    u32 wal_frame = 0;
+    ResultCode rc = ResultCode::kOk;
+    if (SqlitePagerPrivateWalFindFrame(page_number, wal_frame)) {
+      rc = SqlitePagerPrivateWalReadFrame(page_number, wal_frame,
+                                          p_page->p_image_.data());
+    } else {
+      u32 file_size = 0;
+      rc = fd_->OsFileSize(file_size);
+      if (rc == ResultCode::kOk &&
+          file_size <= (page_number - 1) * page_size_) {
+        std::fill(p_page->p_image_.begin(), p_page->p_image_.end(),
+                  std::byte{0});
+      } else if (rc == ResultCode::kOk) {
+        rc = fd_->OsReadAt(p_page->p_image_.data(), page_size_,
+                           (page_number - 1) * page_size_);
+      }
+    }
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    p_page = p_next_page;
+  }
+  return ResultCode::kOk;
+}
+
+// SqlitePagerWrite in WAL mode: there is nothing to journal
+ResultCode Pager::SqlitePagerPrivateWalWrite(BasePage *p_page) {
+  if (lock_state_ != SqliteLockState::K_SQLITE_WRITE_LOCK) {
+    ResultCode rc = SqlitePagerPrivateWalBegin();
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+  }
+  p_page->p_header_->is_dirty_ = true;
+  p_page->PrivatizeImage(page_size_);
+  is_dirty_ = true;
+  if (num_database_size_ < (int)p_page->p_header_->page_number_) {
+    num_database_size_ = p_page->p_header_->page_number_;
+  }
+  return ResultCode::kOk;
+}
+
+/**
+ * Writes dirty pages that have to leave the cache before the commit to the
+ * log as uncommitted frames, so that the database file stays untouched.
+ */
+ResultCode Pager::SqlitePagerPrivateWalSpill(std::vector<BasePage *> &pages) {
+  std::vector<std::pair<PageNumber, const std::byte *>> frames;
+  for (BasePage *p_page : pages) {
+    frames.emplace_back(p_page->p_header_->page_number_,
+                        p_page->p_image_.data());
+  }
+  return SqlitePagerPrivateWalAppendFrames(frames, 0);
+}
+
+/**
+ * SqlitePagerCommit in WAL mode: appends the dirty pages with a commit frame
+ * and syncs the log once. If every change was spilled already, the last
+ * spilled frame is written again to carry the commit. With group commit on,
+ * the sync is left to the group commit thread: on_durable is queued for it
+ * and is_queued is set. The checkpointer only learns of the frames once they
+ * are synced.
+ */
+ResultCode Pager::SqlitePagerPrivateWalCommit(const CommitCallback &on_durable,
+                                              bool &is_queued) {
+  std::vector<std::pair<PageNumber, const std::byte *>> frames;
+  for (BasePage *cur_page = p_all_page_first_; cur_page != nullptr;
+       cur_page = cur_page->p_header_->p_next_all_) {
+    if (cur_page->p_header_->is_dirty_) {
+      frames.emplace_back(cur_page->p_header_->page_number_,
+                          cur_page->p_image_.data());
+    }
+  }
+  if (frames.empty() && wal_num_pending_frames_ == 0) {
+    SqlitePagerPrivateWalEndWrite();
+    num_database_size_ = -1;
+    return ResultCode::kOk;
+  }
+
+  ResultCode rc = ResultCode::kOk;
+  std::vector<std::byte> last_image(page_size_);
+  if (frames.empty()) {
+    u32 last_frame = wal_num_frames_ + wal_num_pending_frames_ - 1;
+    for (auto &[page_number, frame] : wal_pending_index_) {
+      if (frame == last_frame) {
+        frames.emplace_back(page_number, last_image.data());
+        rc = SqlitePagerPrivateWalReadFrame(page_number, frame,
+                                            last_image.data());
+      }
+    }
+  }
+  if (num_database_size_ < 0) {
+    SqlitePagerPageCount();
+  }
+  if (rc == ResultCode::kOk) {
+    rc = SqlitePagerPrivateWalAppendFrames(frames, num_database_size_);
+  }
+  bool is_grouped =
+      is_journal_sync_allowed_ && group_commit_window_.count() > 0;
+  if (rc == ResultCode::kOk && is_journal_sync_allowed_ && !is_grouped) {
+    rc = wal_fd_->OsSync();
+    num_wal_syncs_++;
+  }
+  if (rc != ResultCode::kOk) {
+    SqlitePagerPrivateWalRollback();
+    return rc;
+  }
+
+  for (auto &[page_number, frame] : wal_pending_index_) {
+    wal_index_[page_number] = frame;
+  }
+  wal_pending_index_.clear();
+  wal_num_frames_ += wal_num_pending_frames_;
+  wal_num_pending_frames_ = 0;
+  wal_db_size_ = num_database_size_;
+  num_wal_commits_++;
+  {
+    std::lock_guard<std::mutex> marks_lock(wal_read_marks_->mutex_);
+    SqlitePagerPrivateWalSetReadMark();
+  }
+  for (BasePage *cur_page = p_all_page_first_; cur_page != nullptr;
+       cur_page = cur_page->p_header_->p_next_all_) {
+    cur_page->p_header_->is_dirty_ = false;
+  }
+  SqlitePagerPrivateWalEndWrite();
+  num_database_size_ = -1;
+  if (!is_grouped) {
+    SqlitePagerPrivateWalSetSynced(wal_salt_, wal_num_frames_);
+    SqlitePagerPrivateWalScheduleCheckpoint();
+    return ResultCode::kOk;
+  }
+
+  // the commit is visible from here on, but only durable after the sync
+  wal_group_commit_->Enqueue({this, wal_salt_, wal_num_frames_, on_durable},
+                             group_commit_window_);
+  is_queued = true;
+  return ResultCode::kOk;
+}
+
+/**
+ * Lets commits in WAL mode share syncs of the log. A commit appends its frames
+ * and returns without syncing; the first commit of a group starts a window,
+ * and when it closes one sync makes every commit of the group durable. The
+ * group takes in the commits every pager of this process makes to the same
+ * log in the meantime (see WalGroupCommit), with whatever window each of them
+ * was given. Each commit learns its outcome through the callback given to
+ * SqlitePagerCommit(const CommitCallback &), while SqlitePagerCommit() waits
+ * for it. A zero window (the default) syncs every commit on its own, as does
+ * the rollback journal, where group commit has no effect.
+ *
+ * A commit is visible to readers as soon as it is appended, before it is
+ * durable. Must not be called inside a write transaction (kMisuse).
+ */
+ResultCode Pager::SqlitePagerSetGroupCommit(std::chrono::microseconds window) {
+  if (lock_state_ == SqliteLockState::K_SQLITE_WRITE_LOCK ||
+      window.count() < 0) {
+    return ResultCode::kMisuse;
+  }
+  if (window.count() == 0) {
+    // the commits still waiting are synced now
+    SqlitePagerPrivateStopGroupCommit();
+  }
+  group_commit_window_ = window;
+  return ResultCode::kOk;
+}
+
+// Syncs the commits of this pager still waiting for their group
+void Pager::SqlitePagerPrivateStopGroupCommit() {
+  if (wal_group_commit_ != nullptr) {
+    wal_group_commit_->Flush(this);
+  }
+}
+
+/**
+ * SqlitePagerRollback in WAL mode. Every cached page the transaction changed,
+ * including the spilled ones, gets its committed image back, and the frames
+ * written after the last commit are cut off the log.
+ */
+ResultCode Pager::SqlitePagerPrivateWalRollback() {
+  ResultCode rc = ResultCode::kOk;
+  u32 committed_size = wal_db_size_;
+  if (committed_size == 0) {
+    u32 file_size = 0;
+    fd_->OsFileSize(file_size);
+    committed_size = file_size / page_size_;
+  }
+  for (BasePage *cur_page = p_all_page_first_; cur_page != nullptr;
+       cur_page = cur_page->p_header_->p_next_all_) {
+    PageHeader *p_header = cur_page->p_header_.get();
+    if (!p_header->is_dirty_ &&
+        wal_pending_index_.count(p_header->page_number_) == 0) {
+      continue;
+    }
+    cur_page->PrivatizeImage(page_size_);
+    ResultCode page_rc = ResultCode::kOk;
+    auto it = wal_index_.find(p_header->page_number_);
+    if (it != wal_index_.end()) {
+      page_rc = SqlitePagerPrivateWalReadFrame(
+          p_header->page_number_, it->second, cur_page->p_image_.data());
+    } else if (p_header->page_number_ <= committed_size) {
+      page_rc = fd_->OsReadAt(cur_page->p_image_.data(), page_size_,
+                              (p_header->page_number_ - 1) * page_size_);
+    } else {
+      std::fill(cur_page->p_image_.begin(), cur_page->p_image_.end(),
+                std::byte{0});
+    }
+    if (page_rc != ResultCode::kOk) {
+      rc = page_rc;
+    }
+    p_header->is_dirty_ = false;
+  }
+  wal_pending_index_.clear();
+  wal_num_pending_frames_ = 0;
+  wal_fd_->OsTruncate(WalFrameOffset(wal_num_frames_, page_size_));
+  SqlitePagerPrivateWalEndWrite();
+  num_database_size_ = -1;
+  return rc;
+}
+
+void Pager::SqlitePagerPrivateWalEndWrite() {
+  wal_fd_->OsUnlock();
+  lock_state_ = SqliteLockState::K_SQLITE_READ_LOCK;
+  is_dirty_ = false;
+}
+
+/**
+ * Starts the log over once every committed frame is in the database file.
+ * The new salt makes any frame left from the old log invalid. Called with the
+ * mutex of wal_read_marks_ held.
+ */
+ResultCode Pager::SqlitePagerPrivateWalRestart() {
+  ResultCode rc = WalWriteHeader(*wal_fd_, wal_salt_ + 1, page_size_);
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  wal_salt_++;
+  wal_index_.clear();
+  wal_num_frames_ = 0;
+  wal_db_size_ = 0;
+  {
+    std::lock_guard<std::mutex> lock(wal_checkpoint_mutex_);
+    wal_checkpoint_salt_ = wal_salt_;
+    wal_num_synced_frames_ = 0;
+    wal_num_checkpointed_frames_ = 0;
+  }
+  // images prefetched from the file before the checkpoint wrote it are stale
+  SqlitePagerPrivateDropPrefetched();
+  if (lock_state_ != SqliteLockState::K_SQLITE_UNLOCK) {
+    SqlitePagerPrivateWalSetReadMark();
+  }
+  return ResultCode::kOk;
+}
+
+/**
+ * Copies the committed frames that every reader sees into the database file,
+ * syncing the log first if they are not all durable. If that was every frame
+ * and no other pager reads the log, the log is started over and is_done is
+ * set. Called with the writer lock on the log held.
+ */
+ResultCode Pager::SqlitePagerPrivateWalBackfill(bool &is_done) {
+  is_done = false;
+  u32 first_frame, num_synced_frames;
+  {
+    std::lock_guard<std::mutex> lock(wal_checkpoint_mutex_);
+    first_frame = wal_num_checkpointed_frames_;
+    num_synced_frames = wal_num_synced_frames_;
+  }
+  u32 num_read_frames, min_db_size;
+  {
+    std::lock_guard<std::mutex> marks_lock(wal_read_marks_->mutex_);
+    wal_read_marks_->GetCheckpointLimit(wal_salt_, num_read_frames,
+                                        min_db_size);
+  }
+  u32 num_frames = std::min(wal_num_frames_, num_read_frames);
+  ResultCode rc = ResultCode::kOk;
+  if (num_frames > first_frame) {
+    if (num_frames > num_synced_frames) {
+      rc = SqlitePagerPrivateWalSyncAll();
+    }
+    if (rc == ResultCode::kOk) {
+      rc = SqlitePagerPrivateWalCopyFrames(wal_salt_, first_frame, num_frames,
+                                           min_db_size);
+    }
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    std::lock_guard<std::mutex> lock(wal_checkpoint_mutex_);
+    wal_num_checkpointed_frames_ = num_frames;
+  }
+  if (std::max(first_frame, num_frames) < wal_num_frames_) {
+    return ResultCode::kOk;
+  }
+  std::lock_guard<std::mutex> marks_lock(wal_read_marks_->mutex_);
+  if (wal_read_marks_->IsReadByOthers(this, wal_salt_)) {
+    return ResultCode::kOk;
+  }
+  rc = SqlitePagerPrivateWalRestart();
+  is_done = rc == ResultCode::kOk;
+  return rc;
+}
+
+/**
+ * Copies frames first_frame up to num_frames of the log with the given salt
+ * into the database file: the latest frame of each page in the range, in page
+ * number order. The file is then grown to the size recorded by the commit
+ * frame num_frames - 1, or cut to it but not below min_db_size, the largest
+ * size a reader still sees, and synced. Only touches the two file
+ * descriptors, so it can run on the checkpoint thread; kBusy means the log was
+ * started over meanwhile.
+ */
+ResultCode Pager::SqlitePagerPrivateWalCopyFrames(u32 salt, u32 first_frame,
+                                                  u32 num_frames,
+                                                  u32 min_db_size) {
+  if (first_frame >= num_frames) {
+    return ResultCode::kOk;
+  }
+  // Step 1: Find the latest frame of every page from the frame headers
+  u32 frame_size = SqlitePagerPrivateWalFrameSize();
+  std::vector<std::byte> frame_buffer(frame_size);
+  std::unordered_map<PageNumber, u32> latest_frames;
+  u32 db_size = 0;
+  for (u32 frame = first_frame; frame < num_frames; frame++) {
+    ResultCode rc = wal_fd_->OsReadAt(frame_buffer, sizeof(WalFrameHeader),
+                                      WalFrameOffset(frame, page_size_));
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    WalFrameHeader frame_header{};
+    std::memcpy(&frame_header, frame_buffer.data(), sizeof(WalFrameHeader));
+    if (frame_header.salt != salt) {
+      return ResultCode::kBusy;
+    }
+    latest_frames[frame_header.page_number] = frame;
+    db_size = frame_header.commit_size;
+  }
+
+  // Step 2: Copy their images into the file
+  std::vector<std::pair<PageNumber, u32>> sorted_frames(latest_frames.begin(),
+                                                        latest_frames.end());
+  std::sort(sorted_frames.begin(), sorted_frames.end());
+  for (auto &[page_number, frame] : sorted_frames) {
+    ResultCode rc = wal_fd_->OsReadAt(frame_buffer, frame_size,
+                                      WalFrameOffset(frame, page_size_));
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    WalFrameHeader frame_header{};
+    std::memcpy(&frame_header, frame_buffer.data(), sizeof(WalFrameHeader));
+    if (frame_header.salt != salt || frame_header.page_number != page_number) {
+      return ResultCode::kBusy;
+    }
+    rc = fd_->OsWriteAt(frame_buffer.data() + sizeof(WalFrameHeader),
+                        page_size_, (page_number - 1) * page_size_);
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+  }
+
+  // Step 3: Give the file the size of the last commit and sync it
+  u32 file_size = 0;
+  ResultCode rc = fd_->OsFileSize(file_size);
+  db_size = std::max(db_size, std::min(file_size / page_size_, min_db_size));
+  if (rc == ResultCode::kOk && db_size != 0 &&
+      file_size != db_size * page_size_) {
+    rc = fd_->OsTruncate(db_size * page_size_);
+  }
+  if (rc != ResultCode::kOk) {
+    return rc;
+  }
+  return fd_->OsSync();
+}
+
+/**
+ * Syncs the log unless every committed frame is known to be durable already,
+ * so that a checkpoint never copies a frame that a crash could still take
+ * back. Called with the writer lock on the log held.
+ */
+ResultCode Pager::SqlitePagerPrivateWalSyncAll() {
+  {
+    std::lock_guard<std::mutex> lock(wal_checkpoint_mutex_);
+    if (wal_checkpoint_salt_ == wal_salt_ &&
+        wal_num_synced_frames_ >= wal_num_frames_) {
+      return ResultCode::kOk;
+    }
+  }
+  if (is_journal_sync_allowed_) {
+    ResultCode rc = wal_fd_->OsSync();
+    if (rc != ResultCode::kOk) {
+      return rc;
+    }
+    num_wal_syncs_++;
+  }
+  SqlitePagerPrivateWalSetSynced(wal_salt_, wal_num_frames_);
+  return ResultCode::kOk;
+}
+
+// Records that the first num_frames frames of the log with the given salt are
+// durable; a sync of a log that was started over since tells nothing
+void Pager::SqlitePagerPrivateWalSetSynced(u32 salt, u32 num_frames) {
+  std::lock_guard<std::mutex> lock(wal_checkpoint_mutex_);
+  if (salt == wal_checkpoint_salt_ && num_frames > wal_num_synced_frames_) {
+    wal_num_synced_frames_ = num_frames;
+  }
+}
+
+// Hands the synced frames that are not in the database file yet, up to the
+// oldest snapshot a reader still reads, to the checkpoint thread once enough
+// piled up. A reader that takes its snapshot later sees all of them.
+void Pager::SqlitePagerPrivateWalScheduleCheckpoint() {
+  u32 salt;
+  {
+    std::lock_guard<std::mutex> lock(wal_checkpoint_mutex_);
+    if (is_wal_checkpoint_running_ ||
+        wal_num_synced_frames_ - wal_num_checkpointed_frames_ <
+            kWalAutoCheckpointFrames) {
+      return;
+    }
+    salt = wal_checkpoint_salt_;
+  }
+  u32 num_read_frames, min_db_size;
+  {
+    std::lock_guard<std::mutex> marks_lock(wal_read_marks_->mutex_);
+    wal_read_marks_->GetCheckpointLimit(salt, num_read_frames, min_db_size);
+  }
+  std::lock_guard<std::mutex> lock(wal_checkpoint_mutex_);
+  u32 num_frames = std::min(wal_num_synced_frames_, num_read_frames);
+  if (is_wal_checkpoint_running_ || salt != wal_checkpoint_salt_ ||
+      num_frames <= wal_num_checkpointed_frames_) {
+    return;
+  }
+  wal_checkpoint_job_salt_ = salt;
+  wal_checkpoint_job_first_frame_ = wal_num_checkpointed_frames_;
+  wal_checkpoint_job_frames_ = num_frames;
+  wal_checkpoint_job_min_db_size_ = min_db_size;
+  has_wal_checkpoint_job_ = true;
+  is_wal_checkpoint_running_ = true;
+  if (!wal_checkpoint_thread_.joinable()) {
+    wal_checkpoint_thread_ =
+        std::thread(&Pager::SqlitePagerPrivateWalCheckpointLoop, this);
+  }
+  wal_checkpoint_cv_.notify_all();
+}
+
+void Pager::SqlitePagerPrivateWalWaitCheckpoint() {
+  std::unique_lock<std::mutex> lock(wal_checkpoint_mutex_);
+  wal_checkpoint_cv_.wait(lock, [this] { return !is_wal_checkpoint_running_; });
+}
+
+/**
+ * Body of the checkpoint thread. A job only covers frames that were synced
+ * when it was handed over; the log is not restarted while a job runs, so the
+ * frames cannot move under it.
+ */
+void Pager::SqlitePagerPrivateWalCheckpointLoop() {
+  std::unique_lock<std::mutex> lock(wal_checkpoint_mutex_);
+  while (true) {
+    wal_checkpoint_cv_.wait(lock, [this] {
+      return is_wal_checkpoint_stopping_ || has_wal_checkpoint_job_;
+    });
+    if (!has_wal_checkpoint_job_) {
+      return;
+    }
+    has_wal_checkpoint_job_ = false;
+    u32 salt = wal_checkpoint_job_salt_;
+    u32 first_frame = wal_checkpoint_job_first_frame_;
+    u32 num_frames = wal_checkpoint_job_frames_;
+    u32 min_db_size = wal_checkpoint_job_min_db_size_;
+    lock.unlock();
+    ResultCode rc = SqlitePagerPrivateWalCopyFrames(salt, first_frame,
+                                                    num_frames, min_db_size);
+    lock.lock();
+    if (rc == ResultCode::kOk && salt == wal_checkpoint_salt_) {
+      wal_num_checkpointed_frames_ = num_frames;
+    }
+    is_wal_checkpoint_running_ = false;
+    wal_checkpoint_cv_.notify_all();
+  }
+}
+
+void Pager::SqlitePagerPrivateWalStopCheckpoint() {
+  if (!wal_checkpoint_thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(wal_checkpoint_mutex_);
+    is_wal_checkpoint_stopping_ = true;
+  }
+  wal_checkpoint_cv_.notify_all();
+  wal_checkpoint_thread_.join();
+  is_wal_checkpoint_stopping_ = false;
+}
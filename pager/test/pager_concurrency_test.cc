@@ -1,3 +1,4 @@
+#include <atomic>
 #include <cmath>
 #include <mutex>
 #include <thread>
@@ -14,7 +15,7 @@ void concurrentAccessRead(int num) {
   BasePage *p_base_page = nullptr;
   ResultCode rc = pager.SqlitePagerGet(1, &p_base_page, SampleMemPage::create);
   EXPECT_EQ(rc, ResultCode::kOk);
-  EXPECT_EQ(std::memcmp(p_base_page->p_image_->data(), &num, sizeof(int)), 0);
+  EXPECT_EQ(std::memcmp(p_base_page->p_image_.data(), &num, sizeof(int)), 0);
 }
 
 TEST(PagerConcurrencyTest, HandlesConcurrentAccess) {
@@ -30,7 +31,7 @@ TEST(PagerConcurrencyTest, HandlesConcurrentAccess) {
   int num = 100;
   ASSERT_EQ(rc, ResultCode::kOk);
   ASSERT_NE(p_base_page, nullptr);
-  std::memcpy(p_base_page->p_image_->data(), &num, sizeof(int));
+  std::memcpy(p_base_page->p_image_.data(), &num, sizeof(int));
   rc = pager.SqlitePagerWrite(p_base_page);
   rc = pager.SqlitePagerCommit();
 
@@ -57,15 +58,15 @@ void readPage() {
   }
   // rc = global_pager->SqlitePagerGet(1, &p_base_page, SampleMemPage::create);
   // EXPECT_EQ(rc, ResultCode::kOk); // kBusy
-  EXPECT_NE(p_base_page->p_image_, nullptr);
+  EXPECT_NE(p_base_page->p_image_.data(), nullptr);
   int result1;
-  std::memcpy(&result1, p_base_page->p_image_->data(), sizeof(int));
+  std::memcpy(&result1, p_base_page->p_image_.data(), sizeof(int));
 
   rc = global_pager->SqlitePagerGet(2, &p_base_page, SampleMemPage::create);
   EXPECT_EQ(rc, ResultCode::kOk);
-  EXPECT_NE(p_base_page->p_image_, nullptr);
+  EXPECT_NE(p_base_page->p_image_.data(), nullptr);
   int result2;
-  std::memcpy(&result2, p_base_page->p_image_->data(), sizeof(int));
+  std::memcpy(&result2, p_base_page->p_image_.data(), sizeof(int));
   EXPECT_TRUE(std::isfinite(result1 + result2));
 }
 
@@ -77,21 +78,21 @@ void writePage() {
 
   rc = global_pager->SqlitePagerGet(1, &p_base_page, SampleMemPage::create);
   EXPECT_EQ(rc, ResultCode::kOk);  // kOk
-  EXPECT_NE(p_base_page->p_image_, nullptr);
+  EXPECT_NE(p_base_page->p_image_.data(), nullptr);
   int num1;
-  std::memcpy(&num1, p_base_page->p_image_->data(), sizeof(int));
+  std::memcpy(&num1, p_base_page->p_image_.data(), sizeof(int));
   num1 += 50;
-  std::memcpy(p_base_page->p_image_->data(), &num1, sizeof(int));
+  std::memcpy(p_base_page->p_image_.data(), &num1, sizeof(int));
   rc = global_pager->SqlitePagerWrite(p_base_page);
   EXPECT_EQ(rc, ResultCode::kOk);  // kBusy
 
   rc = global_pager->SqlitePagerGet(2, &p_base_page, SampleMemPage::create);
   EXPECT_EQ(rc, ResultCode::kOk);  // kOk
-  EXPECT_NE(p_base_page->p_image_, nullptr);
+  EXPECT_NE(p_base_page->p_image_.data(), nullptr);
   int num2;
-  std::memcpy(&num2, p_base_page->p_image_->data(), sizeof(int));
+  std::memcpy(&num2, p_base_page->p_image_.data(), sizeof(int));
   num2 -= 50;
-  std::memcpy(p_base_page->p_image_->data(), &num2, sizeof(int));
+  std::memcpy(p_base_page->p_image_.data(), &num2, sizeof(int));
   rc = global_pager->SqlitePagerWrite(p_base_page);
   EXPECT_EQ(rc, ResultCode::kOk);  // kBusy
 
@@ -112,7 +113,7 @@ TEST(PagerConcurrencyTest, HandlesConcurrentReadWrite) {
   int num1 = 100;
   ASSERT_EQ(rc, ResultCode::kOk);
   ASSERT_NE(p_base_page, nullptr);
-  std::memcpy(p_base_page->p_image_->data(), &num1, sizeof(int));
+  std::memcpy(p_base_page->p_image_.data(), &num1, sizeof(int));
   rc = global_pager->SqlitePagerWrite(p_base_page);
 
   // Initialize the second page with 200
@@ -120,7 +121,7 @@ TEST(PagerConcurrencyTest, HandlesConcurrentReadWrite) {
   int num2 = 200;
   ASSERT_EQ(rc, ResultCode::kOk);
   ASSERT_NE(p_base_page, nullptr);
-  std::memcpy(p_base_page->p_image_->data(), &num2, sizeof(int));
+  std::memcpy(p_base_page->p_image_.data(), &num2, sizeof(int));
   rc = global_pager->SqlitePagerWrite(p_base_page);
 
   rc = global_pager->SqlitePagerCommit();
@@ -140,4 +141,63 @@ TEST(PagerConcurrencyTest, HandlesConcurrentReadWrite) {
   // clear global page
   delete global_pager;
   global_pager = nullptr;
-}
\ No newline at end of file
+}
+// Every thread reads all pages of one shared pager and checks their contents
+void sharedPagerRead(Pager *p_pager, PageNumber num_pages, int rounds,
+                     std::atomic<int> *p_num_errors) {
+  for (int round = 0; round < rounds; round++) {
+    for (PageNumber page_number = 1; page_number <= num_pages; page_number++) {
+      BasePage *p_base_page = nullptr;
+      if (p_pager->SqlitePagerGet(page_number, &p_base_page,
+                                  SampleMemPage::create) != ResultCode::kOk) {
+        (*p_num_errors)++;
+        continue;
+      }
+      PageNumber stored = 0;
+      std::memcpy(&stored, p_base_page->p_image_.data(), sizeof(stored));
+      if (stored != page_number) {
+        (*p_num_errors)++;
+      }
+      p_pager->SqlitePagerUnref(p_base_page);
+    }
+  }
+}
+
+TEST(PagerConcurrencyTest, SharedPagerConcurrentReaders) {
+  std::string filename = "test_SharedPagerConcurrentReaders.db";
+  std::remove(filename.c_str());
+  const PageNumber num_pages = 64;
+  const int num_threads = 8, rounds = 20;
+  Pager pager(filename, 16);
+  ASSERT_EQ(pager.SqlitePagerSetConcurrent(8), ResultCode::kOk);
+
+  BasePage *p_base_page = nullptr;
+  for (PageNumber page_number = 1; page_number <= num_pages; page_number++) {
+    ASSERT_EQ(pager.SqlitePagerGet(page_number, &p_base_page,
+                                   SampleMemPage::create),
+              ResultCode::kOk);
+    ASSERT_EQ(pager.SqlitePagerWrite(p_base_page), ResultCode::kOk);
+    std::memcpy(p_base_page->p_image_.data(), &page_number,
+                sizeof(page_number));
+    pager.SqlitePagerUnref(p_base_page);
+  }
+  ASSERT_EQ(pager.SqlitePagerCommit(), ResultCode::kOk);
+  // switching modes once pages are cached is refused
+  EXPECT_EQ(pager.SqlitePagerSetConcurrent(4), ResultCode::kMisuse);
+
+  std::atomic<int> num_errors{0};
+  u32 num_accesses_before =
+      pager.num_pages_hit_ + pager.num_pages_miss_;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back(sharedPagerRead, &pager, num_pages, rounds,
+                         &num_errors);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(num_errors, 0);
+  EXPECT_EQ(pager.num_pages_hit_ + pager.num_pages_miss_ - num_accesses_before,
+            num_threads * rounds * num_pages);
+  EXPECT_EQ(pager.num_mem_pages_ref_positive_, 0);
+}
@@ -5,6 +5,7 @@
 #include "pager.h"
 
 #include <fstream>
+#include <map>
 #include <ostream>
 
 #include "gtest/gtest.h"
@@ -69,7 +70,7 @@ TEST(PagerFullTest, ExampleFromSimpleSqlite) {
   EXPECT_EQ(ResultCode::kOk, rc);
   rc = pager.SqlitePagerWrite(p_base_page);
   EXPECT_EQ(ResultCode::kOk, rc);
-  std::memcpy(p_base_page->p_image_->data(), str_1.data(), str_1.size());
+  std::memcpy(p_base_page->p_image_.data(), str_1.data(), str_1.size());
   rc = pager.SqlitePagerCommit();
   EXPECT_EQ(ResultCode::kOk, rc);
 
@@ -81,7 +82,7 @@ TEST(PagerFullTest, ExampleFromSimpleSqlite) {
   EXPECT_EQ(ResultCode::kOk, rc);
   rc = pager.SqlitePagerWrite(p_base_page);
   EXPECT_EQ(ResultCode::kOk, rc);
-  std::memcpy(p_base_page->p_image_->data(), str_2.data(), str_2.size());
+  std::memcpy(p_base_page->p_image_.data(), str_2.data(), str_2.size());
   rc = pager.SqlitePagerCommit();
   EXPECT_EQ(ResultCode::kOk, rc);
 
@@ -94,7 +95,7 @@ TEST(PagerFullTest, ExampleFromSimpleSqlite) {
   EXPECT_EQ(ResultCode::kOk, rc);
   rc = pager.SqlitePagerWrite(p_base_page);
   EXPECT_EQ(ResultCode::kOk, rc);
-  std::memcpy(p_base_page->p_image_->data(), str_3.data(), str_3.size());
+  std::memcpy(p_base_page->p_image_.data(), str_3.data(), str_3.size());
   rc = pager.SqlitePagerCommit();
   EXPECT_EQ(ResultCode::kOk, rc);
 
@@ -102,19 +103,19 @@ TEST(PagerFullTest, ExampleFromSimpleSqlite) {
   rc = pager.SqlitePagerGet(1, &p_base_page, SampleMemPage::create);
   EXPECT_EQ(ResultCode::kOk, rc);
   EXPECT_EQ(
-      std::memcmp(p_base_page->p_image_->data(), str_1.data(), str_1.size()),
+      std::memcmp(p_base_page->p_image_.data(), str_1.data(), str_1.size()),
       0);
 
   rc = pager.SqlitePagerGet(2, &p_base_page, SampleMemPage::create);
   EXPECT_EQ(ResultCode::kOk, rc);
   EXPECT_EQ(
-      std::memcmp(p_base_page->p_image_->data(), str_2.data(), str_2.size()),
+      std::memcmp(p_base_page->p_image_.data(), str_2.data(), str_2.size()),
       0);
 
   rc = pager.SqlitePagerGet(3, &p_base_page, SampleMemPage::create);
   EXPECT_EQ(ResultCode::kOk, rc);
   EXPECT_EQ(
-      std::memcmp(p_base_page->p_image_->data(), str_3.data(), str_3.size()),
+      std::memcmp(p_base_page->p_image_.data(), str_3.data(), str_3.size()),
       0);
 
   // Step 4: Write data into the third page and rollback to the previous state
@@ -132,7 +133,7 @@ TEST(PagerFullTest, ExampleFromSimpleSqlite) {
   EXPECT_EQ(ResultCode::kOk, rc);
   rc = pager.SqlitePagerWrite(p_base_page);
   EXPECT_EQ(ResultCode::kOk, rc);
-  std::memcpy(p_base_page->p_image_->data(), str_4.data(), str_4.size());
+  std::memcpy(p_base_page->p_image_.data(), str_4.data(), str_4.size());
 
   // Rollback changes to the previous state
   rc = pager.SqlitePagerRollback();
@@ -143,10 +144,10 @@ TEST(PagerFullTest, ExampleFromSimpleSqlite) {
 
   // Read the value and expect it to be "Page 3"
   EXPECT_EQ(
-      std::memcmp(p_base_page->p_image_->data(), str_3.data(), str_3.size()),
+      std::memcmp(p_base_page->p_image_.data(), str_3.data(), str_3.size()),
       0);
   EXPECT_NE(
-      std::memcmp(p_base_page->p_image_->data(), str_4.data(), str_4.size()),
+      std::memcmp(p_base_page->p_image_.data(), str_4.data(), str_4.size()),
       0);
 
   // Step 5: Check that the page count is 3
@@ -208,8 +209,8 @@ TEST(PagerGetTest, BasicPageFetch) {
   EXPECT_EQ(pager.SqlitePagerPageNumber(p_page), 1);
 
   // Check the content of the newly created page (should be zero-initialized)
-  std::vector<std::byte> expected_content(1024, std::byte(0));
-  EXPECT_EQ(std::memcmp(p_page->p_image_->data(), expected_content.data(),
+  std::vector<std::byte> expected_content(kDefaultPageSize, std::byte(0));
+  EXPECT_EQ(std::memcmp(p_page->p_image_.data(), expected_content.data(),
                         expected_content.size()),
             0);
 }
@@ -273,7 +274,7 @@ TEST(PagerJournalTest, SequentialWritesAndCommit) {
 
     // Fill page with data
     std::vector<std::byte> data(1024, std::byte(i));
-    std::memcpy(p_base_page->p_image_->data(), data.data(), data.size());
+    std::memcpy(p_base_page->p_image_.data(), data.data(), data.size());
   }
 
   // Commit transaction
@@ -286,7 +287,7 @@ TEST(PagerJournalTest, SequentialWritesAndCommit) {
     EXPECT_EQ(rc, ResultCode::kOk);
     ASSERT_NE(p_base_page, nullptr);
     std::vector<std::byte> expected_data(1024, std::byte(i));
-    EXPECT_EQ(std::memcmp(p_base_page->p_image_->data(), expected_data.data(),
+    EXPECT_EQ(std::memcmp(p_base_page->p_image_.data(), expected_data.data(),
                           expected_data.size()),
               0);
   }
@@ -314,11 +315,11 @@ TEST(PagerWriteTest, WriteWithoutCommit) {
 
   // Fill page with data
   std::vector<std::byte> data(1024, std::byte(42));
-  std::memcpy(p_page->p_image_->data(), data.data(), data.size());
+  std::memcpy(p_page->p_image_.data(), data.data(), data.size());
 
   // Verify changes in memory
   std::vector<std::byte> expected_data(1024, std::byte(42));
-  EXPECT_EQ(std::memcmp(p_page->p_image_->data(), expected_data.data(),
+  EXPECT_EQ(std::memcmp(p_page->p_image_.data(), expected_data.data(),
                         expected_data.size()),
             0)
       << "CHECKPOINT 3: Unexpected memory content before commit\n";
@@ -337,8 +338,841 @@ TEST(PagerWriteTest, WriteWithoutCommit) {
       << "CHECKPOINT 5: Unexpected result in reloaded SqlitePagerGet\n";
 
   // Verify that reloaded page contains the same data
-  EXPECT_EQ(std::memcmp(p_page_reloaded->p_image_->data(), expected_data.data(),
+  EXPECT_EQ(std::memcmp(p_page_reloaded->p_image_.data(), expected_data.data(),
                         expected_data.size()),
             0)
       << "CHECKPOINT 6: Data mismatch after commit and reload\n";
 }
+
+// Dirty pages are flushed in page-number order, and adjacent pages share one
+// vectored write at commit time.
+TEST(PagerCommitTest, CoalescesAdjacentDirtyPages) {
+  std::string filename = "test_CoalescesAdjacentDirtyPages.db";
+  std::remove(filename.c_str());
+  std::remove("test_CoalescesAdjacentDirtyPages.db-journal");
+  Pager pager(filename, 10, EvictionPolicy::FIRST_NON_DIRTY);
+  BasePage *p_base_page = nullptr;
+  ResultCode rc;
+
+  // Two runs of adjacent pages, {1, 2, 3} and {6, 7}. The list of all pages
+  // keeps them newest first, so the flush has to sort them.
+  for (PageNumber page_number : {1, 2, 3, 6, 7}) {
+    rc = pager.SqlitePagerGet(page_number, &p_base_page,
+                              SampleMemPage::create);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    ASSERT_NE(p_base_page, nullptr);
+    rc = pager.SqlitePagerWrite(p_base_page);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::memset(p_base_page->p_image_.data(), (int)page_number,
+                kDefaultPageSize);
+  }
+
+  rc = pager.SqlitePagerCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(pager.num_pages_flushed_, 5);
+  EXPECT_EQ(pager.num_flush_syscalls_, 2);
+  EXPECT_EQ(pager.SqlitePagerFlushSyscallsSaved(), 3);
+
+  // Every page lands at its own offset, including the hole at pages 4 and 5
+  Pager pager_reloaded(filename, 10, EvictionPolicy::FIRST_NON_DIRTY);
+  EXPECT_EQ(pager_reloaded.SqlitePagerPageCount(), 7);
+  for (PageNumber page_number : {1, 2, 3, 4, 5, 6, 7}) {
+    rc = pager_reloaded.SqlitePagerGet(page_number, &p_base_page,
+                                       SampleMemPage::create);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::byte expected = (page_number == 4 || page_number == 5)
+                             ? std::byte{0}
+                             : std::byte(page_number);
+    EXPECT_EQ(p_base_page->p_image_[0], expected);
+    EXPECT_EQ(p_base_page->p_image_[kDefaultPageSize - 1], expected);
+  }
+}
+
+// A page below the database size that the file does not reach yet, because
+// only pages after it have been written so far, reads as zeros.
+TEST(PagerGetTest, ReadsPagesPastTheFileEndAsZeros) {
+  std::string filename = "test_ReadsPagesPastTheFileEndAsZeros.db";
+  std::remove(filename.c_str());
+  std::remove("test_ReadsPagesPastTheFileEndAsZeros.db-journal");
+  Pager pager(filename, 10, EvictionPolicy::FIRST_NON_DIRTY);
+  BasePage *p_base_page = nullptr;
+  ResultCode rc;
+
+  // The pages stay referenced, so that the transaction stays open
+  for (PageNumber page_number : {1, 6}) {
+    rc = pager.SqlitePagerGet(page_number, &p_base_page,
+                              SampleMemPage::create);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    ASSERT_NE(p_base_page, nullptr);
+    rc = pager.SqlitePagerWrite(p_base_page);
+    EXPECT_EQ(rc, ResultCode::kOk);
+    std::memset(p_base_page->p_image_.data(), (int)page_number,
+                kDefaultPageSize);
+  }
+  EXPECT_EQ(pager.SqlitePagerPageCount(), 6);
+
+  rc = pager.SqlitePagerGet(4, &p_base_page, SampleMemPage::create);
+  EXPECT_EQ(rc, ResultCode::kOk);
+  ASSERT_NE(p_base_page, nullptr);
+  EXPECT_EQ(p_base_page->p_image_[0], std::byte{0});
+  EXPECT_EQ(p_base_page->p_image_[kDefaultPageSize - 1], std::byte{0});
+  rc = pager.SqlitePagerCommit();
+  EXPECT_EQ(rc, ResultCode::kOk);
+}
+
+// A truncated database loses its last pages at commit, and gets them back on a
+// rollback. Page 1 stays referenced, so the pager keeps its cache across the
+// transactions.
+TEST(PagerTruncateTest, CutsTheFileAtCommit) {
+  std::string filename = "test_CutsTheFileAtCommit.db";
+  std::remove(filename.c_str());
+  std::remove("test_CutsTheFileAtCommit.db-journal");
+  Pager pager(filename, 10, EvictionPolicy::FIRST_NON_DIRTY);
+  BasePage *p_first_page = nullptr;
+  BasePage *p_base_page = nullptr;
+  ResultCode rc;
+  auto file_size = [&filename]() {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    return static_cast<u32>(file.tellg());
+  };
+
+  rc = pager.SqlitePagerGet(1, &p_first_page, SampleMemPage::create);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  rc = pager.SqlitePagerWrite(p_first_page);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  for (PageNumber page_number = 2; page_number <= 8; page_number++) {
+    rc = pager.SqlitePagerGet(page_number, &p_base_page, SampleMemPage::create);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    rc = pager.SqlitePagerWrite(p_base_page);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    std::memset(p_base_page->p_image_.data(), (int)page_number,
+                kDefaultPageSize);
+    pager.SqlitePagerUnref(p_base_page);
+  }
+  rc = pager.SqlitePagerCommit();
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(file_size(), 8 * kDefaultPageSize);
+
+  // Truncating needs a write transaction
+  EXPECT_EQ(pager.SqlitePagerTruncate(5), ResultCode::kError);
+
+  rc = pager.SqlitePagerWrite(p_first_page);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(pager.SqlitePagerTruncate(9), ResultCode::kMisuse);
+  EXPECT_EQ(pager.SqlitePagerTruncate(5), ResultCode::kOk);
+  EXPECT_EQ(pager.SqlitePagerPageCount(), 5);
+  rc = pager.SqlitePagerRollback();
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(pager.SqlitePagerPageCount(), 8);
+  rc = pager.SqlitePagerGet(7, &p_base_page, SampleMemPage::create);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(p_base_page->p_image_[kDefaultPageSize - 1], std::byte{7});
+  pager.SqlitePagerUnref(p_base_page);
+
+  rc = pager.SqlitePagerWrite(p_first_page);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(pager.SqlitePagerTruncate(5), ResultCode::kOk);
+  rc = pager.SqlitePagerCommit();
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(file_size(), 5 * kDefaultPageSize);
+  EXPECT_EQ(pager.SqlitePagerPageCount(), 5);
+  pager.SqlitePagerUnref(p_first_page);
+}
+
+// In memory-mapped mode clean pages are views into the mapping of the file,
+// and a page only gets a private image once it is written.
+TEST(PagerMemoryMappedTest, ViewsCleanPagesAndCopiesOnWrite) {
+  std::string filename = "test_ViewsCleanPagesAndCopiesOnWrite.db";
+  std::remove(filename.c_str());
+  std::remove("test_ViewsCleanPagesAndCopiesOnWrite.db-journal");
+  BasePage *p_base_page = nullptr;
+  ResultCode rc;
+  constexpr PageNumber kNumPages = 30;
+
+  {
+    Pager pager(filename, 10, EvictionPolicy::FIRST_NON_DIRTY);
+    for (PageNumber page_number = 1; page_number <= kNumPages; page_number++) {
+      rc = pager.SqlitePagerGet(page_number, &p_base_page,
+                                SampleMemPage::create);
+      ASSERT_EQ(rc, ResultCode::kOk);
+      rc = pager.SqlitePagerWrite(p_base_page);
+      ASSERT_EQ(rc, ResultCode::kOk);
+      std::memset(p_base_page->p_image_.data(), (int)page_number,
+                kDefaultPageSize);
+    }
+    rc = pager.SqlitePagerCommit();
+    ASSERT_EQ(rc, ResultCode::kOk);
+  }
+
+  Pager pager(filename, 10, EvictionPolicy::FIRST_NON_DIRTY,
+              PageIoMode::MEMORY_MAPPED);
+  auto is_mapped = [&pager](BasePage *p_page) {
+    auto *p_bytes = p_page->p_image_.data();
+    return p_bytes >= pager.p_map_ && p_bytes < pager.p_map_ + pager.map_size_;
+  };
+
+  // Pages that are referenced cannot be evicted, so reading more pages than
+  // the cache holds grows it, with every clean page a view of the mapping
+  std::vector<BasePage *> pages;
+  for (PageNumber page_number = 1; page_number <= kNumPages; page_number++) {
+    rc = pager.SqlitePagerGet(page_number, &p_base_page, SampleMemPage::create);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    EXPECT_TRUE(is_mapped(p_base_page));
+    EXPECT_EQ(p_base_page->p_image_[0], std::byte(page_number));
+    pages.push_back(p_base_page);
+  }
+  EXPECT_EQ(pager.num_pages_mapped_, kNumPages);
+  EXPECT_EQ(pager.num_pages_overflow_, 0);
+
+  // Writing a page copies it out of the mapping; the file is untouched until
+  // commit
+  rc = pager.SqlitePagerWrite(pages[0]);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_FALSE(is_mapped(pages[0]));
+  EXPECT_EQ(pages[0]->p_image_[0], std::byte(1));
+  std::memset(pages[0]->p_image_.data(), 0x7f, kDefaultPageSize);
+  EXPECT_TRUE(is_mapped(pages[1]));
+
+  rc = pager.SqlitePagerCommit();
+  ASSERT_EQ(rc, ResultCode::kOk);
+
+  Pager pager_reloaded(filename, 10, EvictionPolicy::FIRST_NON_DIRTY);
+  rc = pager_reloaded.SqlitePagerGet(1, &p_base_page, SampleMemPage::create);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(p_base_page->p_image_[kDefaultPageSize - 1], std::byte(0x7f));
+
+  // A rolled back change is undone in the cached page as well
+  rc = pager.SqlitePagerWrite(pages[2]);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  std::memset(pages[2]->p_image_.data(), 0x55, kDefaultPageSize);
+  rc = pager.SqlitePagerRollback();
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(pages[2]->p_image_[0], std::byte(3));
+
+  for (BasePage *p_page : pages) {
+    pager.SqlitePagerUnref(p_page);
+  }
+  EXPECT_EQ(pager.p_map_, nullptr);
+}
+
+// Mapped pages count against the cache size like any other page: once the
+// cache is full, reading one evicts an unreferenced page.
+TEST(PagerMemoryMappedTest, KeepsMappedPagesWithinCacheSize) {
+  std::string filename = "test_KeepsMappedPagesWithinCacheSize.db";
+  std::remove(filename.c_str());
+  std::remove("test_KeepsMappedPagesWithinCacheSize.db-journal");
+  BasePage *p_base_page = nullptr;
+  ResultCode rc;
+  constexpr PageNumber kNumPages = 50;
+
+  // page 1 stays referenced, so the cache is not reset between pages
+  BasePage *p_first_page = nullptr;
+  {
+    Pager pager(filename, 10, EvictionPolicy::FIRST_NON_DIRTY);
+    rc = pager.SqlitePagerGet(1, &p_first_page, SampleMemPage::create);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    for (PageNumber page_number = 1; page_number <= kNumPages; page_number++) {
+      rc = pager.SqlitePagerGet(page_number, &p_base_page,
+                                SampleMemPage::create);
+      ASSERT_EQ(rc, ResultCode::kOk);
+      rc = pager.SqlitePagerWrite(p_base_page);
+      ASSERT_EQ(rc, ResultCode::kOk);
+      std::memset(p_base_page->p_image_.data(), (int)page_number,
+                kDefaultPageSize);
+      pager.SqlitePagerUnref(p_base_page);
+    }
+    rc = pager.SqlitePagerCommit();
+    ASSERT_EQ(rc, ResultCode::kOk);
+    pager.SqlitePagerUnref(p_first_page);
+  }
+
+  Pager pager(filename, 10, EvictionPolicy::LRU, PageIoMode::MEMORY_MAPPED);
+  rc = pager.SqlitePagerGet(1, &p_first_page, SampleMemPage::create);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  for (int round = 0; round < 2; round++) {
+    for (PageNumber page_number = 2; page_number <= kNumPages; page_number++) {
+      rc = pager.SqlitePagerGet(page_number, &p_base_page,
+                                SampleMemPage::create);
+      ASSERT_EQ(rc, ResultCode::kOk);
+      EXPECT_EQ(p_base_page->p_image_[0], std::byte(page_number));
+      pager.SqlitePagerUnref(p_base_page);
+      EXPECT_LE(pager.num_mem_pages_, 10);
+    }
+  }
+  EXPECT_EQ(pager.num_pages_mapped_, 1 + 2 * (kNumPages - 1));
+  EXPECT_GT(pager.num_pages_overflow_, 0);
+  pager.SqlitePagerUnref(p_first_page);
+}
+
+// The page hash table agrees with a reference map under a random mix of
+// inserts, replacements and erases, including erases that shift entries
+// back across the wrap-around of the slot array.
+TEST(PageHashTableTest, MatchesReferenceMap) {
+  PageHashTable table;
+  std::map<PageNumber, BasePage *> reference;
+  std::srand(12345);
+  for (int step = 0; step < 20000; step++) {
+    PageNumber page_number = 1 + std::rand() % 500;
+    if (std::rand() % 3 != 0) {
+      BasePage *p_page = table.Insert(page_number, SampleMemPage::create());
+      reference[page_number] = p_page;
+    } else {
+      table.Erase(page_number);
+      reference.erase(page_number);
+    }
+  }
+  EXPECT_EQ(table.Size(), reference.size());
+  for (PageNumber page_number = 1; page_number <= 500; page_number++) {
+    auto it = reference.find(page_number);
+    BasePage *expected = it == reference.end() ? nullptr : it->second;
+    EXPECT_EQ(table.Find(page_number), expected);
+  }
+  table.Clear();
+  EXPECT_EQ(table.Size(), 0);
+  EXPECT_EQ(table.Find(reference.begin()->first), nullptr);
+}
+
+// With the LRU policy the page evicted is the one released the longest time
+// ago, and using a page again moves it to the back of the line.
+TEST(PagerLruTest, EvictsLeastRecentlyUsedPage) {
+  std::string filename = "test_EvictsLeastRecentlyUsedPage.db";
+  std::remove(filename.c_str());
+  Pager pager(filename, 10, EvictionPolicy::LRU);
+  BasePage *p_pinned = nullptr;
+  BasePage *p_base_page = nullptr;
+  ResultCode rc;
+
+  // Keep one page referenced so that the cache is not reset when every other
+  // page is released
+  rc = pager.SqlitePagerGet(20, &p_pinned, SampleMemPage::create);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  for (PageNumber page_number = 1; page_number <= 9; page_number++) {
+    rc = pager.SqlitePagerGet(page_number, &p_base_page,
+                              SampleMemPage::create);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    pager.SqlitePagerUnref(p_base_page);
+  }
+  EXPECT_EQ(pager.num_mem_pages_, 10);
+
+  // Page 1 is used again, which makes page 2 the least recently used one
+  rc = pager.SqlitePagerGet(1, &p_base_page, SampleMemPage::create);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(pager.num_pages_hit_, 1);
+  pager.SqlitePagerUnref(p_base_page);
+
+  rc = pager.SqlitePagerGet(11, &p_base_page, SampleMemPage::create);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(pager.SqlitePagerPageNumber(p_base_page), 11);
+  pager.SqlitePagerUnref(p_base_page);
+  EXPECT_EQ(pager.num_pages_overflow_, 1);
+  EXPECT_EQ(pager.num_mem_pages_, 10);
+
+  BasePage *p_lookup = nullptr;
+  pager.SqlitePagerLookup(2, &p_lookup);
+  EXPECT_EQ(p_lookup, nullptr);
+  pager.SqlitePagerLookup(1, &p_lookup);
+  ASSERT_NE(p_lookup, nullptr);
+  EXPECT_EQ(pager.SqlitePagerPageNumber(p_lookup), 1);
+  pager.SqlitePagerUnref(p_lookup);
+
+  // Page 3 is next in line
+  rc = pager.SqlitePagerGet(12, &p_base_page, SampleMemPage::create);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  pager.SqlitePagerUnref(p_base_page);
+  pager.SqlitePagerLookup(3, &p_lookup);
+  EXPECT_EQ(p_lookup, nullptr);
+
+  pager.SqlitePagerUnref(p_pinned);
+}
+
+// Touches page_number once and releases it again
+static void TouchPage(Pager &pager, PageNumber page_number) {
+  BasePage *p_base_page = nullptr;
+  ResultCode rc =
+      pager.SqlitePagerGet(page_number, &p_base_page, SampleMemPage::create);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  pager.SqlitePagerUnref(p_base_page);
+}
+
+/**
+ * Builds a hot set of pages 1-4, runs a 100 page scan over cold pages and
+ * returns the number of hits when the hot set is read again afterwards.
+ */
+static u32 HotSetHitsAfterScan(EvictionPolicy policy, PagerCacheStats &stats) {
+  std::string filename = "test_HotSetHitsAfterScan.db";
+  std::remove(filename.c_str());
+  Pager pager(filename, 10, policy);
+  BasePage *p_pinned = nullptr;
+  ResultCode rc = pager.SqlitePagerGet(1000, &p_pinned, SampleMemPage::create);
+  EXPECT_EQ(rc, ResultCode::kOk);
+
+  for (int round = 0; round < 2; round++) {
+    for (PageNumber page_number = 1; page_number <= 4; page_number++) {
+      TouchPage(pager, page_number);
+    }
+  }
+  for (PageNumber page_number = 5; page_number <= 13; page_number++) {
+    TouchPage(pager, page_number);
+  }
+  for (PageNumber page_number = 1; page_number <= 4; page_number++) {
+    TouchPage(pager, page_number);
+  }
+  for (PageNumber page_number = 100; page_number < 200; page_number++) {
+    TouchPage(pager, page_number);
+  }
+  u32 num_hits_before = pager.SqlitePagerCacheStats().num_hits;
+  for (PageNumber page_number = 1; page_number <= 4; page_number++) {
+    TouchPage(pager, page_number);
+  }
+  stats = pager.SqlitePagerCacheStats();
+  pager.SqlitePagerUnref(p_pinned);
+  return stats.num_hits - num_hits_before;
+}
+
+TEST(PagerPolicyTest, ScanResistantPoliciesKeepHotSet) {
+  PagerCacheStats stats{};
+
+  EXPECT_EQ(HotSetHitsAfterScan(EvictionPolicy::LRU, stats), 0);
+  EXPECT_EQ(stats.policy, EvictionPolicy::LRU);
+  EXPECT_EQ(stats.num_ghost_hits, 0);
+
+  EXPECT_EQ(HotSetHitsAfterScan(EvictionPolicy::TWO_QUEUE, stats), 4);
+  EXPECT_EQ(stats.policy, EvictionPolicy::TWO_QUEUE);
+  // the hot set reached Am through A1out
+  EXPECT_EQ(stats.num_ghost_hits, 4);
+
+  EXPECT_EQ(HotSetHitsAfterScan(EvictionPolicy::ARC, stats), 4);
+  EXPECT_EQ(stats.policy, EvictionPolicy::ARC);
+  EXPECT_EQ(stats.num_hits + stats.num_misses, 1 + 8 + 9 + 4 + 100 + 4);
+}
+
+// Pinned pages stay off the queues of 2Q and ARC, so each eviction takes the
+// first page of a queue however many pinned pages there are.
+TEST(PagerPolicyTest, EvictsAroundPinnedPages) {
+  for (EvictionPolicy policy :
+       {EvictionPolicy::TWO_QUEUE, EvictionPolicy::ARC}) {
+    std::string filename = "test_EvictsAroundPinnedPages.db";
+    std::remove(filename.c_str());
+    Pager pager(filename, 10, policy);
+    std::vector<BasePage *> pinned(8);
+    for (PageNumber page_number = 1; page_number <= 8; page_number++) {
+      ResultCode rc = pager.SqlitePagerGet(page_number, &pinned[page_number - 1],
+                                           SampleMemPage::create);
+      ASSERT_EQ(rc, ResultCode::kOk);
+    }
+    for (int round = 0; round < 3; round++) {
+      for (PageNumber page_number = 100; page_number < 150; page_number++) {
+        TouchPage(pager, page_number);
+        EXPECT_LE(pager.num_mem_pages_, 10);
+      }
+    }
+    EXPECT_EQ(pager.recent_queue_.size_ + pager.frequent_queue_.size_, 10);
+    for (BasePage *p_page : pinned) {
+      BasePage *p_found = nullptr;
+      EXPECT_EQ(pager.SqlitePagerLookup(p_page->GetPageHeader()->page_number_,
+                                        &p_found),
+                ResultCode::kOk);
+      EXPECT_EQ(p_found, p_page);
+      pager.SqlitePagerUnref(p_found);
+      pager.SqlitePagerUnref(p_page);
+    }
+  }
+}
+
+// The ghost queue agrees with a reference deque under a random mix of pushes,
+// removals and pops, across rebuilds of its ring.
+TEST(GhostQueueTest, MatchesReferenceQueue) {
+  GhostQueue queue;
+  std::deque<PageNumber> reference;
+  std::srand(54321);
+  for (int step = 0; step < 50000; step++) {
+    PageNumber page_number = 1 + std::rand() % 300;
+    int op = std::rand() % 4;
+    if (op <= 1) {
+      queue.PushBack(page_number);
+      reference.erase(
+          std::remove(reference.begin(), reference.end(), page_number),
+          reference.end());
+      reference.push_back(page_number);
+    } else if (op == 2) {
+      bool is_in_reference =
+          std::find(reference.begin(), reference.end(), page_number) !=
+          reference.end();
+      EXPECT_EQ(queue.Remove(page_number), is_in_reference);
+      reference.erase(
+          std::remove(reference.begin(), reference.end(), page_number),
+          reference.end());
+    } else if (reference.size() > 100 || std::rand() % 8 == 0) {
+      queue.PopFront();
+      if (!reference.empty()) {
+        reference.pop_front();
+      }
+    }
+    ASSERT_EQ(queue.Size(), reference.size()) << "step " << step;
+  }
+  for (PageNumber page_number = 1; page_number <= 300; page_number++) {
+    EXPECT_EQ(queue.Contains(page_number),
+              std::find(reference.begin(), reference.end(), page_number) !=
+                  reference.end());
+  }
+  while (!reference.empty()) {
+    EXPECT_TRUE(queue.Contains(reference.front()));
+    queue.PopFront();
+    EXPECT_FALSE(queue.Contains(reference.front()));
+    reference.pop_front();
+  }
+  EXPECT_EQ(queue.Size(), 0);
+}
+
+TEST(PagerPrefetchTest, ReadsChainAheadAndDropsOnWrite) {
+  std::string filename = "test_ReadsChainAheadAndDropsOnWrite.db";
+  std::remove(filename.c_str());
+  BasePage *p_base_page = nullptr;
+  ResultCode rc;
+
+  // Every page stores the number of the page after it
+  {
+    Pager pager(filename, 40);
+    for (PageNumber page_number = 1; page_number <= 20; page_number++) {
+      rc = pager.SqlitePagerGet(page_number, &p_base_page,
+                                SampleMemPage::create);
+      ASSERT_EQ(rc, ResultCode::kOk);
+      ASSERT_EQ(pager.SqlitePagerWrite(p_base_page), ResultCode::kOk);
+      PageNumber next_page_number = page_number < 20 ? page_number + 1 : 0;
+      std::memcpy(p_base_page->p_image_.data(), &next_page_number,
+                  sizeof(next_page_number));
+    }
+    ASSERT_EQ(pager.SqlitePagerCommit(), ResultCode::kOk);
+  }
+
+  Pager pager(filename, 40);
+  auto next_page = [](const PageImage &image) {
+    PageNumber next_page_number;
+    std::memcpy(&next_page_number, image.data(), sizeof(next_page_number));
+    return next_page_number;
+  };
+  auto wait_for_issued = [&pager](u32 num_issued) {
+    for (int i = 0; i < 500; i++) {
+      if (pager.SqlitePagerPrefetchStats().num_issued >= num_issued) return;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  };
+
+  // Page 20 stays referenced so the cache and the prefetched images survive;
+  // the chain 1 -> 10 is read ahead from page 1
+  rc = pager.SqlitePagerGet(20, &p_base_page, SampleMemPage::create);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  BasePage *p_pinned = p_base_page;
+  ASSERT_EQ(pager.SqlitePagerPrefetch(1, 10, next_page), ResultCode::kOk);
+  wait_for_issued(10);
+  EXPECT_EQ(pager.SqlitePagerPrefetchStats().num_issued, 10);
+
+  for (PageNumber page_number = 1; page_number <= 11; page_number++) {
+    rc = pager.SqlitePagerGet(page_number, &p_base_page, SampleMemPage::create);
+    ASSERT_EQ(rc, ResultCode::kOk);
+    EXPECT_EQ(next_page(p_base_page->p_image_), page_number + 1);
+    pager.SqlitePagerUnref(p_base_page);
+  }
+  PagerPrefetchStats stats = pager.SqlitePagerPrefetchStats();
+  EXPECT_EQ(stats.num_hits, 10);
+  EXPECT_EQ(stats.num_wasted, 0);
+
+  // The cached pages 10 and 11 are skipped by following their images, so the
+  // thread reads 12 to 14; writing the file then discards them unused
+  ASSERT_EQ(pager.SqlitePagerPrefetch(10, 5, next_page), ResultCode::kOk);
+  wait_for_issued(13);
+  ASSERT_EQ(pager.SqlitePagerWrite(p_pinned), ResultCode::kOk);
+  ASSERT_EQ(pager.SqlitePagerCommit(), ResultCode::kOk);
+  stats = pager.SqlitePagerPrefetchStats();
+  EXPECT_EQ(stats.num_issued, 13);
+  EXPECT_EQ(stats.num_wasted, 3);
+
+  rc = pager.SqlitePagerGet(12, &p_base_page, SampleMemPage::create);
+  ASSERT_EQ(rc, ResultCode::kOk);
+  EXPECT_EQ(pager.SqlitePagerPrefetchStats().num_hits, 10);
+  pager.SqlitePagerUnref(p_base_page);
+  pager.SqlitePagerUnref(p_pinned);
+}
+
+// Bytes taken in the log by a frame of a page of the default size
+static constexpr long kWalFrameSize = sizeof(WalFrameHeader) + kDefaultPageSize;
+
+static long FileSize(const std::string &filename) {
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  return file.is_open() ? (long)file.tellg() : -1;
+}
+
+static void RemoveWalFiles(const std::string &filename) {
+  std::remove(filename.c_str());
+  std::remove((filename + "-journal").c_str());
+  std::remove((filename + "-wal").c_str());
+}
+
+// Writes value into the first byte of pages first to last and commits
+static void WalWritePages(Pager &pager, PageNumber first, PageNumber last,
+                          u8 value) {
+  BasePage *p_base_page = nullptr;
+  BasePage *p_pinned = nullptr;
+  ASSERT_EQ(pager.SqlitePagerGet(first, &p_pinned, SampleMemPage::create),
+            ResultCode::kOk);
+  for (PageNumber page_number = first; page_number <= last; page_number++) {
+    ASSERT_EQ(
+        pager.SqlitePagerGet(page_number, &p_base_page, SampleMemPage::create),
+        ResultCode::kOk);
+    ASSERT_EQ(pager.SqlitePagerWrite(p_base_page), ResultCode::kOk);
+    p_base_page->p_image_.at(0) = std::byte{value};
+    pager.SqlitePagerUnref(p_base_page);
+  }
+  ASSERT_EQ(pager.SqlitePagerCommit(), ResultCode::kOk);
+  pager.SqlitePagerUnref(p_pinned);
+}
+
+static u8 FirstByteOf(Pager &pager, PageNumber page_number) {
+  BasePage *p_base_page = nullptr;
+  if (pager.SqlitePagerGet(page_number, &p_base_page, SampleMemPage::create) !=
+      ResultCode::kOk) {
+    return 0xff;
+  }
+  u8 value = (u8)p_base_page->p_image_.at(0);
+  pager.SqlitePagerUnref(p_base_page);
+  return value;
+}
+
+TEST(PagerWalTest, CommitsToLogRecoversAndCheckpoints) {
+  std::string filename = "test_CommitsToLogRecoversAndCheckpoints.db";
+  RemoveWalFiles(filename);
+  std::string wal_filename = filename + "-wal";
+
+  // A commit appends three frames and syncs the log once; the database file
+  // is not written
+  {
+    Pager pager(filename, 40);
+    ASSERT_EQ(pager.SqlitePagerSetJournalMode(JournalMode::WAL),
+              ResultCode::kOk);
+    WalWritePages(pager, 1, 3, 7);
+    PagerWalStats stats = pager.SqlitePagerWalStats();
+    EXPECT_EQ(stats.num_commits, 1);
+    EXPECT_EQ(stats.num_syncs, 1);
+    EXPECT_EQ(stats.num_frames, 3);
+    EXPECT_EQ(FileSize(filename), 0);
+    EXPECT_EQ(FileSize(wal_filename), kWalHeaderSize + 3 * kWalFrameSize);
+    EXPECT_EQ(FirstByteOf(pager, 2), 7);
+  }
+
+  // A torn frame after the commit is ignored when the log is recovered
+  {
+    std::ofstream wal_file(wal_filename, std::ios::binary | std::ios::app);
+    std::vector<char> garbage(kWalFrameSize, 0x5a);
+    wal_file.write(garbage.data(), (std::streamsize)garbage.size());
+  }
+  {
+    Pager pager(filename, 40);
+    ASSERT_EQ(pager.SqlitePagerSetJournalMode(JournalMode::WAL),
+              ResultCode::kOk);
+    EXPECT_EQ(pager.SqlitePagerWalStats().num_frames, 3);
+    for (PageNumber page_number = 1; page_number <= 3; page_number++) {
+      EXPECT_EQ(FirstByteOf(pager, page_number), 7);
+    }
+    EXPECT_EQ(pager.SqlitePagerPageCount(), 3);
+
+    // The checkpoint copies the log into the file and starts the log over
+    WalWritePages(pager, 2, 4, 9);
+    ASSERT_EQ(pager.SqlitePagerWalCheckpoint(), ResultCode::kOk);
+    EXPECT_EQ(FileSize(filename), 4 * kDefaultPageSize);
+    EXPECT_EQ(FileSize(wal_filename), kWalHeaderSize);
+    EXPECT_EQ(pager.SqlitePagerWalStats().num_frames, 0);
+    ASSERT_EQ(pager.SqlitePagerSetJournalMode(JournalMode::ROLLBACK),
+              ResultCode::kOk);
+  }
+  EXPECT_EQ(FileSize(wal_filename), -1);
+
+  Pager pager(filename, 40);
+  EXPECT_EQ(FirstByteOf(pager, 1), 7);
+  EXPECT_EQ(FirstByteOf(pager, 2), 9);
+  EXPECT_EQ(FirstByteOf(pager, 4), 9);
+}
+
+TEST(PagerWalTest, RollbackRestoresSpilledPages) {
+  std::string filename = "test_RollbackRestoresSpilledPages.db";
+  RemoveWalFiles(filename);
+  Pager pager(filename, kMaxPageNum);
+  ASSERT_EQ(pager.SqlitePagerSetJournalMode(JournalMode::WAL), ResultCode::kOk);
+  WalWritePages(pager, 1, 5, 1);
+
+  // Writing more pages than the cache holds spills dirty pages to the log as
+  // uncommitted frames
+  BasePage *p_pinned = nullptr;
+  BasePage *p_base_page = nullptr;
+  ASSERT_EQ(pager.SqlitePagerGet(1, &p_pinned, SampleMemPage::create),
+            ResultCode::kOk);
+  for (PageNumber page_number = 1; page_number <= 3 * kMaxPageNum;
+       page_number++) {
+    ASSERT_EQ(
+        pager.SqlitePagerGet(page_number, &p_base_page, SampleMemPage::create),
+        ResultCode::kOk);
+    ASSERT_EQ(pager.SqlitePagerWrite(p_base_page), ResultCode::kOk);
+    p_base_page->p_image_.at(0) = std::byte{2};
+    pager.SqlitePagerUnref(p_base_page);
+  }
+  std::string wal_filename = filename + "-wal";
+  EXPECT_GT(FileSize(wal_filename), kWalHeaderSize + 5 * kWalFrameSize);
+  ASSERT_EQ(pager.SqlitePagerRollback(), ResultCode::kOk);
+  EXPECT_EQ(FileSize(wal_filename), kWalHeaderSize + 5 * kWalFrameSize);
+
+  for (PageNumber page_number = 1; page_number <= 5; page_number++) {
+    EXPECT_EQ(FirstByteOf(pager, page_number), 1);
+  }
+  EXPECT_EQ(pager.SqlitePagerPageCount(), 5);
+  pager.SqlitePagerUnref(p_pinned);
+  EXPECT_EQ(pager.SqlitePagerWalStats().num_commits, 1);
+}
+
+TEST(PagerWalTest, BackgroundCheckpointKeepsLogShort) {
+  std::string filename = "test_BackgroundCheckpointKeepsLogShort.db";
+  RemoveWalFiles(filename);
+  {
+    Pager pager(filename, 40);
+    ASSERT_EQ(pager.SqlitePagerSetJournalMode(JournalMode::WAL),
+              ResultCode::kOk);
+    // 1200 frames: the checkpointer starts at 1000, and a later transaction
+    // starts the log over once it is done
+    for (int i = 0; i < 400; i++) {
+      WalWritePages(pager, 1, 3, (u8)(i % 100));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    WalWritePages(pager, 2, 5, 200);
+    EXPECT_LT(pager.SqlitePagerWalStats().num_frames, kWalAutoCheckpointFrames);
+    EXPECT_GE(FileSize(filename), 3 * kDefaultPageSize);
+  }
+
+  Pager pager(filename, 40);
+  ASSERT_EQ(pager.SqlitePagerSetJournalMode(JournalMode::WAL), ResultCode::kOk);
+  EXPECT_EQ(FirstByteOf(pager, 1), 99);
+  EXPECT_EQ(FirstByteOf(pager, 5), 200);
+  EXPECT_EQ(pager.SqlitePagerPageCount(), 5);
+}
+
+TEST(PagerWalTest, GroupCommitSharesSyncs) {
+  std::string filename = "test_GroupCommitSharesSyncs.db";
+  RemoveWalFiles(filename);
+  Pager pager(filename, 40);
+  ASSERT_EQ(pager.SqlitePagerSetJournalMode(JournalMode::WAL), ResultCode::kOk);
+  ASSERT_EQ(pager.SqlitePagerSetGroupCommit(std::chrono::milliseconds(100)),
+            ResultCode::kOk);
+
+  // Small transactions return before they are synced, and one sync at the end
+  // of the window makes them all durable
+  std::atomic<u32> num_durable{0};
+  BasePage *p_base_page = nullptr;
+  for (int i = 0; i < 50; i++) {
+    ASSERT_EQ(pager.SqlitePagerGet(1, &p_base_page, SampleMemPage::create),
+              ResultCode::kOk);
+    ASSERT_EQ(pager.SqlitePagerWrite(p_base_page), ResultCode::kOk);
+    p_base_page->p_image_.at(0) = std::byte{(u8)i};
+    ASSERT_EQ(pager.SqlitePagerCommit([&num_durable](ResultCode rc) {
+      if (rc == ResultCode::kOk) num_durable++;
+    }),
+              ResultCode::kOk);
+    pager.SqlitePagerUnref(p_base_page);
+  }
+  EXPECT_LT(num_durable, 50);
+  for (int i = 0; i < 200 && num_durable < 50; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(num_durable, 50);
+  PagerWalStats stats = pager.SqlitePagerWalStats();
+  EXPECT_EQ(stats.num_commits, 50);
+  EXPECT_GE(stats.commits_per_sync, 10.0);
+
+  // The blocking commit waits for its group to be synced
+  ASSERT_EQ(pager.SqlitePagerGet(2, &p_base_page, SampleMemPage::create),
+            ResultCode::kOk);
+  ASSERT_EQ(pager.SqlitePagerWrite(p_base_page), ResultCode::kOk);
+  ASSERT_EQ(pager.SqlitePagerCommit(), ResultCode::kOk);
+  EXPECT_EQ(pager.SqlitePagerWalStats().num_syncs, stats.num_syncs + 1);
+  pager.SqlitePagerUnref(p_base_page);
+  EXPECT_EQ(FirstByteOf(pager, 1), 49);
+}
+
+TEST(PagerWalTest, CheckpointWaitsForGroupSync) {
+  std::string filename = "test_CheckpointWaitsForGroupSync.db";
+  RemoveWalFiles(filename);
+  Pager pager(filename, 40);
+  ASSERT_EQ(pager.SqlitePagerSetJournalMode(JournalMode::WAL), ResultCode::kOk);
+  ASSERT_EQ(pager.SqlitePagerSetGroupCommit(std::chrono::seconds(30)),
+            ResultCode::kOk);
+
+  // More frames than kWalAutoCheckpointFrames are committed in one window, but
+  // none of them is synced yet, so none may reach the database file
+  std::atomic<u32> num_durable{0};
+  BasePage *p_pinned = nullptr;
+  BasePage *p_base_page = nullptr;
+  ASSERT_EQ(pager.SqlitePagerGet(1, &p_pinned, SampleMemPage::create),
+            ResultCode::kOk);
+  for (int i = 0; i < 400; i++) {
+    for (PageNumber page_number = 1; page_number <= 3; page_number++) {
+      ASSERT_EQ(pager.SqlitePagerGet(page_number, &p_base_page,
+                                     SampleMemPage::create),
+                ResultCode::kOk);
+      ASSERT_EQ(pager.SqlitePagerWrite(p_base_page), ResultCode::kOk);
+      p_base_page->p_image_.at(0) = std::byte{(u8)(i % 100)};
+      pager.SqlitePagerUnref(p_base_page);
+    }
+    ASSERT_EQ(pager.SqlitePagerCommit([&num_durable](ResultCode rc) {
+      if (rc == ResultCode::kOk) num_durable++;
+    }),
+              ResultCode::kOk);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(num_durable, 0);
+  EXPECT_EQ(FileSize(filename), 0);
+
+  // Closing the window syncs the group, and only then is it checkpointed
+  ASSERT_EQ(pager.SqlitePagerSetGroupCommit(std::chrono::microseconds(0)),
+            ResultCode::kOk);
+  EXPECT_EQ(num_durable, 400);
+  for (int i = 0; i < 200 && FileSize(filename) < 3 * kDefaultPageSize; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(FileSize(filename), 3 * kDefaultPageSize);
+  pager.SqlitePagerUnref(p_pinned);
+  EXPECT_EQ(FirstByteOf(pager, 2), 99);
+}
+
+TEST(PagerWalTest, CheckpointKeepsSnapshotsOfReaders) {
+  std::string filename = "test_CheckpointKeepsSnapshotsOfReaders.db";
+  RemoveWalFiles(filename);
+  std::string wal_filename = filename + "-wal";
+  Pager writer(filename, 40);
+  ASSERT_EQ(writer.SqlitePagerSetJournalMode(JournalMode::WAL),
+            ResultCode::kOk);
+  WalWritePages(writer, 1, 3, 1);
+
+  // The reader keeps its snapshot for as long as it references a page
+  Pager reader(filename, 40);
+  ASSERT_EQ(reader.SqlitePagerSetJournalMode(JournalMode::WAL),
+            ResultCode::kOk);
+  BasePage *p_pinned = nullptr;
+  ASSERT_EQ(reader.SqlitePagerGet(1, &p_pinned, SampleMemPage::create),
+            ResultCode::kOk);
+  EXPECT_EQ((u8)p_pinned->p_image_.at(0), 1);
+  WalWritePages(writer, 1, 3, 2);
+  WalWritePages(writer, 1, 5, 3);
+
+  // Step 1: The checkpoint copies the frames the reader sees, but not the
+  // newer ones, and keeps the log
+  EXPECT_EQ(writer.SqlitePagerWalCheckpoint(), ResultCode::kBusy);
+  EXPECT_EQ(FileSize(filename), 3 * kDefaultPageSize);
+  EXPECT_GT(FileSize(wal_filename), (long)kWalHeaderSize);
+  EXPECT_EQ(FirstByteOf(reader, 2), 1);
+  EXPECT_EQ(FirstByteOf(writer, 2), 3);
+  EXPECT_EQ(FirstByteOf(writer, 5), 3);
+
+  // Step 2: Once the reader lets go, the whole log is copied and started over
+  reader.SqlitePagerUnref(p_pinned);
+  EXPECT_EQ(writer.SqlitePagerWalCheckpoint(), ResultCode::kOk);
+  EXPECT_EQ(FileSize(filename), 5 * kDefaultPageSize);
+  EXPECT_EQ(FileSize(wal_filename), kWalHeaderSize);
+  EXPECT_EQ(FirstByteOf(reader, 2), 3);
+  EXPECT_EQ(FirstByteOf(reader, 5), 3);
+}
@@ -29,7 +29,13 @@ constexpr u32 kMaxPageSize = 65536;
 // The maximum length of a TEXT or BLOB in bytes.
 constexpr u32 kMaxSqlLength = 1000000000;
 
-constexpr u32 kPageSize = 1024;
-
-
-
+// Minimum page size in bytes. Every database chooses its page size when it is
+// created, a power of two from kMinPageSize to kMaxPageSize, and records it on
+// page 1 so that the file is always read with pages of that size.
+constexpr u32 kMinPageSize = 512;
+
+// Whether page_size is a page size a database can have
+constexpr bool IsValidPageSize(u32 page_size) {
+  return page_size >= kMinPageSize && page_size <= kMaxPageSize &&
+         (page_size & (page_size - 1)) == 0;
+}